@@ -15,7 +15,7 @@ echo "------------------------- Running Test Script -------------------------"
 rm -rf build/tests.log
 
 EXE=./build/debug/src/parser
-TEST_FILES=`find tests/ -name *.v | sort`
+TEST_FILES=`find tests/ -maxdepth 1 -name "*.v" | sort`
 
 FAILED_TESTS=" "
 PASSED_TESTS=" "
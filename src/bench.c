@@ -0,0 +1,539 @@
+/*!
+@file bench.c
+@brief A benchmark program for the parser library.
+@details Measures, for one or more named sets of input files:
+
+- How fast the scanner alone runs, in tokens and megabytes per second.
+- How fast a full parse runs, in megabytes per second.
+- How many allocations the parse made, and how much memory they took.
+- How well the include cache did while parsing.
+- How long @ref verilog_resolve_modules takes on the result, per module
+  instantiation, against a linear search of the modules for a sample of
+  the same instantiations, which is how they used to be found.
+- How long the result takes to save as a tree file, and to load again.
+- The peak resident set size of the process.
+
+Results are written as JSON, so that they can be compared across releases.
+
+    verilog-parser-bench [-o results.json] [-r repeats]
+                         [-n name] file... [-n name file...]
+
+Each -n starts a new set of inputs, which is reported separately. Each
+measurement is repeated, and the fastest run is reported.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "verilog_parser.h"
+#include "verilog_ast_util.h"
+#include "verilog_ast_serialise.h"
+
+//! Most instantiations looked up by a linear search of the modules, which
+//! takes time proportional to modules times instantiations.
+#define BENCH_LINEAR_SAMPLE 1000
+
+//! One named set of files to benchmark, and the results for it.
+typedef struct bench_input_t{
+    char          * name;           //!< Reported name of the set.
+    char         ** paths;          //!< Files in the set.
+    unsigned int    count;          //!< Number of files.
+    size_t          bytes;          //!< Total size of all files.
+    unsigned long   tokens;         //!< Tokens returned by the scanner.
+    double          lex_seconds;    //!< Fastest scanner only run.
+    double          parse_seconds;  //!< Fastest full parse.
+    double          resolve_seconds;//!< Fastest module resolution.
+    unsigned long   instances;      //!< Module instantiations resolved.
+    double          linear_seconds; //!< Fastest linear search of a sample.
+    unsigned long   linear_sample;  //!< Instantiations in that sample.
+    double          save_seconds;   //!< Fastest save of the tree.
+    double          load_seconds;   //!< Fastest load of the saved tree.
+    size_t          saved_bytes;    //!< Size of the saved tree.
+    unsigned int    failures;       //!< Files which did not parse.
+    unsigned int    modules;        //!< Modules in the parsed tree.
+    unsigned long   allocations;    //!< Allocations made by a parse.
+    size_t          allocated;      //!< Bytes requested by those.
+    size_t          reserved;       //!< Bytes of arena chunks behind them.
+    verilog_include_cache includes; //!< Only the counters are meaningful.
+    long            peak_rss_kb;    //!< Peak RSS once the set was done.
+} bench_input;
+
+//! Returns a monotonic time in seconds.
+static double bench_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//! Returns the peak resident set size of the process so far, in KiB.
+static long bench_peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/*!
+@brief Reads a whole file into memory, followed by the two NUL characters
+which flex needs at the end of a buffer it scans in place.
+@returns The buffer, or NULL if the file could not be read.
+*/
+static char * bench_load(char * path, size_t * size)
+{
+    FILE * fh = fopen(path, "rb");
+
+    if(fh == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(fh, 0, SEEK_END);
+    long length = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+
+    char * tr = length >= 0 ? malloc(length + 2) : NULL;
+
+    if(tr == NULL || fread(tr, 1, length, fh) != (size_t)length)
+    {
+        free(tr);
+        fclose(fh);
+        return NULL;
+    }
+
+    tr[length]     = '\0';
+    tr[length + 1] = '\0';
+    *size = length;
+
+    fclose(fh);
+    return tr;
+}
+
+//! Gives a context a fresh preprocessor, as if it were parsing a new file.
+static void bench_new_preproc(verilog_parser_context * ctx)
+{
+    verilog_free_preprocessor_context(ctx -> preproc);
+    ctx -> preproc = verilog_new_preprocessor_context();
+    ast_list_append(ctx -> preproc -> search_dirs, "./tests/");
+    ast_list_append(ctx -> preproc -> search_dirs, "./");
+}
+
+/*!
+@brief Runs only the scanner over every file of the input, using the lexer
+API, so no values are built for the tokens.
+@details Files are loaded before the clock starts, so that only scanning is
+measured.
+@returns The time taken, in seconds.
+*/
+static double bench_lex(bench_input * in)
+{
+    double       total = 0;
+    unsigned int f;
+
+    in -> tokens = 0;
+    in -> bytes  = 0;
+
+    for(f = 0; f < in -> count; f ++)
+    {
+        size_t size;
+        char * data = bench_load(in -> paths[f], &size);
+
+        if(data == NULL)
+        {
+            continue;
+        }
+
+        verilog_lexer * lexer = verilog_lex_buffer(data, size);
+        verilog_token   token;
+
+        ast_list_append(lexer -> ctx -> preproc -> search_dirs, "./tests/");
+        ast_list_append(lexer -> ctx -> preproc -> search_dirs, "./");
+        verilog_preprocessor_set_file(lexer -> ctx -> preproc,
+                                      in -> paths[f]);
+
+        double start = bench_now();
+
+        while(verilog_lex_next(lexer, &token))
+        {
+            in -> tokens ++;
+        }
+
+        total += bench_now() - start;
+
+        in -> bytes += size;
+        verilog_lex_free(lexer);
+        free(data);
+    }
+
+    return total;
+}
+
+/*!
+@brief Parses every file of the input into one source tree, and then
+resolves its modules.
+@details Parsing is timed from the path, so includes mapping the file, just
+as @ref verilog_parse_path does for a user.
+@returns The tree, which the caller must free.
+*/
+static verilog_source_tree * bench_parse(
+    bench_input * in,
+    double      * parse_seconds,
+    double      * resolve_seconds
+){
+    verilog_parser_context * ctx = verilog_parser_context_new();
+    unsigned int f;
+
+    in -> failures = 0;
+    *parse_seconds = 0;
+
+    for(f = 0; f < in -> count; f ++)
+    {
+        bench_new_preproc(ctx);
+
+        double start = bench_now();
+        int result = verilog_parse_path_ctx(ctx, in -> paths[f]);
+        *parse_seconds += bench_now() - start;
+
+        in -> failures += result != 0;
+    }
+
+    in -> includes = *ctx -> include_cache;
+
+    verilog_source_tree * tree = ctx -> source_tree;
+    ctx -> source_tree = NULL;
+    verilog_parser_context_free(ctx);
+
+    double start = bench_now();
+    verilog_resolve_modules(tree);
+    *resolve_seconds = bench_now() - start;
+
+    in -> modules     = tree -> modules -> items;
+    in -> allocations = tree -> arena -> allocations;
+    in -> allocated   = tree -> arena -> total_allocated;
+    in -> reserved    = tree -> arena -> total_reserved;
+
+    return tree;
+}
+
+/*!
+@brief Looks up a sample of a tree's module instantiations by searching
+its modules one at a time, as verilog_find_module_declaration did before
+trees kept an index of their modules.
+@returns The time taken.
+*/
+static double bench_resolve_linear(
+    bench_input         * in,
+    verilog_source_tree * tree
+){
+    ast_list      * modules = tree -> modules;
+    unsigned long   found   = 0;
+    unsigned int    m, i, d;
+
+    in -> instances     = 0;
+    in -> linear_sample = 0;
+
+    double start = bench_now();
+
+    for(m = 0; m < modules -> items; m ++)
+    {
+        ast_module_declaration * module = ast_list_get(modules, m);
+
+        if(module -> module_instantiations == NULL)
+        {
+            continue;
+        }
+
+        in -> instances += module -> module_instantiations -> items;
+
+        for(i = 0; i < module -> module_instantiations -> items &&
+                   in -> linear_sample < BENCH_LINEAR_SAMPLE; i ++)
+        {
+            ast_module_instantiation * inst =
+                ast_list_get(module -> module_instantiations, i);
+
+            for(d = 0; d < modules -> items; d ++)
+            {
+                ast_module_declaration * decl = ast_list_get(modules, d);
+
+                if(ast_identifier_cmp(decl -> identifier,
+                                      inst -> module_identifer) == 0)
+                {
+                    found ++;
+                    break;
+                }
+            }
+
+            in -> linear_sample ++;
+        }
+    }
+
+    double tr = bench_now() - start;
+
+    // Keeps the search from being optimised away.
+    if(found > in -> linear_sample)
+    {
+        fprintf(stderr, "%lu\n", found);
+    }
+
+    return tr;
+}
+
+/*!
+@brief Saves a tree to a temporary file, and loads it back again.
+@details Either time is left at zero if that step fails.
+*/
+static void bench_save_load(
+    bench_input         * in,
+    verilog_source_tree * tree,
+    double              * save_seconds,
+    double              * load_seconds
+){
+    char path[] = "/tmp/verilog-parser-bench-XXXXXX";
+    int  fd     = mkstemp(path);
+
+    *save_seconds = 0;
+    *load_seconds = 0;
+
+    if(fd < 0)
+    {
+        return;
+    }
+    close(fd);
+
+    double start = bench_now();
+    int    saved = verilog_source_tree_save(tree, path);
+    double end   = bench_now();
+
+    if(saved == 0)
+    {
+        *save_seconds = end - start;
+
+        FILE * fh = fopen(path, "rb");
+        if(fh != NULL)
+        {
+            fseek(fh, 0, SEEK_END);
+            in -> saved_bytes = ftell(fh);
+            fclose(fh);
+        }
+
+        start = bench_now();
+        verilog_source_tree * loaded = verilog_source_tree_load(path);
+        end   = bench_now();
+
+        if(loaded != NULL)
+        {
+            *load_seconds = end - start;
+            verilog_free_source_tree(loaded);
+        }
+    }
+
+    remove(path);
+}
+
+//! Runs every measurement on one input, keeping the fastest of each.
+static void bench_run(bench_input * in, unsigned int repeats)
+{
+    unsigned int r;
+
+    for(r = 0; r < repeats; r ++)
+    {
+        double lex = bench_lex(in);
+        double parse, resolve, linear, save, load;
+
+        verilog_source_tree * tree = bench_parse(in, &parse, &resolve);
+        linear = bench_resolve_linear(in, tree);
+        bench_save_load(in, tree, &save, &load);
+        verilog_free_source_tree(tree);
+
+        if(r == 0 || lex < in -> lex_seconds)
+        {
+            in -> lex_seconds = lex;
+        }
+        if(r == 0 || parse < in -> parse_seconds)
+        {
+            in -> parse_seconds = parse;
+        }
+        if(r == 0 || resolve < in -> resolve_seconds)
+        {
+            in -> resolve_seconds = resolve;
+        }
+        if(r == 0 || linear < in -> linear_seconds)
+        {
+            in -> linear_seconds = linear;
+        }
+        if(r == 0 || save < in -> save_seconds)
+        {
+            in -> save_seconds = save;
+        }
+        if(r == 0 || load < in -> load_seconds)
+        {
+            in -> load_seconds = load;
+        }
+    }
+
+    in -> peak_rss_kb = bench_peak_rss_kb();
+}
+
+//! Returns n / seconds, or zero if no time was measured.
+static double bench_rate(double n, double seconds)
+{
+    return seconds > 0 ? n / seconds : 0;
+}
+
+//! Writes the results of every input as a JSON document.
+static void bench_write_json(
+    FILE        * out,
+    bench_input * inputs,
+    unsigned int  count
+){
+    unsigned int i;
+    double       mb;
+
+    fprintf(out, "{\n  \"inputs\": [\n");
+
+    for(i = 0; i < count; i ++)
+    {
+        bench_input * in = &inputs[i];
+        mb = in -> bytes / (1024.0 * 1024.0);
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"name\": \"%s\",\n", in -> name);
+        fprintf(out, "      \"files\": %u,\n", in -> count);
+        fprintf(out, "      \"bytes\": %zu,\n", in -> bytes);
+        fprintf(out, "      \"lex\": {\n");
+        fprintf(out, "        \"seconds\": %.6f,\n", in -> lex_seconds);
+        fprintf(out, "        \"tokens\": %lu,\n", in -> tokens);
+        fprintf(out, "        \"tokens_per_sec\": %.0f,\n",
+                bench_rate(in -> tokens, in -> lex_seconds));
+        fprintf(out, "        \"mb_per_sec\": %.3f\n",
+                bench_rate(mb, in -> lex_seconds));
+        fprintf(out, "      },\n");
+        fprintf(out, "      \"parse\": {\n");
+        fprintf(out, "        \"seconds\": %.6f,\n", in -> parse_seconds);
+        fprintf(out, "        \"mb_per_sec\": %.3f,\n",
+                bench_rate(mb, in -> parse_seconds));
+        fprintf(out, "        \"failures\": %u,\n", in -> failures);
+        fprintf(out, "        \"modules\": %u,\n", in -> modules);
+        fprintf(out, "        \"allocations\": %lu,\n", in -> allocations);
+        fprintf(out, "        \"bytes_allocated\": %zu,\n", in -> allocated);
+        fprintf(out, "        \"bytes_reserved\": %zu\n", in -> reserved);
+        fprintf(out, "      },\n");
+        fprintf(out, "      \"includes\": {\n");
+        fprintf(out, "        \"indexes_built\": %lu,\n",
+                in -> includes.indexes_built);
+        fprintf(out, "        \"resolve_hits\": %lu,\n",
+                in -> includes.resolve_hits);
+        fprintf(out, "        \"resolve_misses\": %lu,\n",
+                in -> includes.resolve_misses);
+        fprintf(out, "        \"content_hits\": %lu,\n",
+                in -> includes.content_hits);
+        fprintf(out, "        \"content_misses\": %lu\n",
+                in -> includes.content_misses);
+        fprintf(out, "      },\n");
+        fprintf(out, "      \"resolve\": {\n");
+        fprintf(out, "        \"seconds\": %.6f,\n", in -> resolve_seconds);
+        fprintf(out, "        \"instances\": %lu,\n", in -> instances);
+        fprintf(out, "        \"ns_per_instance\": %.1f,\n",
+                bench_rate(in -> resolve_seconds * 1e9, in -> instances));
+        fprintf(out, "        \"linear_sample\": %lu,\n",
+                in -> linear_sample);
+        fprintf(out, "        \"linear_ns_per_instance\": %.1f\n",
+                bench_rate(in -> linear_seconds * 1e9, in -> linear_sample));
+        fprintf(out, "      },\n");
+        fprintf(out, "      \"save\": {\n");
+        fprintf(out, "        \"seconds\": %.6f,\n", in -> save_seconds);
+        fprintf(out, "        \"bytes\": %zu\n", in -> saved_bytes);
+        fprintf(out, "      },\n");
+        fprintf(out, "      \"load\": {\n");
+        fprintf(out, "        \"seconds\": %.6f,\n", in -> load_seconds);
+        fprintf(out, "        \"mb_per_sec\": %.3f\n",
+                bench_rate(in -> saved_bytes / 1e6, in -> load_seconds));
+        fprintf(out, "      },\n");
+        fprintf(out, "      \"peak_rss_kb\": %ld\n", in -> peak_rss_kb);
+        fprintf(out, "    }%s\n", i + 1 < count ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char ** argv)
+{
+    bench_input * inputs  = calloc(argc, sizeof(bench_input));
+    unsigned int  count   = 0;
+    unsigned int  repeats = 1;
+    char        * output  = NULL;
+    int           A;
+
+    for(A = 1; A < argc; A ++)
+    {
+        if(strcmp(argv[A], "-o") == 0 && A + 1 < argc)
+        {
+            output = argv[++A];
+        }
+        else if(strcmp(argv[A], "-r") == 0 && A + 1 < argc)
+        {
+            repeats = atoi(argv[++A]);
+            repeats = repeats > 0 ? repeats : 1;
+        }
+        else if(strcmp(argv[A], "-n") == 0 && A + 1 < argc)
+        {
+            inputs[count].name  = argv[++A];
+            inputs[count].paths = calloc(argc, sizeof(char*));
+            count ++;
+        }
+        else
+        {
+            if(count == 0)
+            {
+                inputs[count].name  = "default";
+                inputs[count].paths = calloc(argc, sizeof(char*));
+                count ++;
+            }
+
+            bench_input * in = &inputs[count - 1];
+            in -> paths[in -> count ++] = argv[A];
+        }
+    }
+
+    if(count == 0 || inputs[0].count == 0)
+    {
+        printf("ERROR. Please supply at least one file path argument.\n");
+        return 1;
+    }
+
+    unsigned int i;
+    for(i = 0; i < count; i ++)
+    {
+        fprintf(stderr, "%s: %u files\n", inputs[i].name, inputs[i].count);
+        bench_run(&inputs[i], repeats);
+    }
+
+    FILE * out = output != NULL ? fopen(output, "w") : stdout;
+
+    if(out == NULL)
+    {
+        printf("ERROR. Could not open %s for writing.\n", output);
+        return 1;
+    }
+
+    bench_write_json(out, inputs, count);
+
+    if(out != stdout)
+    {
+        fclose(out);
+    }
+
+    // No diagnostics were set up, so the note ast_free_all reports on what
+    // it released goes nowhere, and cannot end up among the results.
+    for(i = 0; i < count; i ++)
+    {
+        free(inputs[i].paths);
+    }
+    free(inputs);
+    ast_free_all();
+    return 0;
+}
@@ -4,19 +4,611 @@
 */
 
 #include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
 
 #include "verilog_parser.h"
 #include "verilog_ast_common.h"
 #include "verilog_preprocessor.h"
 #include "verilog_ast_util.h"
+#include "verilog_ast_serialise.h"
+
+/*!
+@brief Prints each diagnostic as it is reported. Notes are printed as they
+are, and everything else with the line it was found on.
+*/
+static void print_diagnostic(
+    verilog_diagnostics      * diags,
+    const verilog_diagnostic * diagnostic,
+    void                     * data
+){
+    (void)data;
+
+    if(diagnostic -> severity == VERILOG_SEVERITY_NOTE)
+    {
+        printf("%s\n", diagnostic -> message);
+        return;
+    }
+
+    ast_location where = ast_location_expansion_root(diags -> locations,
+                                                     diagnostic -> location);
+
+    printf("line %d - %s: %s\n", ast_location_line(diags -> locations, where),
+           verilog_severity_name(diagnostic -> severity),
+           diagnostic -> message);
+}
+
+//! Prints the name of every module in a source tree, one per line.
+static void print_modules(verilog_source_tree * tree)
+{
+    unsigned int m;
+
+    for(m = 0; m < tree -> modules -> items; m ++)
+    {
+        ast_module_declaration * module = ast_list_get(tree -> modules, m);
+        printf("module %s\n", ast_identifier_tostring(module -> identifier));
+    }
+}
+
+//! The names of port directions, as printed by dump_tree.
+static const char * dump_directions[] = {"input", "output", "inout", "port"};
+
+//! Prints the ports of a module, with their initial values if they have any.
+static void dump_ports(ast_module_declaration * module)
+{
+    unsigned int p, n;
+
+    for(p = 0; module -> module_ports && p < module -> module_ports -> items;
+        p ++)
+    {
+        ast_port_declaration * port = ast_list_get(module -> module_ports, p);
+
+        for(n = 0; n < port -> port_names -> items; n ++)
+        {
+            printf("    %s %s", dump_directions[port -> direction],
+                   ast_identifier_tostring(ast_list_get(port -> port_names,
+                                                        n)));
+
+            if(port -> initial_values != NULL &&
+               ast_list_get(port -> initial_values, n) != NULL)
+            {
+                printf(" = %s", ast_expression_tostring(
+                    ast_list_get(port -> initial_values, n)));
+            }
+            printf("\n");
+        }
+    }
+}
+
+/*!
+@brief Prints a list of ast_port_connection, as ".name(value)" for named
+connections and just the value for ordered ones.
+*/
+static void dump_connections(ast_list * connections)
+{
+    unsigned int c;
+
+    for(c = 0; connections != NULL && c < connections -> items; c ++)
+    {
+        ast_port_connection * connection = ast_list_get(connections, c);
+        const char * value = connection -> expression == NULL ? "" :
+                             ast_expression_tostring(connection -> expression);
+
+        printf("%s", c > 0 ? ", " : "");
+
+        if(connection -> port_name != NULL)
+        {
+            printf(".%s(%s)", ast_identifier_tostring(connection -> port_name),
+                   value);
+        }
+        else
+        {
+            printf("%s", value);
+        }
+    }
+}
+
+//! Prints every module instance of a module, with its connections.
+static void dump_instances(ast_module_declaration * module)
+{
+    unsigned int i, n;
+
+    for(i = 0; i < module -> module_instantiations -> items; i ++)
+    {
+        ast_module_instantiation * inst =
+            ast_list_get(module -> module_instantiations, i);
+        ast_identifier name = inst -> resolved ?
+                              inst -> declaration -> identifier :
+                              inst -> module_identifer;
+
+        for(n = 0; n < inst -> module_instances -> items; n ++)
+        {
+            ast_module_instance * instance =
+                ast_list_get(inst -> module_instances, n);
+
+            printf("    %s", ast_identifier_tostring(name));
+            if(inst -> module_parameters != NULL)
+            {
+                printf(" #(");
+                dump_connections(inst -> module_parameters);
+                printf(")");
+            }
+            printf(" %s(", ast_identifier_tostring(
+                instance -> instance_identifier));
+            dump_connections(instance -> port_connections);
+            printf(")\n");
+        }
+    }
+}
+
+//! Returns the name of one instance from a gate instantiation of a type.
+static ast_identifier dump_gate_name(ast_gate_type type, void * instance)
+{
+    switch(type)
+    {
+        case GATE_CMOS:
+            return ((ast_cmos_switch_instance*)instance) -> name;
+        case GATE_MOS:
+            return ((ast_mos_switch_instance*)instance) -> name;
+        case GATE_PASS:
+            return ((ast_pass_switch_instance*)instance) -> name;
+        case GATE_ENABLE:
+            return ((ast_enable_gate_instance*)instance) -> name;
+        case GATE_N_OUT:
+            return ((ast_n_output_gate_instance*)instance) -> name;
+        case GATE_N_IN:
+            return ((ast_n_input_gate_instance*)instance) -> name;
+        case GATE_PASS_EN:
+            return ((ast_pass_enable_switch*)instance) -> name;
+        default:
+            return ((ast_pull_gate_instance*)instance) -> name;
+    }
+}
+
+//! Prints the names of the instances of each gate instantiation, one per line.
+static void dump_gates(ast_module_declaration * module)
+{
+    unsigned int g, i;
+
+    for(g = 0; g < module -> gate_instantiations -> items; g ++)
+    {
+        ast_gate_instantiation * gate =
+            ast_list_get(module -> gate_instantiations, g);
+        ast_list * instances;
+
+        switch(gate -> type)
+        {
+            case GATE_CMOS:
+            case GATE_MOS:
+            case GATE_PASS:    instances = gate -> switches -> switches; break;
+            case GATE_ENABLE:  instances = gate -> enable -> instances;  break;
+            case GATE_N_OUT:   instances = gate -> n_out -> instances;   break;
+            case GATE_N_IN:    instances = gate -> n_in -> instances;    break;
+            case GATE_PASS_EN: instances = gate -> pass_en -> switches;  break;
+            default:           instances = gate -> pull_gates;           break;
+        }
+
+        printf("    gates");
+        for(i = 0; i < instances -> items; i ++)
+        {
+            ast_identifier name = dump_gate_name(gate -> type,
+                                                 ast_list_get(instances, i));
+            printf(" %s", name == NULL ? "-" : ast_identifier_tostring(name));
+        }
+        printf("\n");
+    }
+}
+
+//! Prints an assignment's lvalue, which is a name or a concatenation.
+static void dump_lvalue(ast_lvalue * lval)
+{
+    unsigned int i;
+
+    if(lval -> type != NET_CONCATENATION && lval -> type != VAR_CONCATENATION)
+    {
+        printf("%s", ast_identifier_tostring(lval -> data.identifier));
+        return;
+    }
+
+    printf("{");
+    for(i = 0; i < lval -> data.concatenation -> items -> items; i ++)
+    {
+        printf("%s%s", i > 0 ? ", " : "", ast_expression_tostring(
+            ast_list_get(lval -> data.concatenation -> items, i)));
+    }
+    printf("}");
+}
+
+//! Prints every net of a module, with its value if it is given one.
+static void dump_nets(ast_module_declaration * module)
+{
+    unsigned int n;
+
+    for(n = 0; n < module -> net_declarations -> items; n ++)
+    {
+        ast_net_declaration * net = ast_list_get(module -> net_declarations,n);
+
+        printf("    net %s", ast_identifier_tostring(net -> identifier));
+        if(net -> value != NULL)
+        {
+            printf(" = %s", ast_expression_tostring(net -> value));
+        }
+        printf("\n");
+    }
+}
+
+//! Prints every continuous assignment of a module.
+static void dump_assigns(ast_module_declaration * module)
+{
+    unsigned int c, a;
+
+    for(c = 0; c < module -> continuous_assignments -> items; c ++)
+    {
+        ast_continuous_assignment * assign =
+            ast_list_get(module -> continuous_assignments, c);
+
+        for(a = 0; a < assign -> assignments -> items; a ++)
+        {
+            ast_single_assignment * single =
+                ast_list_get(assign -> assignments, a);
+
+            printf("    assign ");
+            dump_lvalue(single -> lval);
+            printf(" = %s\n", ast_expression_tostring(single -> expression));
+        }
+    }
+}
+
+//! Prints the blocking assignments of a function body, block by block.
+static void dump_function_statement(ast_statement * statement)
+{
+    unsigned int s;
+
+    if(statement == NULL)
+    {
+        return;
+    }
+    else if(statement -> type == STM_BLOCK)
+    {
+        for(s = 0; s < statement -> block -> statements -> items; s ++)
+        {
+            dump_function_statement(
+                ast_list_get(statement -> block -> statements, s));
+        }
+    }
+    else if(statement -> type == STM_ASSIGNMENT)
+    {
+        ast_procedural_assignment * assign =
+            statement -> assignment -> procedural;
+
+        printf("        ");
+        dump_lvalue(assign -> lval);
+        printf(" = %s\n", ast_expression_tostring(assign -> expression));
+    }
+}
+
+//! Prints every function of a module, with the assignments it makes.
+static void dump_functions(ast_module_declaration * module)
+{
+    unsigned int f;
+
+    for(f = 0; f < module -> function_declarations -> items; f ++)
+    {
+        ast_function_declaration * function =
+            ast_list_get(module -> function_declarations, f);
+
+        printf("    function %s\n",
+               ast_identifier_tostring(function -> identifier));
+        dump_function_statement(function -> statements);
+    }
+}
+
+//! Prints the names in a list of ast_identifier, separated by commas.
+static void dump_names(ast_list * names)
+{
+    unsigned int i;
+
+    for(i = 0; i < names -> items; i ++)
+    {
+        printf("%s%s", i > 0 ? ", " : "",
+               ast_identifier_tostring(ast_list_get(names, i)));
+    }
+}
+
+//! Prints the specparams and simple paths of every specify block.
+static void dump_specify(ast_module_declaration * module)
+{
+    unsigned int b, i;
+
+    for(b = 0; b < module -> specify_blocks -> items; b ++)
+    {
+        ast_list * items = ast_list_get(module -> specify_blocks, b);
+
+        printf("    specify\n");
+        for(i = 0; i < items -> items; i ++)
+        {
+            ast_module_item      * item = ast_list_get(items, i);
+            ast_path_declaration * path = item -> path_declaration;
+
+            if(item -> type != MOD_ITEM_PATH_DECLARATION)
+            {
+                printf("        specparam\n");
+            }
+            else if(path -> type == SIMPLE_PARALLEL_PATH)
+            {
+                ast_simple_parallel_path_declaration * p = path -> parallel;
+                printf("        path %s => %s\n",
+                       ast_identifier_tostring(p -> input_terminal),
+                       ast_identifier_tostring(p -> output_terminal));
+            }
+            else if(path -> type == SIMPLE_FULL_PATH)
+            {
+                printf("        path ");
+                dump_names(path -> full -> input_terminals);
+                printf(" *> ");
+                dump_names(path -> full -> output_terminals);
+                printf("\n");
+            }
+            else
+            {
+                printf("        path\n");
+            }
+        }
+    }
+}
+
+//! Characters for each ast_level_symbol and ast_udp_next_state.
+static const char dump_levels[] = "01bx?";
+static const char dump_states[] = "x01-?";
+
+/*!
+@brief Prints an outline of every UDP in a source tree, with its ports and
+the level symbols of its table.
+*/
+static void dump_primitives(verilog_source_tree * tree)
+{
+    unsigned int u, p, e, l;
+
+    for(u = 0; u < tree -> primitives -> items; u ++)
+    {
+        ast_udp_declaration * udp = ast_list_get(tree -> primitives, u);
+
+        printf("primitive %s line %d\n", ast_identifier_tostring(
+                   udp -> identifier),
+               ast_location_line(tree -> locations, udp -> meta.location));
+
+        for(p = 0; p < udp -> ports -> items; p ++)
+        {
+            ast_udp_port * port = ast_list_get(udp -> ports, p);
+
+            if(port -> direction != PORT_INPUT)
+            {
+                printf("    %s %s\n", dump_directions[port -> direction],
+                       ast_identifier_tostring(port -> identifier));
+                continue;
+            }
+            for(l = 0; l < port -> identifiers -> items; l ++)
+            {
+                printf("    input %s\n", ast_identifier_tostring(
+                    ast_list_get(port -> identifiers, l)));
+            }
+        }
+
+        for(e = 0; e < udp -> body_entries -> items; e ++)
+        {
+            ast_list * levels;
+            char       out;
+
+            if(udp -> body_type == UDP_BODY_COMBINATORIAL)
+            {
+                ast_udp_combinatorial_entry * entry =
+                    ast_list_get(udp -> body_entries, e);
+                levels = entry -> input_levels;
+                out    = dump_states[entry -> output_symbol];
+            }
+            else
+            {
+                ast_udp_sequential_entry * entry =
+                    ast_list_get(udp -> body_entries, e);
+                levels = entry -> entry_prefix == PREFIX_LEVELS ?
+                         entry -> levels : NULL;
+                out    = dump_states[entry -> output];
+            }
+
+            printf("    table");
+            for(l = 0; levels != NULL && l < levels -> items; l ++)
+            {
+                ast_level_symbol * level = ast_list_get(levels, l);
+                printf(" %c", dump_levels[*level]);
+            }
+            printf(" : %c\n", out);
+        }
+    }
+}
+
+/*!
+@brief Prints an outline of every module in a source tree, with the line its
+location records, so that trees can be compared in tests.
+*/
+static void dump_tree(verilog_source_tree * tree)
+{
+    unsigned int m;
+
+    for(m = 0; m < tree -> modules -> items; m ++)
+    {
+        ast_module_declaration * module = ast_list_get(tree -> modules, m);
+
+        printf("module %s line %d\n",
+               ast_identifier_tostring(module -> identifier),
+               ast_location_line(tree -> locations, module -> meta.location));
+        dump_ports(module);
+        dump_instances(module);
+        dump_gates(module);
+        dump_nets(module);
+        dump_assigns(module);
+        dump_functions(module);
+        dump_specify(module);
+    }
+
+    dump_primitives(tree);
+}
+
+/*!
+@brief Parses the file every other file starts from, if there is one.
+@returns Zero on success, or one if the prelude could not be parsed.
+*/
+static int parse_prelude(char * path)
+{
+    if(path != NULL && verilog_parse_path(path) != 0)
+    {
+        printf("ERROR. Could not parse prelude %s\n", path);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*!
+@brief Parses every file on a pool of jobs worker threads, then prints the
+result for each file in the order they were given.
+*/
+static int parse_files_parallel(char ** paths, int count, unsigned int jobs)
+{
+    int * results = calloc(count, sizeof(int));
+    int   tr      = 0;
+    int   F;
+
+    if(results == NULL)
+    {
+        printf("ERROR. Could not allocate results for %d files.\n", count);
+        return 1;
+    }
+
+    verilog_parse_files(yy_verilog_source_tree, paths, count,
+                        yy_preproc -> search_dirs, yy_preproc, jobs, results);
+
+    for(F = 0; F < count; F++)
+    {
+        printf("%s ", paths[F]);
+
+        if(results[F] == 0)
+        {
+            printf(" - Parse successful\n");
+        }
+        else
+        {
+            printf(" - Parse failed\n");
+            if(count<=1) tr = 1;
+        }
+    }
+
+    free(results);
+    return tr;
+}
 
 int main(int argc, char ** argv)
 {
-    if(argc < 2)
+    int first_file = 1;
+    unsigned int jobs = 0;
+    int parallel = 0;
+    int list_modules = 0;
+    int reparse = 0;
+    int dump = 0;
+    int failed = 0;
+    char * round_trip = NULL;
+    char * prelude = NULL;
+    verilog_source_tree * tree;
+    verilog_parse_cache * cache = NULL;
+
+    verilog_parser_init();
+    verilog_diagnostics_set_sink(yy_diagnostics, print_diagnostic, NULL);
+
+    while(argc > first_file + 1)
+    {
+        if(strcmp(argv[first_file], "--modules") == 0)
+        {
+            // parser --modules file...  lists every module parsed, once all
+            // of the files have been.
+            list_modules = 1;
+            first_file += 1;
+            continue;
+        }
+        else if(strcmp(argv[first_file], "--dump") == 0)
+        {
+            // parser --dump file...  prints an outline of every module
+            // parsed, once all of the files have been.
+            dump = 1;
+            first_file += 1;
+            continue;
+        }
+        else if(strcmp(argv[first_file], "--reparse") == 0)
+        {
+            // parser --reparse file...  parses every file again once all of
+            // them have been, which skips those left unchanged.
+            reparse = 1;
+            first_file += 1;
+            continue;
+        }
+        else if(strcmp(argv[first_file], "-j") == 0)
+        {
+            // parser -j N file...  parses the files on N threads. N may be
+            // 0, meaning one thread per processor.
+            jobs = atoi(argv[first_file + 1]);
+            parallel = 1;
+        }
+        else if(strcmp(argv[first_file], "--prelude") == 0)
+        {
+            // parser --prelude PATH file...  parses PATH first, so that
+            // every file, even on -j threads, sees the macros it defines.
+            prelude = argv[first_file + 1];
+        }
+        else if(strcmp(argv[first_file], "--round-trip") == 0)
+        {
+            // parser --round-trip PATH file...  saves the parsed tree to
+            // PATH and loads it again, so --modules and --dump show the
+            // tree as it was loaded.
+            round_trip = argv[first_file + 1];
+        }
+        else if(strcmp(argv[first_file], "--cache-dir") == 0)
+        {
+            // parser --cache-dir DIR file...  loads files parsed before
+            // from DIR, and keeps the rest there for next time.
+            cache = verilog_parse_cache_new(argv[first_file + 1]);
+            if(cache == NULL)
+            {
+                printf("ERROR. Could not use cache directory %s\n",
+                       argv[first_file + 1]);
+                return 1;
+            }
+            verilog_parser_set_parse_cache(cache);
+        }
+        else
+        {
+            break;
+        }
+        first_file += 2;
+    }
+
+    if(argc < first_file + 1)
     {
         printf("ERROR. Please supply at least one file path argument.\n");
         return 1;
     }
+    else if(parallel)
+    {
+        verilog_parser_init();
+
+        ast_list_append(yy_preproc -> search_dirs, "./tests/");
+        ast_list_append(yy_preproc -> search_dirs, "./");
+
+        if(parse_prelude(prelude) != 0)
+        {
+            return 1;
+        }
+
+        failed = parse_files_parallel(argv + first_file, argc - first_file,
+                                      jobs);
+    }
     else
     {
         int F = 0;
@@ -28,20 +620,17 @@ int main(int argc, char ** argv)
         ast_list_append(yy_preproc -> search_dirs, "./tests/");
         ast_list_append(yy_preproc -> search_dirs, "./");
 
-        for(F = 1; F < argc; F++)
+        if(parse_prelude(prelude) != 0)
         {
-            printf("%s ", argv[F]);fflush(stdout);
-
-            // Load the file.
-            FILE * fh = fopen(argv[F], "r");
+            return 1;
+        }
 
-            verilog_preprocessor_set_file(yy_preproc, argv[F]);
-            
-            // Parse the file and store the result.
-            int result = verilog_parse_file(fh);
+        for(F = first_file; F < argc; F++)
+        {
+            printf("%s ", argv[F]);fflush(stdout);
 
-            // Close the file handle
-            fclose(fh);
+            // Map the file, parse it and store the result.
+            int result = verilog_parse_path(argv[F]);
             
             if(result == 0)
             {
@@ -50,11 +639,52 @@ int main(int argc, char ** argv)
             else
             {
                 printf(" - Parse failed\n");
-                if(argc<=2) return 1;
+                failed = argc - first_file <= 1;
             }
         }
+
+        for(F = first_file; reparse && F < argc; F++)
+        {
+            ast_boolean skipped;
+            int result = verilog_reparse_path(argv[F], &skipped);
+
+            printf("%s  - Reparse %s\n", argv[F], skipped ? "skipped" :
+                   result == 0 ? "successful" : "failed");
+        }
     }
+
+    tree = yy_verilog_source_tree;
+
+    if(round_trip != NULL)
+    {
+        tree = verilog_source_tree_save(tree, round_trip) == 0 ?
+               verilog_source_tree_load(round_trip) : NULL;
+        if(tree == NULL)
+        {
+            printf("ERROR. Could not save and load %s\n", round_trip);
+            return 1;
+        }
+    }
+
+    if(list_modules)
+    {
+        print_modules(tree);
+    }
+
+    if(dump)
+    {
+        dump_tree(tree);
+    }
+
+    if(cache != NULL)
+    {
+        printf("Parse cache: %lu hits, %lu misses, %lu stored\n",
+               cache -> hits, cache -> misses, cache -> stores);
+        verilog_parser_set_parse_cache(NULL);
+        verilog_parse_cache_free(cache);
+    }
+
     verilog_resolve_modules(yy_verilog_source_tree);
     ast_free_all();
-    return 0;
+    return failed;
 }
@@ -0,0 +1,380 @@
+/*!
+@file netgen.c
+@brief Generates large, synthetic, Verilog designs for scaling tests.
+@details The designs are meaningless, but syntactically valid, and shaped
+like the two kinds of input which stress the parser the most:
+
+- RTL style hierarchies. A number of modules, spread over a number of levels,
+  each instancing modules from the level below, with wide port lists and
+  large assign fan-outs.
+- Gate level netlists. A top module made of a huge number of instances of a
+  small standard cell library, as written out by synthesis tools.
+
+With -M 1, the cells of the netlist are written as uses of macros with
+arguments instead, to measure the cost of expanding macros.
+
+    verilog-netgen [-m modules] [-i instances] [-d depth] [-p ports]
+                   [-w width] [-f fanout] [-g cells] [-M macros]
+                   [-s seed] [-o file]
+
+The output is a pure function of the arguments, so that results can be
+compared between runs. Everything is written out as it is generated, so even
+designs with many millions of cells need very little memory.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! The parameters of the design to generate.
+typedef struct netgen_options_t{
+    unsigned long modules;   //!< Number of hierarchical modules.
+    unsigned long instances; //!< Instances in each non leaf module.
+    unsigned long depth;     //!< Number of levels in the hierarchy.
+    unsigned long ports;     //!< Input ports on every module.
+    unsigned long width;     //!< Width in bits of every port.
+    unsigned long fanout;    //!< Wires driven by assigns in every module.
+    unsigned long cells;     //!< Standard cells in the gate level top.
+    unsigned long macros;    //!< Write the cells as macro uses if non zero.
+    unsigned long seed;      //!< Seed for all choices made.
+} netgen_options;
+
+//! State of the xorshift generator behind every "random" choice.
+static unsigned long long netgen_state;
+
+//! Returns the next number from the generator, below limit.
+static unsigned long netgen_random(unsigned long limit)
+{
+    netgen_state ^= netgen_state << 13;
+    netgen_state ^= netgen_state >> 7;
+    netgen_state ^= netgen_state << 17;
+    return limit > 0 ? (unsigned long)(netgen_state % limit) : 0;
+}
+
+//! The standard cells which gate level netlists are made of.
+static const char * netgen_cells[] = {"AND2", "OR2", "NAND2", "NOR2", "XOR2"};
+
+//! Number of two input cells in netgen_cells.
+#define NETGEN_CELLS (sizeof(netgen_cells) / sizeof(netgen_cells[0]))
+
+//! Writes the standard cell library.
+static void netgen_write_cells(FILE * out)
+{
+    static const char * ops[] = {"A & B", "A | B", "~(A & B)", "~(A | B)",
+                                 "A ^ B"};
+    unsigned int c;
+
+    for(c = 0; c < NETGEN_CELLS; c ++)
+    {
+        fprintf(out, "module %s (A, B, Y);\n", netgen_cells[c]);
+        fprintf(out, "    input A, B;\n    output Y;\n");
+        fprintf(out, "    assign Y = %s;\n", ops[c]);
+        fprintf(out, "endmodule\n\n");
+    }
+
+    fprintf(out, "module INV (A, Y);\n    input A;\n    output Y;\n");
+    fprintf(out, "    assign Y = ~A;\nendmodule\n\n");
+
+    fprintf(out, "module DFF (D, CK, Q);\n    input D, CK;\n    output Q;\n");
+    fprintf(out, "    reg Q;\n    always @(posedge CK) Q <= D;\n");
+    fprintf(out, "endmodule\n\n");
+}
+
+//! Returns the level of the hierarchy which module m sits at.
+static unsigned long netgen_level(netgen_options * opts, unsigned long m)
+{
+    return m % opts -> depth;
+}
+
+/*!
+@brief Picks a module at the level below the given one to instance.
+@details Modules at level l are those with m % depth == l, so the choice is
+made between those.
+*/
+static unsigned long netgen_child(netgen_options * opts, unsigned long level)
+{
+    unsigned long below = level + 1;
+    unsigned long count = (opts -> modules - below + opts -> depth - 1) /
+                          opts -> depth;
+    return below + opts -> depth * netgen_random(count);
+}
+
+//! Writes the port list and port declarations shared by every module.
+static void netgen_write_ports(FILE * out, netgen_options * opts)
+{
+    unsigned long p;
+
+    fprintf(out, " (");
+    for(p = 0; p < opts -> ports; p ++)
+    {
+        fprintf(out, "i%lu, ", p);
+    }
+    fprintf(out, "o);\n");
+
+    for(p = 0; p < opts -> ports; p ++)
+    {
+        fprintf(out, "    input  [%lu:0] i%lu;\n", opts -> width - 1, p);
+    }
+    fprintf(out, "    output [%lu:0] o;\n", opts -> width - 1);
+}
+
+//! Writes one hierarchical module.
+static void netgen_write_module(
+    FILE           * out,
+    netgen_options * opts,
+    unsigned long    m
+){
+    unsigned long level = netgen_level(opts, m);
+    int           leaf  = level + 1 >= opts -> depth ||
+                          level + 1 >= opts -> modules;
+    unsigned long i, p;
+
+    fprintf(out, "module m%lu", m);
+    netgen_write_ports(out, opts);
+
+    if(leaf)
+    {
+        fprintf(out, "    assign o = i0");
+        for(p = 1; p < opts -> ports; p ++)
+        {
+            fprintf(out, " %c i%lu", "&|^"[p % 3], p);
+        }
+        fprintf(out, ";\n");
+    }
+    else
+    {
+        for(i = 0; i < opts -> instances; i ++)
+        {
+            fprintf(out, "    wire   [%lu:0] w%lu;\n", opts -> width - 1, i);
+        }
+
+        for(i = 0; i < opts -> instances; i ++)
+        {
+            fprintf(out, "    m%lu u%lu (", netgen_child(opts, level), i);
+            for(p = 0; p < opts -> ports; p ++)
+            {
+                // Chain the instances together through their first input.
+                if(p == 0 && i > 0)
+                {
+                    fprintf(out, ".i0(w%lu), ", i - 1);
+                }
+                else
+                {
+                    fprintf(out, ".i%lu(i%lu), ", p, p);
+                }
+            }
+            fprintf(out, ".o(w%lu));\n", i);
+        }
+
+        fprintf(out, "    assign o = w%lu;\n", opts -> instances - 1);
+    }
+
+    for(i = 0; i < opts -> fanout; i ++)
+    {
+        fprintf(out, "    wire   [%lu:0] f%lu;\n", opts -> width - 1, i);
+        fprintf(out, "    assign f%lu = i%lu;\n", i, i % opts -> ports);
+    }
+
+    fprintf(out, "endmodule\n\n");
+}
+
+/*!
+@brief Writes the macros which gate level cells are written as uses of
+when opts -> macros is set.
+@details The net vector is a macro too, so that every use expands another
+macro inside its arguments.
+*/
+static void netgen_write_macros(FILE * out)
+{
+    fprintf(out, "`define NET(i) n[i]\n");
+    fprintf(out, "`define CELL2(kind, name, a, b, y) \\\n");
+    fprintf(out, "    kind name (.A(a), .B(b), .Y(y));\n");
+    fprintf(out, "`define INV(name, a, y) INV name (.A(a), .Y(y));\n");
+    fprintf(out, "`define DFF(name, d, q) DFF name (.D(d), .CK(clk), "
+                 ".Q(q));\n\n");
+}
+
+/*!
+@brief Writes the top module, which instances the top of the hierarchy and
+holds the gate level netlist.
+@details Cell inputs are drawn from nets driven earlier, so that the netlist
+is acyclic apart from the flip-flops, as real netlists are.
+*/
+static void netgen_write_top(FILE * out, netgen_options * opts)
+{
+    unsigned long c, p;
+    unsigned long nets = opts -> cells + opts -> ports + 1;
+
+    fprintf(out, "module top (clk");
+    for(p = 0; p < opts -> ports; p ++)
+    {
+        fprintf(out, ", i%lu", p);
+    }
+    fprintf(out, ", o);\n");
+    fprintf(out, "    input clk;\n");
+    for(p = 0; p < opts -> ports; p ++)
+    {
+        fprintf(out, "    input  [%lu:0] i%lu;\n", opts -> width - 1, p);
+    }
+    fprintf(out, "    output [%lu:0] o;\n", opts -> width - 1);
+    fprintf(out, "    wire [%lu:0] n;\n", nets - 1);
+
+    for(p = 0; p < opts -> ports; p ++)
+    {
+        fprintf(out, "    assign n[%lu] = i%lu[0];\n", p, p);
+    }
+
+    if(opts -> modules > 0)
+    {
+        fprintf(out, "    m0 u_hier (");
+        for(p = 0; p < opts -> ports; p ++)
+        {
+            fprintf(out, ".i%lu(i%lu), ", p, p);
+        }
+        fprintf(out, ".o(o));\n");
+    }
+
+    for(c = 0; c < opts -> cells; c ++)
+    {
+        unsigned long y = opts -> ports + c;
+        unsigned long a = netgen_random(y);
+        unsigned long b = netgen_random(y);
+        unsigned long kind = netgen_random(NETGEN_CELLS + 2);
+
+        if(opts -> macros && kind < NETGEN_CELLS)
+        {
+            fprintf(out, "    `CELL2(%s, g%lu, `NET(%lu), `NET(%lu), "
+                    "`NET(%lu))\n", netgen_cells[kind], c, a, b, y);
+        }
+        else if(opts -> macros && kind == NETGEN_CELLS)
+        {
+            fprintf(out, "    `INV(g%lu, `NET(%lu), `NET(%lu))\n", c, a, y);
+        }
+        else if(opts -> macros)
+        {
+            fprintf(out, "    `DFF(g%lu, `NET(%lu), `NET(%lu))\n", c, a, y);
+        }
+        else if(kind < NETGEN_CELLS)
+        {
+            fprintf(out, "    %s g%lu (.A(n[%lu]), .B(n[%lu]), .Y(n[%lu]));\n",
+                    netgen_cells[kind], c, a, b, y);
+        }
+        else if(kind == NETGEN_CELLS)
+        {
+            fprintf(out, "    INV g%lu (.A(n[%lu]), .Y(n[%lu]));\n", c, a, y);
+        }
+        else
+        {
+            fprintf(out, "    DFF g%lu (.D(n[%lu]), .CK(clk), .Q(n[%lu]));\n",
+                    c, a, y);
+        }
+    }
+
+    fprintf(out, "endmodule\n");
+}
+
+//! Parses the numeric value following the argument at index *A.
+static unsigned long netgen_arg(int argc, char ** argv, int * A)
+{
+    if(*A + 1 >= argc)
+    {
+        printf("ERROR. %s needs a value.\n", argv[*A]);
+        exit(1);
+    }
+    *A += 1;
+    return strtoul(argv[*A], NULL, 0);
+}
+
+//! Returns the option set by the given flag, or NULL if there is none.
+static unsigned long * netgen_option(netgen_options * opts, char * flag)
+{
+    if(strcmp(flag, "-m") == 0) return &opts -> modules;
+    if(strcmp(flag, "-i") == 0) return &opts -> instances;
+    if(strcmp(flag, "-d") == 0) return &opts -> depth;
+    if(strcmp(flag, "-p") == 0) return &opts -> ports;
+    if(strcmp(flag, "-w") == 0) return &opts -> width;
+    if(strcmp(flag, "-f") == 0) return &opts -> fanout;
+    if(strcmp(flag, "-g") == 0) return &opts -> cells;
+    if(strcmp(flag, "-M") == 0) return &opts -> macros;
+    if(strcmp(flag, "-s") == 0) return &opts -> seed;
+    return NULL;
+}
+
+int main(int argc, char ** argv)
+{
+    netgen_options opts;
+    char         * output = NULL;
+    int            A;
+
+    opts.modules   = 100;
+    opts.instances = 10;
+    opts.depth     = 4;
+    opts.ports     = 4;
+    opts.width     = 8;
+    opts.fanout    = 0;
+    opts.cells     = 0;
+    opts.macros    = 0;
+    opts.seed      = 1;
+
+    for(A = 1; A < argc; A ++)
+    {
+        unsigned long * value = netgen_option(&opts, argv[A]);
+
+        if(value != NULL)
+        {
+            *value = netgen_arg(argc, argv, &A);
+        }
+        else if(strcmp(argv[A], "-o") == 0 && A + 1 < argc)
+        {
+            output = argv[++A];
+        }
+        else
+        {
+            printf("ERROR. Unknown argument '%s'.\n", argv[A]);
+            return 1;
+        }
+    }
+
+    opts.depth = opts.depth > 0 ? opts.depth : 1;
+    opts.ports = opts.ports > 0 ? opts.ports : 1;
+    opts.width = opts.width > 0 ? opts.width : 1;
+
+    netgen_state = opts.seed * 2654435761ULL + 1;
+
+    FILE * out = output != NULL ? fopen(output, "w") : stdout;
+
+    if(out == NULL)
+    {
+        printf("ERROR. Could not open %s for writing.\n", output);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by verilog-netgen");
+    for(A = 1; A < argc; A ++)
+    {
+        fprintf(out, " %s", argv[A]);
+    }
+    fprintf(out, "\n\n");
+
+    netgen_write_cells(out);
+
+    if(opts.macros)
+    {
+        netgen_write_macros(out);
+    }
+
+    unsigned long m;
+    for(m = 0; m < opts.modules; m ++)
+    {
+        netgen_write_module(out, &opts, m);
+    }
+
+    netgen_write_top(out, &opts);
+
+    if(out != stdout)
+    {
+        fclose(out);
+    }
+
+    return 0;
+}
@@ -8,17 +8,186 @@ Syntax Tree (AST)
 #include <stdio.h>
 
 #include "verilog_ast.h"
-#include "verilog_preprocessor.h"
+#include "verilog_parser.h"
 
 /*!
-@brief Responsible for setting the line number and file of each node's
-meta data member.
+@brief Responsible for setting the location of each node's meta data
+member.
+@details The location is taken from the parser running on the calling
+thread, and is zero if there is none.
 @param [inout] meta - A pointer to the metadata member to modify.
 */
 void ast_set_meta_info(ast_metadata * meta)
 {
-    meta -> line = yylineno;
-    meta -> file = verilog_preprocessor_current_file(yy_preproc);
+    meta -> location = verilog_parser_current_location();
+}
+
+//! Locks a location table, if it is shared between threads.
+static void ast_location_table_lock(
+    ast_location_table * table
+){
+    if(table -> shared)
+    {
+        pthread_mutex_lock(&table -> lock);
+    }
+}
+
+//! Unlocks a location table locked by ast_location_table_lock.
+static void ast_location_table_unlock(
+    ast_location_table * table
+){
+    if(table -> shared)
+    {
+        pthread_mutex_unlock(&table -> lock);
+    }
+}
+
+ast_location_table * ast_location_table_new(
+    ast_arena * arena
+){
+    ast_location_table * tr = ast_arena_calloc(arena, 1,
+                                               sizeof(ast_location_table));
+    pthread_mutex_init(&tr -> lock, NULL);
+    return tr;
+}
+
+ast_location ast_location_add(
+    ast_location_table * table,
+    ast_file             file,
+    ast_line             line,
+    ast_location         expansion
+){
+    ast_location tr = 0;
+
+    ast_location_table_lock(table);
+
+    if(table -> count == table -> page_capacity)
+    {
+        if(table -> arena == NULL)
+        {
+            table -> arena = ast_arena_new(0);
+        }
+
+        // The old list of pages stays in the arena, so a reader which
+        // still has it sees the same entries.
+        ast_location_entry ** pages = ast_arena_calloc(table -> arena,
+            table -> page_count + 1, sizeof(ast_location_entry*));
+        ast_location_entry  * page  = ast_arena_calloc(table -> arena,
+            AST_LOCATION_PAGE_SIZE, sizeof(ast_location_entry));
+
+        if(pages != NULL && page != NULL)
+        {
+            if(table -> page_count > 0)
+            {
+                memcpy(pages, table -> pages,
+                       table -> page_count * sizeof(ast_location_entry*));
+            }
+            pages[table -> page_count ++] = page;
+            table -> pages          = pages;
+            table -> page_capacity += AST_LOCATION_PAGE_SIZE;
+
+            // The first entry is the unknown location, and stays zeroed.
+            table -> count += table -> count == 0;
+        }
+    }
+
+    if(table -> count < table -> page_capacity)
+    {
+        tr = table -> count ++;
+
+        ast_location_entry * entry =
+            &table -> pages[tr / AST_LOCATION_PAGE_SIZE]
+                           [tr % AST_LOCATION_PAGE_SIZE];
+        entry -> file      = file;
+        entry -> line      = line;
+        entry -> expansion = expansion;
+    }
+
+    ast_location_table_unlock(table);
+    return tr;
+}
+
+ast_location_entry * ast_location_get(
+    ast_location_table * table,
+    ast_location         location
+){
+    ast_location_entry * tr = NULL;
+
+    if(table == NULL || location == 0)
+    {
+        return NULL;
+    }
+
+    ast_location_table_lock(table);
+    if(location < table -> count)
+    {
+        tr = &table -> pages[location / AST_LOCATION_PAGE_SIZE]
+                            [location % AST_LOCATION_PAGE_SIZE];
+    }
+    ast_location_table_unlock(table);
+
+    return tr;
+}
+
+ast_location ast_location_expansion_root(
+    ast_location_table * table,
+    ast_location         location
+){
+    ast_location_entry * entry = ast_location_get(table, location);
+
+    // Expansions are always added before anything inside them, so this
+    // can not loop.
+    while(entry != NULL && entry -> expansion != 0 &&
+          entry -> expansion < location)
+    {
+        location = entry -> expansion;
+        entry    = ast_location_get(table, location);
+    }
+
+    return location;
+}
+
+ast_line ast_location_line(
+    ast_location_table * table,
+    ast_location         location
+){
+    ast_location_entry * entry = ast_location_get(table, location);
+    return entry != NULL ? entry -> line : 0;
+}
+
+ast_file ast_location_file(
+    ast_location_table * table,
+    ast_location         location
+){
+    ast_location_entry * entry = ast_location_get(table, location);
+    return entry != NULL ? entry -> file : NULL;
+}
+
+void ast_location_table_clear(
+    ast_location_table * table
+){
+    ast_location_table_lock(table);
+    ast_arena_free(table -> arena);
+    table -> arena         = NULL;
+    table -> pages         = NULL;
+    table -> page_count    = 0;
+    table -> page_capacity = 0;
+    table -> count         = 0;
+    ast_location_table_unlock(table);
+}
+
+void ast_location_table_reset(
+    ast_location_table * table
+){
+    if(table -> page_count > 1)
+    {
+        ast_location_table_clear(table);
+        return;
+    }
+
+    ast_location_table_lock(table);
+    table -> count = table -> page_count > 0 ? 1 : 0;
+    ast_location_table_unlock(table);
 }
 
 /*!
@@ -114,8 +283,10 @@ char * ast_primary_tostring(
             break;
         case PRIMARY_CONCATENATION:
         default:
-            printf("primary type to string not supported: %d %s\n",
-                __LINE__,__FILE__);
+            VERILOG_DIAGNOSE(yy_diagnostics, VERILOG_SEVERITY_WARNING,
+                DIAG_UNSUPPORTED, 0,
+                "Primary value type %d can not be turned into a string",
+                p -> value_type);
             tr = "<unsupported>";
             break;
     }
@@ -349,8 +520,10 @@ char * ast_expression_tostring(
             strcat(tr,rhs);
             break;
         default:
-            printf("ERROR: Expression type to string not supported. %d of %s",
-                __LINE__,__FILE__);
+            VERILOG_DIAGNOSE(yy_diagnostics, VERILOG_SEVERITY_WARNING,
+                DIAG_UNSUPPORTED, 0,
+                "Expression type %d can not be turned into a string",
+                exp -> type);
             tr = "<unsupported>";
             break;
 
@@ -2045,6 +2218,38 @@ ast_port_declaration * ast_new_port_declaration(
     return tr;
 }
 
+void ast_port_declaration_set_variables(
+    ast_port_declaration * port,
+    ast_list             * variables
+){
+    unsigned int i;
+
+    port -> port_names = ast_list_new();
+
+    for(i = 0; i < variables -> items; i ++)
+    {
+        ast_single_assignment * variable = ast_list_get(variables, i);
+
+        ast_list_append(port -> port_names,
+                        variable -> lval -> data.identifier);
+
+        if(variable -> expression != NULL && port -> initial_values == NULL)
+        {
+            // Ports before the first with a value have none.
+            port -> initial_values = ast_list_new();
+            while(port -> initial_values -> items < i)
+            {
+                ast_list_append(port -> initial_values, NULL);
+            }
+        }
+
+        if(port -> initial_values != NULL)
+        {
+            ast_list_append(port -> initial_values, variable -> expression);
+        }
+    }
+}
+
 /*!
 @brief Creates and returns a node to represent the declaration of a new
 module item construct.
@@ -2095,7 +2300,8 @@ ast_list * ast_new_net_declaration(
         ast_net_declaration * toadd =ast_calloc(1,sizeof(ast_net_declaration));
         toadd -> meta       = type_dec -> meta;
 
-        toadd -> identifier = ast_list_get(type_dec -> identifiers, i);
+        ast_single_assignment * net = ast_list_get(type_dec -> identifiers, i);
+        toadd -> identifier = net -> lval -> data.identifier;
         toadd -> type       = type_dec -> net_type;
         toadd -> delay      = type_dec -> delay;
         toadd -> drive      = type_dec -> drive_strength;
@@ -2103,7 +2309,7 @@ ast_list * ast_new_net_declaration(
         toadd -> vectored   = type_dec -> vectored;
         toadd -> scalared   = type_dec -> scalared;
         toadd -> is_signed  = type_dec -> is_signed;
-        toadd -> value      = NULL;
+        toadd -> value      = net -> expression;
 
         ast_list_append(tr,toadd);
     }
@@ -2411,7 +2617,8 @@ ast_statement_block * ast_extract_statement_block(
     ast_statement_type  type,
     ast_statement     * body
 ){
-    //printf("Reforming block from line %d of %s\n", body -> meta.line,body -> meta.file);
+    ast_line line = ast_location_line(verilog_parser_current_locations(),
+                                      body -> meta.location);
 
     if(body -> type == STM_BLOCK)
     {
@@ -2456,7 +2663,7 @@ ast_statement_block * ast_extract_statement_block(
 
             ast_statement_block * tr = ast_new_statement_block(
                 STM_BLOCK,
-                ast_new_identifier("Unnamed block", body -> meta.line),
+                ast_new_identifier("Unnamed block", line),
                 ast_list_new(), // Empty list, no declarations are made.
                 stm_list
             );
@@ -2475,7 +2682,7 @@ ast_statement_block * ast_extract_statement_block(
 
         ast_statement_block * tr = ast_new_statement_block(
             STM_BLOCK,
-            ast_new_identifier("Unnamed block", body -> meta.line),
+            ast_new_identifier("Unnamed block", line),
             ast_list_new(), // Empty list, no declarations are made.
             stm_list
         );
@@ -2645,8 +2852,9 @@ ast_module_declaration * ast_new_module_declaration(
         } 
         else
         {
-            printf("ERROR: Unsupported module construct type: %d\n",
-                construct -> type);
+            VERILOG_DIAGNOSE(yy_diagnostics, VERILOG_SEVERITY_ERROR,
+                DIAG_UNSUPPORTED, 0,
+                "Unsupported module construct type: %d", construct -> type);
             assert(0); // Fail out because this should *never* happen
         }
     }
@@ -2678,15 +2886,20 @@ array.
 */
 char * ast_identifier_tostring(ast_identifier id)
 {
-    char * tr = ast_strdup(id -> identifier);   
     ast_identifier walker = id;
+    size_t         len    = 0;
 
-    while(walker -> next != NULL)
+    // Arena memory cannot be grown, so size the result up front.
+    while(walker != NULL)
     {
+        len   += strlen(walker -> identifier);
         walker = walker -> next;
+    }
+
+    char * tr = ast_calloc(len+1, sizeof(char));
 
-        size_t len = strlen(walker -> identifier)+1 + strlen(tr);
-        tr = realloc(tr,len);
+    for(walker = id; walker != NULL; walker = walker -> next)
+    {
         strcat(tr, walker -> identifier);
     }
     return tr;
@@ -2694,27 +2907,66 @@ char * ast_identifier_tostring(ast_identifier id)
 
 /*!
 @brief Acts like strcmp but works on ast identifiers.
+@details Compares the same strings as @ref ast_identifier_tostring would
+produce, but walks both identifier chains in place rather than building
+them, so that no memory is allocated.
 */
 int ast_identifier_cmp(
     ast_identifier a,
     ast_identifier b
 ){
-    char * s1 = ast_identifier_tostring(a);
-    char * s2 = ast_identifier_tostring(b);
+    // Identifier text is interned, so simple names compare by pointer.
+    if(a != NULL && b != NULL && a -> next == NULL && b -> next == NULL &&
+       a -> identifier == b -> identifier)
+    {
+        return 0;
+    }
+
+    const unsigned char * s1 = a ? (unsigned char*)a -> identifier : NULL;
+    const unsigned char * s2 = b ? (unsigned char*)b -> identifier : NULL;
+
+    while(1)
+    {
+        // Step over exhausted parts of each hierarchy.
+        while(s1 != NULL && *s1 == '\0' && a -> next != NULL)
+        {
+            a  = a -> next;
+            s1 = (unsigned char*)a -> identifier;
+        }
+        while(s2 != NULL && *s2 == '\0' && b -> next != NULL)
+        {
+            b  = b -> next;
+            s2 = (unsigned char*)b -> identifier;
+        }
 
-    int result = strcmp(s1,s2);
+        unsigned char c1 = s1 != NULL ? *s1 : '\0';
+        unsigned char c2 = s2 != NULL ? *s2 : '\0';
+
+        if(c1 != c2 || c1 == '\0')
+        {
+            return (int)c1 - (int)c2;
+        }
 
-    return result;
+        s1 ++;
+        s2 ++;
+    }
 }
 
 ast_identifier ast_new_identifier(
     char         * identifier, 
     unsigned int   from_line  
+){
+    return ast_new_interned_identifier(ast_intern(identifier), from_line);
+}
+
+ast_identifier ast_new_interned_identifier(
+    char         * identifier, 
+    unsigned int   from_line  
 ){
     ast_identifier tr = ast_calloc(1,sizeof(struct ast_identifier_t));
     ast_set_meta_info(&(tr->meta));
     
-    tr -> identifier = ast_strdup(identifier);
+    tr -> identifier = identifier;
     tr -> from_line = from_line;
     tr -> type = ID_UNKNOWN;
     tr -> next = NULL;
@@ -2897,16 +3149,235 @@ have an object to put parsed constructs into.
 */
 verilog_source_tree * verilog_new_source_tree()
 {
+    ast_arena * arena = ast_arena_new(0);
+    ast_arena * prev  = ast_set_current_arena(arena);
+
     verilog_source_tree * tr = ast_calloc(1,sizeof(verilog_source_tree));
 
+    tr -> arena         =   arena;
     tr -> modules       =   ast_list_new();
     tr -> primitives    =   ast_list_new();
     tr -> configs       =   ast_list_new();
     tr -> libraries     =   ast_list_new();
+    tr -> module_index  =   ast_hashtable_new();
+    tr -> indexed_modules = 0;
+    tr -> locations     =   ast_location_table_new(arena);
+    tr -> files         =   ast_list_new();
+    tr -> file_index    =   ast_hashtable_new();
+
+    ast_set_current_arena(prev);
 
     return tr;
 }
 
+/*!
+@brief Adds a module declaration to the source tree, and to its index of
+modules by name.
+*/
+void verilog_source_tree_add_module(
+    verilog_source_tree    * tree,
+    ast_module_declaration * module
+){
+    ast_list_append(tree -> modules, module);
+    verilog_source_tree_index_modules(tree);
+}
+
+/*!
+@brief Returns the key a module is indexed under in a source tree.
+@details Module names are almost never hierarchical, so the identifier text
+can usually serve as the key without being copied. Otherwise the name is
+built in the current arena.
+*/
+static char * verilog_source_tree_module_key(
+    ast_module_declaration * module
+){
+    return module -> identifier -> next == NULL ?
+                module -> identifier -> identifier :
+                ast_identifier_tostring(module -> identifier);
+}
+
+/*!
+@brief Adds any modules appended to the source tree since the last call to
+its index of modules by name.
+@details If several modules share a name, the first one keeps the entry,
+which matches what a linear search of the modules list would find.
+*/
+void verilog_source_tree_index_modules(
+    verilog_source_tree * tree
+){
+    if(tree -> indexed_modules >= tree -> modules -> items)
+    {
+        return;
+    }
+
+    ast_arena * prev = ast_set_current_arena(tree -> arena);
+
+    unsigned int m;
+    for(m = tree -> indexed_modules; m < tree -> modules -> items; m ++)
+    {
+        ast_module_declaration * module = ast_list_get(tree -> modules, m);
+
+        if(module == NULL || module -> identifier == NULL)
+        {
+            continue;
+        }
+
+        ast_hashtable_insert(tree -> module_index,
+                             verilog_source_tree_module_key(module), module);
+    }
+
+    tree -> indexed_modules = tree -> modules -> items;
+
+    ast_set_current_arena(prev);
+}
+
+verilog_source_file * verilog_source_tree_find_file(
+    verilog_source_tree * tree,
+    char                * path
+){
+    void * tr;
+
+    if(ast_hashtable_get(tree -> file_index, ast_intern(path), &tr) !=
+       HASH_SUCCESS)
+    {
+        return NULL;
+    }
+
+    return tr;
+}
+
+verilog_source_file * verilog_source_tree_file(
+    verilog_source_tree * tree,
+    char                * path
+){
+    verilog_source_file * tr = verilog_source_tree_find_file(tree, path);
+
+    if(tr != NULL)
+    {
+        return tr;
+    }
+
+    ast_arena * prev = ast_set_current_arena(tree -> arena);
+
+    tr = ast_calloc(1, sizeof(verilog_source_file));
+    tr -> path       = ast_intern(path);
+    tr -> modules    = ast_list_new();
+    tr -> primitives = ast_list_new();
+    tr -> configs    = ast_list_new();
+    tr -> libraries  = ast_list_new();
+
+    ast_list_append(tree -> files, tr);
+    ast_hashtable_insert(tree -> file_index, tr -> path, tr);
+
+    ast_set_current_arena(prev);
+
+    return tr;
+}
+
+/*!
+@brief Removes the items of one list from another.
+@details Both lists must hold the items in the same order, which is true of
+a file's lists and the tree's, since items are only ever appended to both,
+so one pass over each list is enough.
+*/
+static void verilog_source_tree_remove_items(
+    ast_list * from,
+    ast_list * items
+){
+    unsigned int i, j = 0, kept = 0;
+
+    for(i = 0; i < from -> items; i ++)
+    {
+        void * item = from -> data[i];
+
+        if(j < items -> items && item == items -> data[j])
+        {
+            j ++;
+        }
+        else
+        {
+            from -> data[kept ++] = item;
+        }
+    }
+
+    from -> items = kept;
+}
+
+int verilog_source_tree_remove_file(
+    verilog_source_tree * tree,
+    char                * path
+){
+    verilog_source_file * file = verilog_source_tree_find_file(tree, path);
+    unsigned int i, m;
+
+    if(file == NULL)
+    {
+        return -1;
+    }
+
+    verilog_source_tree_remove_items(tree -> modules,    file -> modules);
+    verilog_source_tree_remove_items(tree -> primitives, file -> primitives);
+    verilog_source_tree_remove_items(tree -> configs,    file -> configs);
+    verilog_source_tree_remove_items(tree -> libraries,  file -> libraries);
+
+    for(i = 0; i < tree -> files -> items; i ++)
+    {
+        if(ast_list_get(tree -> files, i) == file)
+        {
+            ast_list_remove_at(tree -> files, i);
+            break;
+        }
+    }
+    ast_hashtable_delete(tree -> file_index, file -> path);
+
+    // Another module of the same name may now be the one to find.
+    ast_hashtable_clear(tree -> module_index);
+    tree -> indexed_modules = 0;
+    verilog_source_tree_index_modules(tree);
+
+    ast_arena * prev = ast_set_current_arena(tree -> arena);
+
+    // Instances resolved to a module which is no longer the one found by
+    // its name go back to naming it.
+    for(m = 0; m < tree -> modules -> items; m ++)
+    {
+        ast_module_declaration * module = ast_list_get(tree -> modules, m);
+
+        if(module == NULL || module -> module_instantiations == NULL)
+        {
+            continue;
+        }
+
+        for(i = 0; i < module -> module_instantiations -> items; i ++)
+        {
+            ast_module_instantiation * inst =
+                ast_list_get(module -> module_instantiations, i);
+            ast_module_declaration * declaration = inst -> declaration;
+            void * found = NULL;
+
+            if(!inst -> resolved || declaration == NULL ||
+               declaration -> identifier == NULL)
+            {
+                continue;
+            }
+
+            ast_hashtable_get(tree -> module_index,
+                              verilog_source_tree_module_key(declaration),
+                              &found);
+
+            if(found != declaration)
+            {
+                inst -> resolved         = AST_FALSE;
+                inst -> module_identifer = declaration -> identifier;
+            }
+        }
+    }
+
+    ast_set_current_arena(prev);
+
+    return 0;
+}
+
 /*!
 @brief Releases a source tree object from memory.
 @param [in] tofree - The source tree to be free'd
@@ -2914,5 +3385,18 @@ verilog_source_tree * verilog_new_source_tree()
 void verilog_free_source_tree(
     verilog_source_tree * tofree
 ){
-    printf("ERROR: Function not implemented. Source tree at %p not freed.\n", tofree);
+    if(tofree == NULL)
+    {
+        return;
+    }
+
+    if(tofree == yy_verilog_source_tree)
+    {
+        yy_verilog_source_tree = NULL;
+    }
+
+    ast_location_table_clear(tofree -> locations);
+
+    // The tree object itself lives inside its own arena.
+    ast_arena_free(tofree -> arena);
 }
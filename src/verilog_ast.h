@@ -4,6 +4,7 @@
        and operate on the Verilog Abstract Syntax Tree (AST)
 */
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,8 +14,6 @@
 #ifndef VERILOG_AST_H
 #define VERILOG_AST_H
 
-extern int yylineno;
-
 //! Forward declare. Defines the core node type for the AST.
 typedef struct ast_node_t ast_node;
 
@@ -125,14 +124,120 @@ typedef int ast_line;
 //! Refers to a source code file name.
 typedef char * ast_file;
 
+/*!
+@brief Identifies a place in the source, by its index in an
+@ref ast_location_table. Zero means the place is not known.
+*/
+typedef unsigned int ast_location;
+
+/*!
+@brief Where some text was spelled, and how it got to be where it was
+parsed.
+@details Text from a macro expansion is spelled where the macro was
+defined, while its expansion refers to the location where the macro was
+used. That may itself be inside another expansion, and so on out to the
+text of a file, whose expansion is zero. The arguments of a macro with
+parameters are treated as part of its expansion.
+*/
+typedef struct ast_location_entry_t{
+    ast_file     file;      //!< The file it is spelled in. Interned.
+    ast_line     line;      //!< The line of file it is spelled on.
+    ast_location expansion; //!< Where its macro was used, or zero.
+} ast_location_entry;
+
+//! Number of entries in each page of an ast_location_table.
+#define AST_LOCATION_PAGE_SIZE 4096
+
+/*!
+@brief Maps every location recorded during a parse to its entry.
+@details Entries are kept in fixed size pages, allocated from the table's
+own arena, so that an entry never moves once it has been added. The first
+entry is the unknown location. While shared is set, the table is locked, so
+that the workers of @ref verilog_parse_files can all add to the table of the
+tree their results are merged into, and every location stays valid after
+the merge. A table used by one thread at a time is never locked.
+*/
+typedef struct ast_location_table_t{
+    ast_arena          *  arena;        //!< Owns the pages. Made on demand.
+    ast_location_entry ** pages;        //!< Pages of entries.
+    unsigned int          page_count;   //!< Pages in use.
+    unsigned int          page_capacity;//!< Entries allocated in pages.
+    unsigned int          count;        //!< Entries in use.
+    ast_boolean           shared;       //!< Used by several threads at once.
+    pthread_mutex_t       lock;         //!< Guards every other member.
+} ast_location_table;
+
 /*!
 @brief Stores "meta" information and other tagging stuff about nodes.
 */
 typedef struct ast_metadata_t{
-    ast_line line;  //!< The line number the construct came from.
-    ast_file file;  //!< The file the construct came from.
+    ast_location location;  //!< Where the construct came from.
 } ast_metadata;
 
+/*!
+@brief Adds the location of text spelled on a line of a file, inside an
+expansion, to a table.
+@returns The new location, or zero if the table could not grow.
+*/
+ast_location ast_location_add(
+    ast_location_table * table,
+    ast_file             file,
+    ast_line             line,
+    ast_location         expansion
+);
+
+/*!
+@brief Returns the entry of a location, or NULL if the table is NULL or the
+location is unknown.
+*/
+ast_location_entry * ast_location_get(
+    ast_location_table * table,
+    ast_location         location
+);
+
+/*!
+@brief Follows a location out through every expansion it is inside of, to
+the location in a file of the outermost macro use.
+@details This is where a user would look for the construct. For a location
+which is not inside an expansion, the location itself is returned.
+*/
+ast_location ast_location_expansion_root(
+    ast_location_table * table,
+    ast_location         location
+);
+
+//! Returns the line a location is spelled on, or zero if it is unknown.
+ast_line ast_location_line(
+    ast_location_table * table,
+    ast_location         location
+);
+
+//! Returns the file a location is spelled in, or NULL if it is unknown.
+ast_file ast_location_file(
+    ast_location_table * table,
+    ast_location         location
+);
+
+//! Creates a new, empty, location table, allocated from an arena.
+ast_location_table * ast_location_table_new(
+    ast_arena * arena
+);
+
+//! Releases the entries of a table, leaving it empty.
+void ast_location_table_clear(
+    ast_location_table * table
+);
+
+/*!
+@brief Forgets every entry of a table, leaving it empty.
+@details Unlike @ref ast_location_table_clear, a table which fits in one
+page keeps it, so that a table emptied often does not allocate each time.
+Every location handed out before the call becomes invalid.
+*/
+void ast_location_table_reset(
+    ast_location_table * table
+);
+
 /*! @} */
 
 //-------------- Numbers ---------------------------------------
@@ -278,9 +383,13 @@ initial starting value.
 should be:
     - CONCATENATION_EXPRESSION          : ast_expression
     - CONCATENATION_CONSTANT_EXPRESSION : ast_expression
-    - CONCATENATION_NET                 : ast_identifier
-    - CONCATENATION_VARIABLE            : ast_identifer
-    - CONCATENATION_MODULE_PATH         : ast_identifier
+    - CONCATENATION_NET                 : ast_expression
+    - CONCATENATION_VARIABLE            : ast_expression
+    - CONCATENATION_MODULE_PATH         : ast_expression
+
+The items of net and variable concatenations are primary expressions:
+PRIMARY_IDENTIFIER for a named net or variable, and PRIMARY_CONCATENATION
+for a concatenation nested inside another.
 */
 ast_concatenation * ast_new_concatenation(ast_concatenation_type type,
                                           ast_expression * repeat,
@@ -1092,8 +1201,8 @@ typedef enum ast_event_expression_type_e{
 
 //! Describes a single event expression
 typedef struct ast_event_expression_t ast_event_expression;
-    ast_metadata    meta;   //!< Node metadata.
 struct ast_event_expression_t {
+    ast_metadata    meta;   //!< Node metadata.
     ast_event_expression_type type;
     union{
         ast_expression * expression; //!< Single event expressions.
@@ -1806,7 +1915,7 @@ typedef struct ast_module_instantiation_t {
         ast_identifier  module_identifer; //!< The module being instanced.
         ast_module_declaration * declaration; //!< The module instanced.
     };
-    ast_list              * module_parameters;
+    ast_list              * module_parameters; //!< ast_port_connection
     ast_list              * module_instances;
 } ast_module_instantiation;
 
@@ -1828,7 +1937,7 @@ collection of ast_module_instance with the same parameters.
 typedef struct ast_module_instance_t{
     ast_metadata    meta;   //!< Node metadata.
     ast_identifier          instance_identifier;
-    ast_list              * port_connections;
+    ast_list              * port_connections; //!< ast_port_connection
 } ast_module_instance;
 
 
@@ -1843,11 +1952,13 @@ ast_module_instance * ast_new_module_instance(
 
 /*! 
 @brief Decribes a single port connection in a module instance.
-@note This is also used to represent parameter assignments.
+@note This is also used to represent parameter assignments. Ordered
+connections and assignments have no port name, and an unconnected ordered
+port has no expression.
 */
 typedef struct ast_port_connection_t{
     ast_metadata    meta;   //!< Node metadata.
-    ast_identifier   port_name;
+    ast_identifier   port_name;  //!< NULL for ordered connections.
     ast_expression * expression;
 } ast_port_connection;
 
@@ -2392,10 +2503,14 @@ typedef struct ast_port_declaration_t{
     ast_boolean         is_variable;    //!< Variable or net?
     ast_range         * range;          //!< Bus width.
     ast_list          * port_names;     //!< The names of the ports.
+    ast_list          * initial_values; //!< ast_expression, or NULL.
 } ast_port_declaration;
 
 /*!
 @brief Creates and returns a new port declaration representation.
+@details Ports declared with no initial values have NULL initial_values.
+Otherwise it holds the initial value of each port in port_names, which is
+NULL for ports without one.
 */
 ast_port_declaration * ast_new_port_declaration(
     ast_port_direction  direction,      //!< [in] Input / output / inout etc.
@@ -2407,6 +2522,15 @@ ast_port_declaration * ast_new_port_declaration(
     ast_list          * port_names      //!< [in] The names of the ports.
 );
 
+/*!
+@brief Sets the port names and initial values of a port declaration from a
+list of ast_single_assignment, one for each variable port declared.
+*/
+void ast_port_declaration_set_variables(
+    ast_port_declaration * port,        //!< [inout] The declaration.
+    ast_list             * variables    //!< [in] The declared variables.
+);
+
 /*! @} */
 
 // -------------------------------- Type Declarations ------------------------
@@ -2440,7 +2564,7 @@ typedef struct ast_type_declaration_t{
     ast_metadata    meta;   //!< Node metadata.
     ast_declaration_type  type;
     ast_net_type          net_type;
-    ast_list            * identifiers;
+    ast_list            * identifiers; //!< ast_single_assignment for nets.
     ast_delay3          * delay;
     ast_drive_strength  * drive_strength;
     ast_charge_strength   charge_strength;
@@ -2817,7 +2941,8 @@ typedef enum ast_module_item_type_e{
     MOD_ITEM_EVENT_DECLARATION,
     MOD_ITEM_GENVAR_DECLARATION,
     MOD_ITEM_TASK_DECLARATION,
-    MOD_ITEM_FUNCTION_DECLARATION
+    MOD_ITEM_FUNCTION_DECLARATION,
+    MOD_ITEM_PATH_DECLARATION //!< Only found inside specify blocks.
 } ast_module_item_type;
 
 //! Describes a single module item, its type and data structure.
@@ -2829,7 +2954,7 @@ struct ast_module_item_t{
         ast_port_declaration        * port_declaration;
         ast_generate_block          * generated_instantiation;
         ast_parameter_declarations  * parameter_declaration;
-        ast_list                    * specify_block;
+        ast_list                    * specify_block; //!< ast_module_item
         ast_parameter_declarations  * specparam_declaration;
         ast_list                    * parameter_override;
         ast_continuous_assignment   * continuous_assignment;
@@ -2848,6 +2973,7 @@ struct ast_module_item_t{
         ast_type_declaration        * genvar_declaration;
         ast_task_declaration        * task_declaration;
         ast_function_declaration    * function_declaration;
+        ast_path_declaration        * path_declaration;
     };
 };
 
@@ -2909,7 +3035,7 @@ struct ast_module_declaration_t{
     ast_list * real_declarations; //!< ast_var_declaration
     ast_list * realtime_declarations; //!< ast_var_declaration
     ast_list * reg_declarations; //!< ast_reg_declaration
-    ast_list * specify_blocks; //!< Not Supported
+    ast_list * specify_blocks; //!< Lists of ast_module_item
     ast_list * specparams; //!< ast_parameter_declaration
     ast_list * task_declarations; //!< ast_task_declaration
     ast_list * time_declarations; //!< ast_var_declaration
@@ -3019,7 +3145,7 @@ typedef enum ast_id_range_or_index_e{
 struct ast_identifier_t{
     ast_metadata    meta;   //!< Node metadata.
     ast_identifier_type   type;         //!< What construct does it identify?
-    char                * identifier;   //!< The identifier value.
+    char                * identifier;   //!< The interned identifier value.
     unsigned int          from_line;    //!< The line number of the file.
     ast_boolean           is_system;    //!< Is this a system identifier?
     ast_identifier        next;         //!< Represents a hierarchical id.
@@ -3046,6 +3172,8 @@ char * ast_identifier_tostring(ast_identifier id);
 
 /*!
 @brief Acts like strcmp but works on ast identifiers.
+@details Compares the strings which @ref ast_identifier_tostring would
+return, without allocating them.
 */
 int ast_identifier_cmp(
     ast_identifier a,
@@ -3059,12 +3187,25 @@ and this is set later when the parser winds back up and knows which rules
 to follow.
 Also, the is_system member is set to false. If you want a new system
 idenifier instance, use the @ref ast_new_system_identifier function.
+The identifier text is interned with @ref ast_intern, so every identifier
+with the same name shares one copy of it.
 */
 ast_identifier ast_new_identifier(
     char         * identifier,  //!< String text of the identifier.
     unsigned int   from_line    //!< THe line the idenifier came from.
 );
 
+/*!
+@brief Creates and returns a new node representing an identifier, whose text
+has already been interned.
+@details Identical to @ref ast_new_identifier, but skips looking the text up
+in the intern table again.
+*/
+ast_identifier ast_new_interned_identifier(
+    char         * identifier,  //!< Interned text of the identifier.
+    unsigned int   from_line    //!< The line the idenifier came from.
+);
+
 
 /*!
 @brief Creates and returns a new node representing an identifier.
@@ -3263,17 +3404,61 @@ set manually.
 */
 ast_source_item * ast_new_source_item(ast_source_item_type type);
 
+/*!
+@brief Records what one file added to a source tree, and what it was parsed
+from.
+@details Constructs are listed in the order they appear in the tree's own
+lists. The hashes let @ref verilog_reparse_path_ctx tell whether parsing the
+file again could give a different result, and the snapshot of the
+preprocessor it was parsed with lets it parse the file from the same state.
+Trees loaded from a file have no snapshots.
+*/
+typedef struct verilog_source_file_t{
+    char      * path;           //!< The file, interned.
+    uint64_t    content_hash;   //!< Hash of its contents when parsed.
+    uint64_t    preproc_hash;   //!< Preprocessor state it was parsed with.
+    char      * entry_state;    //!< Snapshot of that state, or NULL.
+    size_t      entry_state_size; //!< Length of entry_state.
+    ast_list  * modules;        //!< ast_module_declaration
+    ast_list  * primitives;     //!< ast_udp_declaration
+    ast_list  * configs;        //!< ast_config_declaration
+    ast_list  * libraries;      //!< ast_library_descriptions
+} verilog_source_file;
+
 /*!
 @brief Top level container for parsed source code.
 @details All source code which the parser processes is placed inside an
 instance of this object. It contains lists of all top level objects which
 a verilog source file can contain.
+
+Every node, string and list parsed into the tree is allocated from the
+tree's own arena, so that the whole tree can be released at once, and
+independently of any other tree, using @ref verilog_free_source_tree.
+
+Modules should be added with @ref verilog_source_tree_add_module, which
+also records them in module_index for constant time lookup by name.
+Modules appended to the list directly are indexed lazily, the next time
+the index is used.
+
+The location in the metadata of each node is an index into the tree's
+table of locations.
+
+Each file parsed into the tree by path has a @ref verilog_source_file,
+which lists the constructs it added, so that they can be replaced when the
+file changes. Constructs parsed from strings, buffers or open files belong
+to no file.
 */
 typedef struct verilog_source_tree_t{
     ast_list    *   modules;
     ast_list    *   primitives;
     ast_list    *   configs;
     ast_list    *   libraries;
+    ast_arena   *   arena;      //!< Owns all memory of the tree.
+    ast_hashtable * module_index;   //!< Module declarations keyed by name.
+    unsigned int    indexed_modules;//!< Number of modules in module_index.
+    ast_location_table * locations; //!< Locations of the tree's nodes.
+    ast_list      * files;          //!< verilog_source_file, in parse order.
+    ast_hashtable * file_index;     //!< Interned path to verilog_source_file.
 } verilog_source_tree;
 
 
@@ -3288,11 +3473,65 @@ have an object to put parsed constructs into.
 */
 verilog_source_tree * verilog_new_source_tree();
 
+/*!
+@brief Adds a module declaration to the source tree, and to its index of
+modules by name.
+*/
+void verilog_source_tree_add_module(
+    verilog_source_tree    * tree,
+    ast_module_declaration * module
+);
+
+/*!
+@brief Brings the source tree's index of modules by name up to date with its
+list of modules.
+@details Only modules appended since the last call are visited. Removing
+modules from the list invalidates the index.
+*/
+void verilog_source_tree_index_modules(
+    verilog_source_tree * tree
+);
+
+/*!
+@brief Returns the record of what a file added to a source tree, creating
+an empty one if the file has not been parsed into the tree before.
+*/
+verilog_source_file * verilog_source_tree_file(
+    verilog_source_tree * tree,
+    char                * path  //!< The file. Need not be interned.
+);
+
+/*!
+@brief Returns the record of what a file added to a source tree, or NULL if
+it has not been parsed into the tree.
+*/
+verilog_source_file * verilog_source_tree_find_file(
+    verilog_source_tree * tree,
+    char                * path  //!< The file. Need not be interned.
+);
+
+/*!
+@brief Removes every construct a file added to a source tree, and the
+file's record.
+@details The module index is rebuilt, and any module instantiation which
+was resolved to a removed module is made unresolved again, so that
+@ref verilog_resolve_modules can resolve it to whatever replaces it. The
+memory of the removed constructs is only released with the tree.
+@returns Zero, or -1 if the file had no record in the tree.
+*/
+int verilog_source_tree_remove_file(
+    verilog_source_tree * tree,
+    char                * path  //!< The file. Need not be interned.
+);
+
 /*!
 @brief Releases a source tree object from memory.
 @details Frees the top level source tree object, and all of it's child
-ast_* objects by calling the ast_free_all function.
+ast_* objects, by releasing the arena which owns them. Other source trees
+are not affected.
 @param [in] tofree - The source tree to be free'd
+@post If tofree was the @ref yy_verilog_source_tree, then that global is
+set to NULL, and @ref verilog_parser_init will create a fresh tree.
 */
 void verilog_free_source_tree(
     verilog_source_tree * tofree
@@ -13,174 +13,145 @@
 #include "verilog_ast_common.h"
 
 /*!
-@brief Creates and returns a pointer to a new linked list.
+@brief Creates and returns a pointer to a new list.
+@details No storage is reserved for items until the first one is added.
 */
 ast_list * ast_list_new ()
 {
     ast_list * tr = ast_calloc(1, sizeof(ast_list));
-    tr -> head          = NULL;
-    tr -> tail          = NULL;
-    tr -> walker        = NULL;
-    tr -> items         = 0;
-    tr -> current_item  = 0;
+    tr -> arena    = ast_current_arena();
+    tr -> base     = NULL;
+    tr -> data     = NULL;
+    tr -> items    = 0;
+    tr -> capacity = 0;
     return tr;
 }
 
 /*!
-@brief Frees the memory of the supplied linked list.
+@brief Frees the memory of the supplied list.
 @note Does not free the memory of the data elements in the list, only
 the list construct itself.
+@note The list's storage is allocated from an arena, so its memory is
+reclaimed in bulk along with the rest of that arena. This function only
+empties the list.
 */
 void       ast_list_free(ast_list * list)
 {
-    if(list -> items > 0)
+    list -> data  = list -> base;
+    list -> items = 0;
+}
+
+/*!
+@brief Moves the items of a list into a new array with room for at least
+`extra` more items.
+@details The array at least doubles in size. When growing for a prepend, all
+of the new space goes in front of the items, otherwise it goes after them.
+The old array belongs to the list's arena and is released along with it.
+*/
+static void ast_list_grow(
+    ast_list   * list,  //!< The list to grow.
+    unsigned int extra, //!< Number of free slots needed.
+    int          front  //!< Whether the free slots are needed at the front.
+){
+    unsigned int head_room = list -> data - list -> base;
+    unsigned int tail_room = list -> capacity - head_room - list -> items;
+    unsigned int capacity  = list -> capacity * 2;
+
+    if(capacity < AST_LIST_INITIAL_CAPACITY)
     {
-        list -> walker = list -> head;
-        
-        // Walk along the list, freeing elements as we go.
-        while(list -> walker != NULL)
-        {
-            ast_list_element * tmp = list -> walker;
-            list -> walker = list -> walker -> next;
+        capacity = AST_LIST_INITIAL_CAPACITY;
+    }
+    if(capacity < list -> items + extra)
+    {
+        capacity = list -> items + extra;
+    }
 
-            if(tmp != NULL)
-            {
-                free(tmp);
-            }
-        }
+    void ** base = ast_arena_calloc(list -> arena, capacity, sizeof(void*));
+    assert(base != NULL);
+
+    if(front)
+    {
+        head_room = capacity - list -> items - tail_room;
+    }
+
+    if(list -> items > 0)
+    {
+        memcpy(base + head_room, list -> data, list -> items * sizeof(void*));
     }
 
-    free(list);
+    list -> base     = base;
+    list -> data     = base + head_room;
+    list -> capacity = capacity;
 }
 
 /*!
-@brief Adds a new item to the end of a linked list.
+@brief Adds a new item to the end of a list.
 */
 void       ast_list_append(ast_list * list, void * data)
 {
-    if(list -> items == 0)
+    if((list -> data - list -> base) + list -> items == list -> capacity)
     {
-        list -> head         = ast_calloc(1,sizeof(ast_list_element));
-        list -> head -> next = NULL;
-        list -> head -> data = data;
-
-        list -> tail         = list -> head;
-        list -> walker       = list -> tail;
-        list -> items       += 1;
-        list -> current_item = list -> items-1;
+        ast_list_grow(list, 1, 0);
     }
-    else
-    {
-        list -> tail -> next = ast_calloc(1, sizeof(ast_list_element));
-        list -> tail = list -> tail -> next;
-        list -> tail -> data = data;
 
-        list -> items += 1;
-    }
+    list -> data[list -> items] = data;
+    list -> items += 1;
 }
 
 
 /*!
-@brief Removes the i'th item from a linked list.
+@brief Removes the i'th item from a list.
 */
 void      ast_list_remove_at(ast_list * list, unsigned int i)
 {
-    if(i > list -> items - 1)
+    if(i >= list -> items)
     {
         return;
     }
+    else if(i == 0)
+    {
+        list -> data  += 1;
+        list -> items -= 1;
+    }
     else
     {
-        if(i <= list -> current_item)
-        {
-            list -> current_item = 0;
-            list -> walker = list -> head;
-        }
-
-        while(list -> current_item != i-1 && list -> walker != NULL)
-        {
-            list -> walker = list -> walker -> next;
-            list -> current_item += 1;
-        }
-        if(i > 0){
-            assert(i-1 == list -> current_item);
-            list -> walker -> next = list -> walker -> next -> next;
-            list -> items -= 1;
-            //ast_list_element * toremove =  list -> walker -> next;
-            //free(toremove);
-        } else {
-            list -> head = list -> head -> next;
-            //ast_list_element * toremove =  list -> head;
-            //free(toremove);
-            list -> items -= 1;
-        }
+        memmove(list -> data + i, list -> data + i + 1,
+                (list -> items - i - 1) * sizeof(void*));
+        list -> items -= 1;
     }
 }
 
 
 /*!
-@brief Adds a new item to the front of a linked list.
+@brief Adds a new item to the front of a list.
 */
 void       ast_list_preappend(ast_list * list, void * data)
 {
-    if(list -> items == 0)
+    if(list -> data == list -> base)
     {
-        list -> head         = ast_calloc(1,sizeof(ast_list_element));
-        list -> head -> next = NULL;
-        list -> head -> data = data;
-
-        list -> tail         = list -> head;
-        list -> walker       = list -> tail;
-        list -> items       += 1;
-        list -> current_item = list -> items-1;
+        ast_list_grow(list, 1, 1);
     }
-    else
-    {
-        ast_list_element * to_add = ast_calloc(1, sizeof(ast_list_element));
-        to_add -> data = data;
-
-        to_add -> next = list -> head;
-        list   -> head = to_add;
 
-        list -> items += 1;
-        list -> current_item += 1;
-    }
+    list -> data  -= 1;
+    list -> data[0] = data;
+    list -> items += 1;
 }
 
 /*!
-@brief Finds and returns the i'th item in the linked list.
+@brief Finds and returns the i'th item in the list.
 @details Returns a void* pointer. The programmer must be sure to cast this
 as the correct type.
 */
 void *    ast_list_get(ast_list * list, unsigned int item)
 {
     assert(list != NULL);
-    if(item > list -> items - 1)
+    if(item >= list -> items)
     {
         return NULL;
     }
     else
     {
-        if(item < list -> current_item)
-        {
-            list -> current_item = 0;
-            list -> walker = list -> head;
-        }
-
-        while(list -> current_item != item && list -> walker != NULL)
-        {
-            list -> walker = list -> walker -> next;
-            list -> current_item += 1;
-        }
-
-        if(list -> walker == NULL)
-        {
-            return NULL;
-        }
-        else
-        {
-            return list -> walker -> data;
-        }
+        return list -> data[item];
     }
 }
 
@@ -197,30 +168,17 @@ int ast_list_contains(
     void * data
 ){
     assert(list != NULL);
-    if(list -> items  <= 0)
-    {
-        return 0;
-    }
-    else
-    {
-        list -> current_item = 0;
-        list -> walker = list -> head;
 
-        while(list -> walker != NULL)
+    unsigned int i;
+    for(i = 0; i < list -> items; i ++)
+    {
+        if(list -> data[i] == data)
         {
-            if(list -> walker -> data == data)
-            {
-                return 1;
-            }
-            else
-            {
-                list -> walker = list -> walker -> next;
-                list -> current_item += 1;
-            }
+            return 1;
         }
-
-        return 0;
     }
+
+    return 0;
 }
 
 
@@ -228,45 +186,30 @@ int ast_list_contains(
 @brief concatenates the two supplied lists into one.
 @param head - This will form the "front" of the new list.
 @param tail - This will form the "end" of the new list.
-@details This function takes all the elements in tail and appends them
-to those in head. The tail argument is then released from memory, and the
-original head pointer is returned, with all data items still in tact.
+@details This function copies all the items in tail onto the end of those
+in head, and returns the head pointer, with all data items still in tact.
+The tail list itself is left unchanged.
 */
 ast_list *    ast_list_concat(ast_list * head, ast_list * tail)
 {
     assert(head != NULL);
     assert(tail != NULL);
 
-    // Perform the concatenation.
-
-    if(head -> tail == NULL)
+    if(tail -> items == 0)
     {
-        head -> tail = tail -> head;
-        head -> head = tail -> head;
+        return head;
     }
-    else if(head -> tail -> next == NULL)
+
+    unsigned int used = (head -> data - head -> base) + head -> items;
+    if(head -> capacity - used < tail -> items)
     {
-        head -> tail -> next = tail -> head;
-        head -> tail = tail -> tail;
-    }
-    else
-    {
-        while(head -> tail -> next != NULL)
-        {
-            head -> tail = head -> tail -> next;
-        }
-        head -> tail -> next = tail -> head;
-        head -> tail = tail -> tail;
+        ast_list_grow(head, tail -> items, 0);
     }
 
+    memcpy(head -> data + head -> items, tail -> data,
+           tail -> items * sizeof(void*));
     head -> items += tail -> items;
-    head -> walker = head -> head;
-    head -> current_item = 0;
-
-    // Free only the tail data-structure, not it's elements.
-    //free(tail);
 
-    // return the new list.
     return head;
 }
 
@@ -275,23 +218,20 @@ ast_list *    ast_list_concat(ast_list * head, ast_list * tail)
 */
 ast_stack * ast_stack_new(){
     ast_stack * tr = ast_calloc(1,sizeof(ast_stack));
+    tr -> arena = ast_current_arena();
     tr -> depth = 0;
     return tr;
 }
 
 /*!
 @brief Free the stack, but not it's contents
+@note Stack elements are allocated from an arena, so their memory is
+reclaimed in bulk along with the rest of that arena.
 */
 void ast_stack_free(ast_stack * stack){
     assert(stack != NULL);
-    
-    while(stack -> items != NULL){
-        ast_stack_element * tmp = stack -> items -> next;
-        free(stack -> items);
-        stack -> items = tmp;
-    }
-
-    free(stack);
+    stack -> items = NULL;
+    stack -> depth = 0;
 }
 
 /*!
@@ -307,12 +247,14 @@ void ast_stack_push(
 
     if(stack -> items == NULL)
     {
-        stack -> items = ast_calloc(1,sizeof(ast_stack_element));
+        stack -> items = ast_arena_calloc(stack -> arena, 1,
+                                          sizeof(ast_stack_element));
         stack -> items -> data = item;
     } 
     else
     {
-        ast_stack_element * toadd = ast_calloc(1,sizeof(ast_stack_element));
+        ast_stack_element * toadd = ast_arena_calloc(stack -> arena, 1,
+                                                sizeof(ast_stack_element));
         toadd -> data = item;
         toadd -> next = stack -> items;
         stack -> items = toadd;
@@ -394,25 +336,124 @@ void * ast_stack_peek2(
     }
 }
 
+/*!
+@brief Computes the 32-bit FNV-1a hash of a null terminated string.
+*/
+static unsigned int ast_hashtable_hash(char * key)
+{
+    unsigned int h = 2166136261u;
+    while(*key != '\0')
+    {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+        key ++;
+    }
+    return h;
+}
+
+/*!
+@brief Finds the slot which holds key, or the free slot which ends its probe
+run if the key is not in the table.
+*/
+static ast_hashtable_element * ast_hashtable_find(
+    ast_hashtable * table, //!< The table to search.
+    char          * key,   //!< The key to look for.
+    unsigned int    hash   //!< The hash of key.
+){
+    unsigned int mask = table -> capacity - 1;
+    unsigned int i    = hash & mask;
+
+    while(table -> slots[i].key != NULL)
+    {
+        ast_hashtable_element * e = &table -> slots[i];
+        if(e -> key == key ||
+           (e -> hash == hash && strcmp(e -> key, key) == 0))
+        {
+            return e;
+        }
+        i = (i + 1) & mask;
+    }
+
+    return &table -> slots[i];
+}
+
+/*!
+@brief Doubles the number of slots in the table and re-inserts every element
+using its cached hash.
+@details The old slot array belongs to the table's arena and is released
+along with it.
+*/
+static ast_hashtable_result ast_hashtable_grow(
+    ast_hashtable * table  //!< The table to grow.
+){
+    unsigned int            old_capacity = table -> capacity;
+    ast_hashtable_element * old_slots    = table -> slots;
+    unsigned int            new_capacity = old_capacity * 2;
+
+    ast_hashtable_element * new_slots = ast_arena_calloc(table -> arena,
+        new_capacity, sizeof(ast_hashtable_element));
+
+    if(new_slots == NULL)
+    {
+        return HASH_FAIL;
+    }
+
+    unsigned int mask = new_capacity - 1;
+    unsigned int i;
+    for(i = 0; i < old_capacity; i ++)
+    {
+        if(old_slots[i].key != NULL)
+        {
+            unsigned int j = old_slots[i].hash & mask;
+            while(new_slots[j].key != NULL)
+            {
+                j = (j + 1) & mask;
+            }
+            new_slots[j] = old_slots[i];
+        }
+    }
+
+    table -> slots    = new_slots;
+    table -> capacity = new_capacity;
+    return HASH_SUCCESS;
+}
+
 //! Creates and returns a new hashtable.
 ast_hashtable * ast_hashtable_new(){
     ast_hashtable * tr = ast_calloc(1,sizeof(ast_hashtable));
 
-    tr -> size = 0;
-    tr -> elements = ast_list_new();
+    tr -> arena    = ast_current_arena();
+    tr -> size     = 0;
+    tr -> capacity = AST_HASHTABLE_INITIAL_CAPACITY;
+    tr -> slots    = ast_arena_calloc(tr -> arena, tr -> capacity,
+                                      sizeof(ast_hashtable_element));
 
     return tr;
 }
 
-//! Frees an existing hashtable, but not it's contents, only the structure.
+/*!
+@brief Frees an existing hashtable, but not it's contents, only the structure.
+@note The table's storage is allocated from an arena, so its memory is
+reclaimed in bulk along with the rest of that arena. This function only
+empties the table.
+*/
 void  ast_hashtable_free(
     ast_hashtable * table  //!< The table to free.
 ){
-    ast_list_free(table -> elements);
-    free(table);
+    ast_hashtable_clear(table);
     return;
 }
 
+//! Removes every item from a hashtable, leaving it ready to be used again.
+void  ast_hashtable_clear(
+    ast_hashtable * table  //!< The table to empty.
+){
+    assert(table != NULL);
+    memset(table -> slots, 0,
+           table -> capacity * sizeof(ast_hashtable_element));
+    table -> size = 0;
+}
+
 //! Inserts a new item into the hashtable.
 ast_hashtable_result ast_hashtable_insert(
     ast_hashtable * table, //!< The table to insert into.
@@ -422,21 +463,28 @@ ast_hashtable_result ast_hashtable_insert(
     assert(key != NULL);
     assert(table != NULL);
 
-    unsigned int i;
-    for(i = 0; i < table -> elements -> items; i ++)
+    unsigned int hash = ast_hashtable_hash(key);
+    ast_hashtable_element * e = ast_hashtable_find(table, key, hash);
+
+    if(e -> key != NULL)
+    {
+        return HASH_KEY_COLLISION;
+    }
+
+    // Keep the load factor at or below 3/4 so probe runs stay short.
+    if((table -> size + 1) * 4 > table -> capacity * 3)
     {
-        ast_hashtable_element * e = ast_list_get(table->elements, i);
-        if(e != NULL)
+        if(ast_hashtable_grow(table) != HASH_SUCCESS)
         {
-            if(strcmp(e -> key , key) == 0){
-                return HASH_KEY_COLLISION;
-            }
+            return HASH_FAIL;
         }
+        e = ast_hashtable_find(table, key, hash);
     }
-    ast_hashtable_element * toinsert = ast_calloc(1,sizeof(ast_hashtable_element));
-    toinsert -> key = key;
-    toinsert -> data = value;
-    ast_list_append(table -> elements, toinsert);;
+
+    e -> key  = key;
+    e -> data = value;
+    e -> hash = hash;
+    table -> size ++;
 
     return HASH_SUCCESS;
 }
@@ -447,39 +495,57 @@ ast_hashtable_result ast_hashtable_get(
     char          * key,   //!< The key of the data to fetch.
     void         ** value  //!< [out] The data being returned.
 ){
-    unsigned int i;
-    for(i = 0; i < table -> elements -> items; i ++)
+    ast_hashtable_element * e = ast_hashtable_find(table, key,
+                                    ast_hashtable_hash(key));
+    if(e -> key == NULL)
     {
-        ast_hashtable_element * e = ast_list_get(table->elements, i);
-        if(e != NULL)
-        {
-            if(strcmp(e -> key , key) == 0){
-                *value = (e -> data);
-                return HASH_SUCCESS;
-            }
-        }
+        return HASH_KEY_NOT_FOUND;
     }
-    return HASH_KEY_NOT_FOUND;
+
+    *value = e -> data;
+    return HASH_SUCCESS;
 }
 
-//! Removes a key value pair from the hashtable.
+/*!
+@brief Removes a key value pair from the hashtable.
+@details Rather than leaving a tombstone, every following element of the
+probe run which could legally live in the freed slot is shifted back into it.
+*/
 ast_hashtable_result ast_hashtable_delete(
     ast_hashtable * table, //!< The table to delete from.
     char          * key    //!< The key to delete.
 ){
-    unsigned int i;
-    for(i = 0; i < table -> elements -> items; i ++)
+    ast_hashtable_element * e = ast_hashtable_find(table, key,
+                                    ast_hashtable_hash(key));
+    if(e -> key == NULL)
+    {
+        return HASH_KEY_NOT_FOUND;
+    }
+
+    unsigned int mask = table -> capacity - 1;
+    unsigned int hole = e - table -> slots;
+    unsigned int i    = (hole + 1) & mask;
+
+    while(table -> slots[i].key != NULL)
     {
-        ast_hashtable_element * e = ast_list_get(table->elements, i);
-        if(e != NULL)
+        unsigned int home = table -> slots[i].hash & mask;
+
+        // The element at i may move into the hole only if the hole lies
+        // between its home slot and i, going round the table.
+        if(((i - home) & mask) >= ((i - hole) & mask))
         {
-            if(strcmp(e -> key , key) == 0){
-                ast_list_remove_at(table->elements, i);
-                return HASH_SUCCESS;
-            }
+            table -> slots[hole] = table -> slots[i];
+            hole = i;
         }
+        i = (i + 1) & mask;
     }
-    return HASH_KEY_NOT_FOUND;
+
+    table -> slots[hole].key  = NULL;
+    table -> slots[hole].data = NULL;
+    table -> slots[hole].hash = 0;
+    table -> size --;
+
+    return HASH_SUCCESS;
 }
 
 //! Updates an existing item in the hashtable.
@@ -488,14 +554,32 @@ ast_hashtable_result ast_hashtable_update(
     char          * key,   //!< The key to update with.
     void          * value  //!< The new data item to update.
 ){
-    unsigned int i;
-    for(i = 0; i < table -> elements -> items; i ++)
+    ast_hashtable_element * e = ast_hashtable_find(table, key,
+                                    ast_hashtable_hash(key));
+    if(e -> key == NULL)
     {
-        ast_hashtable_element * e = ast_list_get(table->elements, i);
-        if(strcmp(e -> key , key) == 0){
-            e -> data = value;
-            return HASH_SUCCESS;
-        }
+        return HASH_KEY_NOT_FOUND;
     }
-    return HASH_KEY_NOT_FOUND;
+
+    e -> data = value;
+    return HASH_SUCCESS;
+}
+
+// --------------- Hashing ------------------------
+
+uint64_t ast_hash_bytes(
+    uint64_t     hash,
+    const void * data,
+    size_t       length
+){
+    const unsigned char * bytes = data;
+    size_t i;
+
+    for(i = 0; i < length; i ++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
 }
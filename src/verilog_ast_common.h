@@ -5,6 +5,7 @@
 */
 
 #include "stdarg.h"
+#include "stdint.h"
 #include "stdlib.h"
 #include "string.h"
 
@@ -14,71 +15,73 @@
 #define VERILOG_AST_COMMON_H
 
 
-// --------------- Linked List ------------------------
+// --------------- List ------------------------
 
 /*!
-@defgroup ast-linked-lists Linked List
+@defgroup ast-linked-lists List
 @{
 @ingroup ast-utility
+@brief An ordered list of pointers, stored in a contiguous array.
+@details Items live in a single array which grows geometrically, so
+indexing is O(1) and appending is amortised O(1). Space is also kept free
+at the front of the array, which makes prepending amortised O(1) too. The
+grammar builds many of its lists back to front.
 */
 
-
-//! Typedef for the ast_list_element_t
-typedef struct ast_list_element_t ast_list_element;
+//! Number of slots a list reserves when the first item is added.
+#define AST_LIST_INITIAL_CAPACITY 4
 
 /*!
-@brief Storage container for a single element in the linked list.
-*/
-struct ast_list_element_t{
-    ast_list_element * next;
-    void             * data;
-};
-
-
-/*!
-@brief Container struct for the linked list data structure.
+@brief Container struct for the list data structure.
+@details Items are stored in items[0..items), which is a window into the
+allocated array `base`. There are `items - base` free slots in front of the
+window, and `capacity - (items - base) - items` free slots after it.
 */
 typedef struct ast_list_t {
-    ast_list_element *  head;         //!< The "front" of the list.
-    ast_list_element *  tail;         //!< The "end" of the list.
-    ast_list_element *  walker;       //!< Used to "walk" along the list.
-    unsigned int        items;        //!< Number of items in the list.
-    unsigned int        current_item; //! Current position of walker in list.
+    void            ** base;     //!< Start of the allocated array.
+    void            ** data;     //!< The first item in the list.
+    unsigned int       items;    //!< Number of items in the list.
+    unsigned int       capacity; //!< Number of slots in base.
+    ast_arena        * arena;    //!< Where the array is allocated.
 } ast_list;
 
 
 /*!
-@brief Creates and returns a pointer to a new linked list.
+@brief Creates and returns a pointer to a new list.
+@details The list, and all storage it later grows into, is allocated from
+the arena which is current when the list is created.
 */
 ast_list * ast_list_new ();
 
 /*!
-@brief Frees the memory of the supplied linked list.
+@brief Frees the memory of the supplied list.
 @note Does not free the memory of the data elements in the list, only
 the list construct itself.
 */
 void       ast_list_free(ast_list * list);
 
 /*!
-@brief Adds a new item to the end of a linked list.
+@brief Adds a new item to the end of a list.
 */
 void       ast_list_append(ast_list * list, void * data);
 
 
 /*!
-@brief Adds a new item to the front of a linked list.
+@brief Adds a new item to the front of a list.
 */
 void       ast_list_preappend(ast_list * list, void * data);
 
 /*!
-@brief Finds and returns the i'th item in the linked list.
+@brief Finds and returns the i'th item in the list.
 @details Returns a void* pointer. The programmer must be sure to cast this
-as the correct type.
+as the correct type. Returns NULL if item is out of range.
 */
 void *    ast_list_get(ast_list * list, unsigned int item);
 
 /*!
-@brief Removes the i'th item from a linked list.
+@brief Removes the i'th item from a list.
+@details Removing the first item is O(1), otherwise later items are moved
+down one place.
 */
 void      ast_list_remove_at(ast_list * list, unsigned int i);
 
@@ -86,9 +89,9 @@ void      ast_list_remove_at(ast_list * list, unsigned int i);
 @brief concatenates the two supplied lists into one.
 @param head - This will form the "front" of the new list.
 @param tail - This will form the "end" of the new list.
-@details This function takes all the elements in tail and appends them
-to those in head. The tail argument is then released from memory, and the
-original head pointer is returned, with all data items still in tact.
+@details This function copies all the items in tail onto the end of those
+in head, and returns the head pointer, with all data items still in tact.
+The tail list itself is left unchanged.
 */
 ast_list *    ast_list_concat(ast_list * head, ast_list * tail);
 
@@ -131,6 +134,7 @@ struct ast_stack_element_t{
 typedef struct ast_stack_t{
     unsigned int          depth; //!< How many items are on the stack?
     ast_stack_element   * items; //!< The stack of items.
+    ast_arena           * arena; //!< Where stack elements are allocated.
 } ast_stack;
 
 /*!
@@ -187,28 +191,37 @@ void * ast_stack_peek2(
 @defgroup ast-hashtable Hash Table
 @{
 @ingroup ast-utility
-@brief A *very* simple hash table implemented (for now) over a linked list.
-@details This can be used for simple key-value pair storage. Current
-access time is O(n) for a table with N elements in it.
-@warning This is a *terrible* way to implement a hash table. It doesn't
-even do any hashing!
-@todo Re-implement over a proper hash table structure.
+@brief A simple string-keyed hash table.
+@details This can be used for simple key-value pair storage. The table uses
+open addressing with linear probing over a power-of-two sized array of
+slots. Each slot caches the full hash of its key, so probes only call strcmp
+when the hashes match, and growing the table never re-hashes a key. Deletion
+shifts later entries of the probe run backwards rather than leaving
+tombstones, so lookups never slow down after many defines and undefines.
+Expected access time is O(1).
+@note Keys are not copied. The caller must keep each key alive for as long
+as it is in the table.
 */
 
 /*! @} */
 
+//! Number of slots in a freshly created hash table. Must be a power of two.
+#define AST_HASHTABLE_INITIAL_CAPACITY 16
 
 //! A single element in the hash table.
 typedef struct ast_hashtable_element_t{
-    char * key; //!< The key for the element.
-    void * data;    //!< The data associated with they key.
+    char * key;          //!< The key for the element, NULL if the slot is free.
+    void * data;         //!< The data associated with they key.
+    unsigned int hash;   //!< Cached hash of the key.
 } ast_hashtable_element;
 
 
 //! A hash table object.
 typedef struct ast_hashtable_t{
-    ast_list * elements; //!< The items.
-    unsigned int size;   //!< The number of elements in the table.
+    ast_hashtable_element * slots;    //!< capacity slots, some of them free.
+    unsigned int            capacity; //!< Number of slots, a power of two.
+    unsigned int            size;     //!< The number of elements in the table.
+    ast_arena             * arena;    //!< Where table slots are allocated.
 } ast_hashtable;
 
 typedef enum ast_hashtable_result_e{
@@ -221,11 +234,21 @@ typedef enum ast_hashtable_result_e{
 //! Creates and returns a new hashtable.
 ast_hashtable * ast_hashtable_new();
 
-//! Frees an existing hashtable, but not it's contents, only the structure.
+/*!
+@brief Frees an existing hashtable, but not it's contents, only the structure.
+@note The table's storage is allocated from an arena, so its memory is
+reclaimed in bulk along with the rest of that arena. This function only
+empties the table, which must not be used again.
+*/
 void  ast_hashtable_free(
     ast_hashtable * table  //!< The table to free.
 );
 
+//! Removes every item from a hashtable, leaving it ready to be used again.
+void  ast_hashtable_clear(
+    ast_hashtable * table  //!< The table to empty.
+);
+
 //! Inserts a new item into the hashtable.
 ast_hashtable_result ast_hashtable_insert(
     ast_hashtable * table, //!< The table to insert into.
@@ -253,4 +276,21 @@ ast_hashtable_result ast_hashtable_update(
     void          * value  //!< The new data item to update.
 );
 
+// --------------- Hashing ------------------------
+
+//! The value to start a hash with @ref ast_hash_bytes.
+#define AST_HASH_SEED 14695981039346656037ull
+
+/*!
+@brief Adds bytes to a running 64-bit FNV-1a hash, and returns the result.
+@details Used to tell whether file contents, or other inputs, have changed
+since they were last seen. Start with AST_HASH_SEED, and pass the result of
+each call to the next.
+*/
+uint64_t ast_hash_bytes(
+    uint64_t     hash,   //!< The hash so far.
+    const void * data,   //!< The bytes to add.
+    size_t       length  //!< The number of bytes.
+);
+
 #endif
@@ -4,26 +4,476 @@
 manage dynamic memory allocation within the library.
 */
 
+#include <pthread.h>
+
 #include "verilog_ast_mem.h"
+#include "verilog_diagnostics.h"
 
 /*!
 @defgroup ast-utility-mem-manage Memory Management
 @{
     @brief Helps to manage memory allocated during AST construction.
+    @details All AST memory is bump-allocated out of an @ref ast_arena_t.
+    Nothing is freed individually. Instead, whole arenas are released in one
+    go, at a cost proportional to the number of chunks rather than the number
+    of nodes.
 @ingroup ast-utility
 */
 
-//! The total number of memory allocations made.
-unsigned int memory_allocations = 0;
+//! Rounds n up to the next multiple of the arena alignment.
+#define AST_ARENA_ROUND(n) \
+    (((n) + AST_ARENA_ALIGN - 1) & ~(AST_ARENA_ALIGN - 1))
+
+//! Size of a chunk header, padded so that chunk data is aligned.
+#define AST_ARENA_HEADER AST_ARENA_ROUND(sizeof(ast_arena_chunk))
+
+//! The arena which backs ast_calloc and ast_strdup by default.
+static ast_arena global_arena = {NULL, AST_ARENA_CHUNK_SIZE, 0, 0, 0, 0,
+                                 NULL, NULL};
+
+//! Serialises allocations from the global arena, which all threads share.
+static pthread_mutex_t global_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//! The arena which currently backs ast_calloc and ast_strdup.
+static VERILOG_THREAD_LOCAL ast_arena * current_arena = NULL;
+
+//! Head of the list of live arenas created with ast_arena_new.
+static ast_arena * live_arenas = NULL;
+
+//! Guards live_arenas.
+static pthread_mutex_t live_arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//! A single slot of the intern table.
+typedef struct ast_intern_slot_t{
+    char         * str;  //!< The interned string, NULL if the slot is free.
+    size_t         len;  //!< strlen(str).
+    unsigned int   hash; //!< Cached hash of str.
+} ast_intern_slot;
+
+//! One independently locked part of the intern table.
+typedef struct ast_intern_shard_t{
+    pthread_mutex_t   lock;     //!< Held while the shard is read or changed.
+    ast_arena         arena;    //!< Storage for strings and slots.
+    ast_intern_slot * slots;    //!< Open addressed table of strings.
+    unsigned int      capacity; //!< Number of slots, a power of two.
+    unsigned long     count;    //!< Number of strings in the shard.
+} ast_intern_shard;
+
+//! The intern table. Shards are initialised on first use.
+static ast_intern_shard intern_shards[AST_INTERN_SHARDS];
+
+//! Makes sure the intern shards are initialised exactly once.
+static pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+
+/*!
+@brief Requests a new chunk with at least size usable bytes from the system.
+*/
+static ast_arena_chunk * ast_arena_new_chunk(
+    ast_arena * arena,
+    size_t      size
+){
+    ast_arena_chunk * tr = calloc(1, AST_ARENA_HEADER + size);
+
+    if(tr == NULL)
+    {
+        return NULL;
+    }
+
+    tr -> size = size;
+    tr -> used = 0;
+
+    arena -> chunk_count    += 1;
+    arena -> total_reserved += size;
+
+    return tr;
+}
+
+
+ast_arena * ast_arena_new(size_t chunk_size)
+{
+    ast_arena * tr = calloc(1, sizeof(ast_arena));
+
+    if(tr == NULL)
+    {
+        return NULL;
+    }
+
+    tr -> chunk_size = chunk_size > 0 ? chunk_size : AST_ARENA_CHUNK_SIZE;
+
+    pthread_mutex_lock(&live_arenas_lock);
+    tr -> next  = live_arenas;
+    if(live_arenas != NULL)
+    {
+        live_arenas -> prev = tr;
+    }
+    live_arenas = tr;
+    pthread_mutex_unlock(&live_arenas_lock);
+
+    return tr;
+}
+
+
+/*!
+@brief Allocates zeroed memory for num elements of the given size from the
+supplied arena.
+@details Small requests are bumped out of the current chunk, and a new chunk
+is started when it runs out. Requests larger than a quarter of a chunk get a
+chunk of their own, which is threaded in *behind* the current chunk so that
+its remaining space is not wasted.
+*/
+static void * ast_arena_calloc_unlocked(
+    ast_arena * arena,
+    size_t      num,
+    size_t      size
+){
+    if(size != 0 && num > ((size_t)-1) / size)
+    {
+        return NULL;
+    }
+
+    size_t bytes   = num * size;
+    size_t rounded = AST_ARENA_ROUND(bytes > 0 ? bytes : 1);
+
+    ast_arena_chunk * chunk = arena -> chunks;
+
+    if(chunk == NULL || chunk -> size - chunk -> used < rounded)
+    {
+        if(rounded > arena -> chunk_size / 4)
+        {
+            chunk = ast_arena_new_chunk(arena, rounded);
+            if(chunk == NULL)
+            {
+                return NULL;
+            }
+
+            if(arena -> chunks == NULL)
+            {
+                arena -> chunks = chunk;
+            }
+            else
+            {
+                chunk -> next = arena -> chunks -> next;
+                arena -> chunks -> next = chunk;
+            }
+        }
+        else
+        {
+            chunk = ast_arena_new_chunk(arena, arena -> chunk_size);
+            if(chunk == NULL)
+            {
+                return NULL;
+            }
+
+            chunk -> next   = arena -> chunks;
+            arena -> chunks = chunk;
+        }
+    }
+
+    void * tr = (char*)chunk + AST_ARENA_HEADER + chunk -> used;
+    chunk -> used += rounded;
+
+    arena -> allocations     += 1;
+    arena -> total_allocated += bytes;
+
+    return tr;
+}
+
+
+/*!
+@brief Allocates zeroed memory from an arena, taking a lock first if the
+arena is the global one, which every thread may use.
+*/
+void * ast_arena_calloc(ast_arena * arena, size_t num, size_t size)
+{
+    if(arena != &global_arena)
+    {
+        return ast_arena_calloc_unlocked(arena, num, size);
+    }
+
+    pthread_mutex_lock(&global_arena_lock);
+    void * tr = ast_arena_calloc_unlocked(arena, num, size);
+    pthread_mutex_unlock(&global_arena_lock);
+
+    return tr;
+}
+
+
+char * ast_arena_strdup(ast_arena * arena, char * in)
+{
+    size_t len = strlen(in);
+    char * tr = ast_arena_calloc(arena, len+1, sizeof(char));
+    if(tr != NULL)
+    {
+        memcpy(tr,in,len);
+    }
+    return tr;
+}
+
+
+/*!
+@brief Releases every chunk owned by the arena back to the system.
+@post The arena owns no memory and all of its counters are reset.
+*/
+void ast_arena_clear(ast_arena * arena)
+{
+    while(arena -> chunks != NULL)
+    {
+        ast_arena_chunk * next = arena -> chunks -> next;
+        free(arena -> chunks);
+        arena -> chunks = next;
+    }
+
+    arena -> chunk_count     = 0;
+    arena -> allocations     = 0;
+    arena -> total_allocated = 0;
+    arena -> total_reserved  = 0;
+}
+
+
+/*!
+@brief Forgets every allocation made from the arena, but keeps its most
+recent chunk.
+@details Only the part of the kept chunk which was handed out is zeroed
+again, since allocations must always come back zeroed.
+*/
+void ast_arena_reset(ast_arena * arena)
+{
+    ast_arena_chunk * keep = arena -> chunks;
+
+    if(keep == NULL)
+    {
+        return;
+    }
+
+    arena -> chunks = keep -> next;
+    keep -> next    = NULL;
+    ast_arena_clear(arena);
+
+    memset((char*)keep + AST_ARENA_HEADER, 0, keep -> used);
+    keep -> used = 0;
+
+    arena -> chunks         = keep;
+    arena -> chunk_count    = 1;
+    arena -> total_reserved = keep -> size;
+}
+
+
+void ast_arena_free(ast_arena * arena)
+{
+    if(arena == NULL)
+    {
+        return;
+    }
+
+    if(current_arena == arena)
+    {
+        current_arena = NULL;
+    }
+
+    pthread_mutex_lock(&live_arenas_lock);
+    if(arena -> prev != NULL)
+    {
+        arena -> prev -> next = arena -> next;
+    }
+    else
+    {
+        live_arenas = arena -> next;
+    }
+    if(arena -> next != NULL)
+    {
+        arena -> next -> prev = arena -> prev;
+    }
+    pthread_mutex_unlock(&live_arenas_lock);
+
+    ast_arena_clear(arena);
+    free(arena);
+}
+
+
+/*!
+@brief Moves every chunk owned by one arena into another, and then frees the
+now empty arena.
+@details The adopted chunks are threaded in behind the current chunk of the
+receiving arena, so that its remaining space is still bumped out of first.
+*/
+void ast_arena_adopt(ast_arena * into, ast_arena * from)
+{
+    if(from == NULL || from == into)
+    {
+        return;
+    }
+
+    if(from -> chunks != NULL)
+    {
+        ast_arena_chunk * last = from -> chunks;
+        while(last -> next != NULL)
+        {
+            last = last -> next;
+        }
+
+        if(into -> chunks == NULL)
+        {
+            into -> chunks = from -> chunks;
+        }
+        else
+        {
+            last -> next = into -> chunks -> next;
+            into -> chunks -> next = from -> chunks;
+        }
+    }
+
+    into -> chunk_count     += from -> chunk_count;
+    into -> allocations     += from -> allocations;
+    into -> total_allocated += from -> total_allocated;
+    into -> total_reserved  += from -> total_reserved;
+
+    from -> chunks = NULL;
+    ast_arena_free(from);
+}
+
+
+ast_arena * ast_global_arena()
+{
+    return &global_arena;
+}
+
+
+ast_arena * ast_current_arena()
+{
+    return current_arena != NULL ? current_arena : &global_arena;
+}
+
+
+ast_arena * ast_set_current_arena(ast_arena * arena)
+{
+    ast_arena * tr = ast_current_arena();
+    current_arena  = arena;
+    return tr;
+}
+
+
+//! Initialises the lock and arena of every intern table shard.
+static void ast_intern_init()
+{
+    unsigned int i;
+    for(i = 0; i < AST_INTERN_SHARDS; i ++)
+    {
+        pthread_mutex_init(&intern_shards[i].lock, NULL);
+        intern_shards[i].arena.chunk_size = AST_ARENA_CHUNK_SIZE;
+    }
+}
+
+/*!
+@brief Doubles the size of an intern table shard, re-inserting every string
+by its cached hash.
+@pre The shard's lock is held.
+*/
+static void ast_intern_grow(ast_intern_shard * shard)
+{
+    unsigned int capacity = shard -> capacity > 0 ?
+                            shard -> capacity * 2 : AST_INTERN_INITIAL_CAPACITY;
+
+    ast_intern_slot * slots = ast_arena_calloc(&shard -> arena, capacity,
+                                               sizeof(ast_intern_slot));
+
+    unsigned int mask = capacity - 1;
+    unsigned int i;
+    for(i = 0; i < shard -> capacity; i ++)
+    {
+        if(shard -> slots[i].str != NULL)
+        {
+            unsigned int j = shard -> slots[i].hash & mask;
+            while(slots[j].str != NULL)
+            {
+                j = (j + 1) & mask;
+            }
+            slots[j] = shard -> slots[i];
+        }
+    }
+
+    shard -> slots    = slots;
+    shard -> capacity = capacity;
+}
+
+
+char * ast_intern_n(char * str, size_t len)
+{
+    // FNV-1a, as used by ast_hashtable.
+    unsigned int hash = 2166136261u;
+    size_t c;
+    for(c = 0; c < len; c ++)
+    {
+        hash ^= (unsigned char)str[c];
+        hash *= 16777619u;
+    }
+
+    pthread_once(&intern_once, ast_intern_init);
+
+    // The low bits of the hash pick the slot, so use the high ones here.
+    ast_intern_shard * shard = &intern_shards[
+        (hash >> 16) % AST_INTERN_SHARDS];
+
+    pthread_mutex_lock(&shard -> lock);
+
+    if((shard -> count + 1) * 4 > (unsigned long)shard -> capacity * 3)
+    {
+        ast_intern_grow(shard);
+    }
+
+    unsigned int mask = shard -> capacity - 1;
+    unsigned int i    = hash & mask;
+    char       * tr   = NULL;
+
+    while(shard -> slots[i].str != NULL)
+    {
+        ast_intern_slot * slot = &shard -> slots[i];
+        if(slot -> hash == hash && slot -> len == len &&
+           memcmp(slot -> str, str, len) == 0)
+        {
+            tr = slot -> str;
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if(tr == NULL)
+    {
+        tr = ast_arena_calloc(&shard -> arena, len + 1, sizeof(char));
+        memcpy(tr, str, len);
+
+        shard -> slots[i].str  = tr;
+        shard -> slots[i].len  = len;
+        shard -> slots[i].hash = hash;
+        shard -> count ++;
+    }
+
+    pthread_mutex_unlock(&shard -> lock);
+
+    return tr;
+}
+
+
+char * ast_intern(char * str)
+{
+    return ast_intern_n(str, strlen(str));
+}
 
-//! The total number of bytes ever allocated using ast_alloc
-size_t       total_allocated = 0;
 
-//! Head of the linked list of allocated memory.
-ast_memory * memory_head = NULL;
+unsigned long ast_intern_count()
+{
+    pthread_once(&intern_once, ast_intern_init);
 
-//! Walker for the linked list of allocated memory.
-ast_memory * walker = NULL;
+    unsigned long tr = 0;
+    unsigned int  i;
+    for(i = 0; i < AST_INTERN_SHARDS; i ++)
+    {
+        pthread_mutex_lock(&intern_shards[i].lock);
+        tr += intern_shards[i].count;
+        pthread_mutex_unlock(&intern_shards[i].lock);
+    }
+    return tr;
+}
 
 
 /*!
@@ -36,71 +486,78 @@ function.
 */
 void * ast_calloc(size_t num, size_t size)
 {
-    // This is the memory the user asked for.
-    void * data = calloc(num,size);
-    
-    memory_allocations += 1;
-
-    // Add the allocated memory to tracking data structure.
-    if(walker == NULL)
-    {
-        memory_head = calloc(1,sizeof(ast_memory));
-        memory_head -> size = num * size;
-        total_allocated += memory_head -> size;
-        memory_head -> data = data;
-        memory_head -> next = NULL;
-        walker      = memory_head;
-    } 
-    else
-    {
-        walker -> next = calloc(1,sizeof(ast_memory));
-        walker -> next -> size = num * size;
-        total_allocated += walker -> size;
-        walker -> next -> data = data;
-        walker -> next -> next = NULL;
-        walker         = walker -> next;
-    }
-
-
-    return data;
+    return ast_arena_calloc(ast_current_arena(), num, size);
 }
 
 /*!
 @brief Frees all memory allocated using @ref ast_calloc.
-@details Free's all data stored in the linked list pointed to by the
-@ref head variable.
-@post @ref walker and @ref head are NULL. All memory allocated by ast_calloc
-has been freed.
+@details Releases every chunk of the global arena, every other live
+arena, and all interned strings, in one sweep.
+@post All memory allocated by ast_calloc has been freed, and any source
+trees or preprocessor contexts are no longer valid.
 */
 void ast_free_all()
 {
-    printf("Freeing data for %u memory allocations.\n", memory_allocations);
-    size_t total_freed = 0;
+    pthread_once(&intern_once, ast_intern_init);
+
+    unsigned long allocations = global_arena.allocations;
+    size_t        reserved    = global_arena.total_reserved;
+    size_t        requested   = global_arena.total_allocated;
+    unsigned int  chunks      = global_arena.chunk_count;
+
+    unsigned int i;
+    for(i = 0; i < AST_INTERN_SHARDS; i ++)
+    {
+        ast_arena * shard = &intern_shards[i].arena;
+        allocations += shard -> allocations;
+        reserved    += shard -> total_reserved;
+        requested   += shard -> total_allocated;
+        chunks      += shard -> chunk_count;
+    }
 
-    while(memory_head != NULL)
+    pthread_mutex_lock(&live_arenas_lock);
+    ast_arena * walker;
+    for(walker = live_arenas; walker != NULL; walker = walker -> next)
     {
-        walker = memory_head -> next;
-        total_freed += memory_head -> size;
+        allocations += walker -> allocations;
+        reserved    += walker -> total_reserved;
+        requested   += walker -> total_allocated;
+        chunks      += walker -> chunk_count;
+    }
+    pthread_mutex_unlock(&live_arenas_lock);
 
-        free(memory_head -> data);
-        free(memory_head);
-        
-        memory_head = walker;
+    VERILOG_DIAGNOSE(yy_diagnostics, VERILOG_SEVERITY_NOTE,
+        DIAG_MEMORY_RELEASED, 0,
+        "Freeing data for %lu memory allocations: %lu bytes in %u chunks "
+        "(%lu bytes requested)", allocations, (unsigned long)reserved,
+        chunks, (unsigned long)requested);
+
+    // The locations it refers to are about to go.
+    if(yy_diagnostics != NULL)
+    {
+        yy_diagnostics -> locations = NULL;
+    }
+
+    while(live_arenas != NULL)
+    {
+        ast_arena_free(live_arenas);
     }
 
-    printf("\tFree'd %lu bytes of %lu bytes allocated.\n", 
-        total_freed, total_allocated);
-    printf("\tBytes remaining: %lu\n", total_allocated - total_freed);
+    ast_arena_clear(&global_arena);
+
+    for(i = 0; i < AST_INTERN_SHARDS; i ++)
+    {
+        ast_arena_clear(&intern_shards[i].arena);
+        intern_shards[i].slots    = NULL;
+        intern_shards[i].capacity = 0;
+        intern_shards[i].count    = 0;
+    }
 }
 
 
 char * ast_strdup(char * in)
 {
-    size_t len = strlen(in);
-    char * tr = ast_calloc(len+1,sizeof(char));
-    memcpy(tr,in,len);
-    return tr;
+    return ast_arena_strdup(ast_current_arena(), in);
 }
 
 /*!@}*/
-
@@ -12,29 +12,198 @@ manage dynamic memory allocation within the library.
 #ifndef VERILOG_AST_MEM_H
 #define VERILOG_AST_MEM_H
 
-//! Typedef over ast_memory_T
-typedef struct ast_memory_t ast_memory;
-
-//! Stores information on some allocated memory as a linked list.
-struct ast_memory_t{
-    size_t          size;   //!< Amount of memory allocated.
-    void        *   data;   //!< Pointer to the allocated memory.
-    ast_memory  *   next;   //!< Next element to be allocated.
+/*!
+@brief Storage class for variables which have one instance per thread.
+@details Used for the handful of "current" pointers which the parser keeps,
+so that several threads can parse at once, each with its own parser context.
+*/
+#ifndef VERILOG_THREAD_LOCAL
+    #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+        !defined(__STDC_NO_THREADS__)
+        #define VERILOG_THREAD_LOCAL _Thread_local
+    #else
+        #define VERILOG_THREAD_LOCAL __thread
+    #endif
+#endif
+
+//! Default number of bytes an arena requests from the system at a time.
+#define AST_ARENA_CHUNK_SIZE (64 * 1024)
+
+//! Every allocation handed out by an arena is aligned to this many bytes.
+#define AST_ARENA_ALIGN      (2 * sizeof(void*))
+
+//! Typedef over ast_arena_chunk_t
+typedef struct ast_arena_chunk_t ast_arena_chunk;
+
+/*!
+@brief A single contiguous block of memory which allocations are "bumped"
+out of.
+@details The usable memory of the chunk immediately follows this header.
+*/
+struct ast_arena_chunk_t{
+    ast_arena_chunk * next; //!< The previously filled chunk.
+    size_t            size; //!< Number of usable bytes in the chunk.
+    size_t            used; //!< Number of bytes handed out so far.
 };
 
+//! Typedef over ast_arena_t
+typedef struct ast_arena_t ast_arena;
+
+/*!
+@brief A chunked bump-pointer allocator.
+@details Memory is requested from the system in large chunks, and each
+allocation simply advances a pointer through the current chunk. Individual
+allocations are never freed, instead the whole arena is released at once,
+which costs O(number of chunks) rather than O(number of allocations).
+@note An arena is not locked. Only one thread at a time may allocate from
+it, which is naturally the case for the arena of a source tree being parsed.
+The global arena is the exception, and is guarded internally.
+*/
+struct ast_arena_t{
+    ast_arena_chunk * chunks;          //!< Current chunk, then older ones.
+    size_t            chunk_size;      //!< Default size of new chunks.
+    unsigned int      chunk_count;     //!< Number of chunks owned.
+    unsigned long     allocations;     //!< Number of allocations served.
+    size_t            total_allocated; //!< Bytes requested by callers.
+    size_t            total_reserved;  //!< Bytes requested from the system.
+    ast_arena       * prev;            //!< Previous live arena.
+    ast_arena       * next;            //!< Next live arena.
+};
+
+/*!
+@brief Creates and returns a new, empty arena.
+@details The arena is remembered until it is freed, so that
+@ref ast_free_all can still release everything the library allocated.
+@param [in] chunk_size - The size of chunks to request from the system. If
+zero, then AST_ARENA_CHUNK_SIZE is used.
+*/
+ast_arena * ast_arena_new(size_t chunk_size);
+
+/*!
+@brief Allocates zeroed memory for num elements of the given size from the
+supplied arena.
+@returns A pointer to the start of the block of memory allocated, or NULL if
+the system is out of memory.
+*/
+void * ast_arena_calloc(ast_arena * arena, size_t num, size_t size);
+
+/*!
+@brief Duplicates the supplied null terminated string into the supplied arena.
+@returns The copy, or NULL if the system is out of memory.
+*/
+char * ast_arena_strdup(ast_arena * arena, char * in);
+
+/*!
+@brief Releases every chunk owned by the arena back to the system.
+@details The arena object itself remains valid and may be allocated from
+again.
+*/
+void ast_arena_clear(ast_arena * arena);
+
+/*!
+@brief Forgets every allocation made from the arena, but keeps its most
+recent chunk for the allocations which follow.
+@details Cheaper than @ref ast_arena_clear when the arena is about to be
+filled again with a similar amount of data, as most of the time no memory
+need be requested from the system at all.
+*/
+void ast_arena_reset(ast_arena * arena);
+
+/*!
+@brief Releases every chunk owned by the arena, and then the arena itself.
+@note If the arena is the current arena, the global arena becomes current.
+*/
+void ast_arena_free(ast_arena * arena);
+
+/*!
+@brief Moves every chunk owned by one arena into another, and then frees the
+now empty arena.
+@details Memory allocated from the adopted arena stays where it is, but is
+now released along with the arena which adopted it. This lets structures
+built on another thread be handed over without copying them.
+@param [inout] into - The arena to take ownership of the chunks.
+@param [in] from - The arena to give them up. Invalid after the call.
+*/
+void ast_arena_adopt(ast_arena * into, ast_arena * from);
+
+/*!
+@brief Returns the arena used when no other arena has been made current.
+*/
+ast_arena * ast_global_arena();
 
-//! Iterates over all allocated memory and frees it.
+/*!
+@brief Returns the arena which currently backs @ref ast_calloc and
+@ref ast_strdup.
+@details Each thread has its own current arena.
+*/
+ast_arena * ast_current_arena();
+
+/*!
+@brief Makes the supplied arena back all future calls to @ref ast_calloc and
+@ref ast_strdup made by the calling thread.
+@param [in] arena - The new current arena, or NULL for the global arena.
+@returns The previously current arena, so that it can be restored.
+*/
+ast_arena * ast_set_current_arena(ast_arena * arena);
+
+/*!
+@brief Frees all memory allocated by the library in a single sweep.
+@details Clears the global arena and frees every other live arena, including
+those owned by source trees and preprocessor contexts. Interned strings are
+released too. How much was released is reported to @ref yy_diagnostics as
+a note.
+@warning Must not be called while any thread is still parsing.
+*/
 void ast_free_all();
 
 //! Duplicates the supplied null terminated string.
 char * ast_strdup(char * in);
 
+/*!
+@defgroup ast-utility-intern String Interning
+@{
+@ingroup ast-utility-mem-manage
+@brief Gives every distinct string one shared, stable copy.
+@details Interned strings live in a table of their own, outside of any
+source tree or preprocessor context, until @ref ast_free_all is called.
+Two interned strings are equal if and only if their pointers are equal.
+Interned strings must never be modified.
+
+The table may be used from several threads at once. It is split into
+AST_INTERN_SHARDS independent shards, chosen by the top bits of each string's
+hash, and every shard has its own lock, so threads interning different
+strings rarely wait for each other.
+*/
+
+//! Number of slots in an intern table shard when it is first used.
+#define AST_INTERN_INITIAL_CAPACITY 256
+
+//! Number of independently locked shards of the intern table.
+#define AST_INTERN_SHARDS           64
+
+/*!
+@brief Returns the interned copy of the supplied null terminated string.
+@details The string is copied into the intern table the first time it is
+seen. Later calls with an equal string return the same pointer.
+*/
+char * ast_intern(char * str);
+
+/*!
+@brief Returns the interned copy of the first len bytes of str.
+@details str need not be null terminated, but the returned copy always is.
+*/
+char * ast_intern_n(char * str, size_t len);
+
+//! Returns the number of distinct strings in the intern table.
+unsigned long ast_intern_count();
+
+/*! @} */
+
 /*!
 @brief A simple wrapper around calloc.
-@details This function is identical to calloc, but uses the head and
-walker variables above to keep a linked list of all heap memory that the
-AST construction allocates. This makes it very easy to clean up afterward
-using the @ref ast_free_all function.
+@details This function is identical to calloc, but bump-allocates out of the
+arena returned by @ref ast_current_arena. This makes it very easy (and cheap)
+to clean up afterward using the @ref ast_free_all function.
 @param [in] num - Number of elements to allocate space for.
 @param [in] size - The size of each element being allocated.
 @returns A pointer to the start of the block of memory allocated.
@@ -44,4 +213,3 @@ void * ast_calloc(size_t num, size_t size);
 
 
 #endif
-
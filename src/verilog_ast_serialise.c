@@ -0,0 +1,2342 @@
+/*!
+@file verilog_ast_serialise.c
+@brief Contains definitions of functions which save parsed source trees to
+       files, and load them back again.
+@details A tree file is laid out as follows, where every number is a 32 bit
+word in the byte order of the machine:
+
+- The magic "VAST", and a header of @ref AST_FILE_HEADER_WORDS words.
+- The string table: the offset of each string, then the NUL terminated text
+  of every string.
+- The locations: the file, line and expansion of each location used by a
+  node written, numbered from one. A file is given as a string index.
+- The module index: the name, image offset and image section of each of
+  the tree's modules, in order.
+- Padding, up to a multiple of @ref AST_ARENA_ALIGN bytes.
+- The image: every node, list and list array, with each pointer replaced by
+  an image offset, or by a string index.
+- The relocations, two words each. The first is the image offset of a
+  pointer slot, or of a node's location, divided by four and shifted up
+  past the kind of the slot, which takes the low three bits. The second is,
+  for a slot pointing into the image, the kind of node it points to, so
+  that a load can check the whole node lies within the image.
+
+Null pointers, and unknown locations, are written as zero, and have no
+relocation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "verilog_ast_serialise.h"
+
+//! First four bytes of every tree file.
+#define AST_FILE_MAGIC      "VAST"
+
+//! Changed whenever the layout of a tree file changes.
+#define AST_FILE_VERSION    6
+
+//! Written to the header, so a file from a machine of the other byte order
+//! is refused.
+#define AST_FILE_BYTE_ORDER 0x01020304u
+
+//! Written in place of a string index for a string which is NULL.
+#define AST_FILE_NONE       0xFFFFFFFFu
+
+//! The alignment of everything in the image.
+#define AST_FILE_ALIGN      sizeof(void*)
+
+//! The bits of a relocation which hold its kind.
+#define AST_FILE_RELOC_KIND 7u
+
+//! Number of words in each relocation.
+#define AST_FILE_RELOC_WORDS 2
+
+//! The most bytes an image can hold, so that every slot can be relocated.
+#define AST_FILE_MAX_IMAGE  0x7FFFFFF0u
+
+//! Number of words in each entry of the location and module sections.
+#define AST_FILE_LOCATION_WORDS 3
+#define AST_FILE_MODULE_WORDS   4
+
+//! Positions of the words in the header of a tree file.
+typedef enum ast_file_header_e{
+    AST_FILE_HEADER_VERSION,
+    AST_FILE_HEADER_BYTE_ORDER,
+    AST_FILE_HEADER_POINTER_SIZE,
+    AST_FILE_HEADER_LAYOUT,         //!< Hash of the size of every node.
+    AST_FILE_HEADER_STRINGS,        //!< Entries in the string table.
+    AST_FILE_HEADER_STRING_BYTES,   //!< Bytes of string text.
+    AST_FILE_HEADER_LOCATIONS,      //!< Entries in the location table.
+    AST_FILE_HEADER_MODULES,        //!< Entries in the module index.
+    AST_FILE_HEADER_IMAGE_SIZE,
+    AST_FILE_HEADER_RELOCATIONS,
+    AST_FILE_HEADER_MODULE_LIST,    //!< Image offset of tree -> modules.
+    AST_FILE_HEADER_PRIMITIVE_LIST, //!< Image offset of tree -> primitives.
+    AST_FILE_HEADER_CONFIG_LIST,    //!< Image offset of tree -> configs.
+    AST_FILE_HEADER_LIBRARY_LIST,   //!< Image offset of tree -> libraries.
+    AST_FILE_HEADER_FILE_LIST,      //!< Image offset of tree -> files.
+    AST_FILE_HEADER_WORDS
+} ast_file_header;
+
+//! The kinds of pointer a relocation can patch.
+typedef enum ast_file_reloc_e{
+    AST_RELOC_NODE     = 0, //!< Points to an image offset.
+    AST_RELOC_STRING   = 1, //!< Points to the text of a string.
+    AST_RELOC_INTERNED = 2, //!< Points to the interned copy of a string.
+    AST_RELOC_ARENA    = 3, //!< Points to the arena of the loaded tree.
+    AST_RELOC_LOCATION = 4  //!< A location, numbered as in the file.
+} ast_file_reloc;
+
+/*!
+@brief The type of everything which can be written to the image.
+@details Most kinds are a node structure of verilog_ast.h. The rest are
+strings, level symbols, and lists whose items are themselves lists.
+*/
+typedef enum ast_ser_kind_e{
+    SER_STRING,
+    SER_LEVEL_SYMBOL,
+    SER_ASSIGNMENT_LIST,    //!< List of ast_single_assignment.
+    SER_MODULE_ITEM_LIST,   //!< List of ast_module_item.
+    SER_NUMBER,
+    SER_ATTRIBUTES,
+    SER_CONCATENATION,
+    SER_LVALUE,
+    SER_FUNCTION_CALL,
+    SER_PRIMARY,
+    SER_EXPRESSION,
+    SER_PARALLEL_PATH,
+    SER_FULL_PATH,
+    SER_EDGE_PARALLEL_PATH,
+    SER_EDGE_FULL_PATH,
+    SER_PATH_DECLARATION,
+    SER_TASK_ENABLE,
+    SER_LOOP,
+    SER_CASE_ITEM,
+    SER_CASE,
+    SER_CONDITIONAL,
+    SER_IF_ELSE,
+    SER_WAIT,
+    SER_EVENT_EXPRESSION,
+    SER_EVENT_CONTROL,
+    SER_DELAY_CTRL,
+    SER_TIMING_CONTROL,
+    SER_DISABLE,
+    SER_STATEMENT_BLOCK,
+    SER_SINGLE_ASSIGNMENT,
+    SER_CONTINUOUS_ASSIGNMENT,
+    SER_PROCEDURAL_ASSIGNMENT,
+    SER_HYBRID_ASSIGNMENT,
+    SER_ASSIGNMENT,
+    SER_STATEMENT,
+    SER_PULSE_CONTROL,
+    SER_RANGE,
+    SER_UDP_PORT,
+    SER_UDP_INITIAL,
+    SER_UDP_BODY,
+    SER_UDP_COMBINATORIAL_ENTRY,
+    SER_UDP_SEQUENTIAL_ENTRY,
+    SER_UDP_DECLARATION,
+    SER_UDP_INSTANCE,
+    SER_UDP_INSTANTIATION,
+    SER_GENERATE_BLOCK,
+    SER_MODULE_INSTANTIATION,
+    SER_MODULE_INSTANCE,
+    SER_PORT_CONNECTION,
+    SER_SWITCH_GATE,
+    SER_PULL_STRENGTH,
+    SER_PRIMITIVE_PULL_STRENGTH,
+    SER_PULL_GATE_INSTANCE,
+    SER_PASS_SWITCH_INSTANCE,
+    SER_N_INPUT_GATE_INSTANCES,
+    SER_N_INPUT_GATE_INSTANCE,
+    SER_ENABLE_GATE_INSTANCES,
+    SER_ENABLE_GATE_INSTANCE,
+    SER_MOS_SWITCH_INSTANCE,
+    SER_CMOS_SWITCH_INSTANCE,
+    SER_PASS_ENABLE_SWITCH,
+    SER_PASS_ENABLE_SWITCHES,
+    SER_N_OUTPUT_GATE_INSTANCE,
+    SER_N_OUTPUT_GATE_INSTANCES,
+    SER_SWITCHES,
+    SER_GATE_INSTANTIATION,
+    SER_DELAY_VALUE,
+    SER_DELAY3,
+    SER_DELAY2,
+    SER_PORT_DECLARATION,
+    SER_TYPE_DECLARATION,
+    SER_NET_DECLARATION,
+    SER_REG_DECLARATION,
+    SER_VAR_DECLARATION,
+    SER_PARAMETER_DECLARATIONS,
+    SER_BLOCK_REG_DECLARATION,
+    SER_BLOCK_ITEM_DECLARATION,
+    SER_RANGE_OR_TYPE,
+    SER_FUNCTION_DECLARATION,
+    SER_TASK_PORT,
+    SER_FUNCTION_ITEM_DECLARATION,
+    SER_TASK_DECLARATION,
+    SER_MODULE_ITEM,
+    SER_MODULE_DECLARATION,
+    SER_IDENTIFIER,
+    SER_CONFIG_RULE,
+    SER_CONFIG_DECLARATION,
+    SER_LIBRARY_DECLARATION,
+    SER_LIBRARY_DESCRIPTIONS,
+    SER_SOURCE_ITEM,
+    SER_SOURCE_FILE,
+    SER_KIND_COUNT
+} ast_ser_kind;
+
+//! Pseudo kind, only used by relocations, for the array of a list.
+#define SER_LIST_ARRAY (SER_KIND_COUNT + 1)
+
+//! The size of each node kind. Zero for kinds which are not a node.
+static const size_t ast_ser_sizes[SER_KIND_COUNT] = {
+    [SER_LEVEL_SYMBOL]              = sizeof(ast_level_symbol),
+    [SER_NUMBER]                    = sizeof(ast_number),
+    [SER_ATTRIBUTES]                = sizeof(ast_node_attributes),
+    [SER_CONCATENATION]             = sizeof(ast_concatenation),
+    [SER_LVALUE]                    = sizeof(ast_lvalue),
+    [SER_FUNCTION_CALL]             = sizeof(ast_function_call),
+    [SER_PRIMARY]                   = sizeof(ast_primary),
+    [SER_EXPRESSION]                = sizeof(ast_expression),
+    [SER_PARALLEL_PATH]  = sizeof(ast_simple_parallel_path_declaration),
+    [SER_FULL_PATH]      = sizeof(ast_simple_full_path_declaration),
+    [SER_EDGE_PARALLEL_PATH] =
+        sizeof(ast_edge_sensitive_parallel_path_declaration),
+    [SER_EDGE_FULL_PATH] = sizeof(ast_edge_sensitive_full_path_declaration),
+    [SER_PATH_DECLARATION]          = sizeof(ast_path_declaration),
+    [SER_TASK_ENABLE]               = sizeof(ast_task_enable_statement),
+    [SER_LOOP]                      = sizeof(ast_loop_statement),
+    [SER_CASE_ITEM]                 = sizeof(ast_case_item),
+    [SER_CASE]                      = sizeof(ast_case_statement),
+    [SER_CONDITIONAL]               = sizeof(ast_conditional_statement),
+    [SER_IF_ELSE]                   = sizeof(ast_if_else),
+    [SER_WAIT]                      = sizeof(ast_wait_statement),
+    [SER_EVENT_EXPRESSION]          = sizeof(ast_event_expression),
+    [SER_EVENT_CONTROL]             = sizeof(ast_event_control),
+    [SER_DELAY_CTRL]                = sizeof(ast_delay_ctrl),
+    [SER_TIMING_CONTROL]            = sizeof(ast_timing_control_statement),
+    [SER_DISABLE]                   = sizeof(ast_disable_statement),
+    [SER_STATEMENT_BLOCK]           = sizeof(ast_statement_block),
+    [SER_SINGLE_ASSIGNMENT]         = sizeof(ast_single_assignment),
+    [SER_CONTINUOUS_ASSIGNMENT]     = sizeof(ast_continuous_assignment),
+    [SER_PROCEDURAL_ASSIGNMENT]     = sizeof(ast_procedural_assignment),
+    [SER_HYBRID_ASSIGNMENT]         = sizeof(ast_hybrid_assignment),
+    [SER_ASSIGNMENT]                = sizeof(ast_assignment),
+    [SER_STATEMENT]                 = sizeof(ast_statement),
+    [SER_PULSE_CONTROL]             = sizeof(ast_pulse_control_specparam),
+    [SER_RANGE]                     = sizeof(ast_range),
+    [SER_UDP_PORT]                  = sizeof(ast_udp_port),
+    [SER_UDP_INITIAL]               = sizeof(ast_udp_initial_statement),
+    [SER_UDP_BODY]                  = sizeof(ast_udp_body),
+    [SER_UDP_COMBINATORIAL_ENTRY]   = sizeof(ast_udp_combinatorial_entry),
+    [SER_UDP_SEQUENTIAL_ENTRY]      = sizeof(ast_udp_sequential_entry),
+    [SER_UDP_DECLARATION]           = sizeof(ast_udp_declaration),
+    [SER_UDP_INSTANCE]              = sizeof(ast_udp_instance),
+    [SER_UDP_INSTANTIATION]         = sizeof(ast_udp_instantiation),
+    [SER_GENERATE_BLOCK]            = sizeof(ast_generate_block),
+    [SER_MODULE_INSTANTIATION]      = sizeof(ast_module_instantiation),
+    [SER_MODULE_INSTANCE]           = sizeof(ast_module_instance),
+    [SER_PORT_CONNECTION]           = sizeof(ast_port_connection),
+    [SER_SWITCH_GATE]               = sizeof(ast_switch_gate),
+    [SER_PULL_STRENGTH]             = sizeof(ast_pull_strength),
+    [SER_PRIMITIVE_PULL_STRENGTH]   = sizeof(ast_primitive_pull_strength),
+    [SER_PULL_GATE_INSTANCE]        = sizeof(ast_pull_gate_instance),
+    [SER_PASS_SWITCH_INSTANCE]      = sizeof(ast_pass_switch_instance),
+    [SER_N_INPUT_GATE_INSTANCES]    = sizeof(ast_n_input_gate_instances),
+    [SER_N_INPUT_GATE_INSTANCE]     = sizeof(ast_n_input_gate_instance),
+    [SER_ENABLE_GATE_INSTANCES]     = sizeof(ast_enable_gate_instances),
+    [SER_ENABLE_GATE_INSTANCE]      = sizeof(ast_enable_gate_instance),
+    [SER_MOS_SWITCH_INSTANCE]       = sizeof(ast_mos_switch_instance),
+    [SER_CMOS_SWITCH_INSTANCE]      = sizeof(ast_cmos_switch_instance),
+    [SER_PASS_ENABLE_SWITCH]        = sizeof(ast_pass_enable_switch),
+    [SER_PASS_ENABLE_SWITCHES]      = sizeof(ast_pass_enable_switches),
+    [SER_N_OUTPUT_GATE_INSTANCE]    = sizeof(ast_n_output_gate_instance),
+    [SER_N_OUTPUT_GATE_INSTANCES]   = sizeof(ast_n_output_gate_instances),
+    [SER_SWITCHES]                  = sizeof(ast_switches),
+    [SER_GATE_INSTANTIATION]        = sizeof(ast_gate_instantiation),
+    [SER_DELAY_VALUE]               = sizeof(ast_delay_value),
+    [SER_DELAY3]                    = sizeof(ast_delay3),
+    [SER_DELAY2]                    = sizeof(ast_delay2),
+    [SER_PORT_DECLARATION]          = sizeof(ast_port_declaration),
+    [SER_TYPE_DECLARATION]          = sizeof(ast_type_declaration),
+    [SER_NET_DECLARATION]           = sizeof(ast_net_declaration),
+    [SER_REG_DECLARATION]           = sizeof(ast_reg_declaration),
+    [SER_VAR_DECLARATION]           = sizeof(ast_var_declaration),
+    [SER_PARAMETER_DECLARATIONS]    = sizeof(ast_parameter_declarations),
+    [SER_BLOCK_REG_DECLARATION]     = sizeof(ast_block_reg_declaration),
+    [SER_BLOCK_ITEM_DECLARATION]    = sizeof(ast_block_item_declaration),
+    [SER_RANGE_OR_TYPE]             = sizeof(ast_range_or_type),
+    [SER_FUNCTION_DECLARATION]      = sizeof(ast_function_declaration),
+    [SER_TASK_PORT]                 = sizeof(ast_task_port),
+    [SER_FUNCTION_ITEM_DECLARATION] = sizeof(ast_function_item_declaration),
+    [SER_TASK_DECLARATION]          = sizeof(ast_task_declaration),
+    [SER_MODULE_ITEM]               = sizeof(ast_module_item),
+    [SER_MODULE_DECLARATION]        = sizeof(ast_module_declaration),
+    [SER_IDENTIFIER]                = sizeof(struct ast_identifier_t),
+    [SER_CONFIG_RULE]               = sizeof(ast_config_rule_statement),
+    [SER_CONFIG_DECLARATION]        = sizeof(ast_config_declaration),
+    [SER_LIBRARY_DECLARATION]       = sizeof(ast_library_declaration),
+    [SER_LIBRARY_DESCRIPTIONS]      = sizeof(ast_library_descriptions),
+    [SER_SOURCE_ITEM]               = sizeof(ast_source_item),
+    [SER_SOURCE_FILE]               = sizeof(verilog_source_file)
+};
+
+/*!
+@brief Returns a hash of the size of every node kind, and of a list.
+@details Stored in the header, so that a file written by a build with a
+different structure layout is refused.
+*/
+static uint32_t ast_ser_layout_hash()
+{
+    uint32_t     hash = 2166136261u;
+    unsigned int k;
+
+    for(k = 0; k <= SER_KIND_COUNT; k ++)
+    {
+        size_t size = k < SER_KIND_COUNT ? ast_ser_sizes[k] : sizeof(ast_list);
+        hash = (hash ^ (uint32_t)size) * 16777619u;
+    }
+
+    return hash;
+}
+
+// ----------------------- Writing ------------------------------------
+
+//! A cross reference from an instantiation to its module, written last.
+typedef struct ast_ser_deferred_t{
+    size_t                   slot;      //!< Image offset of the pointer.
+    ast_module_declaration * module;    //!< The module it points to.
+} ast_ser_deferred;
+
+//! Everything needed while a tree is being written.
+typedef struct ast_ser_writer_t{
+    char          * image;          //!< The image written so far.
+    size_t          size;           //!< Bytes of image in use.
+    size_t          capacity;       //!< Bytes allocated for image.
+    uint32_t      * relocs;         //!< Every relocation so far.
+    size_t          reloc_count;
+    size_t          reloc_capacity;
+    ast_hashtable * strings;        //!< Index + 1 of each string's text.
+    char         ** string_list;    //!< Every string, by index.
+    size_t          string_count;
+    size_t          string_capacity;
+    size_t          string_bytes;   //!< Bytes of text, with terminators.
+    void         ** map_keys;       //!< Nodes already in the image.
+    size_t        * map_values;     //!< Image offsets of map_keys.
+    size_t          map_count;
+    size_t          map_capacity;   //!< Always a power of two.
+    ast_ser_deferred * deferred;    //!< Module references to fix up last.
+    size_t          deferred_count;
+    size_t          deferred_capacity;
+    ast_location_table * locations; //!< Where node locations are found.
+    uint32_t      * location_map;   //!< Number written as, for each location.
+    uint32_t      * location_words; //!< Entry of each location written.
+    size_t          location_count; //!< Locations written, plus one.
+    size_t          location_capacity;
+    int             unresolve;      //!< Write instances by name only.
+    int             failed;         //!< Set once anything runs out of room.
+} ast_ser_writer;
+
+/*!
+@brief Makes sure an array has room for one more item, doubling it if not.
+@returns Zero on success, or -1 if it could not grow.
+*/
+static int ast_ser_reserve(
+    void   ** array,
+    size_t  * capacity,
+    size_t    count,
+    size_t    item_size
+){
+    if(count < *capacity)
+    {
+        return 0;
+    }
+
+    size_t grown = *capacity > 0 ? *capacity * 2 : 64;
+    void * tr    = realloc(*array, grown * item_size);
+
+    if(tr == NULL)
+    {
+        return -1;
+    }
+
+    *array    = tr;
+    *capacity = grown;
+    return 0;
+}
+
+//! Hashes a node pointer into a position in the node map.
+static size_t ast_ser_map_slot(ast_ser_writer * w, void * node)
+{
+    uintptr_t key = (uintptr_t)node;
+    key ^= key >> 17;
+    key *= 0x9E3779B1u;
+    return (key ^ (key >> 15)) & (w -> map_capacity - 1);
+}
+
+/*!
+@brief Finds where a node was written to the image.
+@returns Non-zero if the node has been written, and sets offset.
+*/
+static int ast_ser_map_get(ast_ser_writer * w, void * node, size_t * offset)
+{
+    if(w -> map_capacity == 0)
+    {
+        return 0;
+    }
+
+    size_t i = ast_ser_map_slot(w, node);
+
+    while(w -> map_keys[i] != NULL)
+    {
+        if(w -> map_keys[i] == node)
+        {
+            *offset = w -> map_values[i];
+            return 1;
+        }
+        i = (i + 1) & (w -> map_capacity - 1);
+    }
+
+    return 0;
+}
+
+//! Records where a node was written, growing the map when half full.
+static void ast_ser_map_put(ast_ser_writer * w, void * node, size_t offset)
+{
+    if((w -> map_count + 1) * 2 > w -> map_capacity)
+    {
+        void  ** old_keys   = w -> map_keys;
+        size_t * old_values = w -> map_values;
+        size_t   old_cap    = w -> map_capacity;
+        size_t   i;
+
+        w -> map_capacity = old_cap > 0 ? old_cap * 2 : 1024;
+        w -> map_keys     = calloc(w -> map_capacity, sizeof(void*));
+        w -> map_values   = calloc(w -> map_capacity, sizeof(size_t));
+
+        if(w -> map_keys == NULL || w -> map_values == NULL)
+        {
+            free(w -> map_keys);
+            free(w -> map_values);
+            w -> map_keys     = old_keys;
+            w -> map_values   = old_values;
+            w -> map_capacity = old_cap;
+            w -> failed       = 1;
+            return;
+        }
+
+        for(i = 0; i < old_cap; i ++)
+        {
+            if(old_keys[i] != NULL)
+            {
+                size_t s = ast_ser_map_slot(w, old_keys[i]);
+                while(w -> map_keys[s] != NULL)
+                {
+                    s = (s + 1) & (w -> map_capacity - 1);
+                }
+                w -> map_keys[s]   = old_keys[i];
+                w -> map_values[s] = old_values[i];
+            }
+        }
+
+        free(old_keys);
+        free(old_values);
+    }
+
+    size_t i = ast_ser_map_slot(w, node);
+    while(w -> map_keys[i] != NULL)
+    {
+        i = (i + 1) & (w -> map_capacity - 1);
+    }
+
+    w -> map_keys[i]   = node;
+    w -> map_values[i] = offset;
+    w -> map_count    += 1;
+}
+
+/*!
+@brief Reserves zeroed, aligned, space at the end of the image.
+@returns The image offset of the space.
+@note The image may move, so callers must keep offsets, never pointers.
+*/
+static size_t ast_ser_alloc(ast_ser_writer * w, size_t size)
+{
+    size_t at  = w -> size;
+    size_t end = at + ((size + AST_FILE_ALIGN - 1) & ~(AST_FILE_ALIGN - 1));
+
+    if(w -> failed || end > AST_FILE_MAX_IMAGE)
+    {
+        w -> failed = 1;
+        return 0;
+    }
+
+    if(end > w -> capacity)
+    {
+        size_t capacity = w -> capacity > 0 ? w -> capacity : 64 * 1024;
+        while(capacity < end)
+        {
+            capacity *= 2;
+        }
+
+        char * image = realloc(w -> image, capacity);
+        if(image == NULL)
+        {
+            w -> failed = 1;
+            return 0;
+        }
+
+        w -> image    = image;
+        w -> capacity = capacity;
+    }
+
+    memset(w -> image + at, 0, end - at);
+    w -> size = end;
+    return at;
+}
+
+//! Stores a value in a pointer slot of the image, and adds its relocation.
+static void ast_ser_relocate(
+    ast_ser_writer * w,
+    size_t           slot,
+    size_t           value,
+    ast_file_reloc   kind,
+    ast_ser_kind     target //!< For AST_RELOC_NODE, what value points to.
+){
+    if(w -> failed)
+    {
+        return;
+    }
+
+    if(ast_ser_reserve((void**)&w -> relocs, &w -> reloc_capacity,
+                       w -> reloc_count,
+                       AST_FILE_RELOC_WORDS * sizeof(uint32_t)))
+    {
+        w -> failed = 1;
+        return;
+    }
+
+    if(kind == AST_RELOC_LOCATION)
+    {
+        ast_location v = value;
+        memcpy(w -> image + slot, &v, sizeof(v));
+    }
+    else
+    {
+        uintptr_t v = value;
+        memcpy(w -> image + slot, &v, sizeof(v));
+    }
+
+    uint32_t * reloc = w -> relocs + AST_FILE_RELOC_WORDS * w -> reloc_count;
+    reloc[0] = (uint32_t)(slot / 4) << 3 | kind;
+    reloc[1] = kind == AST_RELOC_NODE ? target : 0;
+    w -> reloc_count ++;
+}
+
+/*!
+@brief Returns the index of a string in the string table, adding it if
+this is the first time the text has been seen.
+*/
+static uint32_t ast_ser_string_index(ast_ser_writer * w, char * string)
+{
+    void * found;
+
+    if(ast_hashtable_get(w -> strings, string, &found) == HASH_SUCCESS)
+    {
+        return (uint32_t)((uintptr_t)found - 1);
+    }
+
+    if(ast_ser_reserve((void**)&w -> string_list, &w -> string_capacity,
+                       w -> string_count, sizeof(char*)))
+    {
+        w -> failed = 1;
+        return 0;
+    }
+
+    uint32_t tr = w -> string_count;
+    w -> string_list[w -> string_count ++] = string;
+    w -> string_bytes += strlen(string) + 1;
+    ast_hashtable_insert(w -> strings, string, (void*)((uintptr_t)tr + 1));
+
+    return tr;
+}
+
+/*!
+@brief Returns the number a location is written as, adding it, and any
+expansion it is inside of, to the locations written if it is not there yet.
+@details Only the locations nodes use are written, so a file of a few
+constructs does not carry the whole location table of its tree.
+*/
+static uint32_t ast_ser_location(ast_ser_writer * w, ast_location location)
+{
+    ast_location_entry * entry = ast_location_get(w -> locations, location);
+
+    if(entry == NULL || w -> failed)
+    {
+        return 0;
+    }
+    else if(w -> location_map[location] != 0)
+    {
+        return w -> location_map[location];
+    }
+
+    size_t words = AST_FILE_LOCATION_WORDS * (w -> location_count + 1);
+    if(words > w -> location_capacity)
+    {
+        size_t capacity = words > 1024 ? words * 2 : 1024;
+        uint32_t * grown = realloc(w -> location_words,
+                                   capacity * sizeof(uint32_t));
+        if(grown == NULL)
+        {
+            w -> failed = 1;
+            return 0;
+        }
+        w -> location_words    = grown;
+        w -> location_capacity = capacity;
+    }
+
+    // Numbered before the expansion is, so a loop can never recurse.
+    uint32_t tr = w -> location_count ++;
+    w -> location_map[location] = tr;
+
+    uint32_t file = entry -> file != NULL ?
+                    ast_ser_string_index(w, entry -> file) : AST_FILE_NONE;
+    uint32_t expansion = ast_ser_location(w, entry -> expansion);
+
+    uint32_t * words_at = w -> location_words + AST_FILE_LOCATION_WORDS * tr;
+    words_at[0] = file;
+    words_at[1] = entry -> line;
+    words_at[2] = expansion;
+
+    return tr;
+}
+
+static size_t ast_ser_node(ast_ser_writer * w, void * node,
+                           ast_ser_kind kind, ast_ser_kind elem);
+
+static size_t ast_ser_list(ast_ser_writer * w, ast_list * list,
+                           ast_ser_kind elem, uint32_t * sections);
+
+/*!
+@brief Writes whatever a pointer slot of the image points to, and then
+points the slot at it.
+@details Identifier text is interned again when loaded, since identifiers
+are compared by pointer. Any other string is left in the string table.
+*/
+static void ast_ser_pointer(
+    ast_ser_writer * w,
+    size_t           slot,  //!< Image offset of the pointer.
+    void           * ptr,   //!< What it points to, outside the image.
+    ast_ser_kind     kind,  //!< What sort of thing ptr points to.
+    ast_ser_kind     elem   //!< For lists, and switches, what they hold.
+){
+    uintptr_t zero = 0;
+    size_t    target;
+
+    if(w -> failed)
+    {
+        return;
+    }
+    else if(ptr == NULL)
+    {
+        memcpy(w -> image + slot, &zero, sizeof(zero));
+        return;
+    }
+
+    switch(kind)
+    {
+        case SER_STRING:
+            target = ast_ser_string_index(w, ptr);
+            ast_ser_relocate(w, slot, target,
+                elem == SER_IDENTIFIER ? AST_RELOC_INTERNED : AST_RELOC_STRING,
+                SER_STRING);
+            return;
+        case SER_ASSIGNMENT_LIST:
+            target = ast_ser_list(w, ptr, SER_SINGLE_ASSIGNMENT, NULL);
+            break;
+        case SER_MODULE_ITEM_LIST:
+            target = ast_ser_list(w, ptr, SER_MODULE_ITEM, NULL);
+            break;
+        default:
+            target = ast_ser_node(w, ptr, kind, elem);
+            break;
+    }
+
+    ast_ser_relocate(w, slot, target, AST_RELOC_NODE, kind);
+}
+
+/*!
+@brief Writes a list, and everything in it, to the image.
+@details The items are written compacted, with no free space around them.
+Items which are NULL stay NULL.
+@param [out] sections - If not NULL, gets the image range each item was
+written to, as two words per item.
+@returns The image offset of the list.
+*/
+static size_t ast_ser_list(
+    ast_ser_writer * w,
+    ast_list       * list,
+    ast_ser_kind     elem,
+    uint32_t       * sections
+){
+    size_t at;
+
+    if(ast_ser_map_get(w, list, &at))
+    {
+        return at;
+    }
+
+    at = ast_ser_alloc(w, sizeof(ast_list));
+    if(w -> failed)
+    {
+        return 0;
+    }
+    ast_ser_map_put(w, list, at);
+
+    unsigned int items = list -> items;
+    ast_list     copy  = {NULL, NULL, items, items, NULL};
+    memcpy(w -> image + at, &copy, sizeof(copy));
+
+    ast_ser_relocate(w, at + offsetof(ast_list, arena), 0, AST_RELOC_ARENA,
+                     SER_STRING);
+
+    if(items == 0)
+    {
+        return at;
+    }
+
+    size_t array = ast_ser_alloc(w, items * sizeof(void*));
+    ast_ser_relocate(w, at + offsetof(ast_list, base), array, AST_RELOC_NODE,
+                     SER_LIST_ARRAY);
+    ast_ser_relocate(w, at + offsetof(ast_list, data), array, AST_RELOC_NODE,
+                     SER_LIST_ARRAY);
+
+    unsigned int i;
+    for(i = 0; i < items && !w -> failed; i ++)
+    {
+        size_t start = w -> size;
+
+        ast_ser_pointer(w, array + i * sizeof(void*), list -> data[i],
+                        elem, SER_KIND_COUNT);
+
+        if(sections != NULL)
+        {
+            sections[2 * i]     = start;
+            sections[2 * i + 1] = w -> size;
+        }
+    }
+
+    return at;
+}
+
+//! Writes a pointer member of the node being written.
+#define SER(T, field, kind) \
+    ast_ser_pointer(w, at + offsetof(T, field), ((T*)node) -> field, \
+                    kind, SER_KIND_COUNT)
+
+//! Writes a list member of the node being written, holding elem nodes.
+#define SER_LIST(T, field, elem) \
+    ast_ser_pointer(w, at + offsetof(T, field), ((T*)node) -> field, \
+                    SER_LIST_OF, elem)
+
+//! Writes a string member of the node being written.
+#define SER_TEXT(T, field, interned) \
+    ast_ser_pointer(w, at + offsetof(T, field), ((T*)node) -> field, \
+                    SER_STRING, interned ? SER_IDENTIFIER : SER_KIND_COUNT)
+
+//! Pseudo kind, only used by SER_LIST, for a list of elem nodes.
+#define SER_LIST_OF SER_KIND_COUNT
+
+/*!
+@brief Writes the pointer members of a node which has just been copied to
+the image, at offset at.
+@details Every pointer member must be written, even where it is NULL, or
+the copied pointer would be left in the image. Unions are written through
+whichever member their type selects.
+*/
+static void ast_ser_fields(
+    ast_ser_writer * w,
+    void           * node,
+    ast_ser_kind     kind,
+    ast_ser_kind     elem,
+    size_t           at
+){
+    switch(kind)
+    {
+    case SER_NUMBER:
+        if(((ast_number*)node) -> representation == REP_BITS)
+        {
+            SER_TEXT(ast_number, as_bits, 0);
+        }
+        break;
+    case SER_ATTRIBUTES:
+        SER(ast_node_attributes, attr_name, SER_IDENTIFIER);
+        SER(ast_node_attributes, attr_value, SER_EXPRESSION);
+        SER(ast_node_attributes, next, SER_ATTRIBUTES);
+        break;
+    case SER_CONCATENATION:
+        SER(ast_concatenation, repeat, SER_EXPRESSION);
+        SER_LIST(ast_concatenation, items, SER_EXPRESSION);
+        break;
+    case SER_LVALUE:
+    {
+        ast_lvalue * lv = node;
+        if(lv -> type == NET_CONCATENATION || lv -> type == VAR_CONCATENATION)
+        {
+            SER(ast_lvalue, data.concatenation, SER_CONCATENATION);
+        }
+        else
+        {
+            SER(ast_lvalue, data.identifier, SER_IDENTIFIER);
+        }
+        break;
+    }
+    case SER_FUNCTION_CALL:
+        SER(ast_function_call, function, SER_IDENTIFIER);
+        SER_LIST(ast_function_call, arguments, SER_EXPRESSION);
+        SER(ast_function_call, attributes, SER_ATTRIBUTES);
+        break;
+    case SER_PRIMARY:
+        switch(((ast_primary*)node) -> value_type)
+        {
+            case PRIMARY_NUMBER:
+                SER(ast_primary, value.number, SER_NUMBER); break;
+            case PRIMARY_CONCATENATION:
+                SER(ast_primary, value.concatenation, SER_CONCATENATION);
+                break;
+            case PRIMARY_FUNCTION_CALL:
+                SER(ast_primary, value.function_call, SER_FUNCTION_CALL);
+                break;
+            case PRIMARY_MINMAX_EXP:
+                SER(ast_primary, value.minmax, SER_EXPRESSION); break;
+            case PRIMARY_IDENTIFIER:
+            case PRIMARY_MACRO_USAGE:
+            default:
+                SER(ast_primary, value.identifier, SER_IDENTIFIER); break;
+        }
+        break;
+    case SER_EXPRESSION:
+        SER(ast_expression, attributes, SER_ATTRIBUTES);
+        SER(ast_expression, left, SER_EXPRESSION);
+        SER(ast_expression, right, SER_EXPRESSION);
+        SER(ast_expression, aux, SER_EXPRESSION);
+        SER(ast_expression, primary, SER_PRIMARY);
+        SER_TEXT(ast_expression, string, 0);
+        break;
+    case SER_PARALLEL_PATH:
+        SER(ast_simple_parallel_path_declaration, input_terminal,
+            SER_IDENTIFIER);
+        SER(ast_simple_parallel_path_declaration, output_terminal,
+            SER_IDENTIFIER);
+        SER_LIST(ast_simple_parallel_path_declaration, delay_value,
+                 SER_EXPRESSION);
+        break;
+    case SER_FULL_PATH:
+        SER_LIST(ast_simple_full_path_declaration, input_terminals,
+                 SER_IDENTIFIER);
+        SER_LIST(ast_simple_full_path_declaration, output_terminals,
+                 SER_IDENTIFIER);
+        SER_LIST(ast_simple_full_path_declaration, delay_value,
+                 SER_EXPRESSION);
+        break;
+    case SER_EDGE_PARALLEL_PATH:
+        SER(ast_edge_sensitive_parallel_path_declaration, input_terminal,
+            SER_IDENTIFIER);
+        SER(ast_edge_sensitive_parallel_path_declaration, output_terminal,
+            SER_IDENTIFIER);
+        SER(ast_edge_sensitive_parallel_path_declaration, data_source,
+            SER_EXPRESSION);
+        SER_LIST(ast_edge_sensitive_parallel_path_declaration, delay_value,
+                 SER_EXPRESSION);
+        break;
+    case SER_EDGE_FULL_PATH:
+        SER_LIST(ast_edge_sensitive_full_path_declaration, input_terminal,
+                 SER_IDENTIFIER);
+        SER_LIST(ast_edge_sensitive_full_path_declaration, output_terminal,
+                 SER_IDENTIFIER);
+        SER(ast_edge_sensitive_full_path_declaration, data_source,
+            SER_EXPRESSION);
+        SER_LIST(ast_edge_sensitive_full_path_declaration, delay_value,
+                 SER_EXPRESSION);
+        break;
+    case SER_PATH_DECLARATION:
+        SER(ast_path_declaration, state_expression, SER_EXPRESSION);
+        switch(((ast_path_declaration*)node) -> type)
+        {
+            case SIMPLE_PARALLEL_PATH:
+            case STATE_DEPENDENT_PARALLEL_PATH:
+                SER(ast_path_declaration, parallel, SER_PARALLEL_PATH);
+                break;
+            case SIMPLE_FULL_PATH:
+            case STATE_DEPENDENT_FULL_PATH:
+                SER(ast_path_declaration, full, SER_FULL_PATH);
+                break;
+            case EDGE_SENSITIVE_PARALLEL_PATH:
+            case STATE_DEPENDENT_EDGE_PARALLEL_PATH:
+                SER(ast_path_declaration, es_parallel, SER_EDGE_PARALLEL_PATH);
+                break;
+            case EDGE_SENSITIVE_FULL_PATH:
+            case STATE_DEPENDENT_EDGE_FULL_PATH:
+            default:
+                SER(ast_path_declaration, es_full, SER_EDGE_FULL_PATH);
+                break;
+        }
+        break;
+    case SER_TASK_ENABLE:
+        SER_LIST(ast_task_enable_statement, expressions, SER_EXPRESSION);
+        SER(ast_task_enable_statement, identifier, SER_IDENTIFIER);
+        break;
+    case SER_LOOP:
+        if(((ast_loop_statement*)node) -> type == LOOP_GENERATE)
+        {
+            SER_LIST(ast_loop_statement, generate_items, SER_STATEMENT);
+        }
+        else
+        {
+            SER(ast_loop_statement, inner_statement, SER_STATEMENT);
+        }
+        SER(ast_loop_statement, condition, SER_EXPRESSION);
+        SER(ast_loop_statement, initial, SER_SINGLE_ASSIGNMENT);
+        SER(ast_loop_statement, modify, SER_SINGLE_ASSIGNMENT);
+        break;
+    case SER_CASE_ITEM:
+        SER_LIST(ast_case_item, conditions, SER_EXPRESSION);
+        SER(ast_case_item, body, SER_STATEMENT);
+        break;
+    case SER_CASE:
+        SER(ast_case_statement, expression, SER_EXPRESSION);
+        SER_LIST(ast_case_statement, cases, SER_CASE_ITEM);
+        SER(ast_case_statement, default_item, SER_STATEMENT);
+        break;
+    case SER_CONDITIONAL:
+        SER(ast_conditional_statement, statement, SER_STATEMENT);
+        SER(ast_conditional_statement, condition, SER_EXPRESSION);
+        break;
+    case SER_IF_ELSE:
+        SER_LIST(ast_if_else, conditional_statements, SER_CONDITIONAL);
+        SER(ast_if_else, else_condition, SER_STATEMENT);
+        break;
+    case SER_WAIT:
+        SER(ast_wait_statement, expression, SER_EXPRESSION);
+        SER(ast_wait_statement, statement, SER_STATEMENT);
+        break;
+    case SER_EVENT_EXPRESSION:
+        if(((ast_event_expression*)node) -> type == EVENT_SEQUENCE)
+        {
+            SER_LIST(ast_event_expression, sequence, SER_EVENT_EXPRESSION);
+        }
+        else
+        {
+            SER(ast_event_expression, expression, SER_EXPRESSION);
+        }
+        break;
+    case SER_EVENT_CONTROL:
+        SER(ast_event_control, expression, SER_EVENT_EXPRESSION);
+        break;
+    case SER_DELAY_CTRL:
+        if(((ast_delay_ctrl*)node) -> type == DELAY_CTRL_VALUE)
+        {
+            SER(ast_delay_ctrl, value, SER_DELAY_VALUE);
+        }
+        else
+        {
+            SER(ast_delay_ctrl, mintypmax, SER_EXPRESSION);
+        }
+        break;
+    case SER_TIMING_CONTROL:
+        if(((ast_timing_control_statement*)node) -> type ==
+           TIMING_CTRL_DELAY_CONTROL)
+        {
+            SER(ast_timing_control_statement, delay, SER_DELAY_CTRL);
+        }
+        else
+        {
+            SER(ast_timing_control_statement, event_ctrl, SER_EVENT_CONTROL);
+        }
+        SER(ast_timing_control_statement, repeat, SER_EXPRESSION);
+        SER(ast_timing_control_statement, statement, SER_STATEMENT);
+        break;
+    case SER_DISABLE:
+        SER(ast_disable_statement, id, SER_IDENTIFIER);
+        break;
+    case SER_STATEMENT_BLOCK:
+        SER(ast_statement_block, block_identifier, SER_IDENTIFIER);
+        SER_LIST(ast_statement_block, declarations,
+                 SER_BLOCK_ITEM_DECLARATION);
+        SER_LIST(ast_statement_block, statements, SER_STATEMENT);
+        SER(ast_statement_block, trigger, SER_TIMING_CONTROL);
+        break;
+    case SER_SINGLE_ASSIGNMENT:
+        SER(ast_single_assignment, lval, SER_LVALUE);
+        SER(ast_single_assignment, expression, SER_EXPRESSION);
+        SER(ast_single_assignment, drive_strength, SER_PULL_STRENGTH);
+        SER(ast_single_assignment, delay, SER_DELAY3);
+        break;
+    case SER_CONTINUOUS_ASSIGNMENT:
+        SER_LIST(ast_continuous_assignment, assignments,
+                 SER_SINGLE_ASSIGNMENT);
+        break;
+    case SER_PROCEDURAL_ASSIGNMENT:
+        SER(ast_procedural_assignment, lval, SER_LVALUE);
+        SER(ast_procedural_assignment, expression, SER_EXPRESSION);
+        SER(ast_procedural_assignment, delay_or_event, SER_TIMING_CONTROL);
+        break;
+    case SER_HYBRID_ASSIGNMENT:
+        switch(((ast_hybrid_assignment*)node) -> type)
+        {
+            case HYBRID_ASSIGNMENT_DEASSIGN:
+            case HYBRID_ASSIGNMENT_RELEASE_VAR:
+            case HYBRID_ASSIGNMENT_RELEASE_NET:
+                SER(ast_hybrid_assignment, lval, SER_LVALUE);
+                break;
+            default:
+                SER(ast_hybrid_assignment, assignment, SER_SINGLE_ASSIGNMENT);
+                break;
+        }
+        break;
+    case SER_ASSIGNMENT:
+        switch(((ast_assignment*)node) -> type)
+        {
+            case ASSIGNMENT_CONTINUOUS:
+                SER(ast_assignment, continuous, SER_CONTINUOUS_ASSIGNMENT);
+                break;
+            case ASSIGNMENT_HYBRID:
+                SER(ast_assignment, hybrid, SER_HYBRID_ASSIGNMENT);
+                break;
+            default:
+                SER(ast_assignment, procedural, SER_PROCEDURAL_ASSIGNMENT);
+                break;
+        }
+        break;
+    case SER_STATEMENT:
+    {
+        static const ast_ser_kind data[] = {
+            [STM_GENERATE]       = SER_GENERATE_BLOCK,
+            [STM_ASSIGNMENT]     = SER_ASSIGNMENT,
+            [STM_CASE]           = SER_CASE,
+            [STM_CONDITIONAL]    = SER_IF_ELSE,
+            [STM_DISABLE]        = SER_DISABLE,
+            [STM_EVENT_TRIGGER]  = SER_IDENTIFIER,
+            [STM_LOOP]           = SER_LOOP,
+            [STM_BLOCK]          = SER_STATEMENT_BLOCK,
+            [STM_BLOCK_ALWAYS]   = SER_STATEMENT_BLOCK,
+            [STM_BLOCK_INITIAL]  = SER_STATEMENT_BLOCK,
+            [STM_TIMING_CONTROL] = SER_TIMING_CONTROL,
+            [STM_FUNCTION_CALL]  = SER_FUNCTION_CALL,
+            [STM_TASK_ENABLE]    = SER_TASK_ENABLE,
+            [STM_WAIT]           = SER_WAIT,
+            [STM_MODULE_ITEM]    = SER_MODULE_ITEM
+        };
+        ast_statement_type type = ((ast_statement*)node) -> type;
+
+        SER(ast_statement, attributes, SER_ATTRIBUTES);
+        if((unsigned int)type < sizeof(data) / sizeof(data[0]))
+        {
+            SER(ast_statement, data, data[type]);
+        }
+        else
+        {
+            SER(ast_statement, data, SER_KIND_COUNT);
+        }
+        break;
+    }
+    case SER_PULSE_CONTROL:
+        SER(ast_pulse_control_specparam, reject_limit, SER_EXPRESSION);
+        SER(ast_pulse_control_specparam, error_limit, SER_EXPRESSION);
+        SER(ast_pulse_control_specparam, input_terminal, SER_IDENTIFIER);
+        SER(ast_pulse_control_specparam, output_terminal, SER_IDENTIFIER);
+        break;
+    case SER_RANGE:
+        SER(ast_range, upper, SER_EXPRESSION);
+        SER(ast_range, lower, SER_EXPRESSION);
+        break;
+    case SER_UDP_PORT:
+        if(((ast_udp_port*)node) -> direction == PORT_INPUT)
+        {
+            SER_LIST(ast_udp_port, identifiers, SER_IDENTIFIER);
+        }
+        else
+        {
+            SER(ast_udp_port, identifier, SER_IDENTIFIER);
+        }
+        SER(ast_udp_port, attributes, SER_ATTRIBUTES);
+        SER(ast_udp_port, default_value, SER_EXPRESSION);
+        break;
+    case SER_UDP_INITIAL:
+        SER(ast_udp_initial_statement, output_port, SER_IDENTIFIER);
+        SER(ast_udp_initial_statement, initial_value, SER_NUMBER);
+        break;
+    case SER_UDP_BODY:
+        SER_LIST(ast_udp_body, entries,
+            ((ast_udp_body*)node) -> body_type == UDP_BODY_SEQUENTIAL ?
+                SER_UDP_SEQUENTIAL_ENTRY : SER_UDP_COMBINATORIAL_ENTRY);
+        SER(ast_udp_body, initial, SER_UDP_INITIAL);
+        break;
+    case SER_UDP_COMBINATORIAL_ENTRY:
+        SER_LIST(ast_udp_combinatorial_entry, input_levels, SER_LEVEL_SYMBOL);
+        break;
+    case SER_UDP_SEQUENTIAL_ENTRY:
+        SER_LIST(ast_udp_sequential_entry, levels, SER_LEVEL_SYMBOL);
+        break;
+    case SER_UDP_DECLARATION:
+        SER(ast_udp_declaration, identifier, SER_IDENTIFIER);
+        SER(ast_udp_declaration, attributes, SER_ATTRIBUTES);
+        SER_LIST(ast_udp_declaration, ports, SER_UDP_PORT);
+        SER_LIST(ast_udp_declaration, body_entries,
+            ((ast_udp_declaration*)node) -> body_type == UDP_BODY_SEQUENTIAL ?
+                SER_UDP_SEQUENTIAL_ENTRY : SER_UDP_COMBINATORIAL_ENTRY);
+        SER(ast_udp_declaration, initial, SER_UDP_INITIAL);
+        break;
+    case SER_UDP_INSTANCE:
+        SER(ast_udp_instance, identifier, SER_IDENTIFIER);
+        SER(ast_udp_instance, range, SER_RANGE);
+        SER(ast_udp_instance, output, SER_LVALUE);
+        SER_LIST(ast_udp_instance, inputs, SER_EXPRESSION);
+        break;
+    case SER_UDP_INSTANTIATION:
+        SER_LIST(ast_udp_instantiation, instances, SER_UDP_INSTANCE);
+        SER(ast_udp_instantiation, identifier, SER_IDENTIFIER);
+        SER(ast_udp_instantiation, drive_strength, SER_PULL_STRENGTH);
+        SER(ast_udp_instantiation, delay, SER_DELAY2);
+        break;
+    case SER_GENERATE_BLOCK:
+        SER(ast_generate_block, identifier, SER_IDENTIFIER);
+        SER_LIST(ast_generate_block, generate_items, SER_STATEMENT);
+        break;
+    case SER_MODULE_INSTANTIATION:
+    {
+        ast_module_instantiation * inst = node;
+        size_t slot = at + offsetof(ast_module_instantiation, declaration);
+
+        if(inst -> resolved && inst -> declaration != NULL && w -> unresolve)
+        {
+            // The module may not be written at all, so it is named instead.
+            ast_boolean resolved = AST_FALSE;
+            memcpy(w -> image + at + offsetof(ast_module_instantiation,
+                   resolved), &resolved, sizeof(resolved));
+            ast_ser_pointer(w, slot, inst -> declaration -> identifier,
+                            SER_IDENTIFIER, SER_KIND_COUNT);
+        }
+        else if(inst -> resolved && inst -> declaration != NULL)
+        {
+            // Written once every root is, so that a module is never
+            // written into the section of another.
+            if(ast_ser_reserve((void**)&w -> deferred,
+                               &w -> deferred_capacity, w -> deferred_count,
+                               sizeof(ast_ser_deferred)))
+            {
+                w -> failed = 1;
+                break;
+            }
+            w -> deferred[w -> deferred_count].slot   = slot;
+            w -> deferred[w -> deferred_count].module = inst -> declaration;
+            w -> deferred_count ++;
+        }
+        else
+        {
+            SER(ast_module_instantiation, module_identifer, SER_IDENTIFIER);
+        }
+        SER_LIST(ast_module_instantiation, module_parameters,
+                 SER_PORT_CONNECTION);
+        SER_LIST(ast_module_instantiation, module_instances,
+                 SER_MODULE_INSTANCE);
+        break;
+    }
+    case SER_MODULE_INSTANCE:
+        SER(ast_module_instance, instance_identifier, SER_IDENTIFIER);
+        SER_LIST(ast_module_instance, port_connections, SER_PORT_CONNECTION);
+        break;
+    case SER_PORT_CONNECTION:
+        SER(ast_port_connection, port_name, SER_IDENTIFIER);
+        SER(ast_port_connection, expression, SER_EXPRESSION);
+        break;
+    case SER_SWITCH_GATE:
+    {
+        ast_switchtype type = ((ast_switch_gate*)node) -> type;
+        if(type == SWITCH_TRAN || type == SWITCH_RTRAN)
+        {
+            SER(ast_switch_gate, delay2, SER_DELAY2);
+        }
+        else
+        {
+            SER(ast_switch_gate, delay3, SER_DELAY3);
+        }
+        break;
+    }
+    case SER_PULL_GATE_INSTANCE:
+        SER(ast_pull_gate_instance, name, SER_IDENTIFIER);
+        SER(ast_pull_gate_instance, output_terminal, SER_LVALUE);
+        break;
+    case SER_PASS_SWITCH_INSTANCE:
+        SER(ast_pass_switch_instance, name, SER_IDENTIFIER);
+        SER(ast_pass_switch_instance, terminal_1, SER_LVALUE);
+        SER(ast_pass_switch_instance, terminal_2, SER_LVALUE);
+        break;
+    case SER_N_INPUT_GATE_INSTANCES:
+        SER(ast_n_input_gate_instances, delay, SER_DELAY3);
+        SER(ast_n_input_gate_instances, drive_strength, SER_PULL_STRENGTH);
+        SER_LIST(ast_n_input_gate_instances, instances,
+                 SER_N_INPUT_GATE_INSTANCE);
+        break;
+    case SER_N_INPUT_GATE_INSTANCE:
+        SER(ast_n_input_gate_instance, name, SER_IDENTIFIER);
+        SER_LIST(ast_n_input_gate_instance, input_terminals, SER_EXPRESSION);
+        SER(ast_n_input_gate_instance, output_terminal, SER_LVALUE);
+        break;
+    case SER_ENABLE_GATE_INSTANCES:
+        SER(ast_enable_gate_instances, delay, SER_DELAY3);
+        SER(ast_enable_gate_instances, drive_strength, SER_PULL_STRENGTH);
+        SER_LIST(ast_enable_gate_instances, instances,
+                 SER_ENABLE_GATE_INSTANCE);
+        break;
+    case SER_ENABLE_GATE_INSTANCE:
+        SER(ast_enable_gate_instance, name, SER_IDENTIFIER);
+        SER(ast_enable_gate_instance, output_terminal, SER_LVALUE);
+        SER(ast_enable_gate_instance, enable_terminal, SER_EXPRESSION);
+        SER(ast_enable_gate_instance, input_terminal, SER_EXPRESSION);
+        break;
+    case SER_MOS_SWITCH_INSTANCE:
+        SER(ast_mos_switch_instance, name, SER_IDENTIFIER);
+        SER(ast_mos_switch_instance, output_terminal, SER_LVALUE);
+        SER(ast_mos_switch_instance, enable_terminal, SER_EXPRESSION);
+        SER(ast_mos_switch_instance, input_terminal, SER_EXPRESSION);
+        break;
+    case SER_CMOS_SWITCH_INSTANCE:
+        SER(ast_cmos_switch_instance, name, SER_IDENTIFIER);
+        SER(ast_cmos_switch_instance, output_terminal, SER_LVALUE);
+        SER(ast_cmos_switch_instance, ncontrol_terminal, SER_EXPRESSION);
+        SER(ast_cmos_switch_instance, pcontrol_terminal, SER_EXPRESSION);
+        SER(ast_cmos_switch_instance, input_terminal, SER_EXPRESSION);
+        break;
+    case SER_PASS_ENABLE_SWITCH:
+        SER(ast_pass_enable_switch, name, SER_IDENTIFIER);
+        SER(ast_pass_enable_switch, terminal_1, SER_LVALUE);
+        SER(ast_pass_enable_switch, terminal_2, SER_LVALUE);
+        SER(ast_pass_enable_switch, enable, SER_EXPRESSION);
+        break;
+    case SER_PASS_ENABLE_SWITCHES:
+        SER(ast_pass_enable_switches, delay, SER_DELAY2);
+        SER_LIST(ast_pass_enable_switches, switches, SER_PASS_ENABLE_SWITCH);
+        break;
+    case SER_N_OUTPUT_GATE_INSTANCE:
+        SER(ast_n_output_gate_instance, name, SER_IDENTIFIER);
+        SER_LIST(ast_n_output_gate_instance, outputs, SER_LVALUE);
+        SER(ast_n_output_gate_instance, input, SER_EXPRESSION);
+        break;
+    case SER_N_OUTPUT_GATE_INSTANCES:
+        SER(ast_n_output_gate_instances, delay, SER_DELAY2);
+        SER(ast_n_output_gate_instances, drive_strength, SER_PULL_STRENGTH);
+        SER_LIST(ast_n_output_gate_instances, instances,
+                 SER_N_OUTPUT_GATE_INSTANCE);
+        break;
+    case SER_SWITCHES:
+        // What the switches are is only known from the gate instantiation,
+        // which passes it down as elem.
+        SER(ast_switches, type, SER_SWITCH_GATE);
+        SER_LIST(ast_switches, switches, elem);
+        break;
+    case SER_GATE_INSTANTIATION:
+        switch(((ast_gate_instantiation*)node) -> type)
+        {
+            case GATE_CMOS:
+                ast_ser_pointer(w, at + offsetof(ast_gate_instantiation,
+                    switches), ((ast_gate_instantiation*)node) -> switches,
+                    SER_SWITCHES, SER_CMOS_SWITCH_INSTANCE);
+                break;
+            case GATE_MOS:
+                ast_ser_pointer(w, at + offsetof(ast_gate_instantiation,
+                    switches), ((ast_gate_instantiation*)node) -> switches,
+                    SER_SWITCHES, SER_MOS_SWITCH_INSTANCE);
+                break;
+            case GATE_PASS:
+                ast_ser_pointer(w, at + offsetof(ast_gate_instantiation,
+                    switches), ((ast_gate_instantiation*)node) -> switches,
+                    SER_SWITCHES, SER_PASS_SWITCH_INSTANCE);
+                break;
+            case GATE_ENABLE:
+                SER(ast_gate_instantiation, enable, SER_ENABLE_GATE_INSTANCES);
+                break;
+            case GATE_N_OUT:
+                SER(ast_gate_instantiation, n_out,
+                    SER_N_OUTPUT_GATE_INSTANCES);
+                break;
+            case GATE_N_IN:
+                SER(ast_gate_instantiation, n_in, SER_N_INPUT_GATE_INSTANCES);
+                break;
+            case GATE_PASS_EN:
+                SER(ast_gate_instantiation, pass_en, SER_PASS_ENABLE_SWITCHES);
+                break;
+            case GATE_PULL_UP:
+            case GATE_PULL_DOWN:
+            default:
+                SER(ast_gate_instantiation, pull_strength,
+                    SER_PRIMITIVE_PULL_STRENGTH);
+                SER_LIST(ast_gate_instantiation, pull_gates,
+                         SER_PULL_GATE_INSTANCE);
+                break;
+        }
+        break;
+    case SER_DELAY_VALUE:
+        switch(((ast_delay_value*)node) -> type)
+        {
+            case DELAY_VAL_NUMBER:
+                SER(ast_delay_value, unsigned_number, SER_NUMBER); break;
+            case DELAY_VAL_MINTYPMAX:
+                SER(ast_delay_value, mintypmax, SER_EXPRESSION); break;
+            case DELAY_VAL_PARAMETER:
+            case DELAY_VAL_SPECPARAM:
+            default:
+                SER(ast_delay_value, parameter_id, SER_IDENTIFIER); break;
+        }
+        break;
+    case SER_DELAY3:
+        SER(ast_delay3, min, SER_DELAY_VALUE);
+        SER(ast_delay3, max, SER_DELAY_VALUE);
+        SER(ast_delay3, avg, SER_DELAY_VALUE);
+        break;
+    case SER_DELAY2:
+        SER(ast_delay2, min, SER_DELAY_VALUE);
+        SER(ast_delay2, max, SER_DELAY_VALUE);
+        break;
+    case SER_PORT_DECLARATION:
+        SER(ast_port_declaration, range, SER_RANGE);
+        SER_LIST(ast_port_declaration, port_names, SER_IDENTIFIER);
+        SER_LIST(ast_port_declaration, initial_values, SER_EXPRESSION);
+        break;
+    case SER_TYPE_DECLARATION:
+        SER_LIST(ast_type_declaration, identifiers,
+            ((ast_type_declaration*)node) -> type == DECLARE_NET ?
+                SER_SINGLE_ASSIGNMENT : SER_IDENTIFIER);
+        SER(ast_type_declaration, delay, SER_DELAY3);
+        SER(ast_type_declaration, drive_strength, SER_PULL_STRENGTH);
+        SER(ast_type_declaration, range, SER_RANGE);
+        break;
+    case SER_NET_DECLARATION:
+        SER(ast_net_declaration, identifier, SER_IDENTIFIER);
+        SER(ast_net_declaration, delay, SER_DELAY3);
+        SER(ast_net_declaration, drive, SER_PULL_STRENGTH);
+        SER(ast_net_declaration, range, SER_RANGE);
+        SER(ast_net_declaration, value, SER_EXPRESSION);
+        break;
+    case SER_REG_DECLARATION:
+        SER(ast_reg_declaration, identifier, SER_IDENTIFIER);
+        SER(ast_reg_declaration, range, SER_RANGE);
+        SER(ast_reg_declaration, value, SER_EXPRESSION);
+        break;
+    case SER_VAR_DECLARATION:
+        SER(ast_var_declaration, identifier, SER_IDENTIFIER);
+        break;
+    case SER_PARAMETER_DECLARATIONS:
+        SER_LIST(ast_parameter_declarations, assignments,
+                 SER_SINGLE_ASSIGNMENT);
+        SER(ast_parameter_declarations, range, SER_RANGE);
+        break;
+    case SER_BLOCK_REG_DECLARATION:
+        SER(ast_block_reg_declaration, range, SER_RANGE);
+        SER_LIST(ast_block_reg_declaration, identifiers, SER_IDENTIFIER);
+        break;
+    case SER_BLOCK_ITEM_DECLARATION:
+        SER(ast_block_item_declaration, attributes, SER_ATTRIBUTES);
+        switch(((ast_block_item_declaration*)node) -> type)
+        {
+            case BLOCK_ITEM_REG:
+                SER(ast_block_item_declaration, reg,
+                    SER_BLOCK_REG_DECLARATION);
+                break;
+            case BLOCK_ITEM_PARAM:
+                SER(ast_block_item_declaration, parameters,
+                    SER_PARAMETER_DECLARATIONS);
+                break;
+            case BLOCK_ITEM_TYPE:
+            default:
+                SER(ast_block_item_declaration, event_or_var,
+                    SER_TYPE_DECLARATION);
+                break;
+        }
+        break;
+    case SER_RANGE_OR_TYPE:
+        if(((ast_range_or_type*)node) -> is_range)
+        {
+            SER(ast_range_or_type, range, SER_RANGE);
+        }
+        break;
+    case SER_FUNCTION_DECLARATION:
+        SER(ast_function_declaration, rot, SER_RANGE_OR_TYPE);
+        SER(ast_function_declaration, identifier, SER_IDENTIFIER);
+        SER_LIST(ast_function_declaration, item_declarations,
+            ((ast_function_declaration*)node) -> function_or_block ?
+                SER_FUNCTION_ITEM_DECLARATION : SER_BLOCK_ITEM_DECLARATION);
+        SER(ast_function_declaration, statements, SER_STATEMENT);
+        break;
+    case SER_TASK_PORT:
+        SER(ast_task_port, range, SER_RANGE);
+        SER_LIST(ast_task_port, identifiers, SER_IDENTIFIER);
+        break;
+    case SER_FUNCTION_ITEM_DECLARATION:
+        if(((ast_function_item_declaration*)node) -> is_port_declaration)
+        {
+            SER(ast_function_item_declaration, port_declaration,
+                SER_TASK_PORT);
+        }
+        else
+        {
+            SER(ast_function_item_declaration, block_item,
+                SER_BLOCK_ITEM_DECLARATION);
+        }
+        break;
+    case SER_TASK_DECLARATION:
+        SER(ast_task_declaration, identifier, SER_IDENTIFIER);
+        SER_LIST(ast_task_declaration, ports, SER_TASK_PORT);
+        SER_LIST(ast_task_declaration, declarations,
+            ((ast_task_declaration*)node) -> ports == NULL ?
+                SER_FUNCTION_ITEM_DECLARATION : SER_BLOCK_ITEM_DECLARATION);
+        SER(ast_task_declaration, statements, SER_STATEMENT);
+        break;
+    case SER_MODULE_ITEM:
+    {
+        static const ast_ser_kind data[] = {
+            [MOD_ITEM_PORT_DECLARATION]       = SER_PORT_DECLARATION,
+            [MOD_ITEM_GENERATED_INSTANTIATION]= SER_GENERATE_BLOCK,
+            [MOD_ITEM_PARAMETER_DECLARATION]  = SER_PARAMETER_DECLARATIONS,
+            [MOD_ITEM_SPECIFY_BLOCK]          = SER_MODULE_ITEM_LIST,
+            [MOD_ITEM_SPECPARAM_DECLARATION]  = SER_PARAMETER_DECLARATIONS,
+            [MOD_ITEM_PARAMETER_OVERRIDE]     = SER_ASSIGNMENT_LIST,
+            [MOD_ITEM_CONTINOUS_ASSIGNMENT]   = SER_CONTINUOUS_ASSIGNMENT,
+            [MOD_ITEM_GATE_INSTANTIATION]     = SER_GATE_INSTANTIATION,
+            [MOD_ITEM_UDP_INSTANTIATION]      = SER_UDP_INSTANTIATION,
+            [MOD_ITEM_MODULE_INSTANTIATION]   = SER_MODULE_INSTANTIATION,
+            [MOD_ITEM_INITIAL_CONSTRUCT]      = SER_STATEMENT,
+            [MOD_ITEM_ALWAYS_CONSTRUCT]       = SER_STATEMENT,
+            [MOD_ITEM_NET_DECLARATION]        = SER_TYPE_DECLARATION,
+            [MOD_ITEM_REG_DECLARATION]        = SER_TYPE_DECLARATION,
+            [MOD_ITEM_INTEGER_DECLARATION]    = SER_TYPE_DECLARATION,
+            [MOD_ITEM_REAL_DECLARATION]       = SER_TYPE_DECLARATION,
+            [MOD_ITEM_TIME_DECLARATION]       = SER_TYPE_DECLARATION,
+            [MOD_ITEM_REALTIME_DECLARATION]   = SER_TYPE_DECLARATION,
+            [MOD_ITEM_EVENT_DECLARATION]      = SER_TYPE_DECLARATION,
+            [MOD_ITEM_GENVAR_DECLARATION]     = SER_TYPE_DECLARATION,
+            [MOD_ITEM_TASK_DECLARATION]       = SER_TASK_DECLARATION,
+            [MOD_ITEM_FUNCTION_DECLARATION]   = SER_FUNCTION_DECLARATION,
+            [MOD_ITEM_PATH_DECLARATION]       = SER_PATH_DECLARATION
+        };
+        ast_module_item_type type = ((ast_module_item*)node) -> type;
+
+        SER(ast_module_item, attributes, SER_ATTRIBUTES);
+        if((unsigned int)type < sizeof(data) / sizeof(data[0]))
+        {
+            SER(ast_module_item, port_declaration, data[type]);
+        }
+        else
+        {
+            SER(ast_module_item, port_declaration, SER_KIND_COUNT);
+        }
+        break;
+    }
+    case SER_MODULE_DECLARATION:
+        SER(ast_module_declaration, attributes, SER_ATTRIBUTES);
+        SER(ast_module_declaration, identifier, SER_IDENTIFIER);
+        SER_LIST(ast_module_declaration, always_blocks, SER_STATEMENT_BLOCK);
+        SER_LIST(ast_module_declaration, continuous_assignments,
+                 SER_CONTINUOUS_ASSIGNMENT);
+        SER_LIST(ast_module_declaration, event_declarations,
+                 SER_VAR_DECLARATION);
+        SER_LIST(ast_module_declaration, function_declarations,
+                 SER_FUNCTION_DECLARATION);
+        SER_LIST(ast_module_declaration, gate_instantiations,
+                 SER_GATE_INSTANTIATION);
+        SER_LIST(ast_module_declaration, genvar_declarations,
+                 SER_VAR_DECLARATION);
+        SER_LIST(ast_module_declaration, generate_blocks,
+                 SER_GENERATE_BLOCK);
+        SER_LIST(ast_module_declaration, initial_blocks, SER_STATEMENT_BLOCK);
+        SER_LIST(ast_module_declaration, integer_declarations,
+                 SER_VAR_DECLARATION);
+        SER_LIST(ast_module_declaration, local_parameters,
+                 SER_PARAMETER_DECLARATIONS);
+        SER_LIST(ast_module_declaration, module_instantiations,
+                 SER_MODULE_INSTANTIATION);
+        SER_LIST(ast_module_declaration, module_parameters,
+                 SER_PARAMETER_DECLARATIONS);
+        SER_LIST(ast_module_declaration, module_ports, SER_PORT_DECLARATION);
+        SER_LIST(ast_module_declaration, net_declarations,
+                 SER_NET_DECLARATION);
+        SER_LIST(ast_module_declaration, parameter_overrides,
+                 SER_ASSIGNMENT_LIST);
+        SER_LIST(ast_module_declaration, real_declarations,
+                 SER_VAR_DECLARATION);
+        SER_LIST(ast_module_declaration, realtime_declarations,
+                 SER_VAR_DECLARATION);
+        SER_LIST(ast_module_declaration, reg_declarations,
+                 SER_REG_DECLARATION);
+        SER_LIST(ast_module_declaration, specify_blocks,
+                 SER_MODULE_ITEM_LIST);
+        SER_LIST(ast_module_declaration, specparams,
+                 SER_PARAMETER_DECLARATIONS);
+        SER_LIST(ast_module_declaration, task_declarations,
+                 SER_TASK_DECLARATION);
+        SER_LIST(ast_module_declaration, time_declarations,
+                 SER_VAR_DECLARATION);
+        SER_LIST(ast_module_declaration, udp_instantiations,
+                 SER_UDP_INSTANTIATION);
+        break;
+    case SER_IDENTIFIER:
+        SER_TEXT(struct ast_identifier_t, identifier, 1);
+        SER(struct ast_identifier_t, next, SER_IDENTIFIER);
+        switch(((ast_identifier)node) -> range_or_idx)
+        {
+            case ID_HAS_RANGE:
+                SER(struct ast_identifier_t, range, SER_RANGE); break;
+            case ID_HAS_RANGES:
+                SER_LIST(struct ast_identifier_t, ranges, SER_RANGE); break;
+            case ID_HAS_INDEX:
+                SER(struct ast_identifier_t, index, SER_EXPRESSION); break;
+            case ID_HAS_NONE:
+            default:
+                ast_ser_pointer(w, at + offsetof(struct ast_identifier_t,
+                                range), NULL, SER_RANGE, SER_KIND_COUNT);
+                break;
+        }
+        break;
+    case SER_CONFIG_RULE:
+        SER(ast_config_rule_statement, clause_1, SER_IDENTIFIER);
+        if(((ast_config_rule_statement*)node) -> multiple_clauses)
+        {
+            SER_LIST(ast_config_rule_statement, clauses, SER_IDENTIFIER);
+        }
+        else
+        {
+            SER(ast_config_rule_statement, clause_2, SER_IDENTIFIER);
+        }
+        break;
+    case SER_CONFIG_DECLARATION:
+        SER(ast_config_declaration, identifier, SER_IDENTIFIER);
+        SER(ast_config_declaration, design_statement, SER_IDENTIFIER);
+        SER_LIST(ast_config_declaration, rule_statements, SER_CONFIG_RULE);
+        break;
+    case SER_LIBRARY_DECLARATION:
+        SER(ast_library_declaration, identifier, SER_IDENTIFIER);
+        SER_LIST(ast_library_declaration, file_paths, SER_STRING);
+        SER_LIST(ast_library_declaration, incdirs, SER_STRING);
+        break;
+    case SER_LIBRARY_DESCRIPTIONS:
+        switch(((ast_library_descriptions*)node) -> type)
+        {
+            case LIB_LIBRARY:
+                SER(ast_library_descriptions, library,
+                    SER_LIBRARY_DECLARATION);
+                break;
+            case LIB_CONFIG:
+                SER(ast_library_descriptions, config, SER_CONFIG_DECLARATION);
+                break;
+            case LIB_INCLUDE:
+            default:
+                SER_TEXT(ast_library_descriptions, include, 0);
+                break;
+        }
+        break;
+    case SER_SOURCE_FILE:
+        SER_TEXT(verilog_source_file, path, 1);
+        // Preprocessor snapshots are not kept in saved trees.
+        ast_ser_pointer(w, at + offsetof(verilog_source_file, entry_state),
+                        NULL, SER_STRING, SER_KIND_COUNT);
+        SER_LIST(verilog_source_file, modules, SER_MODULE_DECLARATION);
+        SER_LIST(verilog_source_file, primitives, SER_UDP_DECLARATION);
+        SER_LIST(verilog_source_file, configs, SER_CONFIG_DECLARATION);
+        SER_LIST(verilog_source_file, libraries, SER_LIBRARY_DESCRIPTIONS);
+        break;
+    case SER_SOURCE_ITEM:
+        if(((ast_source_item*)node) -> type == SOURCE_MODULE)
+        {
+            SER(ast_source_item, module, SER_MODULE_DECLARATION);
+        }
+        else
+        {
+            SER(ast_source_item, udp, SER_UDP_DECLARATION);
+        }
+        break;
+    default:
+        // Nodes of these kinds hold no pointers.
+        break;
+    }
+}
+
+/*!
+@brief Writes a node, and everything it points to, to the image, unless it
+has been written already.
+@details A node is recorded as written before its members are, so that
+nodes which point back at one another are only written once.
+@returns The image offset of the node.
+*/
+static size_t ast_ser_node(
+    ast_ser_writer * w,
+    void           * node,
+    ast_ser_kind     kind,
+    ast_ser_kind     elem
+){
+    size_t at;
+
+    if(kind == SER_LIST_OF)
+    {
+        return ast_ser_list(w, node, elem, NULL);
+    }
+    else if(ast_ser_map_get(w, node, &at))
+    {
+        return at;
+    }
+
+    size_t size = ast_ser_sizes[kind];
+
+    at = ast_ser_alloc(w, size);
+    if(w -> failed)
+    {
+        return 0;
+    }
+
+    memcpy(w -> image + at, node, size);
+    ast_ser_map_put(w, node, at);
+
+    // Every node but these starts with its metadata.
+    if(kind != SER_LEVEL_SYMBOL && kind != SER_RANGE &&
+       kind != SER_SOURCE_FILE)
+    {
+        ast_location location = ((ast_metadata*)node) -> location;
+        uint32_t     written  = ast_ser_location(w, location);
+
+        if(written != 0)
+        {
+            ast_ser_relocate(w, at, written, AST_RELOC_LOCATION, SER_STRING);
+        }
+        else
+        {
+            memset(w -> image + at, 0, sizeof(ast_location));
+        }
+    }
+
+    ast_ser_fields(w, node, kind, elem, at);
+
+    return at;
+}
+
+//! Writes an array of 32 bit words to a file.
+static void ast_ser_put(FILE * fh, uint32_t * words, size_t count)
+{
+    if(count > 0)
+    {
+        fwrite(words, sizeof(uint32_t), count, fh);
+    }
+}
+
+//! Writes zeros to a file, until its length is a multiple of align.
+static void ast_ser_pad(FILE * fh, size_t written, size_t align)
+{
+    static const char zeros[64] = {0};
+    size_t pad = (align - written % align) % align;
+    fwrite(zeros, 1, pad, fh);
+}
+
+/*!
+@brief Writes a tree file holding the supplied lists, and everything they
+lead to.
+@param [in] lists - The modules, primitives, configs, libraries and file
+records to write, in that order.
+@param [in] unresolve - Whether resolved instances are written by name,
+rather than bringing their modules with them.
+*/
+static int ast_ser_save(
+    verilog_source_tree * tree,
+    ast_list           ** lists,
+    int                   unresolve,
+    char                * path
+){
+    ast_arena      * scratch = ast_arena_new(0);
+    ast_arena      * prev    = ast_set_current_arena(scratch);
+    ast_ser_writer   w;
+    uint32_t         header[AST_FILE_HEADER_WORDS];
+    uint32_t       * sections;
+    uint32_t       * modules;
+    unsigned int     module_count = lists[0] -> items;
+    unsigned int     i;
+    int              tr = -1;
+
+    memset(&w, 0, sizeof(w));
+    w.strings        = ast_hashtable_new();
+    w.unresolve      = unresolve;
+    w.locations      = tree -> locations;
+    w.location_count = 1;
+    w.location_map   = ast_arena_calloc(scratch, tree -> locations != NULL ?
+                                        tree -> locations -> count + 1 : 1,
+                                        sizeof(uint32_t));
+
+    sections  = ast_arena_calloc(scratch, 2 * module_count + 2,
+                                 sizeof(uint32_t));
+    modules   = ast_arena_calloc(scratch, AST_FILE_MODULE_WORDS *
+                                 module_count + 1, sizeof(uint32_t));
+
+    // Write the roots, then anything only reachable through a resolved
+    // instance, which can itself lead to more.
+    header[AST_FILE_HEADER_MODULE_LIST] =
+        ast_ser_list(&w, lists[0], SER_MODULE_DECLARATION, sections);
+    header[AST_FILE_HEADER_PRIMITIVE_LIST] =
+        ast_ser_list(&w, lists[1], SER_UDP_DECLARATION, NULL);
+    header[AST_FILE_HEADER_CONFIG_LIST] =
+        ast_ser_list(&w, lists[2], SER_CONFIG_DECLARATION, NULL);
+    header[AST_FILE_HEADER_LIBRARY_LIST] =
+        ast_ser_list(&w, lists[3], SER_LIBRARY_DESCRIPTIONS, NULL);
+    header[AST_FILE_HEADER_FILE_LIST] =
+        ast_ser_list(&w, lists[4], SER_SOURCE_FILE, NULL);
+
+    size_t d;
+    for(d = 0; d < w.deferred_count && !w.failed; d ++)
+    {
+        size_t target = ast_ser_node(&w, w.deferred[d].module,
+                                     SER_MODULE_DECLARATION, SER_KIND_COUNT);
+        ast_ser_relocate(&w, w.deferred[d].slot, target, AST_RELOC_NODE,
+                         SER_MODULE_DECLARATION);
+    }
+
+    for(i = 0; i < module_count && !w.failed; i ++)
+    {
+        ast_module_declaration * module = ast_list_get(lists[0], i);
+        uint32_t * entry = modules + AST_FILE_MODULE_WORDS * i;
+        size_t     at    = 0;
+
+        entry[0] = AST_FILE_NONE;
+        entry[1] = AST_FILE_NONE;
+        entry[2] = sections[2 * i];
+        entry[3] = sections[2 * i + 1];
+
+        if(module != NULL && ast_ser_map_get(&w, module, &at))
+        {
+            entry[1] = at;
+        }
+        if(module != NULL && module -> identifier != NULL)
+        {
+            entry[0] = ast_ser_string_index(&w,
+                module -> identifier -> next == NULL ?
+                    module -> identifier -> identifier :
+                    ast_identifier_tostring(module -> identifier));
+        }
+    }
+
+    size_t location_count = w.location_count;
+    FILE * fh = w.failed ? NULL : fopen(path, "wb");
+
+    if(fh != NULL)
+    {
+        header[AST_FILE_HEADER_VERSION]      = AST_FILE_VERSION;
+        header[AST_FILE_HEADER_BYTE_ORDER]   = AST_FILE_BYTE_ORDER;
+        header[AST_FILE_HEADER_POINTER_SIZE] = sizeof(void*);
+        header[AST_FILE_HEADER_LAYOUT]       = ast_ser_layout_hash();
+        header[AST_FILE_HEADER_STRINGS]      = w.string_count;
+        header[AST_FILE_HEADER_STRING_BYTES] = w.string_bytes;
+        header[AST_FILE_HEADER_LOCATIONS]    = location_count;
+        header[AST_FILE_HEADER_MODULES]      = module_count;
+        header[AST_FILE_HEADER_IMAGE_SIZE]   = w.size;
+        header[AST_FILE_HEADER_RELOCATIONS]  = w.reloc_count;
+
+        fwrite(AST_FILE_MAGIC, 1, 4, fh);
+        ast_ser_put(fh, header, AST_FILE_HEADER_WORDS);
+
+        size_t offset = 0;
+        for(i = 0; i < w.string_count; i ++)
+        {
+            uint32_t o = offset;
+            ast_ser_put(fh, &o, 1);
+            offset += strlen(w.string_list[i]) + 1;
+        }
+        for(i = 0; i < w.string_count; i ++)
+        {
+            fwrite(w.string_list[i], 1, strlen(w.string_list[i]) + 1, fh);
+        }
+
+        size_t written = 4 + sizeof(header) +
+                         w.string_count * sizeof(uint32_t) + w.string_bytes;
+        ast_ser_pad(fh, written, sizeof(uint32_t));
+        written += (sizeof(uint32_t) - written % sizeof(uint32_t)) %
+                   sizeof(uint32_t);
+
+        if(location_count > 1)
+        {
+            ast_ser_put(fh, w.location_words + AST_FILE_LOCATION_WORDS,
+                        AST_FILE_LOCATION_WORDS * (location_count - 1));
+        }
+        ast_ser_put(fh, modules, AST_FILE_MODULE_WORDS * module_count);
+        written += sizeof(uint32_t) * (AST_FILE_LOCATION_WORDS *
+                   (location_count - 1) + AST_FILE_MODULE_WORDS*module_count);
+
+        ast_ser_pad(fh, written, AST_ARENA_ALIGN);
+        fwrite(w.image, 1, w.size, fh);
+        ast_ser_put(fh, w.relocs, AST_FILE_RELOC_WORDS * w.reloc_count);
+
+        tr = ferror(fh) ? -1 : 0;
+
+        if(fclose(fh) != 0)
+        {
+            tr = -1;
+        }
+    }
+
+    free(w.image);
+    free(w.relocs);
+    free(w.string_list);
+    free(w.map_keys);
+    free(w.map_values);
+    free(w.deferred);
+    free(w.location_words);
+
+    ast_set_current_arena(prev);
+    ast_arena_free(scratch);
+
+    return tr;
+}
+
+int verilog_source_tree_save(
+    verilog_source_tree * tree,
+    char                * path
+){
+    ast_list * lists[5] = {
+        tree -> modules, tree -> primitives, tree -> configs,
+        tree -> libraries, tree -> files
+    };
+
+    return ast_ser_save(tree, lists, 0, path);
+}
+
+int verilog_source_file_save(
+    verilog_source_tree * tree,
+    verilog_source_file * file,
+    char                * path
+){
+    ast_arena * scratch = ast_arena_new(0);
+    ast_arena * prev    = ast_set_current_arena(scratch);
+    ast_list  * files   = ast_list_new();
+
+    ast_list_append(files, file);
+    ast_set_current_arena(prev);
+
+    ast_list * lists[5] = {
+        file -> modules, file -> primitives, file -> configs,
+        file -> libraries, files
+    };
+
+    int tr = ast_ser_save(tree, lists, 1, path);
+
+    ast_arena_free(scratch);
+    return tr;
+}
+
+// ----------------------- Loading ------------------------------------
+
+//! Returns value rounded up to a multiple of align.
+static size_t ast_ser_round(size_t value, size_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+/*!
+@brief Checks that a list of a loaded image, not yet relocated, and the
+array of its items, lie within the image.
+@returns Zero if they do, or -1 if not.
+*/
+static int ast_ser_check_list(
+    char   * image,
+    size_t   image_size,
+    size_t   at
+){
+    ast_list list;
+
+    if(at % AST_FILE_ALIGN != 0 || at + sizeof(list) > image_size)
+    {
+        return -1;
+    }
+
+    memcpy(&list, image + at, sizeof(list));
+
+    // The array is still an image offset, and lists are written with no
+    // free space.
+    uintptr_t data  = (uintptr_t)list.data;
+    size_t    items = (size_t)list.items * sizeof(void*);
+
+    if(list.base != list.data || list.capacity != list.items)
+    {
+        return -1;
+    }
+
+    if(items > 0 && (items > image_size || data > image_size - items ||
+                     data % AST_FILE_ALIGN != 0))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+@brief Checks every relocation of a loaded image, before any is applied.
+@details A node relocation must point at a whole node of the kind recorded
+for it, so that nothing read through the pointer lies past the image.
+@returns Zero if every relocation can be applied, or -1 if not.
+*/
+static int ast_ser_check_relocations(
+    char                * image,
+    size_t                image_size,
+    uint32_t            * relocs,
+    size_t                reloc_count,
+    size_t                string_count,
+    size_t                location_count
+){
+    size_t r;
+
+    for(r = 0; r < reloc_count; r ++)
+    {
+        uint32_t     * reloc  = relocs + AST_FILE_RELOC_WORDS * r;
+        size_t         slot   = (size_t)(reloc[0] >> 3) * 4;
+        ast_file_reloc kind   = reloc[0] & AST_FILE_RELOC_KIND;
+        uint32_t       target = reloc[1];
+        uintptr_t      value;
+        size_t         size;
+
+        if(kind == AST_RELOC_LOCATION)
+        {
+            ast_location location;
+
+            if(slot + sizeof(location) > image_size)
+            {
+                return -1;
+            }
+
+            memcpy(&location, image + slot, sizeof(location));
+            if(location == 0 || location >= location_count)
+            {
+                return -1;
+            }
+            continue;
+        }
+        else if(slot % AST_FILE_ALIGN != 0 ||
+                slot + sizeof(void*) > image_size)
+        {
+            return -1;
+        }
+
+        memcpy(&value, image + slot, sizeof(value));
+
+        switch(kind)
+        {
+            case AST_RELOC_NODE:
+                if(target == SER_LIST_OF || target == SER_ASSIGNMENT_LIST ||
+                   target == SER_MODULE_ITEM_LIST)
+                {
+                    if(value > image_size ||
+                       ast_ser_check_list(image, image_size, value) != 0)
+                    {
+                        return -1;
+                    }
+                    break;
+                }
+
+                size = target == SER_LIST_ARRAY ? sizeof(void*) :
+                       target <  SER_KIND_COUNT ? ast_ser_sizes[target] : 0;
+
+                if(size == 0 || value % AST_FILE_ALIGN != 0 ||
+                   value > image_size || size > image_size - value)
+                {
+                    return -1;
+                }
+                break;
+            case AST_RELOC_STRING:
+            case AST_RELOC_INTERNED:
+                if(value >= string_count) return -1;
+                break;
+            case AST_RELOC_ARENA:
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*!
+@brief Points every relocated slot of a loaded image at its target.
+@details The relocations must have been checked with
+ast_ser_check_relocations. Locations are left numbered as in the file.
+*/
+static void ast_ser_apply_relocations(
+    verilog_source_tree * tree,
+    char                * image,
+    uint32_t            * relocs,
+    size_t                reloc_count,
+    uint32_t            * string_offsets,
+    char                * string_text,
+    size_t                string_count
+){
+    char ** interned = ast_arena_calloc(tree -> arena, string_count + 1,
+                                        sizeof(char*));
+    size_t  r;
+
+    for(r = 0; r < reloc_count; r ++)
+    {
+        uint32_t     * reloc = relocs + AST_FILE_RELOC_WORDS * r;
+        size_t         slot  = (size_t)(reloc[0] >> 3) * 4;
+        ast_file_reloc kind  = reloc[0] & AST_FILE_RELOC_KIND;
+        uintptr_t      value;
+        void         * ptr   = NULL;
+
+        if(kind == AST_RELOC_LOCATION)
+        {
+            continue;
+        }
+
+        memcpy(&value, image + slot, sizeof(value));
+
+        switch(kind)
+        {
+            case AST_RELOC_NODE:
+                ptr = image + value;
+                break;
+            case AST_RELOC_STRING:
+                ptr = string_text + string_offsets[value];
+                break;
+            case AST_RELOC_INTERNED:
+                if(interned[value] == NULL)
+                {
+                    interned[value] =
+                        ast_intern(string_text + string_offsets[value]);
+                }
+                ptr = interned[value];
+                break;
+            case AST_RELOC_ARENA:
+                ptr = tree -> arena;
+                break;
+            default:
+                break;
+        }
+
+        memcpy(image + slot, &ptr, sizeof(ptr));
+    }
+}
+
+/*!
+@brief Renumbers every location of a loaded image to match the table of
+the tree loaded into.
+*/
+static void ast_ser_apply_locations(
+    char                * image,
+    uint32_t            * relocs,
+    size_t                reloc_count,
+    ast_location        * location_map
+){
+    size_t r;
+
+    for(r = 0; r < reloc_count; r ++)
+    {
+        uint32_t * reloc = relocs + AST_FILE_RELOC_WORDS * r;
+        size_t     slot  = (size_t)(reloc[0] >> 3) * 4;
+
+        if((reloc[0] & AST_FILE_RELOC_KIND) == AST_RELOC_LOCATION)
+        {
+            ast_location location;
+
+            memcpy(&location, image + slot, sizeof(location));
+            memcpy(image + slot, &location_map[location], sizeof(location));
+        }
+    }
+}
+
+/*!
+@brief Adds the locations of a tree file to the location table of a tree.
+@returns A table giving the new number of each location in the file, or
+NULL if an entry is not valid.
+*/
+static ast_location * ast_ser_add_locations(
+    verilog_source_tree * tree,
+    uint32_t            * locations,
+    size_t                location_count,
+    uint32_t            * string_offsets,
+    char                * string_text,
+    size_t                string_count
+){
+    ast_location * tr = ast_arena_calloc(tree -> arena, location_count,
+                                         sizeof(ast_location));
+    size_t         i;
+
+    // Checked first, so nothing is added for a file which is not valid.
+    for(i = 1; i < location_count; i ++)
+    {
+        uint32_t * entry = locations + AST_FILE_LOCATION_WORDS * (i - 1);
+
+        if((entry[0] != AST_FILE_NONE && entry[0] >= string_count) ||
+           entry[2] >= location_count)
+        {
+            return NULL;
+        }
+    }
+
+    for(i = 1; i < location_count; i ++)
+    {
+        uint32_t * entry = locations + AST_FILE_LOCATION_WORDS * (i - 1);
+        char     * file  = entry[0] == AST_FILE_NONE ? NULL :
+                           ast_intern(string_text + string_offsets[entry[0]]);
+
+        tr[i] = ast_location_add(tree -> locations, file, entry[1], 0);
+
+        if(tr[i] == 0)
+        {
+            return NULL;
+        }
+    }
+
+    // An expansion may be numbered after the location it expands, so they
+    // are only linked once every location has been added.
+    for(i = 1; i < location_count; i ++)
+    {
+        uint32_t expansion = locations[AST_FILE_LOCATION_WORDS * (i-1) + 2];
+
+        if(expansion != 0)
+        {
+            ast_location_get(tree -> locations, tr[i]) -> expansion =
+                tr[expansion];
+        }
+    }
+
+    return tr;
+}
+
+//! Appends every item of one list to another.
+static void ast_ser_append_all(
+    ast_list * to,
+    ast_list * items
+){
+    unsigned int i;
+
+    for(i = 0; i < items -> items; i ++)
+    {
+        ast_list_append(to, ast_list_get(items, i));
+    }
+}
+
+int verilog_source_tree_load_into(
+    verilog_source_tree * tree,
+    char                * path
+){
+    FILE * fh = fopen(path, "rb");
+
+    if(fh == NULL)
+    {
+        return -1;
+    }
+
+    fseek(fh, 0, SEEK_END);
+    long length = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+
+    size_t   size   = length > 0 ? length : 0;
+    size_t   offset = 4 + AST_FILE_HEADER_WORDS * sizeof(uint32_t);
+    uint32_t header[AST_FILE_HEADER_WORDS];
+
+    if(size < offset)
+    {
+        fclose(fh);
+        return -1;
+    }
+
+    // The whole file goes into the tree's arena with one read, and stays
+    // there. The image is patched in place, and becomes the nodes.
+    char * data = ast_arena_calloc(tree -> arena, size, 1);
+
+    if(data == NULL || fread(data, 1, size, fh) != size ||
+       memcmp(data, AST_FILE_MAGIC, 4) != 0)
+    {
+        fclose(fh);
+        return -1;
+    }
+
+    fclose(fh);
+    memcpy(header, data + 4, sizeof(header));
+
+    size_t strings     = header[AST_FILE_HEADER_STRINGS];
+    size_t text_size   = header[AST_FILE_HEADER_STRING_BYTES];
+    size_t loc_count   = header[AST_FILE_HEADER_LOCATIONS];
+    size_t mod_count   = header[AST_FILE_HEADER_MODULES];
+    size_t image_size  = header[AST_FILE_HEADER_IMAGE_SIZE];
+    size_t reloc_count = header[AST_FILE_HEADER_RELOCATIONS];
+
+    size_t text_at   = offset + strings * sizeof(uint32_t);
+    size_t loc_at    = ast_ser_round(text_at + text_size, sizeof(uint32_t));
+    size_t mod_at    = loc_at + (loc_count > 0 ? loc_count - 1 : 0) *
+                       AST_FILE_LOCATION_WORDS * sizeof(uint32_t);
+    size_t image_at  = ast_ser_round(mod_at + mod_count *
+                       AST_FILE_MODULE_WORDS * sizeof(uint32_t),
+                       AST_ARENA_ALIGN);
+    size_t reloc_at  = image_at + image_size;
+
+    // Each count is a 32 bit word, so none of these sums can overflow.
+    if(header[AST_FILE_HEADER_VERSION]      != AST_FILE_VERSION    ||
+       header[AST_FILE_HEADER_BYTE_ORDER]   != AST_FILE_BYTE_ORDER ||
+       header[AST_FILE_HEADER_POINTER_SIZE] != sizeof(void*)       ||
+       header[AST_FILE_HEADER_LAYOUT]       != ast_ser_layout_hash() ||
+       loc_count == 0 ||
+       reloc_at + reloc_count * AST_FILE_RELOC_WORDS * sizeof(uint32_t) !=
+       size ||
+       (text_size > 0 && data[text_at + text_size - 1] != '\0'))
+    {
+        return -1;
+    }
+
+    uint32_t * string_offsets = (uint32_t*)(data + offset);
+    uint32_t * locations      = (uint32_t*)(data + loc_at);
+    uint32_t * modules        = (uint32_t*)(data + mod_at);
+    uint32_t * relocs         = (uint32_t*)(data + reloc_at);
+    char     * text           = data + text_at;
+    char     * image          = data + image_at;
+    ast_list * roots[5];
+    size_t     i;
+
+    for(i = 0; i < strings; i ++)
+    {
+        if(string_offsets[i] >= text_size)
+        {
+            return -1;
+        }
+    }
+
+    for(i = 0; i < mod_count; i ++)
+    {
+        uint32_t * entry = modules + AST_FILE_MODULE_WORDS * i;
+
+        if((entry[0] != AST_FILE_NONE && entry[0] >= strings) ||
+           (entry[1] != AST_FILE_NONE && entry[1] >= image_size))
+        {
+            return -1;
+        }
+    }
+
+    // The roots are walked as they are added to the tree, so their items
+    // must lie within the image too.
+    for(i = 0; i < 5; i ++)
+    {
+        if(ast_ser_check_list(image, image_size,
+                              header[AST_FILE_HEADER_MODULE_LIST + i]) != 0)
+        {
+            return -1;
+        }
+    }
+
+    // Everything is checked before any location is added, so that a file
+    // which is refused leaves nothing behind in the tree.
+    if(ast_ser_check_relocations(image, image_size, relocs, reloc_count,
+                                 strings, loc_count) != 0)
+    {
+        return -1;
+    }
+
+    ast_ser_apply_relocations(tree, image, relocs, reloc_count,
+                              string_offsets, text, strings);
+
+    for(i = 0; i < 5; i ++)
+    {
+        roots[i] = (ast_list*)(image + header[AST_FILE_HEADER_MODULE_LIST + i]);
+    }
+
+    if(roots[0] -> items != mod_count)
+    {
+        return -1;
+    }
+
+    for(i = 0; i < roots[4] -> items; i ++)
+    {
+        verilog_source_file * file = ast_list_get(roots[4], i);
+
+        if(file == NULL || file -> path == NULL)
+        {
+            return -1;
+        }
+    }
+
+    ast_location * location_map = ast_ser_add_locations(tree, locations,
+                                    loc_count, string_offsets, text, strings);
+
+    if(location_map == NULL)
+    {
+        return -1;
+    }
+
+    ast_ser_apply_locations(image, relocs, reloc_count, location_map);
+
+    // Nothing has been added to the tree's constructs so far. Everything
+    // from here on succeeds.
+    verilog_source_tree_index_modules(tree);
+
+    ast_arena * prev = ast_set_current_arena(tree -> arena);
+
+    ast_ser_append_all(tree -> modules,    roots[0]);
+    ast_ser_append_all(tree -> primitives, roots[1]);
+    ast_ser_append_all(tree -> configs,    roots[2]);
+    ast_ser_append_all(tree -> libraries,  roots[3]);
+
+    for(i = 0; i < mod_count; i ++)
+    {
+        uint32_t * entry = modules + AST_FILE_MODULE_WORDS * i;
+
+        if(entry[0] == AST_FILE_NONE || entry[1] == AST_FILE_NONE)
+        {
+            continue;
+        }
+
+        // As with verilog_source_tree_index_modules, the first module of a
+        // name keeps the entry.
+        ast_hashtable_insert(tree -> module_index,
+                             text + string_offsets[entry[0]],
+                             image + entry[1]);
+    }
+
+    tree -> indexed_modules = tree -> modules -> items;
+
+    for(i = 0; i < roots[4] -> items; i ++)
+    {
+        verilog_source_file * file     = ast_list_get(roots[4], i);
+        verilog_source_file * existing =
+            verilog_source_tree_find_file(tree, file -> path);
+
+        if(existing == NULL)
+        {
+            ast_list_append(tree -> files, file);
+            ast_hashtable_insert(tree -> file_index, file -> path, file);
+            continue;
+        }
+
+        // The file's constructs follow those already recorded for it, in
+        // the same order as they now appear in the tree.
+        ast_ser_append_all(existing -> modules,    file -> modules);
+        ast_ser_append_all(existing -> primitives, file -> primitives);
+        ast_ser_append_all(existing -> configs,    file -> configs);
+        ast_ser_append_all(existing -> libraries,  file -> libraries);
+        existing -> content_hash = file -> content_hash;
+        existing -> preproc_hash = file -> preproc_hash;
+        existing -> entry_state  = NULL;
+    }
+
+    ast_set_current_arena(prev);
+
+    return 0;
+}
+
+verilog_source_tree * verilog_source_tree_load(
+    char * path
+){
+    verilog_source_tree * tree = verilog_new_source_tree();
+
+    if(verilog_source_tree_load_into(tree, path) != 0)
+    {
+        verilog_free_source_tree(tree);
+        return NULL;
+    }
+
+    return tree;
+}
@@ -0,0 +1,98 @@
+/*!
+@file verilog_ast_serialise.h
+@brief Declares functions which save parsed source trees to files, and load
+       them back again.
+*/
+
+#include "verilog_ast.h"
+
+#ifndef VERILOG_AST_SERIALISE_H
+#define VERILOG_AST_SERIALISE_H
+
+/*!
+@defgroup ast-serialise Saving & Loading Source Trees
+@{
+@ingroup ast-utility
+@brief Lets a design be parsed once, and then loaded by any number of tools
+without lexing or parsing it again.
+@details A saved tree is an image of every node, list and string reachable
+from the tree, in which each pointer has been replaced by the offset of what
+it points to. Strings are kept once each, in a table, and identifiers are
+interned again as they are loaded. The file also holds the table of
+locations, so every node keeps its location, and an index of the modules,
+giving the name of each and the range of the image its nodes were written
+to. Only the locations used by the nodes written are kept, and they are
+numbered again as they are added to the table of the tree loaded into.
+
+Loading reads the whole file with a single read, into the arena of the
+tree, and then patches each pointer in place from a list of relocations.
+No node is copied or allocated on its own.
+
+@note Tree files are written in the byte order of the machine, with its
+pointer size and structure layout, and are meant to be loaded by the same
+build of the library. Anything else is refused when loading. The contents
+of a file are otherwise trusted, so files should only be loaded from a
+place the program itself writes to.
+*/
+
+/*!
+@brief Saves a source tree, and everything reachable from it, to a file.
+@details Modules which instances have been resolved to by
+@ref verilog_resolve_modules are saved too, even if they belong to another
+tree, so the resolved instances are still resolved once the tree is loaded.
+The record of which file each construct came from is saved too, so that
+@ref verilog_reparse_path_ctx can replace the constructs of a changed file
+in a loaded tree.
+@returns Zero on success, or -1 if the file could not be written.
+*/
+int verilog_source_tree_save(
+    verilog_source_tree * tree, //!< The tree to save.
+    char                * path  //!< Where to write the tree.
+);
+
+/*!
+@brief Saves the constructs parsed from one file of a source tree, so that
+they can later be loaded into another tree.
+@details Unlike @ref verilog_source_tree_save, instances resolved to a
+module are saved naming the module instead, so the file holds nothing but
+what was parsed from the source file. The record of the source file is
+saved with them.
+@returns Zero on success, or -1 if the file could not be written.
+*/
+int verilog_source_file_save(
+    verilog_source_tree * tree, //!< The tree the file was parsed into.
+    verilog_source_file * file, //!< The record of the file to save.
+    char                * path  //!< Where to write the constructs.
+);
+
+/*!
+@brief Loads a file written by @ref verilog_source_tree_save or
+@ref verilog_source_file_save, adding everything in it to an existing tree.
+@details The constructs are appended to the lists of the tree, as if they
+had just been parsed into it, and the records of their source files are
+added to it. A record for a file the tree already has takes the hashes of
+the loaded one.
+@returns Zero on success, or -1 if the file could not be read or is not a
+valid tree file, in which case the constructs of the tree are unchanged.
+*/
+int verilog_source_tree_load_into(
+    verilog_source_tree * tree, //!< The tree to add to.
+    char                * path  //!< The tree file to load.
+);
+
+/*!
+@brief Creates a new source tree, holding the tree saved in a file by
+@ref verilog_source_tree_save.
+@details The tree owns all of its memory, just like a tree which was
+parsed, and is released with @ref verilog_free_source_tree. More files can
+be parsed into it afterwards.
+@returns The new tree, or NULL if the file could not be read or is not a
+valid tree file.
+*/
+verilog_source_tree * verilog_source_tree_load(
+    char * path //!< The tree file to load.
+);
+
+/*! @} */
+
+#endif
@@ -13,6 +13,8 @@
 /*!
 @brief Searches the list of modules in the parsed source tree, returning the
 one that matches the passed identifer.
+@details Uses the source tree's index of modules by name, so this takes
+constant time rather than being linear in the number of modules.
 @returns The matching module declaration, or NULL if no such declaration
 exists.
 */
@@ -20,18 +22,24 @@ ast_module_declaration * verilog_find_module_declaration(
     verilog_source_tree * source,
     ast_identifier module_name
 ){
-    unsigned int m;
-    for(m = 0; m < source -> modules -> items; m++)
+    if(module_name == NULL)
     {
-        ast_module_declaration * candidate = ast_list_get(source -> modules,m);
+        return NULL;
+    }
 
-        if(ast_identifier_cmp(module_name, candidate -> identifier) == 0)
-        {
-            return candidate;
-        }
+    verilog_source_tree_index_modules(source);
+
+    char * key = module_name -> next == NULL ?
+                    module_name -> identifier :
+                    ast_identifier_tostring(module_name);
+
+    void * tr = NULL;
+    if(ast_hashtable_get(source -> module_index, key, &tr) != HASH_SUCCESS)
+    {
+        return NULL;
     }
 
-    return NULL;
+    return tr;
 }
 
 
@@ -45,6 +53,9 @@ void verilog_resolve_modules(
     assert(source != NULL);
     assert(source -> modules != NULL);
 
+    // Any scratch memory belongs to the tree being resolved.
+    ast_arena * prev = ast_set_current_arena(source -> arena);
+
     int resolved = 0;
     int unresolved = 0;
 
@@ -99,6 +110,8 @@ void verilog_resolve_modules(
     }
     //printf("Resolved Modules: %d\t Unresolved Modules: %d\n", 
     //    resolved,unresolved);
+
+    ast_set_current_arena(prev);
 }
 
 
@@ -165,7 +178,8 @@ to which the passed module belongs.
 ast_hashtable * verilog_modules_get_children(
     verilog_source_tree * source
 ){
-    ast_hashtable * tr = ast_hashtable_new();
+    ast_arena     * prev = ast_set_current_arena(source -> arena);
+    ast_hashtable * tr   = ast_hashtable_new();
 
     unsigned int m;
     for(m = 0; m < source -> modules -> items; m++)
@@ -179,5 +193,6 @@ ast_hashtable * verilog_modules_get_children(
         ast_hashtable_insert(tr,key,children);
     }
 
+    ast_set_current_arena(prev);
     return tr;
 }
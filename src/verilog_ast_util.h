@@ -30,6 +30,8 @@ void verilog_resolve_modules(
 /*!
 @brief Searches the list of modules in the parsed source tree, returning the
 one that matches the passed identifer.
+@details Looks the name up in the source tree's module index, in constant
+time.
 @returns The matching module declaration, or NULL if no such declaration
 exists.
 */
@@ -60,7 +62,8 @@ ast_list * verilog_module_get_children(
 /*!
 @brief Finds the child modules for all modules in a source tree.
 @returns A hash table, keyed by the module identifiers, of lists of
-module children.
+module children. These are allocated from, and freed along with, the
+source tree.
 @pre The verilog_resolve_modules function has been called on the source tree
 to which the passed module belongs.
 @see verilog_module_get_children
@@ -0,0 +1,205 @@
+/*!
+@file verilog_diagnostics.c
+@brief Contains definitions of functions which report, buffer and hand on
+       diagnostics.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "verilog_diagnostics.h"
+
+verilog_diagnostics * yy_diagnostics = NULL;
+
+//! Entries of items allocated when the first diagnostic is buffered.
+#define VERILOG_DIAGNOSTICS_INITIAL 16
+
+//! Names of each severity, in the order of verilog_severity.
+static const char * verilog_severity_names[VERILOG_SEVERITY_COUNT] = {
+    "note",
+    "warning",
+    "error"
+};
+
+//! Names of each code, in the order of verilog_diagnostic_code.
+static const char * verilog_diagnostic_code_names[DIAG_CODE_COUNT] = {
+    "syntax-error",
+    "unsupported",
+    "include-not-found",
+    "macro-arguments",
+    "macro-no-arguments",
+    "macro-too-deep",
+    "elsif-without-ifdef",
+    "else-without-ifdef",
+    "endif-without-ifdef",
+    "memory-released",
+    "input-too-large"
+};
+
+verilog_diagnostics * verilog_diagnostics_new()
+{
+    verilog_diagnostics * tr = calloc(1, sizeof(verilog_diagnostics));
+
+    if(tr != NULL)
+    {
+        tr -> enabled = AST_TRUE;
+    }
+
+    return tr;
+}
+
+void verilog_diagnostics_free(
+    verilog_diagnostics * tofree
+){
+    if(tofree == NULL)
+    {
+        return;
+    }
+
+    verilog_diagnostics_clear(tofree);
+    free(tofree -> items);
+    free(tofree);
+}
+
+void verilog_diagnostics_set_sink(
+    verilog_diagnostics     * diags,
+    verilog_diagnostic_sink   sink,
+    void                    * data
+){
+    diags -> sink      = sink;
+    diags -> sink_data = data;
+}
+
+void verilog_diagnostics_clear(
+    verilog_diagnostics * diags
+){
+    unsigned int i;
+
+    for(i = 0; i < diags -> count; i ++)
+    {
+        free(diags -> items[i].message);
+    }
+
+    diags -> count = 0;
+}
+
+void verilog_diagnostics_add(
+    verilog_diagnostics     * diags,
+    verilog_severity          severity,
+    verilog_diagnostic_code   code,
+    ast_location              location,
+    const char              * format,
+    ...
+){
+    va_list            args;
+    int                length;
+    verilog_diagnostic diagnostic;
+
+    va_start(args, format);
+    length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if(length < 0)
+    {
+        length = 0;
+    }
+
+    diagnostic.severity = severity;
+    diagnostic.code     = code;
+    diagnostic.location = location;
+    diagnostic.message  = malloc((size_t)length + 1);
+
+    if(diagnostic.message == NULL)
+    {
+        return;
+    }
+
+    va_start(args, format);
+    vsnprintf(diagnostic.message, (size_t)length + 1, format, args);
+    va_end(args);
+
+    if(severity < VERILOG_SEVERITY_COUNT)
+    {
+        diags -> counts[severity] ++;
+    }
+
+    if(diags -> sink != NULL)
+    {
+        diags -> sink(diags, &diagnostic, diags -> sink_data);
+        free(diagnostic.message);
+        return;
+    }
+
+    if(diags -> count == diags -> capacity)
+    {
+        unsigned int         capacity = diags -> capacity == 0 ?
+                                        VERILOG_DIAGNOSTICS_INITIAL :
+                                        diags -> capacity * 2;
+        verilog_diagnostic * items    = realloc(diags -> items,
+                                        capacity * sizeof(verilog_diagnostic));
+        if(items == NULL)
+        {
+            free(diagnostic.message);
+            return;
+        }
+
+        diags -> items    = items;
+        diags -> capacity = capacity;
+    }
+
+    diags -> items[diags -> count ++] = diagnostic;
+}
+
+void verilog_diagnostics_replay(
+    verilog_diagnostics * into,
+    verilog_diagnostics * from
+){
+    unsigned int i;
+
+    for(i = 0; i < from -> count; i ++)
+    {
+        verilog_diagnostic * d = &from -> items[i];
+
+        VERILOG_DIAGNOSE(into, d -> severity, d -> code, d -> location,
+                         "%s", d -> message);
+    }
+
+    verilog_diagnostics_clear(from);
+}
+
+ast_location verilog_diagnostics_location(
+    verilog_diagnostics * diags,
+    char                * file,
+    unsigned int          line
+){
+    if(diags == NULL || diags -> locations == NULL)
+    {
+        return 0;
+    }
+
+    return ast_location_add(diags -> locations, file, line, 0);
+}
+
+const char * verilog_severity_name(
+    verilog_severity severity
+){
+    if(severity >= VERILOG_SEVERITY_COUNT)
+    {
+        return "unknown";
+    }
+
+    return verilog_severity_names[severity];
+}
+
+const char * verilog_diagnostic_code_name(
+    verilog_diagnostic_code code
+){
+    if(code >= DIAG_CODE_COUNT)
+    {
+        return "unknown";
+    }
+
+    return verilog_diagnostic_code_names[code];
+}
@@ -0,0 +1,194 @@
+/*!
+@file verilog_diagnostics.h
+@brief Declares the structures and functions through which the library
+       reports errors, warnings and notes.
+*/
+
+#include "verilog_ast.h"
+
+#ifndef VERILOG_DIAGNOSTICS_H
+#define VERILOG_DIAGNOSTICS_H
+
+/*!
+@defgroup diagnostics Diagnostics
+@{
+@ingroup parser-api
+@brief Errors, warnings and notes, kept as records rather than printed.
+@details The library does not print the problems it finds. Each one is
+instead reported to a verilog_diagnostics object, as a severity,
+a code saying what sort of problem it is, the location it was found at and
+a message. Each parser context has one of its own, and the functions which
+take no context report to @ref yy_diagnostics.
+
+Diagnostics are buffered until they are read and cleared, unless a sink is
+installed, in which case each is handed to the sink as it is reported and
+not kept. When a diagnostics object is disabled, nothing is reported to it
+at all, and a report costs a single test. No location is recorded, and no
+message is formatted.
+*/
+
+//! How serious a diagnostic is.
+typedef enum verilog_severity_e{
+    VERILOG_SEVERITY_NOTE    = 0, //!< Information only.
+    VERILOG_SEVERITY_WARNING = 1, //!< Suspect, but the input is still used.
+    VERILOG_SEVERITY_ERROR   = 2, //!< Some of the input could not be used.
+    VERILOG_SEVERITY_COUNT   = 3
+} verilog_severity;
+
+//! What sort of problem a diagnostic describes.
+typedef enum verilog_diagnostic_code_e{
+    DIAG_SYNTAX_ERROR         = 0,  //!< The parser found a syntax error.
+    DIAG_UNSUPPORTED          = 1,  //!< A construct which is not supported.
+    DIAG_INCLUDE_NOT_FOUND    = 2,  //!< An include file could not be found.
+    DIAG_MACRO_ARGUMENTS      = 3,  //!< Wrong number of macro arguments.
+    DIAG_MACRO_NO_ARGUMENTS   = 4,  //!< Macro with parameters used without.
+    DIAG_MACRO_TOO_DEEP       = 5,  //!< Macros nested too deeply.
+    DIAG_ELSIF_WITHOUT_IFDEF  = 6,  //!< An `elsif with no `ifdef open.
+    DIAG_ELSE_WITHOUT_IFDEF   = 7,  //!< An `else with no `ifdef open.
+    DIAG_ENDIF_WITHOUT_IFDEF  = 8,  //!< An `endif with no `ifdef open.
+    DIAG_MEMORY_RELEASED      = 9,  //!< What ast_free_all released.
+    DIAG_INPUT_TOO_LARGE      = 10, //!< A file too long to scan.
+    DIAG_CODE_COUNT           = 11
+} verilog_diagnostic_code;
+
+//! One error, warning or note.
+typedef struct verilog_diagnostic_t{
+    verilog_severity        severity; //!< How serious it is.
+    verilog_diagnostic_code code;     //!< What sort of problem it is.
+    ast_location            location; //!< Where it was found, or zero.
+    char                  * message;  //!< Says what was found.
+} verilog_diagnostic;
+
+typedef struct verilog_diagnostics_t verilog_diagnostics;
+
+/*!
+@brief Receives diagnostics as they are reported.
+@param [in] diags - The object they were reported to, whose locations
+table the location of the diagnostic refers to.
+@param [in] diagnostic - Only valid until the sink returns.
+@param [in] data - The pointer given to @ref verilog_diagnostics_set_sink
+*/
+typedef void (*verilog_diagnostic_sink)(
+    verilog_diagnostics      * diags,
+    const verilog_diagnostic * diagnostic,
+    void                     * data
+);
+
+/*!
+@brief Collects the diagnostics of a parser context.
+@details A diagnostics object is only ever used by one thread at a time,
+just like the parser context it belongs to.
+*/
+struct verilog_diagnostics_t{
+    ast_boolean             enabled;   //!< Nothing is reported if false.
+    verilog_diagnostic    * items;     //!< Buffered diagnostics, in order.
+    unsigned int            count;     //!< Entries of items used.
+    unsigned int            capacity;  //!< Entries of items allocated.
+    unsigned long           counts[VERILOG_SEVERITY_COUNT]; //!< Reported.
+    verilog_diagnostic_sink sink;      //!< Takes diagnostics, or NULL.
+    void                  * sink_data; //!< Passed to the sink.
+    ast_location_table    * locations; //!< Where locations are recorded.
+};
+
+/*!
+@brief The diagnostics of the functions which take no parser context.
+@details Created by @ref verilog_parser_init. Also receives the
+diagnostics of every file parsed by @ref verilog_parse_files, and the
+note from @ref ast_free_all.
+*/
+extern verilog_diagnostics * yy_diagnostics;
+
+//! Creates a new, empty and enabled, diagnostics object.
+verilog_diagnostics * verilog_diagnostics_new();
+
+//! Frees a diagnostics object, and every diagnostic buffered in it.
+void verilog_diagnostics_free(
+    verilog_diagnostics * tofree
+);
+
+/*!
+@brief Installs a sink, which takes every diagnostic reported from now on
+instead of it being buffered.
+@param [in] sink - The sink, or NULL to buffer diagnostics again.
+@param [in] data - Passed to every call of the sink.
+*/
+void verilog_diagnostics_set_sink(
+    verilog_diagnostics     * diags,
+    verilog_diagnostic_sink   sink,
+    void                    * data
+);
+
+/*!
+@brief Reports every diagnostic buffered in one object to another, in the
+order they were reported, then forgets them.
+@details Both objects must record their locations in the same table.
+@param [inout] into - Where to report them. May be NULL, or disabled, in
+which case they are just forgotten.
+*/
+void verilog_diagnostics_replay(
+    verilog_diagnostics * into,
+    verilog_diagnostics * from
+);
+
+//! Forgets every buffered diagnostic. The counts are kept.
+void verilog_diagnostics_clear(
+    verilog_diagnostics * diags
+);
+
+/*!
+@brief Reports a diagnostic. Use @ref VERILOG_DIAGNOSE rather than calling
+this directly, so that nothing is done when diagnostics are disabled.
+@param [in] format - A printf style format for the message.
+*/
+void verilog_diagnostics_add(
+    verilog_diagnostics     * diags,
+    verilog_severity          severity,
+    verilog_diagnostic_code   code,
+    ast_location              location,
+    const char              * format,
+    ...
+)
+#ifdef __GNUC__
+__attribute__((format(printf, 5, 6)))
+#endif
+;
+
+/*!
+@brief Records the location of a line of a file in the locations table of a
+diagnostics object.
+@returns The location, or zero if the object has no locations table.
+*/
+ast_location verilog_diagnostics_location(
+    verilog_diagnostics * diags,
+    char                * file, //!< Interned, or NULL.
+    unsigned int          line
+);
+
+//! Returns the name of a severity, such as "error".
+const char * verilog_severity_name(
+    verilog_severity severity
+);
+
+//! Returns the name of a diagnostic code, such as "syntax-error".
+const char * verilog_diagnostic_code_name(
+    verilog_diagnostic_code code
+);
+
+/*!
+@brief Reports a diagnostic, if diags is not NULL and is enabled.
+@details The location and message arguments are only evaluated if the
+diagnostic is reported.
+*/
+#define VERILOG_DIAGNOSE(diags, severity, code, location, ...)              \
+    do{                                                                     \
+        verilog_diagnostics * diagnose_to_ = (diags);                       \
+        if(diagnose_to_ != NULL && diagnose_to_ -> enabled)                 \
+        {                                                                   \
+            verilog_diagnostics_add(diagnose_to_, severity, code,           \
+                                    location, __VA_ARGS__);                 \
+        }                                                                   \
+    } while(0)
+
+/*! @} */
+
+#endif
@@ -0,0 +1,462 @@
+/*!
+@file verilog_parse_cache.c
+@brief Contains definitions of functions which keep parsed files in a cache
+       directory, and load them back again.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "verilog_ast_serialise.h"
+#include "verilog_parse_cache.h"
+
+//! First line of every manifest, followed by whether a cell define is open.
+#define VERILOG_CACHE_MANIFEST "VDEP 1"
+
+//! Longest manifest line read, including the path of an include.
+#define VERILOG_CACHE_LINE     4096
+
+//! One included file, as listed by the manifest of an entry.
+typedef struct verilog_cache_include_t{
+    uint64_t       hash;    //!< Hash of the contents when the entry was made.
+    unsigned int   line;    //!< Line of the include directive.
+    char           path[VERILOG_CACHE_LINE]; //!< Where it was found.
+} verilog_cache_include;
+
+verilog_parse_cache * verilog_parse_cache_new(
+    char * dir
+){
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST)
+    {
+        return NULL;
+    }
+
+    verilog_parse_cache * tr = calloc(1, sizeof(verilog_parse_cache));
+
+    if(tr == NULL || (tr -> dir = strdup(dir)) == NULL)
+    {
+        free(tr);
+        return NULL;
+    }
+
+    pthread_mutex_init(&tr -> lock, NULL);
+
+    return tr;
+}
+
+void verilog_parse_cache_free(
+    verilog_parse_cache * tofree
+){
+    if(tofree == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_destroy(&tofree -> lock);
+    free(tofree -> dir);
+    free(tofree);
+}
+
+uint64_t verilog_parse_cache_key(
+    char     * path,
+    uint64_t   content_hash,
+    uint64_t   preproc_hash
+){
+    uint64_t tr = ast_hash_bytes(AST_HASH_SEED, path, strlen(path) + 1);
+
+    tr = ast_hash_bytes(tr, &content_hash, sizeof(content_hash));
+    tr = ast_hash_bytes(tr, &preproc_hash, sizeof(preproc_hash));
+
+    return tr;
+}
+
+//! Returns the path of one file of an entry, which the caller frees.
+static char * verilog_parse_cache_path(
+    verilog_parse_cache * cache,
+    uint64_t              key,
+    char                * suffix
+){
+    size_t length = strlen(cache -> dir) + 32;
+    char * tr     = malloc(length);
+
+    if(tr != NULL)
+    {
+        snprintf(tr, length, "%s/%016" PRIx64 "%s", cache -> dir, key,
+                 suffix);
+    }
+
+    return tr;
+}
+
+/*!
+@brief Hashes the contents of an included file, reading it through the
+include cache where there is one.
+@returns Zero on success, or -1 if the file could not be read.
+*/
+static int verilog_parse_cache_hash_file(
+    verilog_include_cache * includes,
+    char                  * path,
+    uint64_t              * hash
+){
+    if(includes != NULL)
+    {
+        verilog_include_file * file =
+            verilog_include_cache_read(includes, ast_intern(path));
+
+        if(file == NULL)
+        {
+            return -1;
+        }
+
+        *hash = ast_hash_bytes(AST_HASH_SEED, file -> data, file -> size);
+        return 0;
+    }
+
+    FILE * fh = fopen(path, "rb");
+    char   buffer[BUFSIZ];
+    size_t read;
+
+    if(fh == NULL)
+    {
+        return -1;
+    }
+
+    *hash = AST_HASH_SEED;
+    while((read = fread(buffer, 1, sizeof(buffer), fh)) > 0)
+    {
+        *hash = ast_hash_bytes(*hash, buffer, read);
+    }
+
+    int tr = ferror(fh) ? -1 : 0;
+    fclose(fh);
+
+    return tr;
+}
+
+/*!
+@brief Reads the manifest of an entry, checking every include it lists.
+@param [out] cell_define - Whether a cell define was left open.
+@param [out] count - The number of includes listed.
+@returns The includes, which the caller frees, or NULL if there is no
+manifest, it is not valid, or an include has changed. A manifest with no
+includes gives an array of one unused entry.
+*/
+static verilog_cache_include * verilog_parse_cache_read_manifest(
+    char                  * path,
+    verilog_include_cache * includes,
+    ast_boolean           * cell_define,
+    unsigned int          * count
+){
+    FILE * fh = fopen(path, "r");
+    char   line[VERILOG_CACHE_LINE + 64];
+    int    open_define;
+
+    if(fh == NULL)
+    {
+        return NULL;
+    }
+
+    if(fgets(line, sizeof(line), fh) == NULL ||
+       strncmp(line, VERILOG_CACHE_MANIFEST " ",
+               sizeof(VERILOG_CACHE_MANIFEST)) != 0 ||
+       sscanf(line + sizeof(VERILOG_CACHE_MANIFEST), "%d", &open_define) != 1)
+    {
+        fclose(fh);
+        return NULL;
+    }
+
+    verilog_cache_include * tr       = malloc(sizeof(verilog_cache_include));
+    unsigned int            capacity = 1;
+    int                     failed   = tr == NULL;
+
+    *count       = 0;
+    *cell_define = open_define ? AST_TRUE : AST_FALSE;
+
+    while(!failed && fgets(line, sizeof(line), fh) != NULL)
+    {
+        verilog_cache_include * entry;
+        uint64_t                hash;
+        int                     at;
+
+        if(*count == capacity)
+        {
+            capacity *= 2;
+            entry = realloc(tr, capacity * sizeof(verilog_cache_include));
+            if(entry == NULL)
+            {
+                failed = 1;
+                break;
+            }
+            tr = entry;
+        }
+
+        entry = &tr[*count];
+        line[strcspn(line, "\n")] = '\0';
+
+        if(sscanf(line, "%" SCNx64 " %u %n", &entry -> hash, &entry -> line,
+                  &at) != 2 || line[at] == '\0')
+        {
+            failed = 1;
+            break;
+        }
+
+        strcpy(entry -> path, line + at);
+
+        failed = verilog_parse_cache_hash_file(includes, entry -> path,
+                                               &hash) != 0 ||
+                 hash != entry -> hash;
+        *count += 1;
+    }
+
+    fclose(fh);
+
+    if(failed)
+    {
+        free(tr);
+        return NULL;
+    }
+
+    return tr;
+}
+
+/*!
+@brief Copies the include directories, include cache and include
+directives of one preprocessor context into another.
+*/
+static void verilog_parse_cache_carry(
+    verilog_preprocessor_context * from,
+    verilog_preprocessor_context * to
+){
+    ast_arena * prev = ast_set_current_arena(to -> arena);
+    unsigned int i;
+
+    to -> search_dirs   = ast_list_new();
+    to -> include_cache = from -> include_cache;
+
+    for(i = 0; i < from -> search_dirs -> items; i ++)
+    {
+        ast_list_append(to -> search_dirs, ast_arena_strdup(to -> arena,
+                        ast_list_get(from -> search_dirs, i)));
+    }
+
+    for(i = 0; i < from -> includes -> items; i ++)
+    {
+        verilog_include_directive * old = ast_list_get(from -> includes, i);
+        verilog_include_directive * copy =
+            ast_arena_calloc(to -> arena, 1, sizeof(verilog_include_directive));
+
+        *copy = *old;
+        copy -> filename = ast_arena_strdup(to -> arena, old -> filename);
+        ast_list_append(to -> includes, copy);
+    }
+
+    ast_set_current_arena(prev);
+}
+
+int verilog_parse_cache_fetch(
+    verilog_parse_cache           * cache,
+    uint64_t                        key,
+    char                          * path,
+    verilog_source_tree           * tree,
+    verilog_preprocessor_context ** preproc
+){
+    char * manifest = verilog_parse_cache_path(cache, key, ".deps");
+    char * snapshot = verilog_parse_cache_path(cache, key, ".vpps");
+    char * items    = verilog_parse_cache_path(cache, key, ".vast");
+    int    tr       = -1;
+
+    verilog_cache_include        * includes = NULL;
+    verilog_preprocessor_context * loaded   = NULL;
+    ast_boolean                    cell_define;
+    unsigned int                   count, i;
+
+    if(manifest != NULL && snapshot != NULL && items != NULL)
+    {
+        includes = verilog_parse_cache_read_manifest(manifest,
+                        (*preproc) -> include_cache, &cell_define, &count);
+    }
+
+    if(includes != NULL)
+    {
+        loaded = verilog_preprocessor_load(snapshot);
+    }
+
+    // The constructs are loaded last, since only this step changes the tree.
+    if(loaded != NULL && verilog_source_tree_load_into(tree, items) == 0)
+    {
+        verilog_parse_cache_carry(*preproc, loaded);
+
+        ast_arena * prev = ast_set_current_arena(loaded -> arena);
+
+        for(i = 0; i < count; i ++)
+        {
+            verilog_include_directive * directive = ast_arena_calloc(
+                loaded -> arena, 1, sizeof(verilog_include_directive));
+
+            directive -> filename   = ast_arena_strdup(loaded -> arena,
+                                                       includes[i].path);
+            directive -> lineNumber = includes[i].line;
+            directive -> file_found = AST_TRUE;
+            ast_list_append(loaded -> includes, directive);
+        }
+
+        ast_set_current_arena(prev);
+
+        loaded -> in_cell_define = cell_define;
+        verilog_preprocessor_set_file(loaded, path);
+
+        verilog_free_preprocessor_context(*preproc);
+        *preproc = loaded;
+        loaded   = NULL;
+        tr       = 0;
+    }
+
+    verilog_free_preprocessor_context(loaded);
+    free(includes);
+    free(manifest);
+    free(snapshot);
+    free(items);
+
+    pthread_mutex_lock(&cache -> lock);
+    cache -> hits   += tr == 0;
+    cache -> misses += tr != 0;
+    pthread_mutex_unlock(&cache -> lock);
+
+    return tr;
+}
+
+/*!
+@brief Writes one file of an entry under a temporary name, which is
+returned, malloc'd, for the caller to rename.
+*/
+static char * verilog_parse_cache_temp(
+    verilog_parse_cache * cache,
+    uint64_t              key
+){
+    char * tr = verilog_parse_cache_path(cache, key, ".XXXXXX");
+    int    fd = tr != NULL ? mkstemp(tr) : -1;
+
+    if(fd < 0)
+    {
+        free(tr);
+        return NULL;
+    }
+
+    close(fd);
+    return tr;
+}
+
+//! Moves a temporary file into place as one file of an entry.
+static int verilog_parse_cache_commit(
+    verilog_parse_cache * cache,
+    uint64_t              key,
+    char                * temp,
+    char                * suffix,
+    int                   written
+){
+    char * path = verilog_parse_cache_path(cache, key, suffix);
+    int    tr   = -1;
+
+    if(written == 0 && path != NULL && rename(temp, path) == 0)
+    {
+        tr = 0;
+    }
+    else
+    {
+        remove(temp);
+    }
+
+    free(path);
+    free(temp);
+
+    return tr;
+}
+
+//! Writes the manifest of an entry to a file.
+static int verilog_parse_cache_write_manifest(
+    char                         * path,
+    verilog_preprocessor_context * preproc,
+    unsigned int                   first_include
+){
+    FILE * fh = fopen(path, "w");
+    unsigned int i;
+
+    if(fh == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(fh, VERILOG_CACHE_MANIFEST " %d\n", preproc -> in_cell_define);
+
+    for(i = first_include; i < preproc -> includes -> items; i ++)
+    {
+        verilog_include_directive * directive =
+            ast_list_get(preproc -> includes, i);
+        uint64_t hash;
+
+        // An include which was not found, or whose path can not be listed,
+        // makes the result impossible to check later.
+        if(!directive -> file_found ||
+           strlen(directive -> filename) >= VERILOG_CACHE_LINE ||
+           strchr(directive -> filename, '\n') != NULL ||
+           verilog_parse_cache_hash_file(preproc -> include_cache,
+                                         directive -> filename, &hash) != 0)
+        {
+            fclose(fh);
+            return -1;
+        }
+
+        fprintf(fh, "%016" PRIx64 " %u %s\n", hash, directive -> lineNumber,
+                directive -> filename);
+    }
+
+    int tr = ferror(fh) ? -1 : 0;
+
+    return fclose(fh) != 0 ? -1 : tr;
+}
+
+int verilog_parse_cache_store(
+    verilog_parse_cache          * cache,
+    uint64_t                       key,
+    verilog_source_tree          * tree,
+    verilog_source_file          * file,
+    verilog_preprocessor_context * preproc,
+    unsigned int                   first_include
+){
+    char * temp;
+    int    tr;
+
+    temp = verilog_parse_cache_temp(cache, key);
+    tr   = temp == NULL ? -1 : verilog_parse_cache_commit(cache, key, temp,
+               ".vast", verilog_source_file_save(tree, file, temp));
+
+    if(tr == 0)
+    {
+        temp = verilog_parse_cache_temp(cache, key);
+        tr   = temp == NULL ? -1 : verilog_parse_cache_commit(cache, key,
+                   temp, ".vpps", verilog_preprocessor_save(preproc, temp));
+    }
+
+    // Written last, so that the entry is only ever found complete.
+    if(tr == 0)
+    {
+        temp = verilog_parse_cache_temp(cache, key);
+        tr   = temp == NULL ? -1 : verilog_parse_cache_commit(cache, key,
+                   temp, ".deps", verilog_parse_cache_write_manifest(temp,
+                                      preproc, first_include));
+    }
+
+    if(tr == 0)
+    {
+        pthread_mutex_lock(&cache -> lock);
+        cache -> stores ++;
+        pthread_mutex_unlock(&cache -> lock);
+    }
+
+    return tr;
+}
@@ -0,0 +1,125 @@
+/*!
+@file verilog_parse_cache.h
+@brief Declares a cache of parsed files, kept in a directory, which lets a
+       file that has been parsed before be loaded instead.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "verilog_ast.h"
+#include "verilog_preprocessor.h"
+
+#ifndef VERILOG_PARSE_CACHE_H
+#define VERILOG_PARSE_CACHE_H
+
+/*!
+@defgroup parse-cache On-disk Parse Cache
+@{
+@ingroup parser-api
+@brief Keeps what each file parsed to, so that parsing the same file, in
+the same way, again loads the result rather than running the scanner and
+parser.
+@details Every entry is keyed on the path of a file, a hash of its
+contents, and the hash given by @ref verilog_preprocessor_hash of the
+preprocessor state it was parsed with. An entry is kept as three files in
+the cache directory, all named after the key:
+
+- `<key>.vast` The constructs parsed from the file, as written by
+  @ref verilog_source_file_save.
+- `<key>.vpps` A snapshot of the preprocessor once the file was parsed, so
+  that macros it defined are still defined after a hit.
+- `<key>.deps` The path, line and content hash of every file it included.
+  This is written last, so an entry without one is never used.
+
+Which files are included is only known once a file has been parsed, so they
+are checked when an entry is found, rather than being part of the key. An
+entry is only used if every file it included still has the same contents.
+Files which failed to parse, or which included a file that could not be
+found, are never stored.
+
+A cache may be shared by any number of parser contexts, on any number of
+threads, and by separate processes. Each file of an entry is written under
+a temporary name and then renamed, so a reader only ever sees whole files.
+@note Entries are never removed. The directory can be emptied at any time
+when nothing is using it.
+*/
+
+//! A directory of parsed files, and counts of how it has been used.
+typedef struct verilog_parse_cache_t{
+    char          * dir;    //!< Directory the entries are kept in.
+    pthread_mutex_t lock;   //!< Guards the counters.
+    unsigned long   hits;   //!< Files loaded from an entry.
+    unsigned long   misses; //!< Files which had to be parsed.
+    unsigned long   stores; //!< Entries written.
+} verilog_parse_cache;
+
+/*!
+@brief Creates a cache which keeps its entries in the supplied directory.
+@details The directory is created if it does not exist. Its parent must.
+@returns The new cache, or NULL if the directory could not be created.
+*/
+verilog_parse_cache * verilog_parse_cache_new(
+    char * dir //!< Where to keep the entries.
+);
+
+//! Frees a cache. The entries in its directory are left as they are.
+void verilog_parse_cache_free(
+    verilog_parse_cache * tofree
+);
+
+/*!
+@brief Returns the key of the entry for a file, given the preprocessor
+state it is about to be parsed with.
+*/
+uint64_t verilog_parse_cache_key(
+    char     * path,         //!< The file, as it is recorded in the tree.
+    uint64_t   content_hash, //!< Hash of the contents of the file.
+    uint64_t   preproc_hash  //!< As given by verilog_preprocessor_hash.
+);
+
+/*!
+@brief Loads the entry with the supplied key into a source tree, if there
+is one whose included files are all unchanged.
+@details On a hit, the constructs of the entry are added to the tree as
+if the file had just been parsed into it, and *preproc is freed and replaced
+by a context in the state it would have been left in by parsing the file.
+The new context keeps the include directories, include cache and include
+directives of the old one.
+@param [inout] tree - The tree to add the constructs to.
+@param [inout] preproc - The preprocessor context the file would be parsed
+with.
+@returns Zero on a hit, or -1 on a miss, in which case neither the tree nor
+the preprocessor context are changed.
+*/
+int verilog_parse_cache_fetch(
+    verilog_parse_cache           * cache,
+    uint64_t                        key,
+    char                          * path,
+    verilog_source_tree           * tree,
+    verilog_preprocessor_context ** preproc
+);
+
+/*!
+@brief Writes an entry for a file which has just been parsed.
+@param [in] key - The key given by @ref verilog_parse_cache_key before the
+file was parsed.
+@param [in] tree - The tree it was parsed into.
+@param [in] file - The tree's record of the file.
+@param [in] preproc - The preprocessor context it was parsed with.
+@param [in] first_include - The number of include directives preproc had
+before the file was parsed. Those after it were made by the file.
+@returns Zero if the entry was written, or -1 if it was not.
+*/
+int verilog_parse_cache_store(
+    verilog_parse_cache          * cache,
+    uint64_t                       key,
+    verilog_source_tree          * tree,
+    verilog_source_file          * file,
+    verilog_preprocessor_context * preproc,
+    unsigned int                   first_include
+);
+
+/*! @} */
+
+#endif
@@ -11,6 +11,8 @@ as well as an easy way to change the input stream.
 
 // Essential to make sure we have access to all of the yy functions.
 #include "verilog_preprocessor.h"
+#include "verilog_parse_cache.h"
+#include "verilog_diagnostics.h"
 
 #ifndef H_VERILOG_PARSER
 #define H_VERILOG_PARSER
@@ -23,13 +25,16 @@ typedef size_t yy_size_t;
 #ifndef YY_BUF_SIZE
     #define YY_BUF_SIZE 16384
 #endif
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void * yyscan_t;
+#endif
+
+#ifndef YY_TYPEDEF_YY_BUFFER_STATE
+#define YY_TYPEDEF_YY_BUFFER_STATE
 typedef struct yy_buffer_state *YY_BUFFER_STATE;
-extern void yyrestart (FILE *input_file  );
-extern void yy_switch_to_buffer (YY_BUFFER_STATE new_buffer  );
-extern YY_BUFFER_STATE yy_create_buffer (FILE *file,int size  );
-extern YY_BUFFER_STATE yy_scan_buffer (char *base,yy_size_t size  );
-extern YY_BUFFER_STATE yy_scan_bytes (const char *bytes,int len  );
-extern void yy_delete_buffer (YY_BUFFER_STATE b  );
+#endif
 
 /*!
 @defgroup parser-api Verilog Parser API
@@ -37,6 +42,347 @@ extern void yy_delete_buffer (YY_BUFFER_STATE b  );
 @brief Describes the top level, programmer facing parser API.
 */
 
+/*!
+@brief The value the scanner gives each identifier token.
+@details Grammar actions intern the text, and turn it into an ast_identifier
+node, only when the identifier is actually kept, so tokens which are
+skipped by the preprocessor, or only ever looked at, cost no allocation.
+The text is a slice of the buffer being scanned, or of a copy of it, and
+lasts until the end of the parse.
+*/
+typedef struct verilog_id_token_t{
+    char         * text;   //!< The identifier. Not NUL terminated.
+    size_t         length; //!< Length of text.
+    unsigned int   line;   //!< The line it was found on.
+} verilog_id_token;
+
+//! Typedef over verilog_parser_context_t
+typedef struct verilog_parser_context_t verilog_parser_context;
+
+/*!
+@brief A function which is handed each module or UDP as soon as it has been
+parsed, when streaming.
+@param [in] ctx - The context doing the parsing.
+@param [in] item - The module or UDP. Only valid until the function returns.
+@param [in] data - The pointer given to @ref verilog_parser_set_item_callback
+*/
+typedef void (*verilog_item_callback)(
+    verilog_parser_context * ctx,
+    ast_source_item        * item,
+    void                   * data
+);
+
+/*!
+@brief Everything needed to run one parse, independently of any other.
+@details Holds a reentrant scanner, together with the preprocessor context
+and source tree which the parse reads from and adds to. The parser itself is
+a pure bison parser, and so keeps no state of its own between calls. Every
+node is allocated from the arena of the context's source tree, which thus
+acts as the context's allocator. When streaming, modules and UDPs are
+allocated from item_arena instead. Identifiers scanned from buffers which do
+not last the whole parse are copied to token_arena, which is emptied after
+each parse. The include cache is kept for the life of the context, whichever
+preprocessor context each parse uses. If a parse cache is set, files parsed
+by path are loaded from it where they can be, and stored in it where they
+can not. Errors and warnings found by the scanner, preprocessor and parser
+are reported to its diagnostics. The last location recorded during a parse
+is remembered, so that constructs from the same line share one entry of the
+location table.
+
+Separate contexts may be used to parse on separate threads at the same
+time. A single context must only be used by one thread at a time.
+*/
+struct verilog_parser_context_t{
+    yyscan_t                       scanner;     //!< The reentrant scanner.
+    verilog_preprocessor_context * preproc;     //!< Directives and macros.
+    verilog_source_tree          * source_tree; //!< Parsed constructs.
+    verilog_item_callback          on_item;     //!< Set when streaming.
+    void                         * on_item_data;//!< Passed to on_item.
+    ast_arena                    * item_arena;  //!< Holds the current item.
+    ast_arena                    * token_arena; //!< Identifier text copies.
+    int                            lex_only;    //!< Scan without values.
+    verilog_include_cache        * include_cache;//!< Included files seen.
+    verilog_parse_cache          * parse_cache; //!< Not owned. May be NULL.
+    ast_location                   location;    //!< Last location recorded.
+    ast_location_entry             location_at; //!< Where it refers to.
+    verilog_diagnostics          * diagnostics; //!< Errors and warnings.
+    unsigned int                   syntax_errors;//!< Syntax errors found.
+    char                         * mapped;      //!< File being parsed, if.
+    size_t                         mapped_size; //!< Length of the file.
+    size_t                         mapped_released;//!< Pages given back.
+};
+
+extern int  yylex_init_extra (verilog_parser_context * extra,
+                              yyscan_t * scanner);
+extern int  yylex_destroy (yyscan_t scanner);
+extern int  yyget_lineno (yyscan_t scanner);
+extern void yyset_lineno (int line_number, yyscan_t scanner);
+extern char * yyget_text (yyscan_t scanner);
+extern void yy_switch_to_buffer (YY_BUFFER_STATE new_buffer,
+                                 yyscan_t scanner);
+extern YY_BUFFER_STATE yy_create_buffer (FILE *file, int size,
+                                         yyscan_t scanner);
+extern YY_BUFFER_STATE yy_scan_buffer (char *base, yy_size_t size,
+                                       yyscan_t scanner);
+extern YY_BUFFER_STATE yy_scan_bytes (const char *bytes, int len,
+                                      yyscan_t scanner);
+extern void yy_delete_buffer (YY_BUFFER_STATE b, yyscan_t scanner);
+
+//! Defined in verilog_scanner.l. Empties the scanner's stack of buffers.
+extern void verilog_scanner_reset (yyscan_t scanner);
+
+//! Defined in verilog_scanner.l. Returns the buffer being scanned.
+extern char * verilog_scanner_buffer (yyscan_t scanner);
+
+//! Defined in verilog_scanner.l. Returns the length of the last token.
+extern size_t verilog_scanner_token_length (yyscan_t scanner);
+
+/*!
+@brief Creates a new parser context, with a fresh scanner, preprocessor
+context, source tree and diagnostics.
+@returns The new context, or NULL if the scanner could not be created.
+*/
+verilog_parser_context * verilog_parser_context_new();
+
+/*!
+@brief Frees a parser context, along with its scanner, preprocessor context,
+source tree and diagnostics.
+@details To keep the parsed source tree, or the preprocessor context, set the
+corresponding member to NULL before calling this function. It then becomes
+the caller's job to free it.
+*/
+void verilog_parser_context_free(
+    verilog_parser_context * tofree
+);
+
+/*!
+@brief Switches a context into, or out of, streaming mode.
+@details In streaming mode, modules and UDPs are not added to the source
+tree. Instead, each is handed to the callback as soon as its closing keyword
+has been parsed, and all of its memory, along with the entries of the
+location table made for it, is released again once the callback returns.
+Peak memory use is then bounded by the largest single module, rather than by
+the whole design. Configurations and libraries are still added to the source
+tree as usual.
+@param [inout] ctx - The context to change.
+@param [in] callback - The function to call with each item, or NULL to stop
+streaming.
+@param [in] data - Passed to every call of the callback.
+@note Anything the callback wants to keep must be copied out of the item,
+including what its locations refer to. Since modules are not kept, module
+instantiations can not be resolved. Diagnostics buffered in the context keep
+the location table from being emptied, so give the context a diagnostics
+sink when streaming a design with many errors.
+*/
+void verilog_parser_set_item_callback(
+    verilog_parser_context * ctx,
+    verilog_item_callback    callback,
+    void                   * data
+);
+
+/*!
+@brief Sets the parse cache used by @ref verilog_parse_path,
+@ref verilog_reparse_path and @ref verilog_parse_files.
+@details Contexts made by @ref verilog_parser_context_new have no cache
+until their parse_cache member is set.
+@param [in] cache - The cache to use, or NULL to stop using one. Must
+outlive every parse which uses it.
+*/
+void verilog_parser_set_parse_cache(
+    verilog_parse_cache * cache
+);
+
+/*!
+@brief Used by the grammar to pass on each module or UDP parsed.
+@details The item is added to the source tree straight away, so that it is
+kept even if the parse later fails, unless the context is streaming, in
+which case the callback is run instead.
+*/
+void verilog_parser_emit_item(
+    verilog_parser_context * ctx,
+    ast_source_item        * item
+);
+
+/*!
+@brief Used by the grammar to report a syntax error.
+@details The error is found at the token the scanner has just read. It is
+counted in syntax_errors whether or not diagnostics are enabled, so that the
+parse still fails.
+*/
+void verilog_parser_syntax_error(
+    verilog_parser_context * ctx,
+    const char             * message
+);
+
+/*!
+@brief Returns the context used by the functions which take no context,
+such as @ref verilog_parse_path, after making sure it refers to the current
+yy_preproc, yy_verilog_source_tree and yy_diagnostics.
+*/
+verilog_parser_context * verilog_parser_default_context();
+
+/*!
+@brief Returns the context being parsed with on the calling thread, or NULL
+if the thread is not currently parsing.
+*/
+verilog_parser_context * verilog_parser_current_context();
+
+/*!
+@brief Returns the line the calling thread's parser has reached, or zero if
+the thread is not currently parsing.
+*/
+unsigned int verilog_parser_current_line();
+
+/*!
+@brief Returns the file the calling thread's parser is currently reading.
+@details Falls back on the global @ref yy_preproc if the thread is not
+currently parsing, and returns NULL if that does not exist either.
+*/
+char * verilog_parser_current_file();
+
+/*!
+@brief Returns the location a context's scanner has reached, recording it in
+the location table of the context's source tree.
+@details Inside a macro expansion, this is the line of the macro definition
+being read, within the expansion. Returns zero if the context has no source
+tree.
+*/
+ast_location verilog_parser_location(
+    verilog_parser_context * ctx
+);
+
+/*!
+@brief Returns the location the calling thread's parser has reached, or zero
+if the thread is not currently parsing.
+*/
+ast_location verilog_parser_current_location();
+
+/*!
+@brief Returns the location table of the source tree the calling thread's
+parser is adding to, or NULL if the thread is not currently parsing.
+*/
+ast_location_table * verilog_parser_current_locations();
+
+/*!
+@brief Perform a parsing operation on the supplied file, using the supplied
+context.
+@details Behaves exactly as @ref verilog_parse_file, except that constructs
+are added to ctx -> source_tree, and directives are read from and added to
+ctx -> preproc. No global state is used, so this may be called from several
+threads at once, as long as each has its own context.
+*/
+int     verilog_parse_file_ctx(
+    verilog_parser_context * ctx,
+    FILE                   * to_parse
+);
+
+/*!
+@brief Perform a parsing operation on the supplied in-memory string, using
+the supplied context.
+@see verilog_parse_string verilog_parse_file_ctx
+*/
+int     verilog_parse_string_ctx(
+    verilog_parser_context * ctx,
+    char                   * to_parse,
+    int                      length
+);
+
+/*!
+@brief Perform a parsing operation on the supplied in-memory buffer, using
+the supplied context.
+@see verilog_parse_buffer verilog_parse_file_ctx
+*/
+int     verilog_parse_buffer_ctx(
+    verilog_parser_context * ctx,
+    char                   * to_parse,
+    int                      length
+);
+
+/*!
+@brief Perform a parsing operation on the file at the supplied path, using
+the supplied context.
+@details Behaves like @ref verilog_parse_path, but with the context's
+preprocessor and source tree. If the context has a parse cache, the file is
+loaded from it when it holds an entry for the file, its contents and the
+state of the preprocessor. A hit replaces ctx -> preproc with a context in
+the state parsing the file would have left it in.
+@see verilog_parse_path verilog_parse_file_ctx
+*/
+int     verilog_parse_path_ctx(
+    verilog_parser_context * ctx,
+    char                   * path
+);
+
+/*!
+@brief Parses a file into the context's source tree again, replacing
+everything it added the last time it was parsed.
+@details The file is only parsed if its contents, or the state of the
+context's preprocessor, have changed since it was last parsed into the
+tree. Otherwise the tree is left exactly as it is. When the file is parsed,
+its old constructs are first removed with
+@ref verilog_source_tree_remove_file, and its new ones are added after those
+of every other file.
+
+The file is compared, and parsed again, with the preprocessor in the state
+it was last parsed with, kept as a snapshot in the file's record, rather
+than as ctx -> preproc is now. So a file whose include guard is defined by
+now is still parsed in full. The include directories are those of
+ctx -> preproc, which is left as it was found. Files with no snapshot, such
+as those of a loaded tree, are compared with ctx -> preproc as it is.
+@param [inout] ctx - The context to parse with.
+@param [in] path - The file to parse.
+@param [out] skipped - If not NULL, set to AST_TRUE if the file was
+unchanged and so was not parsed, or AST_FALSE if it was.
+@returns As @ref verilog_parse_path_ctx. Zero if the file was skipped.
+@note Only the contents of the file itself are compared, not those of the
+files it includes. Any instance left unresolved by a removed module needs
+@ref verilog_resolve_modules to be called again.
+*/
+int     verilog_reparse_path_ctx(
+    verilog_parser_context * ctx,
+    char                   * path,
+    ast_boolean            * skipped
+);
+
+/*!
+@brief Parses a list of files on a pool of worker threads, merging the
+results into a single source tree.
+@details Each worker owns one parser context, and every file is parsed with
+a preprocessor context of its own, so macros defined in one file are not
+visible in any other. Each of those starts as a copy of the prelude, so
+macros defined before the call, such as by files parsed first with
+@ref verilog_parse_path, are visible in every file. Once all workers
+finish, the constructs of each file are appended to the tree in the order
+the files were given, regardless of which worker parsed them or when. The memory of every worker is then handed
+over to the tree, so it is released with it. The diagnostics of each file
+are reported to @ref yy_diagnostics in the same order, with their locations
+in the tree's table.
+@param [inout] tree - The tree to add every parsed construct to.
+@param [in] paths - The paths of the files to parse.
+@param [in] count - The number of paths.
+@param [in] search_dirs - Directories to look for include files in, copied
+into the preprocessor context of every file. May be NULL.
+@param [in] prelude - The preprocessor state every file starts from, or NULL
+for a fresh one. Only read before the workers start.
+@param [in] jobs - The number of worker threads. If zero, one is started for
+each online processor. Never more than count are started.
+@param [out] results - If not NULL, receives the result of parsing each
+file, as returned by @ref verilog_parse_file, or -1 if it could not be
+opened.
+@returns The number of files which failed to open or to parse.
+@note Module instantiations are not resolved. Call
+@ref verilog_resolve_modules on the tree afterwards.
+*/
+int     verilog_parse_files(
+    verilog_source_tree * tree,
+    char               ** paths,
+    unsigned int          count,
+    ast_list            * search_dirs,
+    verilog_preprocessor_context * prelude,
+    unsigned int          jobs,
+    int                 * results
+);
+
 /*!
 @brief Sets up the parsing environment ready for input.
 @details Makes sure that there is a vaild preprocessor context and source
@@ -47,6 +393,13 @@ state
 are certain to be either new or existing contexts ready for parsing.
 @note Calling this function, parsing a file, and then calling this function
 again, does *not* destroy the original preprocessor context or source tree.
+To start again with an empty tree, release the old one with
+verilog_free_source_tree and then call this function.
+@note This function, and the verilog_parse_file, verilog_parse_string and
+verilog_parse_buffer functions, work on a single, process wide, parser
+context built around the yy_preproc and yy_verilog_source_tree globals. They
+must not be used from more than one thread. Use @ref verilog_parser_context_new
+and the *_ctx functions for that.
 */
 void    verilog_parser_init();
 
@@ -63,24 +416,26 @@ yy_verilog_source_tree global object.
 @returns An integer describing the result of the parse operation. If 
 the return value is a zero, the file was parsed successfully. If it takes
 any other value, the file parsed was syntactically invalid.
-@note In the event of an invalid file being parsed, then the 
-yy_verilog_source_tree object will only contain upto, but not including,
-the most recently valid parsed object. For example, when the following
-source is parsed:
+@note Parsing carries on past a syntax error, from the end of the
+statement, module item or module it was found in, so a single pass finds
+every error in the source. Each is reported to the diagnostics of the
+context parsed with, and whatever was parsed around it is kept. For
+example, when the following source is parsed:
 
-    module valid_module();
+    module first_module();
         initial begin
-            $display("This module is valid");
+            a = ;
+            $display("This module is kept");
         end
     endmodule
 
-    module invalid_module();
-        initial begin
-            $display("This module is syntactically invalid");
+    module second_module();
+        assign = b;
+        assign c = d;
     endmodule
 
-then the first "valid_module" object will be added to the source tree, but
-the second will not.
+then both modules are added to the source tree, without the statement and
+the continuous assignment in error, and two errors are recorded.
 */
 int     verilog_parse_file(FILE * to_parse);
 
@@ -101,24 +456,7 @@ any other value, the file parsed was syntactically invalid.
 @warning This function will create a copy of to_parse, and so is not destructive
 to the originally passed variable. If you would rather not create a copy,
 then use the verilog_parse_buffer function.
-@note In the event of an invalid file being parsed, then the 
-yy_verilog_source_tree object will only contain upto, but not including,
-the most recently valid parsed object. For example, when the following
-source is parsed:
-
-    module valid_module();
-        initial begin
-            $display("This module is valid");
-        end
-    endmodule
-
-    module invalid_module();
-        initial begin
-            $display("This module is syntactically invalid");
-    endmodule
-
-then the first "valid_module" object will be added to the source tree, but
-the second will not.
+@see verilog_parse_file for how syntax errors are recovered from.
 */
 int     verilog_parse_string(char * to_parse, int length);
 
@@ -140,26 +478,146 @@ any other value, the file parsed was syntactically invalid.
 @warning This function does not create a copy of the to_parse data, and will
 destroy the contents of the buffer. If you would rather the function operate
 on a copy of the data instead, please use the verilog_parse_string function.
-@note In the event of an invalid file being parsed, then the 
-yy_verilog_source_tree object will only contain upto, but not including,
-the most recently valid parsed object. For example, when the following
-source is parsed:
+@see verilog_parse_file for how syntax errors are recovered from.
+*/
+int     verilog_parse_buffer(char * to_parse, int length);
 
-    module valid_module();
-        initial begin
-            $display("This module is valid");
-        end
-    endmodule
+/*!
+@brief Perform a parsing operation on the file at the supplied path.
+@details The file is memory mapped and scanned in place, rather than being
+read through stdio a buffer at a time, which makes this the fastest way to
+parse large files. The path is also made the current file of the
+preprocessor for the duration of the parse, just as
+@ref verilog_preprocessor_set_file would.
+@param [in] path - The path of the file to parse.
+@pre verilog_parser_init has been called atleast once.
+@post Any valid verilog constructs have been added to the
+yy_verilog_source_tree global object.
+@returns Zero if the file was parsed successfully, -1 if it could not be
+opened or mapped, and any other value if it was syntactically invalid.
+@note The mapping is private. The scanner writes into its copy of the
+mapped pages, and the file itself is never changed. Those writes make the
+system copy each page on write as the scanner reaches it, so by the end of
+the parse a private copy of the whole file is held, much as if it had been
+read. When streaming, the pages behind the scanner are given back after
+every item, so only a few are held at a time. Nothing in the resulting
+source tree refers to the mapping, which is released before this function
+returns. Files longer than INT_MAX - 2 bytes, which flex can not scan as
+one buffer, are refused, with an error reported to the diagnostics.
+*/
+int     verilog_parse_path(char * path);
 
-    module invalid_module();
-        initial begin
-            $display("This module is syntactically invalid");
-    endmodule
+/*!
+@brief Parses a file into the yy_verilog_source_tree object again, unless it
+is unchanged, replacing whatever it added last time.
+@details Works like @ref verilog_reparse_path_ctx, using yy_preproc.
+@pre verilog_parser_init has been called atleast once.
+*/
+int     verilog_reparse_path(char * path, ast_boolean * skipped);
 
-then the first "valid_module" object will be added to the source tree, but
-the second will not.
+/*!
+@defgroup parser-lex-api Verilog Lexer API
+@{
+@ingroup parser-api
+@brief Runs the scanner, and the preprocessor, without the parser.
+@details For tools which only need the tokens of a source file. Tokens are
+returned one at a time, as records pointing into the scanned buffer, and no
+AST nodes are built for them at all.
+
+    verilog_lexer * lexer = verilog_lex_path("design.v");
+    verilog_token   token;
+
+    while(verilog_lex_next(lexer, &token))
+    {
+        printf("%s %.*s\n", verilog_token_name(token.kind),
+               (int)token.length, token.text);
+    }
+
+    verilog_lex_free(lexer);
+
+The preprocessor runs as it does when parsing, so directives are obeyed,
+macros are expanded and include files are followed. Include directories can
+be added to lexer -> ctx -> preproc -> search_dirs before the first token is
+asked for.
 */
-int     verilog_parse_buffer(char * to_parse, int length);
+
+//! A single token, as returned by @ref verilog_lex_next.
+typedef struct verilog_token_t{
+    int            kind;     //!< Token type, as in verilog_parser.tab.h
+    char         * text;     //!< Token text, valid until the next token.
+    size_t         length;   //!< Number of characters of text.
+    size_t         offset;   //!< Offset of text in the buffer it came from.
+    unsigned int   line;     //!< Line the token ends on.
+    char         * file;     //!< Current file, if known. Interned.
+    int            in_input; //!< False if from an include file or macro.
+} verilog_token;
+
+//! Scans one input for tokens. Created by the verilog_lex_* functions.
+typedef struct verilog_lexer_t{
+    verilog_parser_context * ctx;    //!< Scanner and preprocessor.
+    char                   * input;  //!< The buffer being scanned.
+    size_t                   length; //!< Length of input, less its NULs.
+    size_t                   mapped; //!< Length of the mapping, if mapped.
+    int                      owned;  //!< If input must be freed.
+    int                      done;   //!< Set once the input is used up.
+} verilog_lexer;
+
+/*!
+@brief Creates a lexer which scans the supplied buffer in place.
+@param [inout] buffer - The text to scan. Must be followed by two NUL
+characters, and is changed as it is scanned, as with
+@ref verilog_parse_buffer. Must outlive the lexer.
+@param [in] length - The length of the text, not counting the NULs.
+@returns The lexer, or NULL if buffer is not correctly terminated, or is
+longer than INT_MAX - 2 bytes.
+*/
+verilog_lexer * verilog_lex_buffer(
+    char   * buffer,
+    size_t   length
+);
+
+//! Creates a lexer which scans a copy of the supplied text.
+verilog_lexer * verilog_lex_string(
+    char   * string,
+    size_t   length
+);
+
+/*!
+@brief Creates a lexer which scans a memory mapping of the supplied file.
+@details The file is mapped just as @ref verilog_parse_path maps it, and
+stays mapped until the lexer is freed.
+@returns The lexer, or NULL if the file could not be opened or mapped.
+*/
+verilog_lexer * verilog_lex_path(
+    char * path
+);
+
+/*!
+@brief Scans the next token.
+@param [inout] lexer - The lexer to scan with.
+@param [out] token - Filled in with the token, if there is one.
+@returns Non-zero if a token was found, zero once the input is used up.
+@note The text, offset and in_input members of a token describe whichever
+buffer it was scanned from, which is the lexer's input unless the token came
+from an include file or macro expansion.
+*/
+int     verilog_lex_next(
+    verilog_lexer * lexer,
+    verilog_token * token
+);
+
+//! Releases a lexer, and its input too if the lexer made it.
+void    verilog_lex_free(
+    verilog_lexer * lexer
+);
+
+/*!
+@brief Returns a printable name for a token kind.
+@details Defined in verilog_parser.y, from the parser's table of names.
+*/
+const char * verilog_token_name(int kind);
+
+/*! @} */
 
 /*! }@ */
 
@@ -6,30 +6,54 @@
 
 %define parse.error verbose
 
+%define api.pure full
+%lex-param   {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {verilog_parser_context * ctx}
+
 %{
     #include <stdio.h>
     #include <string.h>
     #include <assert.h>
 
     #include "verilog_ast.h"
-
-    extern int yylex();
-    extern int yylineno;
-    extern char * yytext;
-
-    void yyerror(const char *msg){
-        printf("line %d - ERROR: %s\n", yylineno,msg);
-        printf("- '%s'\n", yytext);
-    }
 %}
 
 %code requires{
     #include "verilog_ast.h"
+    #include "verilog_parser.h"
+}
+
+%code{
+    extern int yylex(YYSTYPE * yylval_param, yyscan_t scanner);
+
+    /*!
+    @brief Makes the identifier node for a SIMPLE_ID, ESCAPED_ID or
+    SYSTEM_ID, interning its text.
+    @details The token's text is a slice, with no terminating NUL, which
+    lasts until the end of the parse. Only identifiers which are kept are
+    interned, so anything which only looks at a token uses ID_IS instead.
+    */
+    #define ID_NODE(t) ast_new_interned_identifier( \
+        ast_intern_n((t).text, (t).length), (t).line)
+
+    //! True if the text of an identifier token is the string literal s.
+    #define ID_IS(t, s) ((t).length == sizeof(s) - 1 && \
+                         memcmp((t).text, s, sizeof(s) - 1) == 0)
+
+    void yyerror(
+        yyscan_t scanner,
+        verilog_parser_context * ctx,
+        const char *msg
+    ){
+        (void)scanner;
+        verilog_parser_syntax_error(ctx, msg);
+    }
 }
 
 
 /* token types */
 %union {
+    verilog_id_token               id_token;
     ast_assignment               * assignment;
     ast_block_item_declaration   * block_item_declaration;
     ast_block_reg_declaration    * block_reg_declaration;
@@ -167,9 +191,9 @@
 %type  <number> octal_number
 %type  <number> real_number
 
-%token <identifier> SYSTEM_ID
-%token <identifier> SIMPLE_ID
-%token <identifier> ESCAPED_ID
+%token <id_token> SYSTEM_ID
+%token <id_token> SIMPLE_ID
+%token <id_token> ESCAPED_ID
 %token <identifier> DEFINE_ID
 
 %token <string> ATTRIBUTE_START
@@ -365,6 +389,7 @@
 %start grammar_begin
 
 %type   <assignment>                 blocking_assignment
+%type   <assignment>                 function_blocking_assignment
 %type   <assignment>                 continuous_assign
 %type   <assignment>                 nonblocking_assignment
 %type   <assignment>                 procedural_continuous_assignments
@@ -396,10 +421,8 @@
 %type   <concatenation>              multiple_concatenation
 %type   <concatenation>              net_concatenation
 %type   <concatenation>              net_concatenation_cont
-%type   <concatenation>              net_concatenation_value
 %type   <concatenation>              variable_concatenation
 %type   <concatenation>              variable_concatenation_cont
-%type   <concatenation>              variable_concatenation_value
 %type   <config_declaration>         config_declaration
 %type   <config_rule_statement>      config_rule_statement
 %type   <delay2>                     delay2
@@ -423,6 +446,8 @@
 %type   <expression>                 conditional_expression
 %type   <expression>                 constant_expression
 %type   <expression>                 constant_mintypmax_expression
+%type   <expression>                 net_concatenation_value
+%type   <expression>                 variable_concatenation_value
 %type   <expression>                 constant_range_expression
 %type   <expression>                 data_source_expression
 %type   <expression>                 enable_terminal
@@ -438,8 +463,6 @@
 %type   <expression>                 module_path_expression
 %type   <expression>                 module_path_mintypemax_expression
 %type   <expression>                 ncontrol_terminal
-%type   <expression>                 ordered_parameter_assignment
-%type   <expression>                 ordered_port_connection
 %type   <expression>                 path_delay_expression
 %type   <expression>                 pcontrol_terminal
 %type   <expression>                 range_expression
@@ -629,6 +652,7 @@
 %type   <module_instance>            module_instance
 %type   <module_instantiation>       module_instantiation
 %type   <module_item>                module_item
+%type   <module_item>                specify_item
 %type   <module_item>                module_or_generate_item
 %type   <module_item>                module_or_generate_item_declaration
 %type   <module_item>                non_port_module_item
@@ -644,7 +668,6 @@
 %type   <node>                       actual_argument
 %type   <node>                       pulsestyle_declaration
 %type   <node>                       showcancelled_declaration
-%type   <node>                       specify_item
 %type   <node>                       system_timing_check
 %type   <node_attributes>            attr_spec
 %type   <node_attributes>            attr_specs
@@ -671,6 +694,8 @@
 %type   <path_declaration>           simple_path_declaration
 %type   <path_declaration>           state_dependent_path_declaration
 %type   <port_connection>            named_parameter_assignment
+%type   <port_connection>            ordered_parameter_assignment
+%type   <port_connection>            ordered_port_connection
 %type   <port_connection>            named_port_connection
 %type   <port_declaration>           inout_declaration
 %type   <port_declaration>           input_declaration
@@ -694,7 +719,6 @@
 %type   <range>                      range_o
 %type   <range_or_type>              range_or_type
 %type   <range_or_type>              range_or_type_o
-%type   <single_assignment>          function_blocking_assignment
 %type   <single_assignment>          genvar_assignment
 %type   <single_assignment>          net_assignment
 %type   <single_assignment>          net_decl_assignment
@@ -770,41 +794,16 @@
 
 grammar_begin : 
   library_text {
-    assert(yy_verilog_source_tree != NULL);
-    yy_verilog_source_tree -> libraries = 
-        ast_list_concat(yy_verilog_source_tree -> libraries, $1);
+    assert(ctx -> source_tree != NULL);
+    ctx -> source_tree -> libraries = 
+        ast_list_concat(ctx -> source_tree -> libraries, $1);
 }
 | config_declaration {
-    assert(yy_verilog_source_tree != NULL);
-    ast_list_append(yy_verilog_source_tree -> configs, $1);
+    assert(ctx -> source_tree != NULL);
+    ast_list_append(ctx -> source_tree -> configs, $1);
 }
 | source_text {
-    assert(yy_verilog_source_tree != NULL);
-
-    unsigned int i;
-    for(i  = 0; i < $1 -> items; i ++)
-    {
-        ast_source_item * toadd = ast_list_get($1, i);
-
-        if(toadd -> type == SOURCE_MODULE)
-        {
-            ast_list_append(yy_verilog_source_tree -> modules, 
-                toadd -> module);
-        }
-        else if (toadd -> type == SOURCE_UDP)
-        {
-            ast_list_append(yy_verilog_source_tree -> primitives, 
-                toadd -> udp);
-        }
-        else
-        {
-            // Do nothing / unknown / unsupported type.
-            printf("line %d of %s - Unknown source item type: %d",
-                __LINE__,
-                __FILE__,
-                toadd -> type);
-        }
-    }
+    // Each module and UDP was added to the source tree as it was parsed.
 }
 | {
     // Do nothing, it's an empty file.
@@ -1029,12 +1028,12 @@ use_clause :
 
 source_text : 
   description {
-    $$ = ast_list_new();
-    ast_list_append($$,$1);
+    // Descriptions are handed off as they are parsed, so that they are kept
+    // even if a later one fails. The list is then never needed.
+    $$ = NULL;
 }
 | source_text description{
-    $$ = $1;
-    ast_list_append($$,$2);
+    $$ = NULL;
 }
 ;
 
@@ -1042,10 +1041,21 @@ description :
   module_declaration{
     $$ = ast_new_source_item(SOURCE_MODULE);
     $$ -> module = $1;
+    verilog_parser_emit_item(ctx, $$);
 }
 | udp_declaration     {
     $$ = ast_new_source_item(SOURCE_UDP);
     $$ -> udp = $1;
+    verilog_parser_emit_item(ctx, $$);
+}
+| error KW_ENDMODULE {
+    // A module whose header could not be parsed is skipped entirely.
+    $$ = NULL;
+    yyerrok;
+}
+| error KW_ENDPRIMITIVE {
+    $$ = NULL;
+    yyerrok;
 }
 ;
 
@@ -1072,6 +1082,31 @@ module_declaration :
     // function.
     $$ = ast_new_module_declaration($1,$3,$4,NULL,$7);
 }
+| attribute_instances
+  module_keyword
+  module_identifier
+  module_parameter_port_list
+  list_of_port_declarations
+  SEMICOLON
+  non_port_module_item_os
+  error
+  KW_ENDMODULE{
+    // An item with no semicolon to recover at. Keep the items before it.
+    $$ = ast_new_module_declaration($1,$3,$4,$5,$7);
+    yyerrok;
+}
+| attribute_instances
+  module_keyword
+  module_identifier
+  module_parameter_port_list
+  list_of_ports
+  SEMICOLON
+  module_item_os
+  error
+  KW_ENDMODULE{
+    $$ = ast_new_module_declaration($1,$3,$4,NULL,$7);
+    yyerrok;
+}
 ;
 
 module_keyword     : KW_MODULE
@@ -1150,6 +1185,10 @@ port_declaration_l:
     ast_list_append(names, $4);
     $$ = ast_new_port_declaration(PORT_NONE, NET_TYPE_NONE, AST_FALSE,
     AST_TRUE,AST_FALSE,NULL,names);
+    if($5 != NULL){
+        $$ -> initial_values = ast_list_new();
+        ast_list_append($$ -> initial_values, $5);
+    }
 }
 | output_variable_type_o      port_identifier{
     ast_list * names = ast_list_new();
@@ -1162,6 +1201,10 @@ port_declaration_l:
     ast_list_append(names, $2);
     $$ = ast_new_port_declaration(PORT_NONE, NET_TYPE_NONE, AST_FALSE,
     AST_FALSE,AST_TRUE,NULL,names);
+    if($3 != NULL){
+        $$ -> initial_values = ast_list_new();
+        ast_list_append($$ -> initial_values, $3);
+    }
 }
 ;
 
@@ -1242,6 +1285,13 @@ module_item_os : {$$ = ast_list_new();}
     $$ = $1;
     ast_list_append($$,$2);
 }
+| module_item_os error SEMICOLON{
+    // Skip the item in error, and carry on with the next one. Modules with
+    // a list of port declarations only recover at their endmodule, since
+    // recovering in both lists of items would add conflicts.
+    $$ = $1;
+    yyerrok;
+}
 ;
 
 non_port_module_item_os : {$$ = ast_list_new();}
@@ -1487,14 +1537,16 @@ NET_TYPE_NONE,$3,$2,AST_FALSE,$4,$5);
         AST_FALSE,
         AST_TRUE,
         NULL,
-        $3);
+        NULL);
+    ast_port_declaration_set_variables($$,$3);
   }
 | KW_OUTPUT KW_REG signed_o range_o list_of_variable_port_identifiers{
     $$ = ast_new_port_declaration(PORT_OUTPUT,
                                   NET_TYPE_NONE,
                                   $3, AST_TRUE,
                                   AST_FALSE,
-                                  $4, $5);
+                                  $4, NULL);
+    ast_port_declaration_set_variables($$,$5);
   }
 ;
 
@@ -1810,14 +1862,17 @@ list_of_net_decl_assignments :
 }
 ;
 
+/* Nets are held like net_decl_assignments, just without a value. */
 list_of_net_identifiers      :
   net_identifier dimensions_o{
     $$ = ast_list_new();
-    ast_list_append($$,$1);
+    ast_list_append($$,
+        ast_new_single_assignment(ast_new_lvalue_id(NET_IDENTIFIER,$1),NULL));
   }
 | list_of_net_identifiers COMMA net_identifier dimensions_o{
     $$ = $1;
-    ast_list_append($$,$3);
+    ast_list_append($$,
+        ast_new_single_assignment(ast_new_lvalue_id(NET_IDENTIFIER,$3),NULL));
 }
 ;
 
@@ -1869,14 +1924,15 @@ list_of_real_identifiers     :
 }
 ;
 
+/* Pulse control specparams are NULL, and left out. */
 list_of_specparam_assignments: 
   specparam_assignment{
     $$ = ast_list_new();
-    ast_list_append($$,$1);
+    if($1 != NULL) ast_list_append($$,$1);
   }
 | list_of_specparam_assignments COMMA specparam_assignment{
     $$ = $1;
-    ast_list_append($$,$3);
+    if($3 != NULL) ast_list_append($$,$3);
 }
 ;
 
@@ -1899,12 +1955,12 @@ eq_const_exp_o :
 list_of_variable_port_identifiers : 
   port_identifier eq_const_exp_o {
     $$ = ast_list_new();
-    ast_list_append($$, 
+    ast_list_append($$,
         ast_new_single_assignment(ast_new_lvalue_id(VAR_IDENTIFIER,$1),$2));
   }
 | list_of_variable_port_identifiers COMMA port_identifier eq_const_exp_o{
     $$ = $1;
-    ast_list_append($$, 
+    ast_list_append($$,
         ast_new_single_assignment(ast_new_lvalue_id(VAR_IDENTIFIER,$3),$4));
 }
 ;
@@ -1929,7 +1985,7 @@ specparam_assignment    :
     $$= ast_new_single_assignment(ast_new_lvalue_id(SPECPARAM_ID,$1),$3);
   }
 | pulse_control_specparam{
-    $<pulse_control_specparam>$ = $1;
+    $$ = NULL;
 }
 ;
 
@@ -2332,14 +2388,14 @@ gate_enable :
 | enable_gatetype OB output_terminal COMMA input_terminal COMMA 
   enable_terminal CB COMMA n_output_gate_instances{
     ast_enable_gate_instance * gate = ast_new_enable_gate_instance(
-        ast_new_identifier("unamed_gate",yylineno), $3,$7,$5);
+        ast_new_identifier("unamed_gate",yyget_lineno(scanner)), $3,$7,$5);
     ast_list_preappend($10,gate);
     $$ = ast_new_enable_gate_instances($1,NULL,NULL,$10);
 }
 | enable_gatetype OB output_terminal COMMA input_terminal COMMA 
   enable_terminal CB{
     ast_enable_gate_instance * gate = ast_new_enable_gate_instance(
-        ast_new_identifier("unamed_gate",yylineno), $3,$7,$5);
+        ast_new_identifier("unamed_gate",yyget_lineno(scanner)), $3,$7,$5);
     ast_list * list = ast_list_new();
     ast_list_append(list,gate);
     $$ = ast_new_enable_gate_instances($1,NULL,NULL,list);
@@ -2387,7 +2443,7 @@ gate_n_input :
   }
 | gatetype_n_input OB output_terminal COMMA input_terminals CB {
     ast_n_input_gate_instance * gate = ast_new_n_input_gate_instance(
-        ast_new_identifier("unamed_gate",yylineno), $5,$3);
+        ast_new_identifier("unamed_gate",yyget_lineno(scanner)), $5,$3);
     ast_list * list = ast_list_new();
     ast_list_append(list,gate);
     $$ = ast_new_n_input_gate_instances($1,NULL,NULL,list);
@@ -2396,7 +2452,7 @@ gate_n_input :
   COMMA n_input_gate_instances{
     
     ast_n_input_gate_instance * gate = ast_new_n_input_gate_instance(
-        ast_new_identifier("unamed_gate",yylineno), $5,$3);
+        ast_new_identifier("unamed_gate",yyget_lineno(scanner)), $5,$3);
     ast_list * list = $8;
     ast_list_preappend(list,gate);
     $$ = ast_new_n_input_gate_instances($1,NULL,NULL,list);
@@ -2438,8 +2494,8 @@ pass_enable_switch_instances :
     ast_list_append($$,$1);
   }
 | pass_enable_switch_instances COMMA pass_enable_switch_instance{
-    $$ = ast_list_new();
-    ast_list_append($$,$1);
+    $$ = $1;
+    ast_list_append($$,$3);
   }
 ;
 
@@ -2460,8 +2516,8 @@ pull_gate_instances :
     ast_list_append($$,$1);
   }
 | pull_gate_instances COMMA pull_gate_instance{
-    $$ = ast_list_new();
-    ast_list_append($$,$1);
+    $$ = $1;
+    ast_list_append($$,$3);
   }
 ;
 
@@ -2471,8 +2527,8 @@ pass_switch_instances :
     ast_list_append($$,$1);
   }
 | pass_switch_instances COMMA pass_switch_instance{
-    $$ = ast_list_new();
-    ast_list_append($$,$1);
+    $$ = $1;
+    ast_list_append($$,$3);
   }
 ;
 
@@ -2482,8 +2538,8 @@ n_input_gate_instances :
     ast_list_append($$,$1);
   }
  | n_input_gate_instances COMMA n_input_gate_instance{
-    $$ = ast_list_new();
-    ast_list_append($$,$1);
+    $$ = $1;
+    ast_list_append($$,$3);
   }
  ;
 
@@ -2493,8 +2549,8 @@ mos_switch_instances :
     ast_list_append($$,$1);
   }
 | mos_switch_instances COMMA mos_switch_instance{
-    $$ = ast_list_new();
-    ast_list_append($$,$1);
+    $$ = $1;
+    ast_list_append($$,$3);
   }
 ;
 
@@ -2504,8 +2560,8 @@ cmos_switch_instances :
     ast_list_append($$,$1);
   }
 | cmos_switch_instances COMMA cmos_switch_instance{
-    $$ = ast_list_new();
-    ast_list_append($$,$1);
+    $$ = $1;
+    ast_list_append($$,$3);
   }
 ;
 
@@ -2606,7 +2662,7 @@ pullup_strength             :
 
 name_of_gate_instance   : 
   gate_instance_identifier range_o {$$ = $1;}
-| {$$ = ast_new_identifier("Unnamed gate instance", yylineno);}
+| {$$ = ast_new_identifier("Unnamed gate instance", yyget_lineno(scanner));}
 ;
 
 /* A.3.3 primitive terminals */
@@ -2693,7 +2749,7 @@ module_instances : module_instance{
 ;
 
 ordered_parameter_assignment : expression{
-    $$=$1;
+    $$ = ast_new_named_port_connection(NULL,$1);
 };
 
 named_parameter_assignment : 
@@ -2739,11 +2795,10 @@ named_port_connections   :
 ;
 
 ordered_port_connection : attribute_instances expression_o{
-    if($2 == NULL){ $$ = NULL;}
-    else{
+    if($2 != NULL){
         $2 -> attributes = $1;
-        $$ = $2;
     }
+    $$ = ast_new_named_port_connection(NULL,$2);
 }
 ;
 
@@ -2759,9 +2814,9 @@ expression_o : expression {$$=$1;}
 /* A.4.2 Generated instantiation */
 
 generated_instantiation : KW_GENERATE generate_items KW_ENDGENERATE {
-    char * id = calloc(25,sizeof(char));
-    sprintf(id,"gen_%d",yylineno);
-    ast_identifier new_id = ast_new_identifier(id,yylineno);
+    char id[25];
+    sprintf(id,"gen_%d",yyget_lineno(scanner));
+    ast_identifier new_id = ast_new_identifier(id,yyget_lineno(scanner));
     $$ = ast_new_generate_block(new_id,$2);
 };
 
@@ -2861,9 +2916,9 @@ genvar_assignment : genvar_identifier EQ constant_expression{
 
 generate_block : 
   KW_BEGIN generate_items KW_END{
-    char * id = calloc(25,sizeof(char));
-    sprintf(id,"gen_%d",yylineno);
-    ast_identifier new_id = ast_new_identifier(id,yylineno);
+    char id[25];
+    sprintf(id,"gen_%d",yyget_lineno(scanner));
+    ast_identifier new_id = ast_new_identifier(id,yyget_lineno(scanner));
     $$ = ast_new_generate_block(new_id, $2);
   }
 | KW_BEGIN COLON generate_block_identifier generate_items KW_END{
@@ -2876,8 +2931,6 @@ generate_block :
 udp_declaration : 
   attribute_instances KW_PRIMITIVE udp_identifier OPEN_BRACKET udp_port_list
   CLOSE_BRACKET SEMICOLON udp_port_declarations udp_body KW_ENDPRIMITIVE{
-    printf("%d %s Need to re-write this rule.\n",__LINE__,__FILE__);
-
     ast_node_attributes * attrs      = $1;
     ast_identifier        id         = $3;
     ast_list            * ports      = $8;
@@ -2899,7 +2952,7 @@ udp_port_declarations :
   }
 | udp_port_declarations udp_port_declaration{
     $$ = $1;
-    ast_list_append($$,$1);
+    ast_list_append($$,$2);
   }
 ;
 
@@ -2935,7 +2988,7 @@ udp_input_declarations  :
   }
 | udp_input_declarations udp_input_declaration{
     $$ = $1;
-    ast_list_append($$,$1);
+    ast_list_append($$,$2);
   }
 ;
 
@@ -3029,12 +3082,16 @@ level_symbols_o       : level_symbols {$$=$1;} | {$$=NULL;} ;
 
 level_symbols         : 
   level_symbol {
+    ast_level_symbol * symbol = ast_calloc(1,sizeof(ast_level_symbol));
+    *symbol = $1;
     $$ = ast_list_new();
-    ast_list_append($$,&$1);
+    ast_list_append($$,symbol);
   }
 | level_symbols level_symbol{
+    ast_level_symbol * symbol = ast_calloc(1,sizeof(ast_level_symbol));
+    *symbol = $2;
     $$= $1;
-    ast_list_append($$,&$2);
+    ast_list_append($$,symbol);
   }
 ;
 
@@ -3056,7 +3113,11 @@ next_state            : output_symbol  {$$=$1;}
                       ;
 
 output_symbol : 
-  unsigned_number {$$ = UDP_NEXT_STATE_X; /*TODO FIX THIS*/}
+  unsigned_number {
+    $$ = strcmp($1 -> as_bits, "0") == 0 ? UDP_NEXT_STATE_0 :
+         strcmp($1 -> as_bits, "1") == 0 ? UDP_NEXT_STATE_1 :
+                                           UDP_NEXT_STATE_X ;
+  }
 | 'X'       {$$ = UDP_NEXT_STATE_X;}
 | 'x'       {$$ = UDP_NEXT_STATE_X;}
 | TERNARY   {$$ = UDP_NEXT_STATE_QM;}
@@ -3064,7 +3125,11 @@ output_symbol :
 ;
 
 level_symbol :
-  unsigned_number {$$ = LEVEL_X;}
+  unsigned_number {
+    $$ = strcmp($1 -> as_bits, "0") == 0 ? LEVEL_0 :
+         strcmp($1 -> as_bits, "1") == 0 ? LEVEL_1 :
+                                           LEVEL_X ;
+  }
 | 'X'             {$$ = LEVEL_X;}
 | 'x'             {$$ = LEVEL_X;}
 | TERNARY         {$$ = LEVEL_Q;}
@@ -3082,13 +3147,13 @@ edge_symbol : /* can be r,f,p,n or star in any case. */
 | 'P'   {$$ = EDGE_POS;}
 | 'n'   {$$ = EDGE_NEG;}
 | 'N'   {$$ = EDGE_NEG;}
-| SIMPLE_ID {      if (strcmp(yylval.string,"r") == 0) $$ = EDGE_POS ;
-              else if (strcmp(yylval.string,"R") == 0) $$ = EDGE_POS ;
-              else if (strcmp(yylval.string,"f") == 0) $$ = EDGE_NEG ;
-              else if (strcmp(yylval.string,"F") == 0) $$ = EDGE_NEG ;
-              else if (strcmp(yylval.string,"p") == 0) $$ = EDGE_POS ;
-              else if (strcmp(yylval.string,"P") == 0) $$ = EDGE_POS ;
-              else if (strcmp(yylval.string,"n") == 0) $$ = EDGE_NEG ;
+| SIMPLE_ID {      if (ID_IS($1,"r")) $$ = EDGE_POS ;
+              else if (ID_IS($1,"R")) $$ = EDGE_POS ;
+              else if (ID_IS($1,"f")) $$ = EDGE_NEG ;
+              else if (ID_IS($1,"F")) $$ = EDGE_NEG ;
+              else if (ID_IS($1,"p")) $$ = EDGE_POS ;
+              else if (ID_IS($1,"P")) $$ = EDGE_POS ;
+              else if (ID_IS($1,"n")) $$ = EDGE_NEG ;
               else                                     $$ = EDGE_NEG ;
   }
 | STAR {$$ = EDGE_ANY;}
@@ -3185,7 +3250,7 @@ procedural_continuous_assignments :
 ;
 
 function_blocking_assignment : variable_lvalue EQ expression{
-    $$ = ast_new_single_assignment($1,$3);
+    $$ = ast_new_blocking_assignment($1,$3,NULL);
 };
 
 function_statement_or_null : function_statement {$$ =$1;}
@@ -3262,6 +3327,13 @@ statement{
 | statements statement{
     $$ = $1;
     ast_list_append($$,$2);
+}
+| statements error SEMICOLON{
+    // Skip the statement in error, and carry on with the next one. An error
+    // in the first statement of a block is recovered from by the module
+    // item the block is in.
+    $$ = $1;
+    yyerrok;
 }
              ;
 
@@ -3692,19 +3764,34 @@ specify_items_o         : specify_items {$$ = $1;}
 
 specify_items           : specify_item{
                             $$ = ast_list_new();
-                            ast_list_append($$,$1);
+                            if($1 != NULL) ast_list_append($$,$1);
                         }
                         | specify_items specify_item{
                             $$ = $1;
-                            ast_list_append($$,$2);
+                            if($2 != NULL) ast_list_append($$,$2);
                         }
                         ;
 
-specify_item            : specparam_declaration
-                        | pulsestyle_declaration
-                        | showcancelled_declaration
-                        | path_declaration
-                        | system_timing_check {printf("%s:%d: System Timing check not supported\n", __FILE__, __LINE__);}
+/* Items with no representation in the tree are NULL, and left out. */
+specify_item            : specparam_declaration{
+                            $$ = ast_new_module_item(NULL,
+                                MOD_ITEM_SPECPARAM_DECLARATION);
+                            $$ -> specparam_declaration = $1;
+                        }
+                        | pulsestyle_declaration {$$ = NULL;}
+                        | showcancelled_declaration {$$ = NULL;}
+                        | path_declaration{
+                            $$ = ast_new_module_item(NULL,
+                                MOD_ITEM_PATH_DECLARATION);
+                            $$ -> path_declaration = $1;
+                        }
+                        | system_timing_check {
+                            VERILOG_DIAGNOSE(ctx -> diagnostics,
+                                VERILOG_SEVERITY_WARNING, DIAG_UNSUPPORTED,
+                                verilog_parser_location(ctx),
+                                "System timing checks are not supported");
+                            $$ = NULL;
+                        }
                         ;
 
 pulsestyle_declaration  : KW_PULSESTYLE_ONEVENT list_of_path_outputs SEMICOLON
@@ -3874,8 +3961,9 @@ state_dependent_path_declaration :
     else if($$ -> type == SIMPLE_FULL_PATH)
         $$ -> type = STATE_DEPENDENT_FULL_PATH;
     else
-        printf("%s:%d ERROR, invalid path declaration type when state dependent\n",
-            __FILE__,__LINE__);
+        VERILOG_DIAGNOSE(ctx -> diagnostics, VERILOG_SEVERITY_ERROR,
+            DIAG_SYNTAX_ERROR, verilog_parser_location(ctx),
+            "Path declaration can not be state dependent");
   }
 | KW_IF OPEN_BRACKET module_path_expression CLOSE_BRACKET 
   edge_sensitive_path_declaration{
@@ -3885,8 +3973,9 @@ state_dependent_path_declaration :
     else if($$ -> type == EDGE_SENSITIVE_FULL_PATH)
         $$ -> type = STATE_DEPENDENT_EDGE_FULL_PATH;
     else
-        printf("%s:%d ERROR, invalid path declaration type when state dependent\n",
-            __FILE__,__LINE__);
+        VERILOG_DIAGNOSE(ctx -> diagnostics, VERILOG_SEVERITY_ERROR,
+            DIAG_SYNTAX_ERROR, verilog_parser_location(ctx),
+            "Path declaration can not be state dependent");
   }
 
 | KW_IFNONE simple_path_declaration{
@@ -3904,7 +3993,7 @@ polarity_operator : PLUS  {$$=$1;}
 
 /* A.7.5.1 System timing check commands */
 
-system_timing_check : {printf("%s:%d Not Supported\n",__FILE__,__LINE__);};
+system_timing_check : {};
 
 /* A.7.5.2 System timing check command arguments */
 
@@ -4026,19 +4115,25 @@ sq_bracket_expressions :
 
 net_concatenation_value : /* TODO - fix proper identifier stuff. */
   hierarchical_net_identifier {
-      $$ = ast_new_concatenation(CONCATENATION_NET,NULL,$1);
+      $$ = ast_new_expression_primary(ast_new_primary(PRIMARY_IDENTIFIER));
+      $$ -> primary -> value.identifier = $1;
   }
 | hierarchical_net_identifier sq_bracket_expressions {
-      $$ = ast_new_concatenation(CONCATENATION_NET,NULL,$1);
+      $$ = ast_new_expression_primary(ast_new_primary(PRIMARY_IDENTIFIER));
+      $$ -> primary -> value.identifier = $1;
   }
 | hierarchical_net_identifier sq_bracket_expressions range_expression {
-      $$ = ast_new_concatenation(CONCATENATION_NET,NULL,$1);
+      $$ = ast_new_expression_primary(ast_new_primary(PRIMARY_IDENTIFIER));
+      $$ -> primary -> value.identifier = $1;
   }
 | hierarchical_net_identifier range_expression {
-      $$ = ast_new_concatenation(CONCATENATION_NET,NULL,$1);
+      $$ = ast_new_expression_primary(ast_new_primary(PRIMARY_IDENTIFIER));
+      $$ -> primary -> value.identifier = $1;
   }
 | net_concatenation {
-      $$ = $1;
+      $$ = ast_new_expression_primary(
+          ast_new_primary(PRIMARY_CONCATENATION));
+      $$ -> primary -> value.concatenation = $1;
   }
 ;
 
@@ -4061,19 +4156,25 @@ variable_concatenation_cont :
 
 variable_concatenation_value : /* TODO - fix proper identifier stuff. */
   hierarchical_variable_identifier {
-      $$ = ast_new_concatenation(CONCATENATION_NET,NULL,$1);
+      $$ = ast_new_expression_primary(ast_new_primary(PRIMARY_IDENTIFIER));
+      $$ -> primary -> value.identifier = $1;
   }
 | hierarchical_variable_identifier sq_bracket_expressions {
-      $$ = ast_new_concatenation(CONCATENATION_NET,NULL,$1);
+      $$ = ast_new_expression_primary(ast_new_primary(PRIMARY_IDENTIFIER));
+      $$ -> primary -> value.identifier = $1;
   }
 | hierarchical_variable_identifier sq_bracket_expressions range_expression {
-      $$ = ast_new_concatenation(CONCATENATION_NET,NULL,$1);
+      $$ = ast_new_expression_primary(ast_new_primary(PRIMARY_IDENTIFIER));
+      $$ -> primary -> value.identifier = $1;
   }
 | hierarchical_variable_identifier range_expression {
-      $$ = ast_new_concatenation(CONCATENATION_NET,NULL,$1);
+      $$ = ast_new_expression_primary(ast_new_primary(PRIMARY_IDENTIFIER));
+      $$ -> primary -> value.identifier = $1;
   }
 | variable_concatenation {
-      $$ = $1;
+      $$ = ast_new_expression_primary(
+          ast_new_primary(PRIMARY_CONCATENATION));
+      $$ -> primary -> value.concatenation = $1;
   }
 ;
 
@@ -4452,7 +4553,7 @@ primary :
       $$ = ast_new_primary_function_call($2);
   }
 | SIMPLE_ID constant_function_call_pid{ // Weird quick, but it works.
-      $2 -> function= $1;
+      $2 -> function= ID_NODE($1);
       $$ = ast_new_primary_function_call($2);
   }
 | system_function_call{
@@ -4833,7 +4934,7 @@ identifier :
 
 simple_identifier: 
   SIMPLE_ID {
-    $$ = $1;
+    $$ = ID_NODE($1);
 }
 | text_macro_usage {
     $$ = $1;
@@ -4842,7 +4943,7 @@ simple_identifier:
 ;
 
 escaped_identifier  : ESCAPED_ID {
-    $$=$1;
+    $$=ID_NODE($1);
 };
 
 simple_arrayed_identifier       : simple_identifier range_o {
@@ -4860,11 +4961,11 @@ simple_hierarchical_identifier  :
 ;
 
 system_function_identifier      : SYSTEM_ID {
-    $$ = $1;
+    $$ = ID_NODE($1);
     $$ -> type = ID_SYSTEM_FUNCTION;
 };
 system_task_identifier          : SYSTEM_ID {
-    $$ = $1;
+    $$ = ID_NODE($1);
     $$ -> type = ID_SYSTEM_TASK;
 };
 
@@ -4875,14 +4976,14 @@ in the closed brackets reduces to an "unsigned_number" */
 
 simple_hierarchical_branch : 
   SIMPLE_ID {
-      $$ = $1;
+      $$ = ID_NODE($1);
   }
 | SIMPLE_ID OPEN_SQ_BRACKET expression CLOSE_SQ_BRACKET{
-      $$=$1;
+      $$=ID_NODE($1);
       ast_identifier_set_index($$,$3);
   }
 | SIMPLE_ID OPEN_SQ_BRACKET range_expression CLOSE_SQ_BRACKET{
-      $$=$1;
+      $$=ID_NODE($1);
       ast_identifier_set_index($$,$3);
   }
 | simple_hierarchical_branch DOT simple_identifier{
@@ -4890,13 +4991,13 @@ simple_hierarchical_branch :
   }
 | simple_hierarchical_branch DOT SIMPLE_ID OPEN_SQ_BRACKET expression 
   CLOSE_SQ_BRACKET {
-      $$=$3;
+      $$=ID_NODE($3);
       ast_identifier_set_index($$,$5);
       $$ = ast_append_identifier($1,$$);
   }
 | simple_hierarchical_branch DOT SIMPLE_ID OPEN_SQ_BRACKET range_expression 
   CLOSE_SQ_BRACKET{
-      $$=$3;
+      $$=ID_NODE($3);
       ast_identifier_set_index($$,$5);
       $$ = ast_append_identifier($1,$$);
   }
@@ -4930,3 +5031,8 @@ escaped_hierarchical_branch :
 white_space : SPACE | TAB | NEWLINE;
 
 %%
+
+const char * verilog_token_name(int kind)
+{
+    return yytname[YYTRANSLATE(kind)];
+}
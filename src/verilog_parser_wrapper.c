@@ -1,18 +1,35 @@
-
 /*!
 @file verilog_parser_wrapper.c
 @brief Contains implementations of functions declared in verilog_parser.h
 */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "verilog_ast.h"
 #include "verilog_parser.h"
+#include "verilog_parser.tab.h"
 
 //! This is defined in the generated bison parser code.
-extern int yyparse();
+extern int yyparse(yyscan_t scanner, verilog_parser_context * ctx);
+
+//! This is defined in the generated flex scanner code.
+extern int yylex(YYSTYPE * yylval_param, yyscan_t scanner);
+
+//! The context the calling thread is currently parsing with, if any.
+static VERILOG_THREAD_LOCAL verilog_parser_context * current_context = NULL;
+
+//! The cache used by the default context, and by verilog_parse_files.
+static verilog_parse_cache * default_parse_cache = NULL;
 
 void    verilog_parser_init()
 {
-    if(yy_preproc == NULL) 
+    if(yy_preproc == NULL)
     {
         //printf("Added new preprocessor context\n");
         yy_preproc = verilog_new_preprocessor_context();
@@ -22,6 +39,794 @@ void    verilog_parser_init()
         //printf("Added new source tree\n");
         yy_verilog_source_tree = verilog_new_source_tree();
     }
+    if(yy_diagnostics == NULL)
+    {
+        yy_diagnostics = verilog_diagnostics_new();
+    }
+}
+
+verilog_parser_context * verilog_parser_context_new()
+{
+    verilog_parser_context * tr = calloc(1, sizeof(verilog_parser_context));
+
+    if(tr == NULL)
+    {
+        return NULL;
+    }
+
+    if(yylex_init_extra(tr, &tr -> scanner) != 0)
+    {
+        free(tr);
+        return NULL;
+    }
+
+    tr -> preproc       = verilog_new_preprocessor_context();
+    tr -> source_tree   = verilog_new_source_tree();
+    tr -> include_cache = verilog_include_cache_new();
+    tr -> diagnostics   = verilog_diagnostics_new();
+
+    return tr;
+}
+
+void verilog_parser_context_free(
+    verilog_parser_context * tofree
+){
+    if(tofree == NULL)
+    {
+        return;
+    }
+
+    yylex_destroy(tofree -> scanner);
+    ast_arena_free(tofree -> item_arena);
+    ast_arena_free(tofree -> token_arena);
+    verilog_free_preprocessor_context(tofree -> preproc);
+    verilog_free_source_tree(tofree -> source_tree);
+    verilog_include_cache_free(tofree -> include_cache);
+    verilog_diagnostics_free(tofree -> diagnostics);
+    free(tofree);
+}
+
+void verilog_parser_set_item_callback(
+    verilog_parser_context * ctx,
+    verilog_item_callback    callback,
+    void                   * data
+){
+    ctx -> on_item      = callback;
+    ctx -> on_item_data = data;
+
+    if(callback != NULL && ctx -> item_arena == NULL)
+    {
+        ctx -> item_arena = ast_arena_new(0);
+    }
+    else if(callback == NULL)
+    {
+        ast_arena_free(ctx -> item_arena);
+        ctx -> item_arena = NULL;
+    }
+}
+
+void verilog_parser_set_parse_cache(
+    verilog_parse_cache * cache
+){
+    default_parse_cache = cache;
+}
+
+/*!
+@brief Empties the location table of a streaming context once the callback
+is done with an item, so that it only ever holds the locations of one item.
+@details Locations which are still referred to, by an open macro expansion
+or by a diagnostic which has been buffered rather than handed to a sink,
+are kept until a later item instead.
+*/
+static void verilog_parser_reset_locations(
+    verilog_parser_context * ctx
+){
+    ast_location_table * table = ctx -> source_tree -> locations;
+
+    if(table == NULL || table -> shared ||
+       ctx -> preproc -> expansion_depth > 0 ||
+       (ctx -> diagnostics != NULL && ctx -> diagnostics -> count > 0))
+    {
+        return;
+    }
+
+    ast_location_table_reset(table);
+    ctx -> location = 0;
+}
+
+/*!
+@brief Gives back the pages of a mapped file which the scanner has finished
+with, once the streaming callback is done with an item.
+@details The scanner writes into the pages it scans, so each becomes a
+private copy. Pages wholly before the text of the last token scanned are
+never looked at again, and dropping them returns their memory. Tokens from
+an include file or macro expansion are scanned from a buffer of their own,
+and release nothing.
+*/
+static void verilog_parser_release_mapped(
+    verilog_parser_context * ctx
+){
+    char * text = yyget_text(ctx -> scanner);
+
+    if(ctx -> mapped == NULL || text == NULL || text < ctx -> mapped ||
+       text >= ctx -> mapped + ctx -> mapped_size)
+    {
+        return;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t done = ((text - ctx -> mapped) / page) * page;
+
+    if(done > ctx -> mapped_released)
+    {
+        madvise(ctx -> mapped + ctx -> mapped_released,
+                done - ctx -> mapped_released, MADV_DONTNEED);
+        ctx -> mapped_released = done;
+    }
+}
+
+/*!
+@brief Adds a finished module or UDP to the source tree, or hands it to the
+streaming callback.
+@details Everything parsed since the previous item lives in the item arena,
+so once the callback is done with this item, resetting the arena releases
+all of it at once, keeping one chunk around for the next item.
+*/
+void verilog_parser_emit_item(
+    verilog_parser_context * ctx,
+    ast_source_item        * item
+){
+    if(ctx -> on_item != NULL)
+    {
+        ctx -> on_item(ctx, item, ctx -> on_item_data);
+        ast_arena_reset(ctx -> item_arena);
+        verilog_parser_reset_locations(ctx);
+        verilog_parser_release_mapped(ctx);
+    }
+    else if(item -> type == SOURCE_MODULE)
+    {
+        verilog_source_tree_add_module(ctx -> source_tree, item -> module);
+    }
+    else if(item -> type == SOURCE_UDP)
+    {
+        ast_list_append(ctx -> source_tree -> primitives, item -> udp);
+    }
+}
+
+void verilog_parser_syntax_error(
+    verilog_parser_context * ctx,
+    const char             * message
+){
+    ctx -> syntax_errors ++;
+
+    VERILOG_DIAGNOSE(ctx -> diagnostics, VERILOG_SEVERITY_ERROR,
+                     DIAG_SYNTAX_ERROR, verilog_parser_location(ctx),
+                     "%s, at '%s'", message, yyget_text(ctx -> scanner));
+}
+
+verilog_parser_context * verilog_parser_current_context()
+{
+    return current_context;
+}
+
+unsigned int verilog_parser_current_line()
+{
+    if(current_context == NULL)
+    {
+        return 0;
+    }
+    return yyget_lineno(current_context -> scanner);
+}
+
+char * verilog_parser_current_file()
+{
+    if(current_context != NULL)
+    {
+        return verilog_preprocessor_current_file(current_context -> preproc);
+    }
+    else if(yy_preproc != NULL)
+    {
+        return verilog_preprocessor_current_file(yy_preproc);
+    }
+    return NULL;
+}
+
+ast_location verilog_parser_location(
+    verilog_parser_context * ctx
+){
+    if(ctx -> source_tree == NULL)
+    {
+        return 0;
+    }
+
+    verilog_preprocessor_context * preproc = ctx -> preproc;
+    ast_location_table           * table   = ctx -> source_tree -> locations;
+    ast_location_entry             at;
+
+    at.line = yyget_lineno(ctx -> scanner);
+
+    if(preproc -> expansion_depth == 0)
+    {
+        at.file      = verilog_preprocessor_current_file(preproc);
+        at.expansion = 0;
+    }
+    else
+    {
+        verilog_macro_expansion * e =
+            &preproc -> expansions[preproc -> expansion_depth - 1];
+
+        at.file      = e -> macro -> file;
+        at.line      = e -> macro -> line + at.line - e -> line;
+        at.expansion = e -> site;
+    }
+
+    if(ctx -> location == 0                ||
+       ctx -> location_at.line != at.line  ||
+       ctx -> location_at.file != at.file  ||
+       ctx -> location_at.expansion != at.expansion)
+    {
+        ctx -> location    = ast_location_add(table, at.file, at.line,
+                                              at.expansion);
+        ctx -> location_at = at;
+    }
+
+    return ctx -> location;
+}
+
+ast_location verilog_parser_current_location()
+{
+    if(current_context == NULL)
+    {
+        return 0;
+    }
+    return verilog_parser_location(current_context);
+}
+
+ast_location_table * verilog_parser_current_locations()
+{
+    if(current_context == NULL || current_context -> source_tree == NULL)
+    {
+        return NULL;
+    }
+    return current_context -> source_tree -> locations;
+}
+
+/*!
+@brief Runs the parser over the currently selected buffer of a context,
+allocating every parsed construct from the arena of its source tree, or
+from its item arena when streaming.
+*/
+static int verilog_parse_current_buffer(
+    verilog_parser_context * ctx
+){
+    int streaming = ctx -> on_item != NULL;
+    verilog_parser_context * prev_ctx = current_context;
+    ast_arena * prev = ast_set_current_arena(streaming ?
+                                             ctx -> item_arena :
+                                             ctx -> source_tree -> arena);
+    current_context  = ctx;
+
+    ctx -> preproc -> include_cache = ctx -> include_cache;
+    ctx -> preproc -> diagnostics   = ctx -> diagnostics;
+    ctx -> location = 0;
+
+    if(ctx -> diagnostics != NULL)
+    {
+        ctx -> diagnostics -> locations = ctx -> source_tree -> locations;
+    }
+
+    unsigned int errors = ctx -> syntax_errors;
+    int          result = yyparse(ctx -> scanner, ctx);
+
+    // A parse which recovered from its errors still failed.
+    if(result == 0 && ctx -> syntax_errors != errors)
+    {
+        result = 1;
+    }
+
+    verilog_scanner_reset(ctx -> scanner);
+
+    // Every rule has been reduced, so no token's text is needed any more.
+    if(ctx -> token_arena != NULL)
+    {
+        ast_arena_reset(ctx -> token_arena);
+    }
+
+    if(streaming)
+    {
+        // Whatever was parsed after the last item, such as configurations,
+        // may have been added to the tree, so it must now own it.
+        ast_arena_adopt(ctx -> source_tree -> arena, ctx -> item_arena);
+        ctx -> item_arena = ast_arena_new(0);
+    }
+
+    current_context  = prev_ctx;
+    ast_set_current_arena(prev);
+    return result;
+}
+
+int     verilog_parse_file_ctx(
+    verilog_parser_context * ctx,
+    FILE                   * to_parse
+){
+    YY_BUFFER_STATE new_buffer = yy_create_buffer(to_parse, YY_BUF_SIZE,
+                                                  ctx -> scanner);
+    yy_switch_to_buffer(new_buffer, ctx -> scanner);
+    yyset_lineno(1, ctx -> scanner); // We are in a new file!
+
+    return verilog_parse_current_buffer(ctx);
+}
+
+int     verilog_parse_string_ctx(
+    verilog_parser_context * ctx,
+    char                   * to_parse,
+    int                      length
+){
+    YY_BUFFER_STATE new_buffer = yy_scan_bytes(to_parse, length,
+                                               ctx -> scanner);
+    yy_switch_to_buffer(new_buffer, ctx -> scanner);
+    yyset_lineno(1, ctx -> scanner);
+
+    return verilog_parse_current_buffer(ctx);
+}
+
+int     verilog_parse_buffer_ctx(
+    verilog_parser_context * ctx,
+    char                   * to_parse,
+    int                      length
+){
+    YY_BUFFER_STATE new_buffer = yy_scan_buffer(to_parse, length,
+                                                ctx -> scanner);
+    yy_switch_to_buffer(new_buffer, ctx -> scanner);
+    yyset_lineno(1, ctx -> scanner);
+
+    return verilog_parse_current_buffer(ctx);
+}
+
+//! Longest input flex can scan as one buffer, leaving room for two NULs.
+#define VERILOG_SCAN_MAX ((size_t)INT_MAX - 2)
+
+/*!
+@brief Reports a file which could not be mapped because it is too long.
+@details Files which could not be opened at all are left for the caller to
+report, as they always have been.
+*/
+static void verilog_map_failed(
+    verilog_parser_context * ctx,
+    char                   * path
+){
+    if(errno == EFBIG)
+    {
+        if(ctx -> diagnostics != NULL)
+        {
+            ctx -> diagnostics -> locations = ctx -> source_tree -> locations;
+        }
+
+        VERILOG_DIAGNOSE(ctx -> diagnostics, VERILOG_SEVERITY_ERROR,
+            DIAG_INPUT_TOO_LARGE,
+            verilog_diagnostics_location(ctx -> diagnostics,
+                                         ast_intern(path), 0),
+            "File is longer than the %d bytes which can be scanned",
+            INT_MAX - 2);
+    }
+}
+
+/*!
+@brief Maps a file into memory, ready to be scanned in place by flex.
+@details Flex scans a buffer in place only if it is writable and ends with
+two NUL characters. The mapping is made in two steps to get both: first an
+anonymous, zero filled, region one page size multiple larger than the file
+plus its two NULs, and then a private mapping of the file over the start of
+it. Any bytes past the end of the file are zero either way. Flex keeps the
+sizes of its buffers as ints, so files longer than VERILOG_SCAN_MAX are
+refused, with errno set to EFBIG.
+@param [in] path - The file to map.
+@param [out] size - The size of the file.
+@param [out] length - The length of the mapping, to pass to munmap.
+@returns The start of the mapping, or NULL if it could not be made.
+*/
+static char * verilog_map_path(
+    char   * path,
+    size_t * size,
+    size_t * length
+){
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if((unsigned long long)info.st_size > VERILOG_SCAN_MAX)
+    {
+        close(fd);
+        errno = EFBIG;
+        return NULL;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    *size       = info.st_size;
+    *length     = ((*size + 2 + page - 1) / page) * page;
+
+    char * base = mmap(NULL, *length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(base == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if(*size > 0 && mmap(base, *size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, *length);
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping keeps the file open for as long as it needs to.
+    close(fd);
+    madvise(base, *length, MADV_SEQUENTIAL);
+
+    return base;
+}
+
+//! Returns the four top level construct lists of a tree, in a fixed order.
+static void verilog_source_tree_lists(
+    verilog_source_tree * tree,
+    ast_list           ** lists
+){
+    lists[0] = tree -> modules;
+    lists[1] = tree -> primitives;
+    lists[2] = tree -> configs;
+    lists[3] = tree -> libraries;
+}
+
+//! Returns the four construct lists of a file, in the same order.
+static void verilog_source_file_lists(
+    verilog_source_file * file,
+    ast_list           ** lists
+){
+    lists[0] = file -> modules;
+    lists[1] = file -> primitives;
+    lists[2] = file -> configs;
+    lists[3] = file -> libraries;
+}
+
+/*!
+@brief Keeps a snapshot of the preprocessor a file is about to be parsed with
+in the file's record, so that reparsing the file can start from the same
+state.
+@details A file parsed with the same state as the file recorded before it
+shares that file's snapshot, which is the usual case when every file starts
+from a fresh or loaded preprocessor.
+*/
+static void verilog_source_file_keep_entry(
+    verilog_source_tree          * tree,
+    verilog_source_file          * file,
+    verilog_preprocessor_context * preproc
+){
+    unsigned int i = tree -> files -> items;
+
+    while(i > 0)
+    {
+        verilog_source_file * other = ast_list_get(tree -> files, -- i);
+
+        if(other == file)
+        {
+            continue;
+        }
+
+        if(other -> entry_state != NULL &&
+           other -> preproc_hash == file -> preproc_hash)
+        {
+            file -> entry_state      = other -> entry_state;
+            file -> entry_state_size = other -> entry_state_size;
+            return;
+        }
+        break;
+    }
+
+    size_t size;
+    char * state = verilog_preprocessor_save_buffer(preproc, &size);
+
+    file -> entry_state      = NULL;
+    file -> entry_state_size = 0;
+
+    if(state != NULL)
+    {
+        file -> entry_state = ast_arena_calloc(tree -> arena, size, 1);
+        memcpy(file -> entry_state, state, size);
+        file -> entry_state_size = size;
+        free(state);
+    }
+}
+
+/*!
+@brief Parses a file which has already been mapped into memory, recording
+what it adds to the source tree in the tree's record of the file.
+@details Streamed parses keep no constructs, so they make no record, and
+the file need not be hashed at all.
+@param [in] hash - The hash of the contents of the file, or NULL if it has
+not been worked out.
+*/
+static int verilog_parse_mapped(
+    verilog_parser_context * ctx,
+    char                   * path,
+    char                   * base,
+    size_t                   size,
+    uint64_t               * hash
+){
+    verilog_source_file * file = NULL;
+    ast_list   * from[4];
+    ast_list   * into[4];
+    unsigned int first[4];
+    unsigned int l, i;
+
+    if(ctx -> on_item == NULL)
+    {
+        file = verilog_source_tree_file(ctx -> source_tree, path);
+        file -> content_hash = hash != NULL ? *hash :
+                               ast_hash_bytes(AST_HASH_SEED, base, size);
+        file -> preproc_hash = verilog_preprocessor_hash(ctx -> preproc);
+        verilog_source_file_keep_entry(ctx -> source_tree, file,
+                                       ctx -> preproc);
+        verilog_source_file_lists(file, into);
+    }
+
+    verilog_source_tree_lists(ctx -> source_tree, from);
+    for(l = 0; l < 4; l ++)
+    {
+        first[l] = from[l] -> items;
+    }
+
+    verilog_preprocessor_set_file(ctx -> preproc, path);
+
+    YY_BUFFER_STATE new_buffer = yy_scan_buffer(base, size + 2,
+                                                ctx -> scanner);
+    yy_switch_to_buffer(new_buffer, ctx -> scanner);
+    yyset_lineno(1, ctx -> scanner);
+
+    ctx -> mapped          = base;
+    ctx -> mapped_size     = size;
+    ctx -> mapped_released = 0;
+
+    int result = verilog_parse_current_buffer(ctx);
+
+    ctx -> mapped = NULL;
+
+    for(l = 0; file != NULL && l < 4; l ++)
+    {
+        for(i = first[l]; i < from[l] -> items; i ++)
+        {
+            ast_list_append(into[l], ast_list_get(from[l], i));
+        }
+    }
+
+    return result;
+}
+
+/*!
+@brief Loads a file from the context's parse cache, or parses it and then
+stores it there.
+@details Streamed parses never use the cache, since they keep no
+constructs to store. A file is only stored if this parse is all its record
+holds.
+@param [in] hash - The hash of the contents of the file, or NULL if it has
+not been worked out.
+*/
+static int verilog_parse_cached(
+    verilog_parser_context * ctx,
+    char                   * path,
+    char                   * base,
+    size_t                   size,
+    uint64_t               * hash
+){
+    verilog_parse_cache * cache = ctx -> on_item == NULL ?
+                                  ctx -> parse_cache : NULL;
+    uint64_t              known;
+
+    if(cache == NULL)
+    {
+        return verilog_parse_mapped(ctx, path, base, size, hash);
+    }
+
+    if(hash == NULL)
+    {
+        known = ast_hash_bytes(AST_HASH_SEED, base, size);
+        hash  = &known;
+    }
+
+    uint64_t key    = verilog_parse_cache_key(path, *hash,
+                          verilog_preprocessor_hash(ctx -> preproc));
+    int      global = ctx -> preproc == yy_preproc;
+
+    if(verilog_parse_cache_fetch(cache, key, path, ctx -> source_tree,
+                                 &ctx -> preproc) == 0)
+    {
+        if(global)
+        {
+            yy_preproc = ctx -> preproc;
+        }
+        return 0;
+    }
+
+    int fresh = verilog_source_tree_find_file(ctx -> source_tree,
+                                              path) == NULL;
+    unsigned int first_include = ctx -> preproc -> includes -> items;
+    int result = verilog_parse_mapped(ctx, path, base, size, hash);
+
+    if(result == 0 && fresh)
+    {
+        verilog_parse_cache_store(cache, key, ctx -> source_tree,
+            verilog_source_tree_find_file(ctx -> source_tree, path),
+            ctx -> preproc, first_include);
+    }
+
+    return result;
+}
+
+/*!
+@brief Perform a parsing operation on a memory mapped file.
+*/
+int     verilog_parse_path_ctx(
+    verilog_parser_context * ctx,
+    char                   * path
+){
+    size_t size, length;
+    char * base = verilog_map_path(path, &size, &length);
+
+    if(base == NULL)
+    {
+        verilog_map_failed(ctx, path);
+        return -1;
+    }
+
+    int result = verilog_parse_cached(ctx, path, base, size, NULL);
+
+    munmap(base, length);
+    return result;
+}
+
+/*!
+@brief Replaces the preprocessor of a context with one in the state a file
+was last parsed with, as kept by verilog_source_file_keep_entry.
+@details The include directories and include cache are those of the
+context's own preprocessor, since they are not part of a snapshot.
+@returns The preprocessor replaced, for verilog_reparse_leave to put back,
+or NULL if the file has no snapshot, and the context was left alone.
+*/
+static verilog_preprocessor_context * verilog_reparse_enter(
+    verilog_parser_context * ctx,
+    verilog_source_file    * file
+){
+    verilog_preprocessor_context * entry = NULL;
+    verilog_preprocessor_context * live  = ctx -> preproc;
+
+    if(file != NULL && file -> entry_state != NULL)
+    {
+        entry = verilog_preprocessor_load_buffer(file -> entry_state,
+                                                 file -> entry_state_size);
+    }
+
+    if(entry == NULL)
+    {
+        return NULL;
+    }
+
+    entry -> search_dirs   = live -> search_dirs;
+    entry -> include_cache = live -> include_cache;
+
+    ctx -> preproc = entry;
+    if(yy_preproc == live)
+    {
+        yy_preproc = entry;
+    }
+
+    return live;
+}
+
+//! Puts back the preprocessor replaced by verilog_reparse_enter.
+static void verilog_reparse_leave(
+    verilog_parser_context       * ctx,
+    verilog_preprocessor_context * live
+){
+    if(live == NULL)
+    {
+        return;
+    }
+
+    // A cache hit may have replaced the entry state by now.
+    int global = yy_preproc == ctx -> preproc;
+
+    verilog_free_preprocessor_context(ctx -> preproc);
+    ctx -> preproc = live;
+
+    if(global)
+    {
+        yy_preproc = live;
+    }
+}
+
+int     verilog_reparse_path_ctx(
+    verilog_parser_context * ctx,
+    char                   * path,
+    ast_boolean            * skipped
+){
+    size_t size, length;
+    char * base = verilog_map_path(path, &size, &length);
+
+    if(skipped != NULL)
+    {
+        *skipped = AST_FALSE;
+    }
+
+    if(base == NULL)
+    {
+        verilog_map_failed(ctx, path);
+        return -1;
+    }
+
+    uint64_t hash = ast_hash_bytes(AST_HASH_SEED, base, size);
+    verilog_source_file * file =
+        verilog_source_tree_find_file(ctx -> source_tree, path);
+    verilog_preprocessor_context * live = verilog_reparse_enter(ctx, file);
+
+    if(file != NULL && file -> content_hash == hash &&
+       file -> preproc_hash == verilog_preprocessor_hash(ctx -> preproc))
+    {
+        verilog_reparse_leave(ctx, live);
+        munmap(base, length);
+
+        if(skipped != NULL)
+        {
+            *skipped = AST_TRUE;
+        }
+        return 0;
+    }
+
+    verilog_source_tree_remove_file(ctx -> source_tree, path);
+
+    int result = verilog_parse_cached(ctx, path, base, size, &hash);
+
+    verilog_reparse_leave(ctx, live);
+    munmap(base, length);
+    return result;
+}
+
+/*!
+@brief Returns the process wide context used by the legacy parse functions.
+@details The context is created on first use, and always refers to the
+current yy_preproc, yy_verilog_source_tree and yy_diagnostics globals, which
+are created if they do not yet exist.
+*/
+verilog_parser_context * verilog_parser_default_context()
+{
+    static verilog_parser_context * tr = NULL;
+
+    if(tr == NULL)
+    {
+        tr = calloc(1, sizeof(verilog_parser_context));
+        yylex_init_extra(tr, &tr -> scanner);
+        tr -> include_cache = verilog_include_cache_new();
+    }
+
+    verilog_parser_init();
+
+    tr -> preproc     = yy_preproc;
+    tr -> source_tree = yy_verilog_source_tree;
+    tr -> parse_cache = default_parse_cache;
+    tr -> diagnostics = yy_diagnostics;
+
+    return tr;
 }
 
 /*!
@@ -29,12 +834,7 @@ void    verilog_parser_init()
 */
 int     verilog_parse_file(FILE * to_parse)
 {
-    YY_BUFFER_STATE new_buffer = yy_create_buffer(to_parse, YY_BUF_SIZE);
-    yy_switch_to_buffer(new_buffer);
-    yylineno = 0; // Reset the global line counter, we are in a new file!
-    
-    int result = yyparse();
-    return result;
+    return verilog_parse_file_ctx(verilog_parser_default_context(), to_parse);
 }
 
 /*!
@@ -42,11 +842,8 @@ int     verilog_parse_file(FILE * to_parse)
 */
 int     verilog_parse_string(char * to_parse, int length)
 {
-    YY_BUFFER_STATE new_buffer = yy_scan_bytes(to_parse, length);
-    yy_switch_to_buffer(new_buffer);
-    
-    int result = yyparse();
-    return result;
+    return verilog_parse_string_ctx(verilog_parser_default_context(),
+                                    to_parse, length);
 }
 
 
@@ -55,9 +852,494 @@ int     verilog_parse_string(char * to_parse, int length)
 */
 int     verilog_parse_buffer(char * to_parse, int length)
 {
-    YY_BUFFER_STATE new_buffer = yy_scan_buffer(to_parse, length);
-    yy_switch_to_buffer(new_buffer);
-    
-    int result = yyparse();
-    return result;
+    return verilog_parse_buffer_ctx(verilog_parser_default_context(),
+                                    to_parse, length);
+}
+
+
+/*!
+@brief Perform a parsing operation on the file at the supplied path.
+*/
+int     verilog_parse_path(char * path)
+{
+    return verilog_parse_path_ctx(verilog_parser_default_context(), path);
+}
+
+/*!
+@brief Parses a file again, replacing what it added to the source tree.
+*/
+int     verilog_reparse_path(char * path, ast_boolean * skipped)
+{
+    return verilog_reparse_path_ctx(verilog_parser_default_context(), path,
+                                    skipped);
+}
+
+
+//! The constructs one file added to the source tree of the worker parsing it.
+typedef struct verilog_parsed_file_t{
+    int                   result;   //!< Result of parsing the file.
+    verilog_source_tree * tree;     //!< The tree of the worker which parsed it.
+    verilog_diagnostics * diagnostics; //!< Reported while parsing it.
+    unsigned int          first[4]; //!< First module, primitive, etc.
+    unsigned int          last[4];  //!< One past the last of each.
+} verilog_parsed_file;
+
+//! Work shared between every worker of a verilog_parse_files call.
+typedef struct verilog_parse_job_t{
+    char               ** paths;       //!< The files to parse.
+    unsigned int          count;       //!< Number of paths.
+    unsigned int          next;        //!< Next path to hand out.
+    pthread_mutex_t       lock;        //!< Guards next.
+    ast_list            * search_dirs; //!< Include directories, or NULL.
+    char                * prelude;     //!< Snapshot every file starts from.
+    size_t                prelude_size;//!< Length of prelude.
+    verilog_parsed_file * files;       //!< One entry per path.
+    ast_location_table  * locations;   //!< Shared by every worker.
+    verilog_parse_cache * parse_cache; //!< Shared by every worker, or NULL.
+    ast_boolean           diagnose;    //!< Whether to keep diagnostics.
+} verilog_parse_job;
+
+/*!
+@brief Worker thread body for verilog_parse_files.
+@details Takes files from the job one at a time and parses each into the
+source tree of its own context, noting which constructs came from which
+file. The diagnostics of each file are buffered separately, to be reported in
+order by the caller. Returns that source tree, which the caller then takes
+over.
+*/
+static void * verilog_parse_files_worker(void * arg)
+{
+    verilog_parse_job      * job = arg;
+    verilog_parser_context * ctx = verilog_parser_context_new();
+
+    if(ctx == NULL)
+    {
+        return NULL;
+    }
+
+    // Locations go straight into the tree the results are merged into.
+    ctx -> source_tree -> locations = job -> locations;
+    ctx -> parse_cache              = job -> parse_cache;
+
+    // Each file is given diagnostics of its own, which the caller frees.
+    verilog_diagnostics_free(ctx -> diagnostics);
+    ctx -> diagnostics = NULL;
+
+    while(1)
+    {
+        pthread_mutex_lock(&job -> lock);
+        unsigned int f = job -> next;
+        job -> next += f < job -> count;
+        pthread_mutex_unlock(&job -> lock);
+
+        if(f >= job -> count)
+        {
+            break;
+        }
+
+        verilog_parsed_file * file = &job -> files[f];
+        ast_list * lists[4];
+        unsigned int l;
+
+        verilog_source_tree_lists(ctx -> source_tree, lists);
+        for(l = 0; l < 4; l ++)
+        {
+            file -> first[l] = lists[l] -> items;
+        }
+        file -> tree = ctx -> source_tree;
+
+        file -> diagnostics = verilog_diagnostics_new();
+        if(file -> diagnostics != NULL)
+        {
+            file -> diagnostics -> enabled = job -> diagnose;
+        }
+        ctx -> diagnostics = file -> diagnostics;
+
+        // Every file starts with the same preprocessor state: the
+        // prelude's, or a fresh one.
+        verilog_free_preprocessor_context(ctx -> preproc);
+        ctx -> preproc = job -> prelude == NULL ?
+            verilog_new_preprocessor_context() :
+            verilog_preprocessor_load_buffer(job -> prelude,
+                                             job -> prelude_size);
+
+        if(ctx -> preproc == NULL)
+        {
+            ctx -> preproc = verilog_new_preprocessor_context();
+            file -> result = -1;
+        }
+        else
+        {
+            if(job -> search_dirs != NULL)
+            {
+                ast_list_concat(ctx -> preproc -> search_dirs,
+                                job -> search_dirs);
+            }
+
+            file -> result = verilog_parse_path_ctx(ctx, job -> paths[f]);
+        }
+
+        for(l = 0; l < 4; l ++)
+        {
+            file -> last[l] = lists[l] -> items;
+        }
+    }
+
+    verilog_source_tree * tree = ctx -> source_tree;
+    ctx -> source_tree = NULL;
+    ctx -> diagnostics = NULL;
+    verilog_parser_context_free(ctx);
+
+    return tree;
+}
+
+int     verilog_parse_files(
+    verilog_source_tree * tree,
+    char               ** paths,
+    unsigned int          count,
+    ast_list            * search_dirs,
+    verilog_preprocessor_context * prelude,
+    unsigned int          jobs,
+    int                 * results
+){
+    if(count == 0)
+    {
+        return 0;
+    }
+
+    if(jobs == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = online > 0 ? (unsigned int)online : 1;
+    }
+    if(jobs > count)
+    {
+        jobs = count;
+    }
+
+    verilog_parse_job job;
+    job.paths       = paths;
+    job.count       = count;
+    job.next        = 0;
+    job.search_dirs = search_dirs;
+    job.prelude     = NULL;
+    job.prelude_size = 0;
+    job.files       = calloc(count, sizeof(verilog_parsed_file));
+    job.locations   = tree -> locations;
+    job.parse_cache = default_parse_cache;
+    job.diagnose    = yy_diagnostics != NULL && yy_diagnostics -> enabled;
+
+    // Taken once, and loaded again by every file, so that no two workers
+    // ever share the state they go on to change.
+    if(prelude != NULL)
+    {
+        job.prelude = verilog_preprocessor_save_buffer(prelude,
+                                                       &job.prelude_size);
+        if(job.prelude == NULL)
+        {
+            unsigned int f;
+            for(f = 0; results != NULL && f < count; f ++)
+            {
+                results[f] = -1;
+            }
+            free(job.files);
+            return count;
+        }
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+
+    pthread_t           * threads = calloc(jobs, sizeof(pthread_t));
+    verilog_source_tree ** trees  = calloc(jobs, sizeof(verilog_source_tree*));
+    unsigned int t;
+    unsigned int started = 0;
+
+    // Only locked while the workers are all adding to it.
+    tree -> locations -> shared = AST_TRUE;
+
+    for(t = 0; t < jobs; t ++)
+    {
+        if(pthread_create(&threads[t], NULL, verilog_parse_files_worker,
+                          &job) != 0)
+        {
+            break;
+        }
+        started ++;
+    }
+
+    if(started == 0)
+    {
+        // No threads to be had, so do all of the work on this one.
+        trees[0] = verilog_parse_files_worker(&job);
+    }
+
+    for(t = 0; t < started; t ++)
+    {
+        pthread_join(threads[t], (void**)&trees[t]);
+    }
+
+    tree -> locations -> shared = AST_FALSE;
+
+    // Merge in the order the files were given, so the result never depends
+    // on how the work happened to be scheduled.
+    ast_list * into[4];
+    int        failed = 0;
+    unsigned int f;
+
+    verilog_source_tree_lists(tree, into);
+
+    if(yy_diagnostics != NULL)
+    {
+        yy_diagnostics -> locations = tree -> locations;
+    }
+
+    for(f = 0; f < count; f ++)
+    {
+        verilog_parsed_file * file = &job.files[f];
+
+        if(file -> tree == NULL)
+        {
+            // The worker could not even create a parser context.
+            file -> result = -1;
+        }
+        else
+        {
+            ast_list * from[4];
+            ast_list * kept[4];
+            unsigned int l, i;
+
+            // The worker's record of the file moves over with its items.
+            verilog_source_file * parsed = verilog_source_tree_find_file(
+                file -> tree, paths[f]);
+            verilog_source_file * record = NULL;
+
+            if(parsed != NULL)
+            {
+                record = verilog_source_tree_file(tree, paths[f]);
+                record -> content_hash = parsed -> content_hash;
+                record -> preproc_hash = parsed -> preproc_hash;
+                if(parsed -> entry_state != NULL)
+                {
+                    record -> entry_state = ast_arena_calloc(tree -> arena,
+                                            parsed -> entry_state_size, 1);
+                    record -> entry_state_size = parsed -> entry_state_size;
+                    memcpy(record -> entry_state, parsed -> entry_state,
+                           parsed -> entry_state_size);
+                }
+                verilog_source_file_lists(record, kept);
+            }
+
+            verilog_source_tree_lists(file -> tree, from);
+            for(l = 0; l < 4; l ++)
+            {
+                for(i = file -> first[l]; i < file -> last[l]; i ++)
+                {
+                    ast_list_append(into[l], ast_list_get(from[l], i));
+
+                    if(record != NULL)
+                    {
+                        ast_list_append(kept[l], ast_list_get(from[l], i));
+                    }
+                }
+            }
+        }
+
+        if(file -> diagnostics != NULL)
+        {
+            verilog_diagnostics_replay(yy_diagnostics, file -> diagnostics);
+            verilog_diagnostics_free(file -> diagnostics);
+        }
+
+        failed += file -> result != 0;
+
+        if(results != NULL)
+        {
+            results[f] = file -> result;
+        }
+    }
+
+    verilog_source_tree_index_modules(tree);
+
+    for(t = 0; t < jobs; t ++)
+    {
+        if(trees[t] != NULL)
+        {
+            ast_arena_adopt(tree -> arena, trees[t] -> arena);
+        }
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    free(job.prelude);
+    free(job.files);
+    free(threads);
+    free(trees);
+
+    return failed;
+}
+
+
+/*!
+@brief Creates a lexer around an input buffer which is ready to be scanned.
+@details The lexer's context has no source tree, since the scanner never adds
+anything to one, and is set to scan tokens without building their values.
+*/
+static verilog_lexer * verilog_lex_new(
+    char   * input,
+    size_t   length,
+    size_t   mapped,
+    int      owned
+){
+    verilog_lexer * tr = length <= VERILOG_SCAN_MAX ?
+                         calloc(1, sizeof(verilog_lexer)) : NULL;
+
+    if(tr == NULL)
+    {
+        return NULL;
+    }
+
+    tr -> ctx = verilog_parser_context_new();
+
+    if(tr -> ctx == NULL)
+    {
+        free(tr);
+        return NULL;
+    }
+
+    verilog_free_source_tree(tr -> ctx -> source_tree);
+    tr -> ctx -> source_tree = NULL;
+    tr -> ctx -> lex_only    = 1;
+    tr -> ctx -> preproc -> diagnostics = tr -> ctx -> diagnostics;
+
+    tr -> input  = input;
+    tr -> length = length;
+    tr -> mapped = mapped;
+    tr -> owned  = owned;
+
+    YY_BUFFER_STATE buffer = yy_scan_buffer(input, length + 2,
+                                            tr -> ctx -> scanner);
+    if(buffer == NULL)
+    {
+        // The input is still the caller's to release.
+        tr -> mapped = 0;
+        tr -> owned  = 0;
+        verilog_lex_free(tr);
+        return NULL;
+    }
+
+    yy_switch_to_buffer(buffer, tr -> ctx -> scanner);
+    yyset_lineno(1, tr -> ctx -> scanner);
+
+    return tr;
+}
+
+verilog_lexer * verilog_lex_buffer(
+    char   * buffer,
+    size_t   length
+){
+    return verilog_lex_new(buffer, length, 0, 0);
+}
+
+verilog_lexer * verilog_lex_string(
+    char   * string,
+    size_t   length
+){
+    char * copy = malloc(length + 2);
+
+    if(copy == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(copy, string, length);
+    copy[length]     = '\0';
+    copy[length + 1] = '\0';
+
+    verilog_lexer * tr = verilog_lex_new(copy, length, 0, 1);
+
+    if(tr == NULL)
+    {
+        free(copy);
+    }
+    return tr;
+}
+
+verilog_lexer * verilog_lex_path(
+    char * path
+){
+    size_t size, length;
+    char * base = verilog_map_path(path, &size, &length);
+
+    if(base == NULL)
+    {
+        return NULL;
+    }
+
+    verilog_lexer * tr = verilog_lex_new(base, size, length, 0);
+
+    if(tr == NULL)
+    {
+        munmap(base, length);
+        return NULL;
+    }
+
+    verilog_preprocessor_set_file(tr -> ctx -> preproc, path);
+    return tr;
+}
+
+int     verilog_lex_next(
+    verilog_lexer * lexer,
+    verilog_token * token
+){
+    if(lexer -> done)
+    {
+        return 0;
+    }
+
+    verilog_parser_context * ctx = lexer -> ctx;
+    YYSTYPE value;
+
+    ctx -> preproc -> include_cache = ctx -> include_cache;
+
+    int kind = yylex(&value, ctx -> scanner);
+
+    if(kind == 0)
+    {
+        verilog_scanner_reset(ctx -> scanner);
+        lexer -> done = 1;
+        return 0;
+    }
+
+    char * buffer = verilog_scanner_buffer(ctx -> scanner);
+
+    token -> kind     = kind;
+    token -> text     = yyget_text(ctx -> scanner);
+    token -> length   = verilog_scanner_token_length(ctx -> scanner);
+    token -> line     = yyget_lineno(ctx -> scanner);
+    token -> file     = verilog_preprocessor_current_file(ctx -> preproc);
+    token -> in_input = buffer == lexer -> input;
+    token -> offset   = token -> text - buffer;
+
+    return 1;
+}
+
+void    verilog_lex_free(
+    verilog_lexer * lexer
+){
+    if(lexer == NULL)
+    {
+        return;
+    }
+
+    verilog_parser_context_free(lexer -> ctx);
+
+    if(lexer -> mapped > 0)
+    {
+        munmap(lexer -> input, lexer -> mapped);
+    }
+    else if(lexer -> owned)
+    {
+        free(lexer -> input);
+    }
+
+    free(lexer);
 }
@@ -3,13 +3,24 @@
 @brief Contains function implementations to support source code preprocessing.
 */
 
+#include <ctype.h>
+#include <dirent.h>
+#include <stdint.h>
+
 #include "verilog_preprocessor.h"
 
+//! The preprocessor context used by the legacy, global, parser interface.
+verilog_preprocessor_context * yy_preproc;
+
 verilog_preprocessor_context * verilog_new_preprocessor_context()
 {
+    ast_arena * arena = ast_arena_new(0);
+    ast_arena * prev  = ast_set_current_arena(arena);
+
     verilog_preprocessor_context * tr = 
         ast_calloc(1,sizeof(verilog_preprocessor_context));
 
+    tr -> arena          = arena;
     tr -> token_count    = 0;
     tr -> in_cell_define = AST_FALSE;
     tr -> emit           = AST_TRUE;
@@ -25,6 +36,8 @@ verilog_preprocessor_context * verilog_new_preprocessor_context()
     // By default, search CWD for include files.
     ast_list_append(tr -> search_dirs,"./");
 
+    ast_set_current_arena(prev);
+
     return tr;
 }
 
@@ -33,7 +46,8 @@ verilog_preprocessor_context * verilog_new_preprocessor_context()
 @brief Clears the stack of files being parsed, and sets the current file to
 the supplied string.
 @param [inout] preproc - The context who's file name is being set.
-@param [in] file - The file path to put as the current file.
+@param [in] file - The file path to put as the current file. It is interned,
+so need not outlive the call.
 */
 void verilog_preprocessor_set_file(
     verilog_preprocessor_context * preproc,
@@ -43,7 +57,7 @@ void verilog_preprocessor_set_file(
     {
         ast_stack_pop(preproc -> current_file);
     }
-    ast_stack_push(preproc -> current_file, file);
+    ast_stack_push(preproc -> current_file, ast_intern(file));
 }
 
 /*!
@@ -59,27 +73,42 @@ char * verilog_preprocessor_current_file(
 
 void verilog_free_preprocessor_context(verilog_preprocessor_context * tofree)
 {
-    printf("ERROR: Function not implemented. preprocessor context at %p not freed.\n", tofree);
+    if(tofree == NULL)
+    {
+        return;
+    }
+
+    if(tofree == yy_preproc)
+    {
+        yy_preproc = NULL;
+    }
+
+    free(tofree -> call.text);
+    free(tofree -> call.args);
+
+    // The context itself lives inside its own arena.
+    ast_arena_free(tofree -> arena);
 }
 
-void verilog_preproc_enter_cell_define()
+void verilog_preproc_enter_cell_define(verilog_preprocessor_context * preproc)
 {
-    yy_preproc -> in_cell_define = AST_FALSE;
+    preproc -> in_cell_define = AST_FALSE;
 }
 
-void verilog_preproc_exit_cell_define()
+void verilog_preproc_exit_cell_define(verilog_preprocessor_context * preproc)
 {
-    yy_preproc -> in_cell_define = AST_FALSE;
+    preproc -> in_cell_define = AST_FALSE;
 }
 
 //! Creates and returns a new default net type directive.
 verilog_default_net_type * verilog_new_default_net_type(
+    verilog_preprocessor_context * preproc,
     unsigned int token_number,  //!< Token number of the directive.
     unsigned int line_number,   //!< Line number of the directive.
     ast_net_type type           //!< The net type.
 ){
-    verilog_default_net_type * tr = 
-        ast_calloc(1,sizeof(verilog_default_net_type));
+    verilog_default_net_type * tr = ast_arena_calloc(preproc -> arena, 1,
+                                        sizeof(verilog_default_net_type));
 
     tr -> token_number = token_number;
     tr -> line_number  = line_number;
@@ -91,20 +120,22 @@ verilog_default_net_type * verilog_new_default_net_type(
 /*!
 @brief Registers a new default net type directive.
 @details Adds a record of the directive to the end of the linked list
-"net_types" in the global yy_preproc.
+"net_types" in the supplied context.
 */
 void verilog_preproc_default_net(
+    verilog_preprocessor_context * preproc,
     unsigned int token_number,  //!< Token number of the directive.
     unsigned int line_number,   //!< Line number of the directive.
     ast_net_type type           //!< The net type.
 ){
     verilog_default_net_type * directive = verilog_new_default_net_type(
+        preproc,
         token_number,
         line_number,
         type
     );
 
-    ast_list_append(yy_preproc -> net_types, directive);
+    ast_list_append(preproc -> net_types, directive);
 }
 
 
@@ -112,8 +143,9 @@ void verilog_preproc_default_net(
 @brief Handles the encounter of a `resetall directive as described in annex
 19.6 of the spec.
 */
-void verilog_preprocessor_resetall()
+void verilog_preprocessor_resetall(verilog_preprocessor_context * preproc)
 {
+    (void)preproc;
     return;
 }
 
@@ -122,311 +154,1410 @@ void verilog_preprocessor_resetall()
 @brief Handles the entering of a no-unconnected drive directive.
 */
 void verilog_preprocessor_nounconnected_drive(
+    verilog_preprocessor_context * preproc,
     ast_primitive_strength direction
 ){
     assert(direction == STRENGTH_PULL1 ||
            direction == STRENGTH_PULL0 ||
            direction == STRENGTH_NONE);
 
-    yy_preproc -> unconnected_drive_pull = direction;
+    preproc -> unconnected_drive_pull = direction;
 }
 
 
-/*! 
-@brief Handles the encounter of an include directive.
-@returns A pointer to the newly created directive reference.
-*/
-verilog_include_directive * verilog_preprocessor_include(
-    char * filename,
-    unsigned int lineNumber
-){
-    verilog_include_directive * toadd = 
-        ast_calloc(1,sizeof(verilog_include_directive));
+verilog_include_cache * verilog_include_cache_new()
+{
+    ast_arena * arena = ast_arena_new(0);
+    ast_arena * prev  = ast_set_current_arena(arena);
 
-    filename = filename + 1; // Remove leading quote mark.
-    size_t length = strlen(filename);
-    
-    toadd -> filename = ast_strdup(filename);
-    toadd -> filename[length-1] = '\0';
-    toadd -> lineNumber = lineNumber;
+    verilog_include_cache * tr = ast_calloc(1, sizeof(verilog_include_cache));
+
+    tr -> arena    = arena;
+    tr -> indexes  = ast_list_new();
+    tr -> contents = ast_hashtable_new();
+
+    ast_set_current_arena(prev);
 
-    ast_list_append(yy_preproc -> includes, toadd);
+    return tr;
+}
 
-    // Search the possible include paths to find a match.
-    unsigned int d = 0;
-    for(d = 0; d < yy_preproc -> search_dirs -> items; d ++)
+void verilog_include_cache_free(
+    verilog_include_cache * tofree
+){
+    if(tofree == NULL)
     {
-        char * dir       = ast_list_get(yy_preproc -> search_dirs, d);
-        size_t dirlen    = strlen(dir)+1;
-        size_t namelen   = strlen(toadd -> filename);
-        char * full_name = ast_calloc(dirlen+namelen, sizeof(char));
+        return;
+    }
 
-        strcat(full_name, dir);
-        strcat(full_name, toadd -> filename);
+    // File contents are the only thing not held by the arena.
+    unsigned int i;
+    for(i = 0; i < tofree -> contents -> capacity; i ++)
+    {
+        verilog_include_file * file = tofree -> contents -> slots[i].data;
 
-        FILE * handle = fopen(full_name,"r");
-        if(handle)
+        if(tofree -> contents -> slots[i].key != NULL)
         {
-            fclose(handle);
-            toadd -> filename = full_name;
-            toadd -> file_found = AST_TRUE;
-            
-            // Since we are diving into an include file, update the stack of
-            // files currently being parsed.
-            ast_stack_push(yy_preproc -> current_file, filename);
-
-            break;
-        }
-        else
-        {   
-            toadd -> file_found = AST_FALSE;
+            free(file -> data);
         }
     }
 
-    return toadd;
+    // The cache itself lives inside its own arena.
+    ast_arena_free(tofree -> arena);
 }
 
-/*
-@brief Instructs the preprocessor to register a new macro definition.
-*/
-void verilog_preprocessor_macro_define(
-    unsigned int line,  //!< The line the defininition comes from.
-    char * macro_name,  //!< The macro identifier.
-    char * macro_text,  //!< The value the macro expands to.
-    size_t text_len     //!< Length in bytes of macro_text.
+verilog_include_file * verilog_include_cache_read(
+    verilog_include_cache * cache,
+    char                  * path
 ){
-    verilog_macro_directive * toadd = 
-        ast_calloc(1, sizeof(verilog_macro_directive));
-    
-    toadd -> line = line;
+    verilog_include_file * tr = NULL;
 
-    //printf("\nEncountered macro '%s' on line %d ",toadd->macro_id,line);
-    //printf("with value '%s'\n", toadd -> macro_value);
-    //fflush(stdout);
+    if(ast_hashtable_get(cache -> contents, path, (void**)&tr)==HASH_SUCCESS)
+    {
+        cache -> content_hits ++;
+        return tr;
+    }
 
-    // Make space for, and duplicate, the macro text, into the thing
-    // we will put into the hashtable.
-    toadd -> macro_id    = ast_strdup(macro_name);
+    FILE * fh = fopen(path, "rb");
 
-    if(text_len > 0){
-        // Make sure we exclude all comments from the macro text.
-        unsigned int i = 0;
-        for(i = 0; i < text_len-1; i++)
-        {
-            if(macro_text[i]   == '/' &&
-               macro_text[i+1] == '/')
-            {
-                text_len = (size_t)i;
-                break;
-            }
-        }
+    if(fh == NULL)
+    {
+        return NULL;
+    }
 
-        toadd -> macro_value = ast_strdup(macro_text);
-    } else {
-        toadd -> macro_value = "";
+    fseek(fh, 0, SEEK_END);
+    long length = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+
+    // Flex scans a buffer in place only if it ends with two NULs.
+    char * data = length >= 0 ? malloc(length + 2) : NULL;
+
+    if(data == NULL || fread(data, 1, length, fh) != (size_t)length)
+    {
+        free(data);
+        fclose(fh);
+        return NULL;
     }
 
-    //printf("MACRO: '%s' - '%s'\n", toadd -> macro_id, toadd -> macro_value);
+    fclose(fh);
+    data[length]     = '\0';
+    data[length + 1] = '\0';
 
-    ast_hashtable_insert(
-        yy_preproc -> macrodefines,
-        toadd -> macro_id,
-        toadd
-    );
+    cache -> content_misses ++;
 
-    return;
+    tr = ast_arena_calloc(cache -> arena, 1, sizeof(verilog_include_file));
+    tr -> data = data;
+    tr -> size = length;
+
+    ast_hashtable_insert(cache -> contents, path, tr);
+
+    return tr;
 }
 
 /*!
-@brief Removes a macro definition from the preprocessors lookup table.
+@brief Looks for a file in one include directory, by trying to open it there.
+@returns The interned path the file was found at, or NULL if it was not.
 */
-void verilog_preprocessor_macro_undefine(
-    char * macro_name //!< The name of the macro to remove.
+static char * verilog_preprocessor_try_dir(
+    char          * dir,
+    char          * filename
 ){
-    ast_hashtable_delete(
-        yy_preproc -> macrodefines,
-        macro_name
-    );
-    //printf("Removed Macro definition: '%s'\n", macro_name);
-    return;
-}
+    size_t dirlen    = strlen(dir);
+    size_t namelen   = strlen(filename);
+    char * full_name = malloc(dirlen + namelen + 1);
+    char * tr        = NULL;
 
-//! Creates and returns a new conditional context.
-verilog_preprocessor_conditional_context * 
-    verilog_preprocessor_new_conditional_context(
-    char        * condition,          //!< The definition to check for.
-    int           line_number         //!< Where the `ifdef came from.
-){
-    verilog_preprocessor_conditional_context * tr = 
-        ast_calloc(1,sizeof(verilog_preprocessor_conditional_context));
+    if(full_name == NULL)
+    {
+        return NULL;
+    }
 
-    tr -> line_number = line_number;
-    tr -> condition   = condition;
+    memcpy(full_name, dir, dirlen);
+    memcpy(full_name + dirlen, filename, namelen + 1);
 
+    FILE * handle = fopen(full_name,"r");
+
+    if(handle)
+    {
+        fclose(handle);
+        tr = ast_intern(full_name);
+    }
+
+    free(full_name);
     return tr;
 }
 
-
 /*!
-@brief Handles an ifdef statement being encountered.
-@param [in] macro_name - The macro to test if defined or not.
+@brief Searches a list of include directories for a file, by trying to open
+it in each of them in turn.
+@returns The interned path the file was found at, or NULL if it was not.
 */
-void verilog_preprocessor_ifdef (
-    char * macro_name,
-    unsigned int lineno,
-    ast_boolean is_ndef
+static char * verilog_preprocessor_search(
+    char         ** dirs,
+    unsigned int    count,
+    char          * filename
 ){
-    // Create a new ifdef context.
-    verilog_preprocessor_conditional_context * topush = 
-        verilog_preprocessor_new_conditional_context(macro_name,lineno);
+    unsigned int d;
+    char       * tr = NULL;
 
-    topush -> is_ndef = is_ndef;
+    for(d = 0; d < count && tr == NULL; d ++)
+    {
+        tr = verilog_preprocessor_try_dir(dirs[d], filename);
+    }
 
-    void * data;
-    ast_hashtable_result r = ast_hashtable_get(yy_preproc -> macrodefines,
-                                               macro_name, &data);
-    
-    //printf("Compilation conditional on '%s' ",macro_name);
-    
-    if(((r == HASH_SUCCESS        && is_ndef == AST_FALSE) ||
-        (r == HASH_KEY_NOT_FOUND  && is_ndef == AST_TRUE )) &&
-        yy_preproc -> emit == AST_FALSE)
+    return tr;
+}
+
+//! Returns true iff the index was built for exactly the supplied directories.
+static ast_boolean verilog_include_index_matches(
+    verilog_include_index * index,
+    ast_list              * search_dirs
+){
+    unsigned int d;
+
+    if(index -> count != search_dirs -> items)
     {
-        // Push the context, with the condition true.
-        topush -> condition_passed = AST_TRUE;
-        topush -> wait_for_endif   = AST_TRUE;
-        yy_preproc -> emit         = AST_TRUE;
-        ast_stack_push(yy_preproc -> ifdefs, topush);
-        //printf("Condition TRUE\n");
+        return AST_FALSE;
     }
-    else
+
+    for(d = 0; d < index -> count; d ++)
     {
-        // Push the context, with the condition false.
-        topush -> condition_passed = AST_FALSE;
-        if(yy_preproc -> emit == AST_FALSE)
-            topush -> wait_for_endif   = AST_TRUE;
-        else
-            topush -> wait_for_endif   = AST_FALSE;
-        yy_preproc -> emit         = AST_FALSE;
-        ast_stack_push(yy_preproc -> ifdefs, topush);
-        //printf("Condition FALSE\n");
+        if(strcmp(index -> dirs[d], ast_list_get(search_dirs, d)) != 0)
+        {
+            return AST_FALSE;
+        }
     }
+
+    return AST_TRUE;
 }
 
 /*!
-@brief Handles an elseif statement being encountered.
-@param [in] macro_name - The macro to test if defined or not.
+@brief Builds the index of a list of include directories, by listing each
+of them once.
+@details A name found in more than one directory resolves to the first, just
+as searching them in order would. Directories which can not be listed are
+left out.
 */
-void verilog_preprocessor_elseif(char * macro_name, unsigned int lineno)
-{
-    verilog_preprocessor_conditional_context * tocheck = 
-        ast_stack_peek(yy_preproc -> ifdefs);
+static verilog_include_index * verilog_include_index_new(
+    verilog_include_cache * cache,
+    ast_list              * search_dirs
+){
+    ast_arena * arena = cache -> arena;
+    ast_arena * prev  = ast_set_current_arena(arena);
 
-    if(tocheck == NULL)
-    {
-        printf("ERROR - `elseif without preceding `ifdef or `ifndef on line \
-            %d\n\tExpect it all to go wrong from here.\n", lineno);
-        return;
-    }
+    verilog_include_index * tr = ast_calloc(1, sizeof(verilog_include_index));
 
-    void * data;
-    ast_hashtable_result r = ast_hashtable_get(yy_preproc -> macrodefines,
-                                               macro_name, &data);
+    tr -> count  = search_dirs -> items;
+    tr -> dirs   = ast_calloc(tr -> count + 1, sizeof(char*));
+    tr -> names  = ast_hashtable_new();
+    tr -> nested = ast_hashtable_new();
 
-    if(tocheck -> wait_for_endif == AST_FALSE &&
-       yy_preproc -> emit        == AST_TRUE)
+    unsigned int d;
+    for(d = 0; d < tr -> count; d ++)
     {
-        if((tocheck -> is_ndef == AST_TRUE  && r == HASH_KEY_NOT_FOUND) ||
-           (tocheck -> is_ndef == AST_FALSE && r == HASH_SUCCESS      ))
+        tr -> dirs[d] = ast_arena_strdup(arena, ast_list_get(search_dirs, d));
+
+        DIR * dir = opendir(tr -> dirs[d]);
+
+        if(dir == NULL)
         {
-            tocheck -> condition_passed = AST_TRUE;
-            tocheck -> wait_for_endif   = AST_TRUE;
-            yy_preproc -> emit          = AST_TRUE;
+            continue;
         }
-        else
+
+        size_t          dirlen = strlen(tr -> dirs[d]);
+        struct dirent * entry;
+
+        while((entry = readdir(dir)) != NULL)
         {
-            yy_preproc -> emit = AST_FALSE;
-            tocheck    -> condition_passed = AST_FALSE;
+            void * found;
+
+            if(ast_hashtable_get(tr -> names, entry -> d_name, &found)
+                == HASH_SUCCESS)
+            {
+                continue; // An earlier directory has it already.
+            }
+
+            size_t namelen = strlen(entry -> d_name);
+            char * path    = ast_arena_calloc(arena, dirlen + namelen + 1, 1);
+
+            memcpy(path, tr -> dirs[d], dirlen);
+            memcpy(path + dirlen, entry -> d_name, namelen + 1);
+
+            ast_hashtable_insert(tr -> names, path + dirlen, ast_intern(path));
         }
+
+        closedir(dir);
     }
-    else
+
+    ast_set_current_arena(prev);
+
+    cache -> indexes_built ++;
+    ast_list_append(cache -> indexes, tr);
+
+    return tr;
+}
+
+/*!
+@brief Returns the index of a list of include directories, building it if
+this is the first time the cache has seen the list.
+*/
+static verilog_include_index * verilog_include_cache_index(
+    verilog_include_cache * cache,
+    ast_list              * search_dirs
+){
+    unsigned int i;
+
+    // Nearly every parse searches the same directories, so the most recently
+    // built index is tried first.
+    for(i = cache -> indexes -> items; i > 0; i --)
     {
-        yy_preproc -> emit = AST_FALSE;
-        tocheck    -> condition_passed = AST_FALSE;
+        verilog_include_index * index = ast_list_get(cache -> indexes, i-1);
+
+        if(verilog_include_index_matches(index, search_dirs))
+        {
+            return index;
+        }
     }
+
+    return verilog_include_index_new(cache, search_dirs);
 }
 
 /*!
-@brief Handles an else statement being encountered.
+@brief Resolves an include name using the cache's index of the supplied
+directories.
+@returns The interned path of the file, or NULL if it is in none of them.
 */
-void verilog_preprocessor_else  (unsigned int lineno)
-{
-    verilog_preprocessor_conditional_context * tocheck = 
-        ast_stack_peek(yy_preproc -> ifdefs);
-
-    verilog_preprocessor_conditional_context * parent = 
-        ast_stack_peek2(yy_preproc -> ifdefs);
+static char * verilog_include_cache_resolve(
+    verilog_include_cache * cache,
+    ast_list              * search_dirs,
+    char                  * filename
+){
+    verilog_include_index * index = verilog_include_cache_index(cache,
+                                                                search_dirs);
+    char * tr = NULL;
 
-    if(tocheck == NULL)
+    if(strchr(filename, '/') == NULL)
     {
-        printf("ERROR - `else without preceding `ifdef or `ifndef on line \
-            %d\n\tExpect it all to go wrong from here.\n", lineno);
-        return;
+        // The listings hold every plain name there is, so a name missing
+        // from them is known to be missing everywhere.
+        ast_hashtable_get(index -> names, filename, (void**)&tr);
+        cache -> resolve_hits ++;
+    }
+    else if(ast_hashtable_get(index -> nested, filename, (void**)&tr)
+            == HASH_SUCCESS)
+    {
+        cache -> resolve_hits ++;
+    }
+    else
+    {
+        cache -> resolve_misses ++;
+        tr = verilog_preprocessor_search(index -> dirs, index -> count,
+                                         filename);
+        ast_hashtable_insert(index -> nested,
+                             ast_arena_strdup(cache -> arena, filename), tr);
     }
+
+    return tr;
+}
+
+/*! 
+@brief Handles the encounter of an include directive.
+@returns A pointer to the newly created directive reference.
+*/
+verilog_include_directive * verilog_preprocessor_include(
+    verilog_preprocessor_context * preproc,
+    char * filename,
+    unsigned int lineNumber
+){
+    ast_arena * arena = preproc -> arena;
+    verilog_include_directive * toadd = 
+        ast_arena_calloc(arena,1,sizeof(verilog_include_directive));
+
+    filename = filename + 1; // Remove leading quote mark.
+    size_t length = strlen(filename);
     
-    if(yy_preproc -> emit           == AST_TRUE && 
-        tocheck   -> wait_for_endif == AST_FALSE)
+    toadd -> filename = ast_arena_strdup(arena,filename);
+    toadd -> filename[length-1] = '\0';
+    toadd -> lineNumber = lineNumber;
+    toadd -> file_found = AST_FALSE;
+
+    ast_list_append(preproc -> includes, toadd);
+
+    verilog_include_cache * cache = preproc -> include_cache;
+    char * full_name;
+
+    if(cache != NULL)
     {
-        yy_preproc -> emit              = AST_FALSE;
-        tocheck    -> condition_passed  = AST_FALSE;
+        full_name = verilog_include_cache_resolve(cache,
+                                                  preproc -> search_dirs,
+                                                  toadd -> filename);
     }
     else
     {
-        if(parent != NULL)
+        unsigned int d;
+
+        full_name = NULL;
+        for(d = 0; d < preproc -> search_dirs -> items &&
+                   full_name == NULL; d ++)
+        {
+            full_name = verilog_preprocessor_try_dir(
+                ast_list_get(preproc -> search_dirs, d), toadd -> filename);
+        }
+    }
+
+    if(full_name != NULL)
+    {
+        toadd -> filename   = full_name;
+        toadd -> file_found = AST_TRUE;
+        
+        // Since we are diving into an include file, update the stack of
+        // files currently being parsed.
+        ast_stack_push(preproc -> current_file, ast_intern(full_name));
+    }
+
+    return toadd;
+}
+
+//! Returns true iff the character can be part of a simple identifier.
+static int verilog_macro_is_id_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+/*!
+@brief Splits the value of a macro into segments of literal text and the
+parameters between them.
+@details Parameter names inside strings, after a backtick or base quote, or
+inside escaped identifiers, are left alone.
+@param [in] macro - The macro to split.
+@param [out] out - Where to put the segments, or NULL to only count them.
+@returns The number of segments.
+*/
+static unsigned int verilog_macro_split(
+    verilog_macro_directive * macro,
+    verilog_macro_segment   * out
+){
+    char       * text   = macro -> macro_value;
+    size_t       length = macro -> macro_length;
+    size_t       i      = 0;
+    size_t       start  = 0;
+    unsigned int count  = 0;
+
+    while(i < length)
+    {
+        char c = text[i];
+
+        if(c == '"')
+        {
+            for(i ++; i < length && text[i] != '"'; i ++)
+            {
+                i += text[i] == '\\';
+            }
+            i ++;
+        }
+        else if(c == '\\')
+        {
+            while(i < length && !isspace((unsigned char)text[i]))
+            {
+                i ++;
+            }
+        }
+        else if(verilog_macro_is_id_char(c))
         {
-            if(parent -> condition_passed == AST_TRUE)
+            size_t end = i;
+            int    p   = -1;
+            char   before = i > 0 ? text[i-1] : ' ';
+
+            while(end < length && verilog_macro_is_id_char(text[end]))
+            {
+                end ++;
+            }
+
+            unsigned int n;
+            for(n = 0; n < macro -> param_count && before != '`' &&
+                       before != '\'' && !isdigit((unsigned char)c); n ++)
             {
-                yy_preproc -> emit              = AST_TRUE;
-                tocheck    -> condition_passed  = AST_TRUE;
+                if(strlen(macro -> params[n]) == end - i &&
+                   strncmp(macro -> params[n], text + i, end - i) == 0)
+                {
+                    p = n;
+                    break;
+                }
             }
-            else
+
+            if(p >= 0)
             {
-                yy_preproc -> emit              = AST_FALSE;
-                tocheck    -> condition_passed  = AST_FALSE;
+                if(i > start && out != NULL)
+                {
+                    out[count].text   = text + start;
+                    out[count].length = i - start;
+                    out[count].param  = -1;
+                }
+                count += i > start;
+
+                if(out != NULL)
+                {
+                    out[count].text   = NULL;
+                    out[count].length = 0;
+                    out[count].param  = p;
+                }
+                count ++;
+                start = end;
             }
+
+            i = end;
         }
         else
         {
-            yy_preproc -> emit              = AST_TRUE;
-            tocheck    -> condition_passed  = AST_TRUE;
+            i ++;
         }
     }
 
-    tocheck -> wait_for_endif = AST_TRUE;
+    if(length > start && out != NULL)
+    {
+        out[count].text   = text + start;
+        out[count].length = length - start;
+        out[count].param  = -1;
+    }
+    count += length > start;
+
+    return count;
 }
 
 /*!
-@brief Handles an else statement being encountered.
+@brief Creates a macro and adds it to the lookup table of a context,
+replacing any macro of the same name.
+@details Line comments are left out of the value, each up to the end of
+its own line.
 */
-void verilog_preprocessor_endif (unsigned int lineno)
-{
-    verilog_preprocessor_conditional_context * tocheck = 
-        ast_stack_pop(yy_preproc -> ifdefs);
+static verilog_macro_directive * verilog_macro_new(
+    verilog_preprocessor_context * preproc,
+    unsigned int line,
+    char * macro_name,
+    char ** params,
+    unsigned int param_count,
+    char * macro_text,
+    size_t text_len
+){
+    ast_arena * arena = preproc -> arena;
+    verilog_macro_directive * toadd = 
+        ast_arena_calloc(arena, 1, sizeof(verilog_macro_directive));
+    
+    toadd -> line = line;
+    toadd -> file = verilog_preprocessor_current_file(preproc);
 
-    if(tocheck == NULL)
-    {
-        printf("ERROR - `endif without preceding `ifdef or `ifndef on line \
-            %d\n\tExpect it all to go wrong from here.\n", lineno);
-        return;
-    }
+    // The name is interned, and the value duplicated, into the thing
+    // we will put into the hashtable.
+    toadd -> macro_id    = ast_intern(macro_name);
 
-    tocheck = ast_stack_peek(yy_preproc -> ifdefs);
+    // Two NULs, so that the value can be scanned in place.
+    toadd -> macro_value  = ast_arena_calloc(arena, text_len + 2, 1);
 
-    if(tocheck == NULL)
-        yy_preproc -> emit = AST_TRUE;
-    else
-        yy_preproc -> emit = tocheck -> condition_passed;
+    // Copy the text without its line comments. Each comment runs only to
+    // the end of its own line, so lines continued after it are kept, and
+    // a // inside a string literal is not a comment at all.
+    size_t i;
+    size_t length    = 0;
+    int    in_string = 0;
+    for(i = 0; i < text_len; i++)
+    {
+        if(in_string && macro_text[i] == '\\' && i + 1 < text_len)
+        {
+            toadd -> macro_value[length ++] = macro_text[i ++];
+        }
+        else if(macro_text[i] == '"')
+        {
+            in_string = !in_string;
+        }
+        else if(!in_string && macro_text[i] == '/' &&
+                i + 1 < text_len && macro_text[i+1] == '/')
+        {
+            while(i < text_len && macro_text[i] != '\n')
+            {
+                i ++;
+            }
+            while(length > 0 &&
+                  isspace((unsigned char)toadd -> macro_value[length-1]) &&
+                  toadd -> macro_value[length-1] != '\n')
+            {
+                length --;
+            }
+            if(i == text_len)
+            {
+                break;
+            }
+        }
+        else if(macro_text[i] == '\n')
+        {
+            in_string = 0;
+        }
+        toadd -> macro_value[length ++] = macro_text[i];
+    }
+    while(length > 0 && isspace((unsigned char)toadd -> macro_value[length-1]))
+    {
+        length --;
+    }
+    toadd -> macro_value[length] = '\0';
+    toadd -> macro_length        = length;
+
+    if(params != NULL)
+    {
+        toadd -> params      = ast_arena_calloc(arena, param_count + 1,
+                                                sizeof(char*));
+        toadd -> param_count = param_count;
+
+        for(i = 0; i < param_count; i ++)
+        {
+            toadd -> params[i] = ast_arena_strdup(arena, params[i]);
+        }
+
+        toadd -> segment_count = verilog_macro_split(toadd, NULL);
+        toadd -> segments      = ast_arena_calloc(arena,
+                                    toadd -> segment_count + 1,
+                                    sizeof(verilog_macro_segment));
+        verilog_macro_split(toadd, toadd -> segments);
+    }
+
+    //printf("MACRO: '%s' - '%s'\n", toadd -> macro_id, toadd -> macro_value);
+
+    // A redefinition replaces the existing macro.
+    ast_hashtable_delete(preproc -> macrodefines, toadd -> macro_id);
+    ast_hashtable_insert(
+        preproc -> macrodefines,
+        toadd -> macro_id,
+        toadd
+    );
+
+    return toadd;
+}
+
+/*
+@brief Instructs the preprocessor to register a new macro definition.
+*/
+void verilog_preprocessor_macro_define(
+    verilog_preprocessor_context * preproc,
+    unsigned int line,  //!< The line the defininition comes from.
+    char * macro_name,  //!< The macro identifier.
+    char * macro_text,  //!< The value the macro expands to.
+    size_t text_len     //!< Length in bytes of macro_text.
+){
+    verilog_macro_new(preproc, line, macro_name, NULL, 0,
+                      macro_text, macro_text != NULL ? text_len : 0);
+}
+
+void verilog_preprocessor_macro_define_function(
+    verilog_preprocessor_context * preproc,
+    unsigned int line,
+    char * macro_name,
+    char ** params,
+    unsigned int param_count,
+    char * macro_text,
+    size_t text_len
+){
+    char * none[1] = {NULL};
+
+    verilog_macro_new(preproc, line, macro_name,
+                      params != NULL ? params : none, param_count,
+                      macro_text, macro_text != NULL ? text_len : 0);
+}
+
+void verilog_preprocessor_macro_directive(
+    verilog_preprocessor_context * preproc,
+    unsigned int line,
+    char * macro_name,
+    char * text,
+    size_t text_len
+){
+    // Join continued lines. The newlines are kept, the backslashes are not.
+    char * copy   = malloc(text_len + 1);
+    size_t length = 0;
+    size_t i;
+
+    if(copy == NULL)
+    {
+        return;
+    }
+
+    for(i = 0; i < text_len; i ++)
+    {
+        if(!(text[i] == '\\' && i + 1 < text_len && text[i+1] == '\n'))
+        {
+            copy[length ++] = text[i];
+        }
+    }
+    copy[length] = '\0';
+
+    char *       body   = copy;
+    char *       end    = copy + length;
+    char *       params[256];
+    unsigned int count  = 0;
+    int          is_fn  = body < end && *body == '(';
+
+    if(is_fn)
+    {
+        // Split the parameter list at its commas, trimming each name.
+        char * name = ++ body;
+
+        while(body < end && *body != ')')
+        {
+            if(*body == ',' && count < 256)
+            {
+                *body = '\0';
+                params[count ++] = name;
+                name = body + 1;
+            }
+            body ++;
+        }
+
+        if(body < end)
+        {
+            *body ++ = '\0';
+        }
+        if(count < 256)
+        {
+            params[count ++] = name;
+        }
+
+        for(i = 0; i < count; i ++)
+        {
+            char * p = params[i];
+            char * e;
+
+            while(isspace((unsigned char)*p)) p ++;
+            for(e = p + strlen(p); e > p && isspace((unsigned char)e[-1]);)
+            {
+                *-- e = '\0';
+            }
+            params[i] = p;
+        }
+
+        // Empty brackets mean there are no parameters at all.
+        if(count == 1 && params[0][0] == '\0')
+        {
+            count = 0;
+        }
+    }
+
+    while(body < end && isspace((unsigned char)*body))
+    {
+        body ++;
+    }
+    while(end > body && isspace((unsigned char)end[-1]))
+    {
+        end --;
+    }
+
+    verilog_macro_new(preproc, line, macro_name,
+                      is_fn ? params : NULL, count, body, end - body);
+    free(copy);
+}
+
+//! Makes sure a call has room for another length bytes of argument text.
+static int verilog_macro_call_reserve(
+    verilog_macro_call * call,
+    size_t               length
+){
+    if(call -> length + length + 1 <= call -> capacity)
+    {
+        return 1;
+    }
+
+    size_t capacity = call -> capacity > 0 ? call -> capacity : 256;
+
+    while(call -> length + length + 1 > capacity)
+    {
+        capacity *= 2;
+    }
+
+    char * text = realloc(call -> text, capacity);
+
+    if(text == NULL)
+    {
+        return 0;
+    }
+
+    call -> text     = text;
+    call -> capacity = capacity;
+    return 1;
 }
 
+void verilog_macro_call_begin(
+    verilog_preprocessor_context * preproc,
+    verilog_macro_directive      * macro
+){
+    verilog_macro_call * call = &preproc -> call;
 
+    call -> macro     = macro;
+    call -> depth     = 0;
+    call -> length    = 0;
+    call -> arg_count = 0;
 
+    verilog_macro_call_next_arg(preproc);
+}
+
+void verilog_macro_call_append(
+    verilog_preprocessor_context * preproc,
+    char                         * text,
+    size_t                         length
+){
+    verilog_macro_call * call = &preproc -> call;
+
+    if(verilog_macro_call_reserve(call, length))
+    {
+        memcpy(call -> text + call -> length, text, length);
+        call -> length += length;
+    }
+}
+
+void verilog_macro_call_next_arg(
+    verilog_preprocessor_context * preproc
+){
+    verilog_macro_call * call = &preproc -> call;
+
+    if(call -> arg_count > 0 && verilog_macro_call_reserve(call, 0))
+    {
+        // End the argument before this one.
+        call -> text[call -> length ++] = '\0';
+    }
+
+    if(call -> arg_count == call -> arg_capacity)
+    {
+        unsigned int capacity = call -> arg_capacity > 0 ?
+                                call -> arg_capacity * 2 : 8;
+        size_t * args = realloc(call -> args, capacity * sizeof(size_t));
+
+        if(args == NULL)
+        {
+            return;
+        }
+
+        call -> args         = args;
+        call -> arg_capacity = capacity;
+    }
+
+    call -> args[call -> arg_count ++] = call -> length;
+}
+
+char * verilog_macro_call_expand(
+    verilog_preprocessor_context * preproc,
+    size_t                       * length,
+    unsigned int                   lineno
+){
+    verilog_macro_call      * call  = &preproc -> call;
+    verilog_macro_directive * macro = call -> macro;
+    unsigned int i;
+
+    if(!verilog_macro_call_reserve(call, 0))
+    {
+        return NULL;
+    }
+    call -> text[call -> length] = '\0';
+
+    // Trim every argument in place.
+    char ** args = calloc(call -> arg_count, sizeof(char*));
+
+    if(args == NULL)
+    {
+        return NULL;
+    }
+
+    for(i = 0; i < call -> arg_count; i ++)
+    {
+        char * a = call -> text + call -> args[i];
+        char * e = a + strlen(a);
+
+        while(isspace((unsigned char)*a)) a ++;
+        while(e > a && isspace((unsigned char)e[-1])) *-- e = '\0';
+        args[i] = a;
+    }
+
+    unsigned int given = call -> arg_count;
+    if(given == 1 && macro -> param_count == 0 && args[0][0] == '\0')
+    {
+        given = 0;
+    }
+
+    if(given != macro -> param_count)
+    {
+        VERILOG_DIAGNOSE(preproc -> diagnostics, VERILOG_SEVERITY_ERROR,
+            DIAG_MACRO_ARGUMENTS,
+            verilog_diagnostics_location(preproc -> diagnostics,
+                verilog_preprocessor_current_file(preproc), lineno),
+            "Macro '%s' takes %u arguments, but was given %u",
+            macro -> macro_id, macro -> param_count, given);
+        free(args);
+        return NULL;
+    }
+
+    *length = 0;
+    for(i = 0; i < macro -> segment_count; i ++)
+    {
+        verilog_macro_segment * seg = &macro -> segments[i];
+        *length += seg -> param < 0 ? seg -> length :
+                                      strlen(args[seg -> param]);
+    }
+
+    char * tr = malloc(*length + 2);
+
+    if(tr != NULL)
+    {
+        char * at = tr;
+
+        for(i = 0; i < macro -> segment_count; i ++)
+        {
+            verilog_macro_segment * seg = &macro -> segments[i];
+            char * from = seg -> param < 0 ? seg -> text : args[seg -> param];
+            size_t n    = seg -> param < 0 ? seg -> length : strlen(from);
+
+            memcpy(at, from, n);
+            at += n;
+        }
+
+        at[0] = '\0';
+        at[1] = '\0';
+    }
+
+    free(args);
+    return tr;
+}
+
+/*!
+@brief Removes a macro definition from the preprocessors lookup table.
+*/
+void verilog_preprocessor_macro_undefine(
+    verilog_preprocessor_context * preproc,
+    char * macro_name //!< The name of the macro to remove.
+){
+    ast_hashtable_delete(
+        preproc -> macrodefines,
+        macro_name
+    );
+    //printf("Removed Macro definition: '%s'\n", macro_name);
+    return;
+}
+
+//! Creates and returns a new conditional context.
+verilog_preprocessor_conditional_context * 
+    verilog_preprocessor_new_conditional_context(
+    verilog_preprocessor_context * preproc,
+    char        * condition,          //!< The definition to check for.
+    int           line_number         //!< Where the `ifdef came from.
+){
+    verilog_preprocessor_conditional_context * tr = 
+        ast_arena_calloc(preproc -> arena, 1,
+                         sizeof(verilog_preprocessor_conditional_context));
+
+    tr -> line_number = line_number;
+    tr -> condition   = condition;
+
+    return tr;
+}
+
+
+/*!
+@brief Handles an ifdef statement being encountered.
+@param [in] macro_name - The macro to test if defined or not.
+@details Inside a region which is already being skipped, the new
+conditional is pushed only so that its `endif can be matched up, and none
+of its branches are taken.
+*/
+void verilog_preprocessor_ifdef (
+    verilog_preprocessor_context * preproc,
+    char * macro_name,
+    unsigned int lineno,
+    ast_boolean is_ndef
+){
+    // Create a new ifdef context.
+    verilog_preprocessor_conditional_context * topush = 
+        verilog_preprocessor_new_conditional_context(preproc,
+                                                     macro_name, lineno);
+
+    topush -> is_ndef = is_ndef;
+
+    void * data;
+    ast_hashtable_result r = ast_hashtable_get(preproc -> macrodefines,
+                                               macro_name, &data);
+
+    ast_boolean passed = (r == HASH_SUCCESS) != (is_ndef == AST_TRUE);
+
+    if(preproc -> emit == AST_TRUE && passed)
+    {
+        // Take this branch, and none of the ones after it.
+        topush -> condition_passed = AST_TRUE;
+        topush -> wait_for_endif   = AST_TRUE;
+    }
+    else
+    {
+        // Skip this branch. Only a later one may be taken, and only if the
+        // enclosing region is being emitted.
+        topush -> condition_passed = AST_FALSE;
+        topush -> wait_for_endif   = preproc -> emit == AST_FALSE;
+    }
+
+    preproc -> emit = topush -> condition_passed;
+    ast_stack_push(preproc -> ifdefs, topush);
+}
+
+/*!
+@brief Handles an elseif statement being encountered.
+@param [in] macro_name - The macro to test if defined or not.
+@details An `elsif always tests whether its macro is defined, whether the
+conditional it continues started with `ifdef or `ifndef.
+*/
+void verilog_preprocessor_elseif(
+    verilog_preprocessor_context * preproc,
+    char * macro_name,
+    unsigned int lineno
+){
+    verilog_preprocessor_conditional_context * tocheck = 
+        ast_stack_peek(preproc -> ifdefs);
+
+    if(tocheck == NULL)
+    {
+        VERILOG_DIAGNOSE(preproc -> diagnostics, VERILOG_SEVERITY_ERROR,
+            DIAG_ELSIF_WITHOUT_IFDEF,
+            verilog_diagnostics_location(preproc -> diagnostics,
+                verilog_preprocessor_current_file(preproc), lineno),
+            "`elsif without preceding `ifdef or `ifndef");
+        return;
+    }
+
+    void * data;
+    ast_hashtable_result r = ast_hashtable_get(preproc -> macrodefines,
+                                               macro_name, &data);
+
+    if(tocheck -> wait_for_endif == AST_FALSE && r == HASH_SUCCESS)
+    {
+        tocheck -> condition_passed = AST_TRUE;
+        tocheck -> wait_for_endif   = AST_TRUE;
+    }
+    else
+    {
+        tocheck -> condition_passed = AST_FALSE;
+    }
+
+    preproc -> emit = tocheck -> condition_passed;
+}
+
+/*!
+@brief Handles an else statement being encountered.
+*/
+void verilog_preprocessor_else  (
+    verilog_preprocessor_context * preproc,
+    unsigned int lineno
+){
+    verilog_preprocessor_conditional_context * tocheck = 
+        ast_stack_peek(preproc -> ifdefs);
+
+    if(tocheck == NULL)
+    {
+        VERILOG_DIAGNOSE(preproc -> diagnostics, VERILOG_SEVERITY_ERROR,
+            DIAG_ELSE_WITHOUT_IFDEF,
+            verilog_diagnostics_location(preproc -> diagnostics,
+                verilog_preprocessor_current_file(preproc), lineno),
+            "`else without preceding `ifdef or `ifndef");
+        return;
+    }
+    
+    // Taken only if no earlier branch was, and the enclosing region is
+    // being emitted.
+    tocheck -> condition_passed = tocheck -> wait_for_endif == AST_FALSE;
+    tocheck -> wait_for_endif   = AST_TRUE;
+    preproc -> emit             = tocheck -> condition_passed;
+}
+
+/*!
+@brief Handles an else statement being encountered.
+*/
+void verilog_preprocessor_endif (
+    verilog_preprocessor_context * preproc,
+    unsigned int lineno
+){
+    verilog_preprocessor_conditional_context * tocheck = 
+        ast_stack_pop(preproc -> ifdefs);
+
+    if(tocheck == NULL)
+    {
+        VERILOG_DIAGNOSE(preproc -> diagnostics, VERILOG_SEVERITY_ERROR,
+            DIAG_ENDIF_WITHOUT_IFDEF,
+            verilog_diagnostics_location(preproc -> diagnostics,
+                verilog_preprocessor_current_file(preproc), lineno),
+            "`endif without preceding `ifdef or `ifndef");
+        return;
+    }
+
+    tocheck = ast_stack_peek(preproc -> ifdefs);
+
+    if(tocheck == NULL)
+        preproc -> emit = AST_TRUE;
+    else
+        preproc -> emit = tocheck -> condition_passed;
+}
+
+
+
+
+// ----------------------- Snapshots ------------------------------------
+
+//! First four bytes of every snapshot.
+#define VERILOG_SNAPSHOT_MAGIC   "VPPS"
+
+//! Changed whenever the layout of a snapshot changes.
+#define VERILOG_SNAPSHOT_VERSION 4
+
+//! Length written in place of a string which is NULL.
+#define VERILOG_SNAPSHOT_NULL    0xFFFFFFFFu
+
+//! Writes one 32 bit number to a snapshot.
+static void verilog_snapshot_put(FILE * fh, unsigned int value)
+{
+    uint32_t v = value;
+    fwrite(&v, sizeof(v), 1, fh);
+}
+
+//! Writes a string, which may be NULL, to a snapshot, preceded by its length.
+static void verilog_snapshot_put_string(FILE * fh, char * string)
+{
+    if(string == NULL)
+    {
+        verilog_snapshot_put(fh, VERILOG_SNAPSHOT_NULL);
+        return;
+    }
+
+    size_t length = strlen(string);
+    verilog_snapshot_put(fh, length);
+    fwrite(string, 1, length, fh);
+}
+
+//! Writes a snapshot of a preprocessor context to an open stream.
+static void verilog_snapshot_write(
+    verilog_preprocessor_context * preproc,
+    FILE                         * fh
+){
+    fwrite(VERILOG_SNAPSHOT_MAGIC, 1, 4, fh);
+    verilog_snapshot_put(fh, VERILOG_SNAPSHOT_VERSION);
+
+    ast_hashtable * macros = preproc -> macrodefines;
+    unsigned int    i;
+
+    verilog_snapshot_put(fh, macros -> size);
+    for(i = 0; i < macros -> capacity; i ++)
+    {
+        verilog_macro_directive * macro = macros -> slots[i].data;
+
+        if(macros -> slots[i].key != NULL)
+        {
+            unsigned int p;
+
+            verilog_snapshot_put(fh, macro -> line);
+            verilog_snapshot_put_string(fh, macro -> file);
+            verilog_snapshot_put_string(fh, macro -> macro_id);
+            verilog_snapshot_put_string(fh, macro -> macro_value);
+
+            verilog_snapshot_put(fh, macro -> params == NULL ?
+                                     VERILOG_SNAPSHOT_NULL :
+                                     macro -> param_count);
+            for(p = 0; macro -> params != NULL &&
+                       p < macro -> param_count; p ++)
+            {
+                verilog_snapshot_put_string(fh, macro -> params[p]);
+            }
+        }
+    }
+
+    verilog_snapshot_put(fh, preproc -> net_types -> items);
+    for(i = 0; i < preproc -> net_types -> items; i ++)
+    {
+        verilog_default_net_type * net = ast_list_get(preproc -> net_types,i);
+
+        verilog_snapshot_put(fh, net -> token_number);
+        verilog_snapshot_put(fh, net -> line_number);
+        verilog_snapshot_put(fh, net -> type);
+    }
+
+    verilog_snapshot_put_string(fh, preproc -> timescale.scale);
+    verilog_snapshot_put_string(fh, preproc -> timescale.precision);
+    verilog_snapshot_put(fh, preproc -> unconnected_drive_pull);
+    verilog_snapshot_put(fh, preproc -> in_cell_define);
+}
+
+int verilog_preprocessor_save(
+    verilog_preprocessor_context * preproc,
+    char                         * path
+){
+    FILE * fh = fopen(path, "wb");
+
+    if(fh == NULL)
+    {
+        return -1;
+    }
+
+    verilog_snapshot_write(preproc, fh);
+
+    int tr = ferror(fh) ? -1 : 0;
+
+    if(fclose(fh) != 0)
+    {
+        tr = -1;
+    }
+
+    return tr;
+}
+
+char * verilog_preprocessor_save_buffer(
+    verilog_preprocessor_context * preproc,
+    size_t                       * size
+){
+    char * tr = NULL;
+    FILE * fh = open_memstream(&tr, size);
+
+    if(fh == NULL)
+    {
+        return NULL;
+    }
+
+    verilog_snapshot_write(preproc, fh);
+
+    int failed = ferror(fh);
+
+    if(fclose(fh) != 0 || failed)
+    {
+        free(tr);
+        return NULL;
+    }
+
+    return tr;
+}
+
+//! A snapshot being read back, with every read checked against its end.
+typedef struct verilog_snapshot_t{
+    char   * data;      //!< The whole snapshot.
+    size_t   size;      //!< Length of data.
+    size_t   offset;    //!< Where the next read starts.
+    int      failed;    //!< Set once any read runs past the end.
+} verilog_snapshot;
+
+//! Reads one 32 bit number from a snapshot.
+static unsigned int verilog_snapshot_get(verilog_snapshot * in)
+{
+    uint32_t v = 0;
+
+    if(in -> size - in -> offset < sizeof(v))
+    {
+        in -> failed = 1;
+        return 0;
+    }
+
+    memcpy(&v, in -> data + in -> offset, sizeof(v));
+    in -> offset += sizeof(v);
+    return v;
+}
+
+//! Reads a string from a snapshot, into a copy allocated from an arena.
+static char * verilog_snapshot_get_string(
+    verilog_snapshot * in,
+    ast_arena        * arena
+){
+    unsigned int length = verilog_snapshot_get(in);
+
+    if(in -> failed || length == VERILOG_SNAPSHOT_NULL)
+    {
+        return NULL;
+    }
+
+    if(in -> size - in -> offset < length)
+    {
+        in -> failed = 1;
+        return NULL;
+    }
+
+    char * tr = ast_arena_calloc(arena, length + 1, sizeof(char));
+    memcpy(tr, in -> data + in -> offset, length);
+    in -> offset += length;
+    return tr;
+}
+
+verilog_preprocessor_context * verilog_preprocessor_load_buffer(
+    char   * data,
+    size_t   size
+){
+    verilog_snapshot in = {data, size, 4, 0};
+
+    if(data == NULL || size < 4 ||
+       memcmp(data, VERILOG_SNAPSHOT_MAGIC, 4) != 0 ||
+       verilog_snapshot_get(&in) != VERILOG_SNAPSHOT_VERSION)
+    {
+        return NULL;
+    }
+
+    verilog_preprocessor_context * tr = verilog_new_preprocessor_context();
+    ast_arena * arena = tr -> arena;
+    unsigned int i;
+
+    unsigned int macros = verilog_snapshot_get(&in);
+    for(i = 0; i < macros && !in.failed; i ++)
+    {
+        unsigned int line  = verilog_snapshot_get(&in);
+        char       * file  = verilog_snapshot_get_string(&in, arena);
+        char       * name  = verilog_snapshot_get_string(&in, arena);
+        char       * value = verilog_snapshot_get_string(&in, arena);
+        unsigned int count = verilog_snapshot_get(&in);
+        char      ** names = NULL;
+        unsigned int p;
+
+        if(name == NULL || value == NULL ||
+           (count != VERILOG_SNAPSHOT_NULL && count > in.size))
+        {
+            in.failed = 1;
+            break;
+        }
+
+        if(count != VERILOG_SNAPSHOT_NULL)
+        {
+            names = ast_arena_calloc(arena, count + 1, sizeof(char*));
+
+            for(p = 0; p < count && !in.failed; p ++)
+            {
+                names[p] = verilog_snapshot_get_string(&in, arena);
+                in.failed |= names[p] == NULL;
+            }
+        }
+
+        if(!in.failed)
+        {
+            verilog_macro_directive * macro = verilog_macro_new(
+                tr, line, name, names, names != NULL ? count : 0,
+                value, strlen(value));
+
+            macro -> file = file != NULL ? ast_intern(file) : NULL;
+        }
+    }
+
+    unsigned int nets = verilog_snapshot_get(&in);
+    for(i = 0; i < nets && !in.failed; i ++)
+    {
+        unsigned int token_number = verilog_snapshot_get(&in);
+        unsigned int line_number  = verilog_snapshot_get(&in);
+        unsigned int type         = verilog_snapshot_get(&in);
+
+        verilog_preproc_default_net(tr, token_number, line_number,
+                                    (ast_net_type)type);
+    }
+
+    tr -> timescale.scale        = verilog_snapshot_get_string(&in, arena);
+    tr -> timescale.precision    = verilog_snapshot_get_string(&in, arena);
+    tr -> unconnected_drive_pull =
+        (ast_primitive_strength)verilog_snapshot_get(&in);
+    tr -> in_cell_define         =
+        verilog_snapshot_get(&in) ? AST_TRUE : AST_FALSE;
+
+    if(in.failed)
+    {
+        verilog_free_preprocessor_context(tr);
+        return NULL;
+    }
+
+    return tr;
+}
+
+verilog_preprocessor_context * verilog_preprocessor_load(
+    char * path
+){
+    FILE * fh = fopen(path, "rb");
+
+    if(fh == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(fh, 0, SEEK_END);
+    long length = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+
+    char * data = length > 0 ? malloc(length) : NULL;
+    verilog_preprocessor_context * tr = NULL;
+
+    if(data != NULL && fread(data, 1, length, fh) == (size_t)length)
+    {
+        tr = verilog_preprocessor_load_buffer(data, length);
+    }
+
+    free(data);
+    fclose(fh);
+    return tr;
+}
+
+// ----------------------- State Hashes ---------------------------------
+
+//! Adds a string, or NULL, and its terminator to a running hash.
+static uint64_t verilog_preprocessor_hash_string(uint64_t hash, char * str)
+{
+    if(str == NULL)
+    {
+        // Strings are hashed with their NUL, so none can end up the same.
+        unsigned char none = 0xFF;
+        return ast_hash_bytes(hash, &none, 1);
+    }
+
+    return ast_hash_bytes(hash, str, strlen(str) + 1);
+}
+
+uint64_t verilog_preprocessor_hash(
+    verilog_preprocessor_context * preproc
+){
+    ast_hashtable * macros = preproc -> macrodefines;
+    uint64_t        sum    = 0;
+    uint64_t        hash   = AST_HASH_SEED;
+    unsigned int    i;
+
+    // Each macro is hashed on its own, and the hashes summed, so that the
+    // order of the slots of the table makes no difference.
+    for(i = 0; i < macros -> capacity; i ++)
+    {
+        verilog_macro_directive * macro = macros -> slots[i].data;
+
+        if(macros -> slots[i].key != NULL)
+        {
+            uint64_t      m = AST_HASH_SEED;
+            unsigned int  p;
+            unsigned char has_params = macro -> params != NULL;
+
+            // A macro declared with an empty parameter list expands
+            // differently to one declared without any.
+            m = verilog_preprocessor_hash_string(m, macro -> macro_id);
+            m = ast_hash_bytes(m, &has_params, sizeof(has_params));
+            m = ast_hash_bytes(m, &macro -> param_count,
+                               sizeof(macro -> param_count));
+            for(p = 0; macro -> params != NULL &&
+                       p < macro -> param_count; p ++)
+            {
+                m = verilog_preprocessor_hash_string(m, macro -> params[p]);
+            }
+            m = ast_hash_bytes(m, macro -> macro_value,
+                               macro -> macro_length);
+            sum += m;
+        }
+    }
+    hash = ast_hash_bytes(hash, &sum, sizeof(sum));
+
+    for(i = 0; i < preproc -> net_types -> items; i ++)
+    {
+        verilog_default_net_type * net = ast_list_get(preproc -> net_types,i);
+        hash = ast_hash_bytes(hash, &net -> type, sizeof(net -> type));
+    }
+
+    for(i = 0; i < preproc -> search_dirs -> items; i ++)
+    {
+        hash = verilog_preprocessor_hash_string(hash,
+                    ast_list_get(preproc -> search_dirs, i));
+    }
+
+    hash = verilog_preprocessor_hash_string(hash, preproc->timescale.scale);
+    hash = verilog_preprocessor_hash_string(hash,
+                                            preproc -> timescale.precision);
+    hash = ast_hash_bytes(hash, &preproc -> unconnected_drive_pull,
+                          sizeof(preproc -> unconnected_drive_pull));
+    hash = ast_hash_bytes(hash, &preproc -> in_cell_define,
+                          sizeof(preproc -> in_cell_define));
+
+    return hash;
+}
@@ -10,6 +10,7 @@
 
 #include "verilog_ast.h"
 #include "verilog_ast_common.h"
+#include "verilog_diagnostics.h"
 
 #ifndef VERILOG_PREPROCESSOR_H
 #define VERILOG_PREPROCESSOR_H
@@ -28,6 +29,13 @@ structure and it's associated functions.
 
 */
 
+/*!
+@brief Stores all of the contextual information used by the pre-processor.
+@details Every directive handler below takes the context it should act on as
+its first argument, so that several contexts can be in use at once.
+*/
+typedef struct verilog_preprocessor_context_t verilog_preprocessor_context;
+
 // ----------------------- Default Net Type Directives ------------------
 
 /*!
@@ -42,6 +50,7 @@ typedef struct verilog_default_net_type_t{
 
 //! Creates and returns a new default net type directive.
 verilog_default_net_type * verilog_new_default_net_type(
+    verilog_preprocessor_context * preproc,
     unsigned int token_number,  //!< Token number of the directive.
     unsigned int line_number,   //!< Line number of the directive.
     ast_net_type type           //!< The net type.
@@ -70,7 +79,7 @@ typedef struct verilog_timescale_directive_t{
 @brief Handles the encounter of a `resetall directive as described in annex
 19.6 of the spec.
 */
-void verilog_preprocessor_resetall();
+void verilog_preprocessor_resetall(verilog_preprocessor_context * preproc);
 
 // ----------------------- Connected Drive Directives -------------------
 
@@ -79,6 +88,7 @@ void verilog_preprocessor_resetall();
 @param [in] direction -  Where should an unconnected line be pulled?
 */
 void verilog_preprocessor_nounconnected_drive(
+    verilog_preprocessor_context * preproc,
     ast_primitive_strength direction
 );
 
@@ -91,40 +101,232 @@ typedef struct verilog_include_directive_t{
     ast_boolean  file_found;    //!< Can we find the file?
 } verilog_include_directive;
 
+//! The contents of one include file, as held by a verilog_include_cache.
+typedef struct verilog_include_file_t{
+    char   * data;      //!< The contents, followed by two NUL characters.
+    size_t   size;      //!< Length of the contents, without the NULs.
+} verilog_include_file;
+
+/*!
+@brief Resolves include names against one list of include directories.
+@details Built by listing every directory once, so that a name is found,
+or found to be missing, without opening anything. Names which contain a
+directory separator can not be answered from the listings. They are
+searched for the first time they are seen, and the answer, found or not,
+is remembered.
+@note Files created in the directories after the index was built are not
+seen.
+*/
+typedef struct verilog_include_index_t{
+    char         ** dirs;   //!< Copies of the directories indexed, in order.
+    unsigned int    count;  //!< Number of directories.
+    ast_hashtable * names;  //!< File name to path, from the first directory.
+    ast_hashtable * nested; //!< Other names to path, or to NULL if missing.
+} verilog_include_index;
+
+/*!
+@brief Remembers where include files were found, and what they contain.
+@details Header files of packages and defines are often included by
+thousands of source files. A cache belongs to a parser context, and so lives
+across every file the context parses, even though each of those gets a new
+preprocessor context. Once an include has been resolved and read, including
+it again, from any file, neither searches the include directories nor reads
+the disk.
+
+Where a name is found depends on the include directories searched, so one
+verilog_include_index is kept for each distinct list of directories. A new
+one is only built when the directories of a preprocessor context change.
+
+The counters are there to help tune include directory lists. A cache is
+only ever used by the thread which owns its parser context.
+*/
+typedef struct verilog_include_cache_t{
+    ast_list      * indexes;        //!< One index per directory list.
+    ast_hashtable * contents;       //!< Path to verilog_include_file.
+    ast_arena     * arena;          //!< Owns the tables, keys and entries.
+    unsigned long   indexes_built;  //!< Directory lists listed.
+    unsigned long   resolve_hits;   //!< Names resolved without searching.
+    unsigned long   resolve_misses; //!< Names searched for.
+    unsigned long   content_hits;   //!< Files included without reading.
+    unsigned long   content_misses; //!< Files read from disk.
+} verilog_include_cache;
+
+//! Creates a new, empty, include cache.
+verilog_include_cache * verilog_include_cache_new();
+
+//! Frees an include cache, and the contents of every file held in it.
+void verilog_include_cache_free(
+    verilog_include_cache * tofree
+);
+
+/*!
+@brief Returns the contents of the file at the supplied path, reading it
+only if it is not already held by the cache.
+@param [inout] cache - The cache to look in, and add to.
+@param [in] path - The file to return. Must be interned.
+@returns The contents, which live as long as the cache, or NULL if the file
+could not be read.
+*/
+verilog_include_file * verilog_include_cache_read(
+    verilog_include_cache * cache,
+    char                  * path
+);
+
 /*! 
 @brief Handles the encounter of an include directive.
+@details If the context has an include_cache, the file is looked up in the
+cache's index of the context's include directories, rather than searched
+for.
 @returns A pointer to the newly created directive reference.
 */
 verilog_include_directive * verilog_preprocessor_include(
+    verilog_preprocessor_context * preproc,
     char * filename,        //<! The file to include.
     unsigned int lineNumber //!< The line number of the directive.
 );
 
 // ----------------------- `define Directives ---------------------------
 
+//! The most macro expansions which may be nested inside each other.
+#define VERILOG_MACRO_MAX_DEPTH 64
+
+/*!
+@brief A piece of the text a macro expands to: either literal text, or the
+place where one of its arguments goes.
+*/
+typedef struct verilog_macro_segment_t{
+    char         * text;    //!< Literal text, when param is negative.
+    size_t         length;  //!< Length of text.
+    int            param;   //!< Parameter substituted here, or -1.
+} verilog_macro_segment;
+
 /*!
 @brief A simple container for macro directives
+@details The text of a macro with parameters is split, once, when it is
+defined, into segments of literal text and the parameters between them. A
+use of the macro is expanded by joining the segments with its arguments, so
+the text is never searched for parameter names again.
+
+The value always ends with two NUL characters, so that the text of a macro
+without parameters can be scanned in place, without copying it.
 */
 typedef struct verilog_macro_directive_t{
     unsigned int line;      //!< Line number of the directive.
-    char * macro_id;        //!< The name of the macro.
+    char * file;            //!< Interned file of the directive, or NULL.
+    char * macro_id;        //!< The interned name of the macro.
     char * macro_value;     //!< The value it expands to.
+    size_t macro_length;    //!< Length of macro_value.
+    char ** params;         //!< Names of its parameters, or NULL if none.
+    unsigned int param_count;           //!< Number of params.
+    verilog_macro_segment * segments;   //!< macro_value, split at params.
+    unsigned int segment_count;         //!< Number of segments.
 } verilog_macro_directive;
 
 /*!
 @brief Instructs the preprocessor to register a new macro definition.
 */
 void verilog_preprocessor_macro_define(
+    verilog_preprocessor_context * preproc,
+    unsigned int line,  //!< The line the defininition comes from.
+    char * macro_name,  //!< The macro identifier.
+    char * macro_text,  //!< The value the macro expands to.
+    size_t text_len     //!< Length in bytes of macro_text.
+);
+
+/*!
+@brief Registers a new macro definition, which takes parameters.
+@details Every use of the macro must then be followed by a parenthesised
+list of arguments, one for each parameter.
+*/
+void verilog_preprocessor_macro_define_function(
+    verilog_preprocessor_context * preproc,
     unsigned int line,  //!< The line the defininition comes from.
     char * macro_name,  //!< The macro identifier.
+    char ** params,     //!< Names of the parameters, in order.
+    unsigned int param_count, //!< Number of params. May be zero.
     char * macro_text,  //!< The value the macro expands to.
     size_t text_len     //!< Length in bytes of macro_text.
 );
+
+/*!
+@brief Registers a macro from the text which follows its name in a `define
+directive.
+@details The text starts with a parameter list iff it begins with an open
+bracket. Lines ending in a backslash continue the text onto the next line.
+*/
+void verilog_preprocessor_macro_directive(
+    verilog_preprocessor_context * preproc,
+    unsigned int line,  //!< The line the defininition comes from.
+    char * macro_name,  //!< The macro identifier.
+    char * text,        //!< The rest of the directive.
+    size_t text_len     //!< Length in bytes of text.
+);
+
+/*!
+@brief A use of a macro with parameters, whose arguments are being read.
+@details There is only ever one of these per context, since the arguments
+are read as plain text, and macros used inside them are only expanded once
+the expansion which contains them is scanned. Its buffers are reused from
+one call to the next.
+*/
+typedef struct verilog_macro_call_t{
+    verilog_macro_directive * macro;    //!< The macro being used.
+    unsigned int   depth;       //!< Depth of brackets the reader is in.
+    char         * text;        //!< Every argument, each ended by a NUL.
+    size_t         length;      //!< Bytes of text used.
+    size_t         capacity;    //!< Bytes of text allocated.
+    size_t       * args;        //!< Where each argument starts in text.
+    unsigned int   arg_count;   //!< Number of arguments so far.
+    unsigned int   arg_capacity;//!< Entries of args allocated.
+} verilog_macro_call;
+
+//! Starts reading the arguments of a use of a macro with parameters.
+void verilog_macro_call_begin(
+    verilog_preprocessor_context * preproc,
+    verilog_macro_directive      * macro
+);
+
+//! Adds text to the argument currently being read.
+void verilog_macro_call_append(
+    verilog_preprocessor_context * preproc,
+    char                         * text,
+    size_t                         length
+);
+
+//! Ends the current argument, and starts the next one.
+void verilog_macro_call_next_arg(
+    verilog_preprocessor_context * preproc
+);
+
+/*!
+@brief A macro expansion which the scanner is reading.
+@details Text from the expansion is spelled on the lines of the macro's
+definition, counting from the scanner's line when the expansion began.
+*/
+typedef struct verilog_macro_expansion_t{
+    void                    * buffer; //!< The scanner buffer holding it.
+    verilog_macro_directive * macro;  //!< The macro being expanded.
+    ast_location              site;   //!< Where the macro was used.
+    unsigned int              line;   //!< Scanner line at the start.
+} verilog_macro_expansion;
+
+/*!
+@brief Expands the macro call whose arguments have just been read.
+@details Leading and trailing white space is removed from each argument.
+@returns The expansion, followed by two NUL characters, which the caller
+must free, or NULL if the number of arguments is wrong.
+*/
+char * verilog_macro_call_expand(
+    verilog_preprocessor_context * preproc,
+    size_t                       * length, //!< [out] Length of the expansion.
+    unsigned int                   lineno  //!< Where the call ends.
+);
     
 /*!
 @brief Removes a macro definition from the preprocessors lookup table.
 */
 void verilog_preprocessor_macro_undefine(
+    verilog_preprocessor_context * preproc,
     char * macro_name //!< The name of the macro to remove.
 );
 
@@ -147,6 +349,7 @@ typedef struct verilog_preprocessor_conditional_context_t{
 //! Creates and returns a new conditional context.
 verilog_preprocessor_conditional_context * 
     verilog_preprocessor_new_conditional_context(
+    verilog_preprocessor_context * preproc,
     char        * condition,          //!< The definition to check for.
     int           line_number         //!< Where the `ifdef came from.
 );
@@ -159,6 +362,7 @@ verilog_preprocessor_conditional_context *
 is `ifdef and this should be FALSE.
 */
 void verilog_preprocessor_ifdef (
+    verilog_preprocessor_context * preproc,
     char * macro_name,
     unsigned int lineno,    //!< line number of the directive.
     ast_boolean is_ndef     //!< Is this an ifndef or ifdef directive.
@@ -169,19 +373,29 @@ void verilog_preprocessor_ifdef (
 @param [in] macro_name - The macro to test if defined or not.
 @param [in] lineno - The line the directive occurs on.
 */
-void verilog_preprocessor_elseif(char * macro_name, unsigned int lineno);
+void verilog_preprocessor_elseif(
+    verilog_preprocessor_context * preproc,
+    char * macro_name,
+    unsigned int lineno
+);
 
 /*!
 @brief Handles an else statement being encountered.
 @param [in] lineno - The line the directive occurs on.
 */
-void verilog_preprocessor_else  (unsigned int lineno);
+void verilog_preprocessor_else  (
+    verilog_preprocessor_context * preproc,
+    unsigned int lineno
+);
 
 /*!
 @brief Handles an else statement being encountered.
 @param [in] lineno - The line the directive occurs on.
 */
-void verilog_preprocessor_endif (unsigned int lineno);
+void verilog_preprocessor_endif (
+    verilog_preprocessor_context * preproc,
+    unsigned int lineno
+);
 
 
 // ----------------------- Preprocessor Context -------------------------
@@ -195,7 +409,7 @@ void verilog_preprocessor_endif (unsigned int lineno);
 - IF/ELSE pre-processor directives.
 - Timescale directives
 */
-typedef struct verilog_preprocessor_context_t{
+struct verilog_preprocessor_context_t{
     ast_boolean     emit;           //!< Only emit tokens iff true.
     unsigned int    token_count;    //!< Keeps count of tokens processed.
     ast_boolean     in_cell_define; //!< TRUE iff we are in a cell define.
@@ -210,7 +424,13 @@ typedef struct verilog_preprocessor_context_t{
     ast_primitive_strength unconnected_drive_pull; //!< nounconnectedrive
     ast_stack     * ifdefs;         //!< Storage for conditional compile stack.
     ast_list      * search_dirs;    //!< Where to look for include files.
-} verilog_preprocessor_context;
+    ast_arena     * arena;          //!< Owns all memory of the context.
+    verilog_include_cache * include_cache; //!< Not owned. May be NULL.
+    verilog_diagnostics * diagnostics;     //!< Not owned. May be NULL.
+    verilog_macro_call call;        //!< Macro arguments being read.
+    verilog_macro_expansion expansions[VERILOG_MACRO_MAX_DEPTH]; //!< Nested.
+    unsigned int    expansion_depth;//!< Number of expansions being scanned.
+};
 
 
 /*! 
@@ -221,7 +441,9 @@ default directives. For example, if I was writing my own simulated and
 wanted to add my own "__IS_MY_SIMULATOR__" pre-defined macro, it can be
 done by accessing this variable, and using the 
 verilog_preprocessor_macro_define function.
-@note This is a global variable. Treat it with care!
+@note This is a global variable. Treat it with care! It is the context used
+by @ref verilog_parse_file and friends. Code which parses on several threads
+should give each @ref verilog_parser_context its own context instead.
 */
 extern verilog_preprocessor_context * yy_preproc;
 
@@ -236,7 +458,8 @@ verilog_preprocessor_context * verilog_new_preprocessor_context();
 @brief Clears the stack of files being parsed, and sets the current file to
 the supplied string.
 @param [inout] preproc - The context who's file name is being set.
-@param [in] file - The file path to put as the current file.
+@param [in] file - The file path to put as the current file. It is interned,
+so need not outlive the call.
 */
 void verilog_preprocessor_set_file(
     verilog_preprocessor_context * preproc,
@@ -253,6 +476,7 @@ char * verilog_preprocessor_current_file(
 
 /*!
 @brief Frees a preprocessor context and all child constructs.
+@details Releases the arena owned by the context in one go.
 */
 void verilog_free_preprocessor_context(
     verilog_preprocessor_context * tofree
@@ -263,23 +487,94 @@ void verilog_free_preprocessor_context(
 @brief Tells the preprocessor we are now defining PLI modules and to tag
        them as such.
 */
-void verilog_preproc_enter_cell_define();
+void verilog_preproc_enter_cell_define(verilog_preprocessor_context * preproc);
 
 
 /*!
 @brief Tells the preprocessor we are no longer defining PLI modules.
 */
-void verilog_preproc_exit_cell_define();
+void verilog_preproc_exit_cell_define(verilog_preprocessor_context * preproc);
 
 /*!
 @brief Registers a new default net type directive.
 */
 void verilog_preproc_default_net(
+    verilog_preprocessor_context * preproc,
     unsigned int token_number,  //!< Token number of the directive.
     unsigned int line_number,   //!< Line number of the directive.
     ast_net_type type           //!< The net type.
 );
 
+// ----------------------- Snapshots ------------------------------------
+
+/*!
+@brief Saves the state a preprocessor context has built up to a file.
+@details The snapshot holds every macro definition, default net type
+directive, the timescale, the unconnected drive pull and whether a cell
+define is open, in a compact binary form. A project whose files all start by
+including the same global define headers can preprocess those once, save
+the result, and then start the preprocessor of every file by loading the
+snapshot, without lexing the headers again.
+@note Snapshots are written in the byte order of the machine, and are meant
+to be reloaded by the same build of the library. Anything else is refused
+when loading.
+@returns Zero on success, or -1 if the file could not be written.
+*/
+int verilog_preprocessor_save(
+    verilog_preprocessor_context * preproc, //!< The context to save.
+    char                         * path     //!< Where to write the snapshot.
+);
+
+/*!
+@brief Takes a snapshot of a preprocessor context in memory rather than in
+a file.
+@details The snapshot is the same as @ref verilog_preprocessor_save would
+write, and is read back with @ref verilog_preprocessor_load_buffer.
+@returns The snapshot, malloc'd for the caller to free, with its length in
+*size, or NULL if it could not be allocated.
+*/
+char * verilog_preprocessor_save_buffer(
+    verilog_preprocessor_context * preproc, //!< The context to save.
+    size_t                       * size     //!< Set to the snapshot length.
+);
+
+/*!
+@brief Creates a new preprocessor context, with the state saved in a
+snapshot by @ref verilog_preprocessor_save.
+@details Include directories and the current file are not part of the
+snapshot, so are those of a context made by
+@ref verilog_new_preprocessor_context.
+@returns The new context, or NULL if the file could not be read or is not
+a valid snapshot.
+*/
+verilog_preprocessor_context * verilog_preprocessor_load(
+    char * path //!< The snapshot to load.
+);
+
+/*!
+@brief As @ref verilog_preprocessor_load, but reads the snapshot from
+memory, as made by @ref verilog_preprocessor_save_buffer.
+*/
+verilog_preprocessor_context * verilog_preprocessor_load_buffer(
+    char   * data,  //!< The snapshot.
+    size_t   size   //!< Length of the snapshot in bytes.
+);
+
+// ----------------------- State Hashes ---------------------------------
+
+/*!
+@brief Returns a hash of the state of a preprocessor context which changes
+how a file is preprocessed.
+@details Covers every macro definition, the default net type directives,
+the include directories, the timescale, the unconnected drive pull and
+whether a cell define is open. Two contexts with the same hash preprocess
+the same text in the same way, as long as the files it includes are
+unchanged. Macros are hashed regardless of the order they were defined in.
+*/
+uint64_t verilog_preprocessor_hash(
+    verilog_preprocessor_context * preproc //!< The context to hash.
+);
+
 /*! @} */
 
 #endif
@@ -0,0 +1,13 @@
+//
+// A macro which uses itself. Its expansion is dropped once macros are nested
+// too deeply, and the parse carries on after it.
+//
+
+`define FOREVER `FOREVER
+
+module deep_macro;
+    `FOREVER
+endmodule
+
+module after_deep_macro;
+endmodule
@@ -0,0 +1,35 @@
+//
+// Syntax errors which the parser should recover from. The parse fails, but
+// every module apart from the one with the broken header is still added to
+// the source tree.
+//
+
+module recover_item(a, b);
+    input  a;
+    output b;
+    assign b = a + ;
+    assign b = a;
+endmodule
+
+module recover_statement(clk, q);
+    input  clk;
+    output q;
+    reg    q;
+    always @(posedge clk) begin
+        q <= 0;
+        q <= = 1;
+        q <= 1;
+    end
+endmodule
+
+module recover_ansi(input a, output b);
+    assign b = a;
+    wire w = ;
+endmodule
+
+module 1broken_header(;
+endmodule
+
+module after_errors(a);
+    input a;
+endmodule
@@ -0,0 +1,38 @@
+
+// Lists of gate instances, and the tables of user defined primitives.
+
+module gate_instances (a, b, c, y, z);
+    input  a, b, c;
+    output y, z;
+    wire   n1, n2, n3;
+
+    nand   g1 (n1, a, b), g2 (n2, b, c), g3 (n3, a, c);
+    not    i1 (y, n1), i2 (z, n2);
+    bufif0 e1 (n1, a, b), e2 (n2, b, c);
+    pullup p1 (n1), p2 (n2);
+    nmos   m1 (n3, a, b), m2 (n3, b, c);
+    tran   t1 (n1, n2), t2 (n2, n3);
+    or     (n3, a, b), o2 (n3, b, c);
+endmodule
+
+primitive udp_and (y, a, b);
+    output y;
+    input  a, b;
+    table
+        0 ? : 0;
+        ? 0 : 0;
+        1 1 : 1;
+    endtable
+endprimitive
+
+primitive udp_latch (q, clk, d);
+    output q;
+    reg    q;
+    input  clk;
+    input  d;
+    table
+        1 0 : ? : 0;
+        1 1 : ? : 1;
+        0 ? : ? : -;
+    endtable
+endprimitive
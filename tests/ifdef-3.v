@@ -0,0 +1,59 @@
+//
+// `ifdef, `ifndef, `elsif and `else chains. Exactly one branch of each is
+// taken. The branches which are not taken hold text which does not parse,
+// so that taking one of them by mistake makes the parse fail.
+//
+
+`define TAKEN
+
+`ifdef NOT_TAKEN
+    module ifdef_wrong_1 ( this does not parse
+`elsif TAKEN
+    module ifdef_elsif_taken;
+    endmodule
+`elsif TAKEN
+    module ifdef_wrong_2 ( only the first elsif which passes is taken
+`else
+    module ifdef_wrong_3 ( nor is the else
+`endif
+
+`ifndef TAKEN
+    module ifdef_wrong_4 (
+`elsif NOT_TAKEN
+    module ifdef_wrong_5 (
+`else
+    module ifdef_else_taken;
+    endmodule
+`endif
+
+`ifndef NOT_TAKEN
+    module ifndef_taken;
+    endmodule
+`else
+    module ifdef_wrong_6 (
+`endif
+
+// Conditionals nested in a region which is being skipped are skipped whole,
+// whatever their conditions. Nothing else in the region is acted on, and
+// directives in its comments and strings are not seen.
+`ifdef NOT_TAKEN
+    `ifdef TAKEN
+        module ifdef_wrong_7 (
+    `else
+        module ifdef_wrong_8 (
+    `endif
+    `define SKIPPED_DEFINE
+    `include "no-such-file.v"
+    `SKIPPED_MACRO_USE
+    // `endif in a comment does not end the region,
+    /* nor does `else in a block comment,
+       `endif */
+    $display("nor does `endif in a string");
+`else
+    `ifdef SKIPPED_DEFINE
+        module ifdef_wrong_9 (
+    `else
+        module ifdef_nested_taken;
+        endmodule
+    `endif
+`endif
@@ -0,0 +1,22 @@
+
+// Ordered and named connections to module ports and parameters.
+
+module leaf (a, b, y);
+    parameter W = 1;
+    parameter D = 2;
+    input  a;
+    input  b;
+    output y;
+endmodule
+
+module instance_connections (a, b, y);
+    input  a;
+    input  b;
+    output y;
+    wire   u;
+
+    leaf #(4, 8)           ordered_params (a, b, u);
+    leaf #(.W(4), .D(8))   named_params   (.a(a), .b(b), .y(u));
+    leaf                   unconnected    (a, , y);
+    leaf                   expressions    (a & b, !b, y), second (b, a, u);
+endmodule
@@ -0,0 +1,22 @@
+// Lists built by adding to their front, to their end, and by joining
+// lists together, each long enough to grow several times over.
+
+module list_order (y);
+    output y;
+    wire n01, n02, n03, n04, n05, n06, n07, n08, n09, n10;
+    wire n11, n12, n13, n14, n15, n16, n17, n18, n19, n20;
+    wire m01;
+    wire m02, m03;
+    wire m04;
+    assign {n01, n02, n03, n04, n05, n06, n07, n08, n09, n10,
+            n11, n12, n13, n14, n15, n16, n17, n18, n19, n20} = y + y;
+endmodule
+
+primitive list_order_udp (y, a01, a02, a03, a04, a05, a06,
+                             a07, a08, a09, a10, a11, a12);
+    output y;
+    input  a01, a02, a03, a04, a05, a06, a07, a08, a09, a10, a11, a12;
+    table
+        0 0 0 0 0 0 0 0 0 0 0 0 : 0;
+    endtable
+endprimitive
@@ -0,0 +1,114 @@
+// Enough macros to grow the preprocessor's table of them several times
+// over, with every other one undefined again afterwards, and one of those
+// defined once more.
+
+`define T01 kept_01
+`define T02 kept_02
+`define T03 kept_03
+`define T04 kept_04
+`define T05 kept_05
+`define T06 kept_06
+`define T07 kept_07
+`define T08 kept_08
+`define T09 kept_09
+`define T10 kept_10
+`define T11 kept_11
+`define T12 kept_12
+`define T13 kept_13
+`define T14 kept_14
+`define T15 kept_15
+`define T16 kept_16
+`define T17 kept_17
+`define T18 kept_18
+`define T19 kept_19
+`define T20 kept_20
+`define T21 kept_21
+`define T22 kept_22
+`define T23 kept_23
+`define T24 kept_24
+`define T25 kept_25
+`define T26 kept_26
+`define T27 kept_27
+`define T28 kept_28
+`define T29 kept_29
+`define T30 kept_30
+`define T31 kept_31
+`define T32 kept_32
+`define T33 kept_33
+`define T34 kept_34
+`define T35 kept_35
+`define T36 kept_36
+`define T37 kept_37
+`define T38 kept_38
+`define T39 kept_39
+`define T40 kept_40
+
+`undef T02
+`undef T04
+`undef T06
+`undef T08
+`undef T10
+`undef T12
+`undef T14
+`undef T16
+`undef T18
+`undef T20
+`undef T22
+`undef T24
+`undef T26
+`undef T28
+`undef T30
+`undef T32
+`undef T34
+`undef T36
+`undef T38
+`undef T40
+
+`define T20 kept_20_again
+
+`ifndef T02
+`ifndef T04
+`ifndef T06
+`ifndef T08
+`ifndef T10
+`ifndef T12
+`ifndef T14
+`ifndef T16
+`ifndef T18
+`ifndef T22
+`ifndef T24
+`ifndef T26
+`ifndef T28
+`ifndef T30
+`ifndef T32
+`ifndef T34
+`ifndef T36
+`ifndef T38
+`ifndef T40
+module macro_table_undefined ();
+endmodule
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+`endif
+
+module macro_table_kept ();
+    wire `T01, `T03, `T05, `T07, `T09, `T11, `T13, `T15, `T17, `T19,
+         `T21, `T23, `T25, `T27, `T29, `T31, `T33, `T35, `T37, `T39;
+    wire `T20;
+endmodule
@@ -0,0 +1,54 @@
+//
+// Macros with parameters, macros used inside the values and arguments of
+// other macros, and definitions continued over several lines.
+//
+
+`define WIDTH 8
+`define MSB (`WIDTH - 1)
+`define RANGE(msb, lsb) [msb:lsb]
+`define MAX(a, b) ((a) > (b) ? (a) : (b))
+`define BUS(name) wire `RANGE(`MSB, 0) name
+`define CONCAT(first, second, third) {first, second, third}
+`define MESSAGE(text) $display(text)
+`define ADD_REG(name, width) \
+    reg [width-1:0] name;    \
+    initial name = 0;
+`define NONE() 1'b0
+`define PAIR(first, second) \
+    wire first, // a comment ends at its own line \
+         second;
+`define URL "http://example.com/a//b"
+
+module macro_arguments(a, b, y);
+    input  `RANGE(`MSB, 0) a;
+    input  `RANGE(`MSB, 0) b;
+    output `RANGE(`MSB, 0) y;
+
+    `BUS(w);
+    `BUS(z);
+
+    // Commas inside brackets, braces and strings do not split arguments.
+    assign w = `MAX(a[3:0], {b[1:0], b[3:2]});
+    assign y = `CONCAT({a[1], a[0]}, b[`MSB:2], w[0]);
+    assign z = `MAX(`MAX(a, b), `NONE());
+
+    // Nor do commas and brackets inside comments.
+    `PAIR(p, q)
+    assign p = `MAX(a /* not a, third argument */,
+                    b // not the end )
+                   );
+
+    initial $display(`URL);
+
+    `ADD_REG(r, `WIDTH)
+    `ADD_REG(s, 4)
+
+    initial `MESSAGE("a, b (and y)");
+endmodule
+
+// A redefinition replaces the macro it redefines.
+`define WIDTH 16
+
+module macro_redefined(a);
+    input `RANGE(`MSB, 0) a;
+endmodule
@@ -0,0 +1,33 @@
+
+// Lists of nets, assignments to concatenations, function bodies and the
+// items of specify blocks.
+
+module nets_specify (a, b, y, z);
+    input  a, b;
+    output y, z;
+    wire   n1, n2, n3;
+    wire   n4 = a & b;
+
+    assign {n1, n2} = a + b;
+    assign n3 = n1 | n2;
+
+    function [1:0] parity;
+        input p, q;
+        reg   h, l;
+        begin
+            {h, l} = p + q;
+            parity = h ^ l;
+        end
+    endfunction
+
+    function first;
+        input p;
+        first = !p;
+    endfunction
+
+    specify
+        specparam t_rise = 1;
+        (a => y) = 1;
+        (a, b *> y, z) = 2;
+    endspecify
+endmodule
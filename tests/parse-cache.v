@@ -0,0 +1,16 @@
+// Parsed three times through a parse cache: once to store it, once to load
+// it back, and once more after a module is added to a copy of it.
+
+module parse_cache_leaf (
+    input  wire a,
+    output wire y
+);
+    assign y = ~a;
+endmodule
+
+module parse_cache_top (
+    input  wire a,
+    output wire y
+);
+    parse_cache_leaf u_leaf (.a(a), .y(y));
+endmodule
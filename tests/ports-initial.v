@@ -0,0 +1,16 @@
+
+// Output ports declared as variables may be given initial values.
+
+module ports_initial_ansi (
+    input  wire       clk,
+    output reg        q = 1'b0,
+    output reg  [3:0] r = 4'b1010,
+    output integer    n = 5
+);
+endmodule
+
+module ports_initial (clk, q, r, s, n);
+    input clk;
+    output reg q = 1'b1, r, s = 1'b0;
+    output integer n = 7;
+endmodule
@@ -0,0 +1,4 @@
+// Parsed first by the prelude test. The files parsed after it, on worker
+// threads of their own, all rely on the macro it defines.
+
+`define PRELUDE_DEFINED
@@ -0,0 +1,9 @@
+// Only finds PRELUDE_DEFINED if it starts from the state the prelude left.
+
+`ifdef PRELUDE_DEFINED
+module prelude_user_b ();
+endmodule
+`else
+module prelude_missing_b ();
+endmodule
+`endif
@@ -0,0 +1,15 @@
+//
+// A file with an include guard. Parsing it again must see the guard as it
+// was the first time, rather than as the file itself left it.
+//
+
+`ifndef REPARSE_GUARD_V
+`define REPARSE_GUARD_V
+
+module reparse_guarded(a, y);
+    input  a;
+    output y;
+    assign y = ~a;
+endmodule
+
+`endif